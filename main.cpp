@@ -1,27 +1,23 @@
 #include "Logging/DefaultLogger.h"
 #include "Relay/JsonRpcRelay.h"
+#include "Server/AdminEndpoint.h"
+#include "Server/EasyServer.h"
+#include "Server/ListenerHandoff.h"
+#include "Server/TlsContext.h"
 #include "spdlog/sinks/stdout_color_sinks.h"
-#include <atomic>
+#include <algorithm>
+#include <boost/asio/signal_set.hpp>
+#include <boost/algorithm/string.hpp>
+#include <boost/asio/steady_timer.hpp>
 #include <boost/program_options.hpp>
 #include <cstdlib>
+#include <fstream>
+#include <sstream>
 #include <thread>
 #include <vector>
 
-std::atomic<bool> g_ShutdownProgram{false};
-
-void interrupt_handler(int)
-{
-    if (!g_ShutdownProgram) {
-        LogWrite("Signal sent to stop application. Setting stop flag.", b_sev::info);
-        g_ShutdownProgram.store(true);
-    }
-}
-
 int main(int argc, char* argv[])
 {
-    g_ShutdownProgram.store(false);
-    signal(SIGINT, interrupt_handler);
-
     namespace params = boost::program_options;
 
     auto console_sink = std::make_shared<spdlog::sinks::stdout_color_sink_mt>();
@@ -35,8 +31,64 @@ int main(int argc, char* argv[])
             ("target_address", params::value<std::string>(),"Target address to send requests to that pass")
             ("target_port", params::value<uint16_t>(),"Target port to send requests that pass")
             ("filter_kind", params::value<std::string>(),"Filter kind to be used; default is jsonrpc filter")
-            ("filter_options", params::value<std::string>(),"Filter definitions based on the filter you choose (for jsonrpc, it's a comma separated list of allowed methods)")
-            ("threads", params::value<uint32_t>(),"Number of threads to use in the application");
+            ("filter_options", params::value<std::string>(),"Filter definitions based on the filter you choose (for jsonrpc, it's a comma separated list of allowed methods, each optionally as method:priority_class)")
+            ("params_rules_file", params::value<std::string>(),"File with constraints on the params of allowed methods, e.g., `getblock(str len 64, int 0..1?)` (see src/Filters/ParamsRules.h)")
+            ("early_rejection", "Check requests while they're read: non-POST requests, bodies over max_request_body_kb and calls of methods that aren't allowed are rejected, and their connection closed, without reading the rest of them")
+            ("max_request_body_kb", params::value<uint64_t>(),"With early_rejection, the largest request body; default is 1024")
+            ("allowed_paths", params::value<std::string>(),"With early_rejection, comma separated list of the paths requests may have, exact or as prefix* (e.g., /,/wallet/*); default is any")
+            ("require_json_content_type", "With early_rejection, reject requests whose Content-Type isn't application/json or text/plain")
+            ("threads", params::value<uint32_t>(),"Number of threads to use in the application")
+            ("execution_model", params::value<std::string>(),"'separate' (default): server and upstream clients run on two thread pools of --threads threads each; 'unified': one pool, and every request stays on one thread")
+            ("websocket_upstream_connections", params::value<uint32_t>(),"Accept websocket clients, whose calls share this many connections to the target; default is 0 (websockets disabled)")
+            ("failover_targets", params::value<std::string>(),"Comma separated list of address:port upstreams for allowed requests while the target is unhealthy, in order of preference (enables health checks)")
+            ("health_check_interval_ms", params::value<uint64_t>(),"Probe every upstream with this period, and fail fast while it's unhealthy; default is 0 (disabled) without failover targets, 1000 with them")
+            ("health_check_timeout_ms", params::value<uint64_t>(),"A probe that takes longer fails; default is 500")
+            ("health_check_method", params::value<std::string>(),"A json-rpc method (e.g., getblockchaininfo) that probes call; by default, probes only connect")
+            ("breaker_failure_threshold", params::value<uint32_t>(),"Consecutive failed requests that mark an upstream unhealthy; default is 5")
+            ("breaker_open_ms", params::value<uint64_t>(),"How long an unhealthy upstream gets no requests before trial requests are let through; default is 2000")
+            ("upstream_connections", params::value<uint32_t>(),"Keep up to this many connections open to every upstream and reuse them for allowed requests; default is 0 (a new connection per request)")
+            ("upstream_timeout_ms", params::value<uint64_t>(),"With upstream_connections, how long a request may take upstream, including the wait for a free connection; default is 30000")
+            ("batch_methods", params::value<std::string>(),"Combine calls of these methods into json-rpc batches upstream; comma separated list of method:latency_budget_us (e.g., getblockhash:2000)")
+            ("batch_max_size", params::value<uint32_t>(),"Send a batch as soon as it has this many calls; default is 32")
+            ("priority_classes", params::value<std::string>(),"Schedule upstream calls by the priority class of their method (given in filter_options as method:class); comma separated list of name:weight[:max_concurrency[:max_queue_length]] (e.g., interactive:8,bulk:1:2)")
+            ("max_upstream_requests", params::value<uint32_t>(),"With priority_classes or fair_queue_key, the upstream calls in flight at once over all classes; default is 64")
+            ("fair_queue_key", params::value<std::string>(),"Queue upstream calls per client, and serve the clients in turns: `address` tells clients apart by source address, `header:<name>` by a header (e.g., header:X-Api-Key), which isn't verified, so only behind a proxy that authenticates clients")
+            ("max_queued_per_client", params::value<uint32_t>(),"With fair_queue_key, the calls of one client that may wait for the upstream; default is 64")
+            ("immutable_cache_dir", params::value<std::string>(),"Keep the results of immutable_cache_methods in memory-mapped files in this directory, and answer repeated calls from them, also after a restart")
+            ("immutable_cache_methods", params::value<std::string>(),"Comma separated list of method[:member] whose results never change (e.g., getblock,getblockheader,getrawtransaction:blockhash); a result is only cached if it has the member")
+            ("immutable_cache_max_mb", params::value<uint64_t>(),"Disk space of the immutable cache; the oldest results are dropped a segment at a time; default is 1024")
+            ("immutable_cache_segment_mb", params::value<uint64_t>(),"Size of an immutable cache segment file, and of the largest result it keeps; default is 64")
+            ("stream_port", params::value<uint16_t>(),"Also accept raw TCP connections on this port, whose json-rpc calls are sent one json object per line (no http) and answered in order, one line each")
+            ("stream_bind_address", params::value<std::string>(),"Address of the raw TCP listener; default is bind_address")
+            ("stream_max_calls_in_flight", params::value<uint32_t>(),"Calls of a raw TCP connection read ahead of their responses; default is 64")
+            ("stream_max_message_kb", params::value<uint64_t>(),"A raw TCP call larger than this gets a parse error, and its connection is closed; default is 8192")
+            ("stream_authorization", params::value<std::string>(),"Authorization header of the upstream requests of raw TCP calls (e.g., Basic <base64>)")
+            ("upstream_pool", params::value<std::vector<std::string>>()->composing(),"A named upstream that calls can be routed to, as name=address:port[,connections=N]; with connections, the pool keeps up to N keep-alive connections of its own (e.g., fewer for slow archive nodes); can be repeated")
+            ("route", params::value<std::vector<std::string>>()->composing(),"Send the allowed calls of a method to an upstream pool, as pattern[(predicates)]=pool, e.g., getrawtransaction=archive, get*info=tip or getblockstats($0<700000)=archive (see src/Filters/RoutingTable.h); the first matching route applies; can be repeated")
+            ("fallback_pool", params::value<std::string>(),"The upstream pool of the allowed calls that match no route; default is the target")
+            ("mirror_target", params::value<std::string>(),"Copy a sample of the allowed requests to this address:port shadow upstream once they're answered, and compare its responses (GET /mirror on the admin port)")
+            ("mirror_sample_every", params::value<uint32_t>(),"Mirror one of every N allowed requests; default is 1 (all)")
+            ("mirror_max_queue", params::value<uint32_t>(),"Mirrored requests that the shadow hasn't answered yet; beyond this, requests aren't mirrored; default is 256")
+            ("mirror_connections", params::value<uint32_t>(),"Connections to the shadow upstream, apart from the ones to the real upstreams; default is 4")
+            ("long_poll_methods", params::value<std::string>(),"Comma separated list of long-poll methods (e.g., waitfornewblock,waitforblock,waitforblockheight) whose identical calls share one upstream call and its response")
+            ("prefetch_rule", params::value<std::vector<std::string>>()->composing(),"After a successful call of a method, prefetch the call that clients usually make next, as trigger>method(params) with $result, $result.<member>, $N and $N+K placeholders (e.g., getblockhash>getblock($result,1) or getblockhash>getblockhash($0+1)); can be repeated")
+            ("prefetch_ttl_ms", params::value<uint64_t>(),"How long a prefetched result is kept for the call it was made for; default is 5000")
+            ("prefetch_max_in_flight", params::value<uint32_t>(),"Prefetches in flight upstream at once; beyond this, prefetches are skipped; default is 4")
+            ("prefetch_depth", params::value<uint32_t>(),"Apply the prefetch rules to prefetched results too, up to this many calls ahead; default is 1")
+            ("capture_file", params::value<std::string>(),"Append every received request to this binary capture file (for replay with relay_replay)")
+            ("shared_metrics", "Publish the counters and latency histogram of the relay in shared memory, for relay_metrics to aggregate over all the relays of the host")
+            ("shared_metrics_prefix", params::value<std::string>(),"Name prefix of the shared metrics segment; default is http_rpc_relay")
+            ("admin_port", params::value<uint16_t>(),"Serve the admin endpoint on this port: GET /usage[?top=N] shows the methods and clients that take the most requests and time, and per-method latency quantiles")
+            ("admin_bind_address", params::value<std::string>()->default_value("127.0.0.1"),"Address of the admin endpoint")
+            ("trace_sample_every", params::value<uint32_t>(),"Trace one of every N requests (Chrome trace json; dumped on SIGUSR1 or rolled to disk)")
+            ("trace_latency_threshold_us", params::value<uint64_t>(),"Trace every request that takes at least this many microseconds")
+            ("trace_output", params::value<std::string>(),"Prefix of the trace files; default is relay_trace")
+            ("trace_roll_interval_ms", params::value<uint64_t>(),"Write the traces to a new file with this period, instead of only on SIGUSR1")
+            ("trace_max_files", params::value<uint32_t>(),"Number of rolled trace files to keep; default keeps all")
+            ("handoff_socket", params::value<std::string>(),"Unix socket path for restarts without downtime: a relay started with the path of a running one takes over its listening socket, and the running one drains and exits")
+            ("drain_timeout_ms", params::value<uint64_t>(),"On SIGTERM or after a handoff, how long to wait for open connections to finish before exiting; default is 30000")
+            ("tls_certificate_file", params::value<std::string>(),"PEM file of the certificate chain; with it, clients connect to the relay over TLS (https)")
+            ("tls_private_key_file", params::value<std::string>(),"PEM file of the private key of the TLS certificate");
     // clang-format on
 
     params::variables_map vm;
@@ -48,12 +100,59 @@ int main(int argc, char* argv[])
         return EXIT_SUCCESS;
     }
 
-    std::string server_bind_address;
-    uint16_t    server_bind_port;
-    std::string target_bind_address;
-    uint16_t    target_bind_port;
-    uint32_t    thread_count;
-    std::string filter_options;
+    std::string         server_bind_address;
+    uint16_t            server_bind_port;
+    std::string         target_bind_address;
+    uint16_t            target_bind_port;
+    uint32_t            thread_count;
+    RelayExecutionModel execution_model                = RelayExecutionModel::SeparatePools;
+    std::string         filter_options;
+    std::string         params_rules_file;
+    uint32_t            websocket_upstream_connections = 0;
+    AsyncClientOptions  keep_alive_options;
+    uint32_t            upstream_connections           = 0;
+    MicroBatchOptions   batch_options;
+    PriorityOptions     priority_options;
+    HealthCheckOptions  health_options;
+    bool                health_checks                  = false;
+    std::string         failover_targets;
+    std::string         capture_file;
+    bool                shared_metrics                 = false;
+    std::string         shared_metrics_prefix          = SharedMetrics::DEFAULT_PREFIX;
+    uint16_t            admin_port                     = 0;
+    std::string         admin_bind_address;
+    uint32_t            trace_sample_every             = 0;
+    uint64_t            trace_latency_threshold_us     = 0;
+    std::string         trace_output                   = "relay_trace";
+    uint64_t            trace_roll_interval_ms         = 0;
+    uint32_t            trace_max_files                = 0;
+    std::string         handoff_socket;
+    uint64_t            drain_timeout_ms               = 30000;
+    std::string         tls_certificate_file;
+    std::string         tls_private_key_file;
+
+    struct UpstreamPoolOption
+    {
+        std::string name;
+        std::string address;
+        uint16_t    port        = 0;
+        uint32_t    connections = 0;
+    };
+    std::vector<UpstreamPoolOption> upstream_pools;
+    RoutingTable                    routing_table;
+
+    RequestScreenOptions screen_options;
+    bool                 early_rejection = false;
+
+    MirrorOptions mirror_options;
+    mirror_options.client.maxConnections = 4;
+
+    ImmutableCacheOptions immutable_cache_options;
+    PrefetchOptions       prefetch_options;
+    std::set<std::string> long_poll_methods;
+    StreamListenerOptions stream_options;
+    uint16_t              stream_port = 0;
+    std::string           stream_bind_address;
 
     try {
         server_bind_address = vm["bind_address"].as<std::string>();
@@ -65,6 +164,14 @@ int main(int argc, char* argv[])
         if (vm.find("threads") != vm.cend()) {
             thread_count = vm["threads"].as<uint32_t>();
         }
+        if (vm.find("execution_model") != vm.cend()) {
+            const std::string model = vm["execution_model"].as<std::string>();
+            if (model == "unified") {
+                execution_model = RelayExecutionModel::Unified;
+            } else if (model != "separate") {
+                throw std::runtime_error("Invalid execution_model: " + model);
+            }
+        }
         if (vm.find("filter_kind") != vm.cend()) {
             // currently there's only jsonrpc filter, so this is no-op
         }
@@ -72,6 +179,229 @@ int main(int argc, char* argv[])
             throw std::runtime_error("The argument filter_options should be specified");
         }
         filter_options = vm["filter_options"].as<std::string>();
+        if (vm.find("params_rules_file") != vm.cend()) {
+            params_rules_file = vm["params_rules_file"].as<std::string>();
+        }
+        early_rejection = vm.count("early_rejection") > 0;
+        if (vm.find("max_request_body_kb") != vm.cend()) {
+            screen_options.maxBodySize = vm["max_request_body_kb"].as<uint64_t>() << 10;
+        }
+        if (vm.find("allowed_paths") != vm.cend()) {
+            boost::split(screen_options.paths,
+                         vm["allowed_paths"].as<std::string>(),
+                         boost::is_any_of(","),
+                         boost::token_compress_on);
+        }
+        screen_options.requireJsonContentType = vm.count("require_json_content_type") > 0;
+        if (vm.find("websocket_upstream_connections") != vm.cend()) {
+            websocket_upstream_connections = vm["websocket_upstream_connections"].as<uint32_t>();
+        }
+        if (vm.find("failover_targets") != vm.cend()) {
+            failover_targets = vm["failover_targets"].as<std::string>();
+            health_checks    = true;
+        }
+        if (vm.find("health_check_interval_ms") != vm.cend()) {
+            const uint64_t interval = vm["health_check_interval_ms"].as<uint64_t>();
+            health_options.interval = std::chrono::milliseconds(interval);
+            health_checks           = interval > 0;
+        }
+        if (vm.find("health_check_timeout_ms") != vm.cend()) {
+            health_options.timeout =
+                std::chrono::milliseconds(vm["health_check_timeout_ms"].as<uint64_t>());
+        }
+        if (vm.find("health_check_method") != vm.cend()) {
+            health_options.method = vm["health_check_method"].as<std::string>();
+        }
+        if (vm.find("breaker_failure_threshold") != vm.cend()) {
+            health_options.breaker.failureThreshold = vm["breaker_failure_threshold"].as<uint32_t>();
+        }
+        if (vm.find("breaker_open_ms") != vm.cend()) {
+            health_options.breaker.openDuration =
+                std::chrono::milliseconds(vm["breaker_open_ms"].as<uint64_t>());
+        }
+        if (vm.find("batch_methods") != vm.cend()) {
+            batch_options.methods =
+                MicroBatchOptions::ParseMethods(vm["batch_methods"].as<std::string>());
+        }
+        if (vm.find("upstream_connections") != vm.cend()) {
+            upstream_connections              = vm["upstream_connections"].as<uint32_t>();
+            keep_alive_options.maxConnections = upstream_connections;
+        }
+        if (vm.find("upstream_timeout_ms") != vm.cend()) {
+            keep_alive_options.requestTimeout =
+                std::chrono::milliseconds(vm["upstream_timeout_ms"].as<uint64_t>());
+        }
+        if (vm.find("batch_max_size") != vm.cend()) {
+            batch_options.maxBatchSize = vm["batch_max_size"].as<uint32_t>();
+        }
+        if (vm.find("priority_classes") != vm.cend()) {
+            priority_options.classes =
+                PriorityOptions::ParseClasses(vm["priority_classes"].as<std::string>());
+        }
+        if (vm.find("max_upstream_requests") != vm.cend()) {
+            priority_options.maxConcurrency = vm["max_upstream_requests"].as<uint32_t>();
+        }
+        if (vm.find("fair_queue_key") != vm.cend()) {
+            const std::string key = vm["fair_queue_key"].as<std::string>();
+            if (key == "address") {
+                priority_options.clientIdentity = ClientIdentity::SourceAddress;
+            } else if (key.compare(0, 7, "header:") == 0 && key.size() > 7) {
+                priority_options.clientIdentity = ClientIdentity::Header;
+                priority_options.identityHeader = key.substr(7);
+            } else {
+                throw std::runtime_error("Invalid fair_queue_key: " + key);
+            }
+        }
+        if (vm.find("max_queued_per_client") != vm.cend()) {
+            priority_options.maxQueuePerClient = vm["max_queued_per_client"].as<uint32_t>();
+        }
+        if (vm.find("immutable_cache_dir") != vm.cend()) {
+            immutable_cache_options.directory = vm["immutable_cache_dir"].as<std::string>();
+            if (vm.find("immutable_cache_methods") == vm.cend()) {
+                throw std::runtime_error("The argument immutable_cache_methods should be specified");
+            }
+            immutable_cache_options.methods =
+                ImmutableCacheOptions::ParseMethods(vm["immutable_cache_methods"].as<std::string>());
+        }
+        if (vm.find("immutable_cache_max_mb") != vm.cend()) {
+            immutable_cache_options.maxBytes = vm["immutable_cache_max_mb"].as<uint64_t>() << 20;
+        }
+        if (vm.find("immutable_cache_segment_mb") != vm.cend()) {
+            immutable_cache_options.segmentBytes = vm["immutable_cache_segment_mb"].as<uint64_t>() << 20;
+        }
+        if (vm.find("upstream_pool") != vm.cend()) {
+            for (const std::string& text : vm["upstream_pool"].as<std::vector<std::string>>()) {
+                // name=address:port[,connections=N]
+                const std::size_t  assign = text.find('=');
+                const std::size_t  comma  = std::min(text.find(','), text.size());
+                const std::size_t  colon  = text.rfind(':', comma);
+                UpstreamPoolOption pool;
+                if (assign == std::string::npos || colon == std::string::npos || colon < assign ||
+                    assign == 0 || comma == colon + 1) {
+                    throw std::runtime_error(
+                        "Invalid upstream_pool (expected name=address:port[,connections=N]): " + text);
+                }
+                pool.name    = text.substr(0, assign);
+                pool.address = text.substr(assign + 1, colon - assign - 1);
+                pool.port =
+                    static_cast<uint16_t>(std::stoul(text.substr(colon + 1, comma - colon - 1)));
+                if (comma < text.size()) {
+                    const std::string extra = text.substr(comma + 1);
+                    if (extra.compare(0, 12, "connections=") != 0 || extra.size() == 12) {
+                        throw std::runtime_error("Invalid upstream_pool option: " + extra);
+                    }
+                    pool.connections = static_cast<uint32_t>(std::stoul(extra.substr(12)));
+                }
+                upstream_pools.push_back(std::move(pool));
+            }
+        }
+        if (vm.find("route") != vm.cend()) {
+            for (const std::string& route : vm["route"].as<std::vector<std::string>>()) {
+                routing_table.addRoute(route);
+            }
+        }
+        if (vm.find("fallback_pool") != vm.cend()) {
+            routing_table.setFallbackPool(vm["fallback_pool"].as<std::string>());
+        }
+        for (const std::string& pool : routing_table.getPools()) {
+            auto defined = [&](const UpstreamPoolOption& p) { return p.name == pool; };
+            if (std::none_of(upstream_pools.cbegin(), upstream_pools.cend(), defined)) {
+                throw std::runtime_error("Calls are routed to an upstream_pool that isn't defined: " + pool);
+            }
+        }
+        if (vm.find("mirror_target") != vm.cend()) {
+            const std::string target = vm["mirror_target"].as<std::string>();
+            const std::size_t colon  = target.rfind(':');
+            if (colon == std::string::npos || colon == 0 || colon + 1 == target.size()) {
+                throw std::runtime_error("Invalid mirror_target (expected address:port): " + target);
+            }
+            mirror_options.address = target.substr(0, colon);
+            mirror_options.port    = static_cast<uint16_t>(std::stoul(target.substr(colon + 1)));
+        }
+        if (vm.find("mirror_sample_every") != vm.cend()) {
+            mirror_options.sampleEvery = std::max<uint32_t>(vm["mirror_sample_every"].as<uint32_t>(), 1);
+        }
+        if (vm.find("mirror_max_queue") != vm.cend()) {
+            mirror_options.maxQueueLength = vm["mirror_max_queue"].as<uint32_t>();
+        }
+        if (vm.find("mirror_connections") != vm.cend()) {
+            mirror_options.client.maxConnections =
+                std::max<uint32_t>(vm["mirror_connections"].as<uint32_t>(), 1);
+        }
+        if (vm.find("long_poll_methods") != vm.cend()) {
+            long_poll_methods =
+                LongPollCollapser::ParseMethods(vm["long_poll_methods"].as<std::string>());
+        }
+        if (vm.find("prefetch_rule") != vm.cend()) {
+            for (const std::string& rule : vm["prefetch_rule"].as<std::vector<std::string>>()) {
+                prefetch_options.rules.push_back(PrefetchRule::Parse(rule));
+            }
+        }
+        if (vm.find("prefetch_ttl_ms") != vm.cend()) {
+            prefetch_options.ttl = std::chrono::milliseconds(vm["prefetch_ttl_ms"].as<uint64_t>());
+        }
+        if (vm.find("prefetch_max_in_flight") != vm.cend()) {
+            prefetch_options.maxInFlight = vm["prefetch_max_in_flight"].as<uint32_t>();
+        }
+        if (vm.find("prefetch_depth") != vm.cend()) {
+            prefetch_options.depth = vm["prefetch_depth"].as<uint32_t>();
+        }
+        if (vm.find("stream_port") != vm.cend()) {
+            stream_port = vm["stream_port"].as<uint16_t>();
+        }
+        stream_bind_address = server_bind_address;
+        if (vm.find("stream_bind_address") != vm.cend()) {
+            stream_bind_address = vm["stream_bind_address"].as<std::string>();
+        }
+        if (vm.find("stream_max_calls_in_flight") != vm.cend()) {
+            stream_options.maxCallsInFlight =
+                std::max<uint32_t>(vm["stream_max_calls_in_flight"].as<uint32_t>(), 1);
+        }
+        if (vm.find("stream_max_message_kb") != vm.cend()) {
+            stream_options.maxMessageSize = vm["stream_max_message_kb"].as<uint64_t>() << 10;
+        }
+        if (vm.find("stream_authorization") != vm.cend()) {
+            stream_options.authorization = vm["stream_authorization"].as<std::string>();
+        }
+        if (vm.find("capture_file") != vm.cend()) {
+            capture_file = vm["capture_file"].as<std::string>();
+        }
+        shared_metrics = vm.count("shared_metrics") > 0;
+        if (vm.find("shared_metrics_prefix") != vm.cend()) {
+            shared_metrics_prefix = vm["shared_metrics_prefix"].as<std::string>();
+        }
+        if (vm.find("admin_port") != vm.cend()) {
+            admin_port = vm["admin_port"].as<uint16_t>();
+        }
+        admin_bind_address = vm["admin_bind_address"].as<std::string>();
+        if (vm.find("trace_sample_every") != vm.cend()) {
+            trace_sample_every = vm["trace_sample_every"].as<uint32_t>();
+        }
+        if (vm.find("trace_latency_threshold_us") != vm.cend()) {
+            trace_latency_threshold_us = vm["trace_latency_threshold_us"].as<uint64_t>();
+        }
+        if (vm.find("trace_output") != vm.cend()) {
+            trace_output = vm["trace_output"].as<std::string>();
+        }
+        if (vm.find("trace_roll_interval_ms") != vm.cend()) {
+            trace_roll_interval_ms = vm["trace_roll_interval_ms"].as<uint64_t>();
+        }
+        if (vm.find("trace_max_files") != vm.cend()) {
+            trace_max_files = vm["trace_max_files"].as<uint32_t>();
+        }
+        if (vm.find("handoff_socket") != vm.cend()) {
+            handoff_socket = vm["handoff_socket"].as<std::string>();
+        }
+        if (vm.find("drain_timeout_ms") != vm.cend()) {
+            drain_timeout_ms = vm["drain_timeout_ms"].as<uint64_t>();
+        }
+        if (vm.find("tls_certificate_file") != vm.cend()) {
+            tls_certificate_file = vm["tls_certificate_file"].as<std::string>();
+            if (vm.find("tls_private_key_file") == vm.cend()) {
+                throw std::runtime_error("The argument tls_private_key_file should be specified");
+            }
+            tls_private_key_file = vm["tls_private_key_file"].as<std::string>();
+        }
     } catch (std::bad_cast& ex) {
         std::cerr << std::endl
                   << "Please include all required options. Use the command line `--help` to see them. "
@@ -84,18 +414,298 @@ int main(int argc, char* argv[])
 
     JsonRPCFilter filter;
     filter.applyOptions(filter_options);
+    if (!params_rules_file.empty()) {
+        std::ifstream rulesFile(params_rules_file);
+        if (!rulesFile) {
+            std::cerr << "Failed to open params rules file: " << params_rules_file << std::endl;
+            return EXIT_FAILURE;
+        }
+        std::stringstream rules;
+        rules << rulesFile.rdbuf();
+        try {
+            filter.applyParamsRules(rules.str());
+        } catch (std::exception& ex) {
+            std::cerr << ex.what() << std::endl;
+            return EXIT_FAILURE;
+        }
+    }
+    filter.setRoutingTable(std::move(routing_table));
 
-    JsonRpcRelay relay(std::move(filter),
-                       server_bind_address,
-                       server_bind_port,
-                       target_bind_address,
-                       target_bind_port,
-                       thread_count);
+    std::shared_ptr<boost::asio::ssl::context> tls;
+    if (!tls_certificate_file.empty()) {
+        TlsOptions tls_options;
+        for (auto file : {std::make_pair(&tls_options.certificateChain, tls_certificate_file),
+                          std::make_pair(&tls_options.privateKey, tls_private_key_file)}) {
+            std::ifstream pemFile(file.second);
+            if (!pemFile) {
+                std::cerr << "Failed to open TLS file: " << file.second << std::endl;
+                return EXIT_FAILURE;
+            }
+            std::stringstream pem;
+            pem << pemFile.rdbuf();
+            *file.first = pem.str();
+        }
+        try {
+            tls = MakeTlsServerContext(tls_options);
+        } catch (std::exception& ex) {
+            std::cerr << ex.what() << std::endl;
+            return EXIT_FAILURE;
+        }
+    }
+
+    // take over the listening socket of the relay this one replaces, if there's one
+    int listening_socket = -1;
+    if (!handoff_socket.empty()) {
+        try {
+            listening_socket = ListenerHandoff::Receive(handoff_socket);
+        } catch (std::exception& ex) {
+            std::cerr << ex.what() << std::endl;
+            return EXIT_FAILURE;
+        }
+        if (listening_socket >= 0) {
+            LogWrite("Took over the listening socket of the running relay", b_sev::info);
+        }
+    }
+
+    std::unique_ptr<JsonRpcRelay> relay_instance;
+    try {
+        relay_instance = std::make_unique<JsonRpcRelay>(std::move(filter),
+                                                        server_bind_address,
+                                                        server_bind_port,
+                                                        target_bind_address,
+                                                        target_bind_port,
+                                                        thread_count,
+                                                        execution_model,
+                                                        listening_socket);
+    } catch (std::exception& ex) {
+        std::cerr << ex.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+    JsonRpcRelay& relay = *relay_instance;
+
+    if (tls) {
+        relay.setTlsContext(tls);
+    }
+
+    if (early_rejection) {
+        relay.enableEarlyRejection(screen_options);
+    }
+
+    if (health_checks) {
+        relay.enableHealthChecks(health_options);
+
+        std::vector<std::string> targets;
+        boost::split(targets, failover_targets, boost::is_any_of(","), boost::token_compress_on);
+        for (const std::string& target : targets) {
+            if (target.empty()) {
+                continue;
+            }
+            const std::size_t colon = target.rfind(':');
+            if (colon == std::string::npos) {
+                std::cerr << "Invalid failover target (expected address:port): " << target << std::endl;
+                relay.stop();
+                return EXIT_FAILURE;
+            }
+            relay.addFailoverUpstream(target.substr(0, colon),
+                                      static_cast<uint16_t>(std::stoul(target.substr(colon + 1))));
+        }
+    }
+
+    if (upstream_connections > 0) {
+        relay.enableUpstreamKeepAlive(keep_alive_options);
+    }
+
+    for (const UpstreamPoolOption& pool : upstream_pools) {
+        if (pool.connections > 0) {
+            AsyncClientOptions pool_options = keep_alive_options;
+            pool_options.maxConnections     = pool.connections;
+            relay.addUpstreamPool(pool.name, pool.address, pool.port, pool_options);
+        } else {
+            relay.addUpstreamPool(pool.name, pool.address, pool.port);
+        }
+    }
+
+    if (websocket_upstream_connections > 0) {
+        relay.enableWebSocket(websocket_upstream_connections);
+    }
+
+    if (!batch_options.methods.empty()) {
+        relay.enableMicroBatching(batch_options);
+    }
+
+    if (!priority_options.classes.empty() || priority_options.clientIdentity != ClientIdentity::None) {
+        relay.enablePriorityClasses(priority_options);
+    }
+
+    if (stream_port > 0) {
+        try {
+            relay.enableStreamListener(stream_bind_address, stream_port, stream_options);
+        } catch (std::exception& ex) {
+            std::cerr << "Failed to listen on " << stream_bind_address << ":" << stream_port << ": "
+                      << ex.what() << std::endl;
+            relay.stop();
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (!capture_file.empty()) {
+        relay.setTrafficCapture(std::make_shared<TrafficCapture>(capture_file));
+    }
+
+    if (shared_metrics) {
+        try {
+            relay.setSharedMetrics(std::make_shared<SharedMetrics>(shared_metrics_prefix));
+        } catch (std::exception& ex) {
+            std::cerr << ex.what() << std::endl;
+            relay.stop();
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (!long_poll_methods.empty()) {
+        relay.setLongPollCollapser(std::make_shared<LongPollCollapser>(long_poll_methods));
+    }
+
+    std::shared_ptr<PrefetchEngine> prefetch;
+    if (!prefetch_options.rules.empty()) {
+        prefetch = std::make_shared<PrefetchEngine>(prefetch_options);
+        relay.setPrefetchEngine(prefetch);
+    }
+
+    std::shared_ptr<TrafficMirror> mirror;
+    if (mirror_options.port > 0) {
+        mirror_options.client.requestTimeout = keep_alive_options.requestTimeout;
+        mirror = std::make_shared<TrafficMirror>(mirror_options);
+        relay.setTrafficMirror(mirror);
+    }
+
+    std::unique_ptr<EasyServer> admin;
+    if (admin_port > 0) {
+        auto usage = std::make_shared<UsageTracker>();
+        relay.setUsageTracker(usage);
+        admin = std::make_unique<EasyServer>(admin_bind_address, admin_port, 1);
+        admin->setRequestResponseFunctor(AdminEndpoint(usage, prefetch, mirror));
+        admin->run();
+    }
+
+    std::shared_ptr<RequestTracer> tracer;
+    if (trace_sample_every > 0 || trace_latency_threshold_us > 0) {
+        tracer = std::make_shared<RequestTracer>(trace_sample_every,
+                                                 std::chrono::microseconds(trace_latency_threshold_us));
+        if (trace_roll_interval_ms > 0) {
+            tracer->startRollingExport(
+                trace_output, std::chrono::milliseconds(trace_roll_interval_ms), trace_max_files);
+        }
+        relay.setRequestTracer(tracer);
+    }
+
+    /////////// wait for signals on the main thread
+
+    // SIGINT stops at once; SIGTERM (or handing the listening socket over) drains the relay first
+    net::io_context                       control;
+    net::signal_set                       signals(control, SIGINT, SIGTERM, SIGUSR1);
+    net::steady_timer                     drainTimer(control);
+    bool                                  draining       = false;
+    uint64_t                              traceDumpCount = 0;
+    std::shared_ptr<ListenerHandoff>      handoff;
+
+    // the cache directory is locked by one relay at a time: a relay that takes over from a running one
+    // opens it once the running one releases it, when it starts draining
+    std::shared_ptr<ImmutableResultCache> immutable_cache;
+    net::steady_timer                     cacheTimer(control);
+
+    std::function<bool()> openImmutableCache = [&]() {
+        try {
+            immutable_cache = ImmutableResultCache::Open(immutable_cache_options);
+        } catch (std::exception& ex) {
+            std::cerr << ex.what() << std::endl;
+            return false;
+        }
+        if (immutable_cache) {
+            relay.setImmutableCache(immutable_cache);
+            return true;
+        }
+        cacheTimer.expires_after(std::chrono::milliseconds(100));
+        cacheTimer.async_wait([&](boost::system::error_code ec) {
+            if (!ec && !draining) {
+                openImmutableCache();
+            }
+        });
+        return true;
+    };
+    if (!immutable_cache_options.directory.empty()) {
+        if (!openImmutableCache()) {
+            relay.stop();
+            return EXIT_FAILURE;
+        }
+        if (!immutable_cache) {
+            LogWrite("The immutable cache is in use by the running relay, until that one drains",
+                     b_sev::info);
+        }
+    }
+
+    auto drain = [&]() {
+        if (draining) {
+            return;
+        }
+        draining = true;
+        LogWrite("Draining: no new connections are accepted", b_sev::info);
+        if (handoff) {
+            handoff->stop();
+        }
+        cacheTimer.cancel();
+        relay.setImmutableCache(nullptr);
+        immutable_cache.reset(); // released once the requests that use it are answered
+        // the relay stops once the last connection is closed, or at the deadline
+        drainTimer.expires_after(std::chrono::milliseconds(drain_timeout_ms));
+        drainTimer.async_wait([&](boost::system::error_code ec) {
+            if (!ec) {
+                LogWrite("Drain timed out with " + std::to_string(relay.getActiveSessionCount()) +
+                             " open connections",
+                         b_sev::warn);
+                control.stop();
+            }
+        });
+        relay.drain([&control]() { control.stop(); });
+    };
+
+    std::function<void()> waitForSignal = [&]() {
+        signals.async_wait([&](boost::system::error_code ec, int signal) {
+            if (ec) {
+                return;
+            }
+            if (signal == SIGINT) {
+                LogWrite("Signal sent to stop application.", b_sev::info);
+                return control.stop();
+            }
+            if (signal == SIGTERM) {
+                drain();
+            } else if (signal == SIGUSR1 && tracer) {
+                const std::string filename =
+                    trace_output + ".dump." + std::to_string(traceDumpCount++) + ".json";
+                if (tracer->exportChromeTraceToFile(filename)) {
+                    LogWrite("Traces written to " + filename, b_sev::info);
+                }
+            }
+            waitForSignal();
+        });
+    };
+    waitForSignal();
 
-    while (!g_ShutdownProgram.load(std::memory_order_relaxed)) {
-        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    if (!handoff_socket.empty()) {
+        handoff = std::make_shared<ListenerHandoff>(
+            control, handoff_socket, relay.getListeningSocket(), [&]() { drain(); });
+        try {
+            handoff->run();
+        } catch (std::exception& ex) {
+            std::cerr << ex.what() << std::endl;
+            relay.stop();
+            return EXIT_FAILURE;
+        }
     }
 
+    control.run();
+
     relay.stop();
 
     return EXIT_SUCCESS;
@@ -0,0 +1,441 @@
+#include "ImmutableResultCache.h"
+
+#include "Filters/JsonRpcScanner.h"
+#include "Logging/DefaultLogger.h"
+#include <algorithm>
+#include <boost/algorithm/string.hpp>
+#include <cerrno>
+#include <cstring>
+#include <dirent.h>
+#include <fcntl.h>
+#include <stdexcept>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+namespace {
+
+/**
+ * A segment file is a header, then records, each aligned to 8 bytes: a record header, the key and the
+ * value. Records are written after their key and value, and the space after the last one is zeroes.
+ */
+constexpr uint32_t FILE_MAGIC   = 0x31435248; // "HRC1"
+constexpr uint32_t VERSION      = 1;
+constexpr uint32_t RECORD_MAGIC = 0x52435248; // "HRCR"
+
+struct FileHeader
+{
+    uint32_t magic;
+    uint32_t version;
+    uint64_t reserved;
+};
+
+struct RecordHeader
+{
+    uint32_t magic;
+    uint32_t checksum; // of the key and the value
+    uint32_t keySize;
+    uint32_t valueSize;
+    uint64_t keyHash;
+};
+
+uint64_t RecordSize(uint64_t keySize, uint64_t valueSize)
+{
+    return (sizeof(RecordHeader) + keySize + valueSize + 7) & ~uint64_t(7);
+}
+
+// FNV-1a, continued from hash
+uint64_t Hash(const char* data, std::size_t size, uint64_t hash = 14695981039346656037ull)
+{
+    for (std::size_t i = 0; i < size; i++) {
+        hash ^= static_cast<unsigned char>(data[i]);
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+uint32_t Checksum(const char* key, std::size_t keySize, const char* value, std::size_t valueSize)
+{
+    const uint64_t hash = Hash(value, valueSize, Hash(key, keySize));
+    return static_cast<uint32_t>(hash ^ (hash >> 32));
+}
+
+std::string SegmentPath(const std::string& directory, uint32_t id)
+{
+    const std::string name = std::to_string(id);
+    return directory + "/" + std::string(10 - std::min<std::size_t>(name.size(), 10), '0') + name +
+           ".seg";
+}
+
+} // namespace
+
+struct ImmutableResultCache::Segment
+{
+    uint32_t    id = 0;
+    std::string path;
+    char*       data = nullptr;
+    uint64_t    size = 0;
+    uint64_t    end  = 0; // where the next record goes
+
+    ~Segment()
+    {
+        if (data) {
+            munmap(data, size);
+        }
+    }
+};
+
+std::map<std::string, std::string> ImmutableCacheOptions::ParseMethods(const std::string& text)
+{
+    std::map<std::string, std::string> methods;
+    std::vector<std::string>           entries;
+    boost::split(entries, text, boost::is_any_of(","), boost::token_compress_on);
+    for (std::string entry : entries) {
+        boost::trim(entry);
+        if (entry.empty()) {
+            continue;
+        }
+        const std::size_t colon  = entry.find(':');
+        const std::string method = entry.substr(0, colon);
+        if (method.empty()) {
+            throw std::runtime_error("Invalid immutable cache method: " + entry);
+        }
+        methods[method] = colon == std::string::npos ? std::string() : entry.substr(colon + 1);
+    }
+    return methods;
+}
+
+ImmutableResultCache::ImmutableResultCache(ImmutableCacheOptions Options, int LockFd)
+    : options(std::move(Options)), lockFd(LockFd)
+{
+}
+
+ImmutableResultCache::~ImmutableResultCache()
+{
+    segments.clear(); // unmapped once no lookup copies from them
+    close(lockFd);
+}
+
+std::shared_ptr<ImmutableResultCache> ImmutableResultCache::Open(ImmutableCacheOptions options)
+{
+    if (options.directory.empty()) {
+        throw std::runtime_error("The immutable cache needs a directory");
+    }
+    if (mkdir(options.directory.c_str(), 0755) != 0 && errno != EEXIST) {
+        throw std::runtime_error("Failed to create the immutable cache directory " + options.directory +
+                                 ": " + std::strerror(errno));
+    }
+    const std::string lockPath = options.directory + "/lock";
+    const int         fd       = open(lockPath.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        throw std::runtime_error("Failed to open " + lockPath + ": " + std::strerror(errno));
+    }
+    if (flock(fd, LOCK_EX | LOCK_NB) != 0) {
+        const int error = errno;
+        close(fd);
+        if (error == EWOULDBLOCK) {
+            return nullptr;
+        }
+        throw std::runtime_error("Failed to lock " + lockPath + ": " + std::strerror(error));
+    }
+
+    // offsets in the index are 32-bit
+    options.segmentBytes =
+        std::min<uint64_t>(std::max<uint64_t>(options.segmentBytes, 4096), UINT32_MAX);
+    std::shared_ptr<ImmutableResultCache> cache(new ImmutableResultCache(std::move(options), fd));
+    cache->loadSegments();
+    return cache;
+}
+
+void ImmutableResultCache::loadSegments()
+{
+    std::vector<uint32_t> ids;
+    DIR*                  dir = opendir(options.directory.c_str());
+    if (!dir) {
+        throw std::runtime_error("Failed to list the immutable cache directory " + options.directory +
+                                 ": " + std::strerror(errno));
+    }
+    while (dirent* entry = readdir(dir)) {
+        const std::string name = entry->d_name;
+        if (name.size() == 14 && boost::ends_with(name, ".seg") &&
+            std::all_of(name.begin(), name.begin() + 10, [](char c) { return c >= '0' && c <= '9'; })) {
+            ids.push_back(static_cast<uint32_t>(std::stoul(name.substr(0, 10))));
+        }
+    }
+    closedir(dir);
+    std::sort(ids.begin(), ids.end());
+
+    std::lock_guard<std::mutex> lock(mutex);
+    for (uint32_t id : ids) {
+        auto segment  = std::make_shared<Segment>();
+        segment->id   = id;
+        segment->path = SegmentPath(options.directory, id);
+
+        const int   fd = open(segment->path.c_str(), O_RDWR | O_CLOEXEC);
+        struct stat st;
+        if (fd < 0 || fstat(fd, &st) != 0 || st.st_size < static_cast<off_t>(sizeof(FileHeader)) ||
+            static_cast<uint64_t>(st.st_size) > UINT32_MAX) {
+            if (fd >= 0) {
+                close(fd);
+            }
+            LogWrite("Removing invalid immutable cache segment " + segment->path, b_sev::warn);
+            unlink(segment->path.c_str());
+            continue;
+        }
+        void*     memory = mmap(nullptr, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        const int error  = errno;
+        close(fd);
+        if (memory == MAP_FAILED) {
+            throw std::runtime_error("Failed to map the immutable cache segment " + segment->path +
+                                     ": " + std::strerror(error));
+        }
+        segment->data = static_cast<char*>(memory);
+        segment->size = static_cast<uint64_t>(st.st_size);
+
+        FileHeader header;
+        std::memcpy(&header, segment->data, sizeof(header));
+        if (header.magic != FILE_MAGIC || header.version != VERSION) {
+            LogWrite("Removing immutable cache segment of another format " + segment->path, b_sev::warn);
+            unlink(segment->path.c_str());
+            continue;
+        }
+        segment->end = indexSegment(*segment);
+        segments.push_back(std::move(segment));
+        nextSegmentId = id + 1;
+    }
+    while (segments.size() > 1 && segments.size() * options.segmentBytes > options.maxBytes) {
+        evictOldestSegment();
+    }
+}
+
+uint64_t ImmutableResultCache::indexSegment(Segment& segment)
+{
+    uint64_t offset = sizeof(FileHeader);
+    while (offset + sizeof(RecordHeader) <= segment.size) {
+        RecordHeader header;
+        std::memcpy(&header, segment.data + offset, sizeof(header));
+        if (header.magic != RECORD_MAGIC) {
+            break;
+        }
+        const uint64_t size = RecordSize(header.keySize, header.valueSize);
+        if (size > segment.size - offset) {
+            break;
+        }
+        const char* key   = segment.data + offset + sizeof(header);
+        const char* value = key + header.keySize;
+        if (header.checksum != Checksum(key, header.keySize, value, header.valueSize) ||
+            header.keyHash != Hash(key, header.keySize)) {
+            break;
+        }
+        index[header.keyHash] = Location{segment.id, static_cast<uint32_t>(offset)};
+        offset += size;
+    }
+    if (offset + sizeof(uint32_t) <= segment.size) {
+        uint32_t magic = 0;
+        std::memcpy(&magic, segment.data + offset, sizeof(magic));
+        if (magic != 0) {
+            // a torn record; what follows it is overwritten by the next appends
+            LogWrite("Truncating immutable cache segment " + segment.path + " at " +
+                         std::to_string(offset),
+                     b_sev::warn);
+            std::memset(segment.data + offset, 0, segment.size - offset);
+        }
+    }
+    return offset;
+}
+
+bool ImmutableResultCache::openSegment()
+{
+    while (!segments.empty() && (segments.size() + 1) * options.segmentBytes > options.maxBytes) {
+        evictOldestSegment();
+    }
+
+    auto segment  = std::make_shared<Segment>();
+    segment->id   = nextSegmentId;
+    segment->path = SegmentPath(options.directory, segment->id);
+
+    const int fd = open(segment->path.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        LogWrite("Failed to create the immutable cache segment " + segment->path + ": " +
+                     std::strerror(errno),
+                 b_sev::err);
+        return false;
+    }
+    // the blocks are allocated now, so that a full disk fails here rather than on a write to the mapping
+    void*     memory = MAP_FAILED;
+    const int error  = posix_fallocate(fd, 0, static_cast<off_t>(options.segmentBytes));
+    if (error == 0) {
+        memory = mmap(nullptr, options.segmentBytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+    const int mapError = errno;
+    close(fd);
+    if (memory == MAP_FAILED) {
+        LogWrite("Failed to map the immutable cache segment " + segment->path + ": " +
+                     std::strerror(error != 0 ? error : mapError),
+                 b_sev::err);
+        unlink(segment->path.c_str());
+        return false;
+    }
+    segment->data = static_cast<char*>(memory);
+    segment->size = options.segmentBytes;
+
+    const FileHeader header{FILE_MAGIC, VERSION, 0};
+    std::memcpy(segment->data, &header, sizeof(header));
+    segment->end = sizeof(header);
+
+    nextSegmentId++;
+    segments.push_back(std::move(segment));
+    return true;
+}
+
+void ImmutableResultCache::evictOldestSegment()
+{
+    std::shared_ptr<Segment> oldest = std::move(segments.front());
+    segments.pop_front();
+    for (auto it = index.begin(); it != index.end();) {
+        if (it->second.segment == oldest->id) {
+            it = index.erase(it);
+        } else {
+            ++it;
+        }
+    }
+    unlink(oldest->path.c_str());
+    evictedSegments++;
+}
+
+std::shared_ptr<ImmutableResultCache::Segment> ImmutableResultCache::findSegment(uint32_t id) const
+{
+    for (auto it = segments.rbegin(); it != segments.rend(); ++it) {
+        if ((*it)->id == id) {
+            return *it;
+        }
+    }
+    return nullptr;
+}
+
+std::string ImmutableResultCache::MakeKey(boost::string_view method, boost::string_view params)
+{
+    std::string key = method.to_string();
+    key += '\n';
+    bool inString = false;
+    bool escaped  = false;
+    for (char c : params) {
+        if (inString) {
+            key += c;
+            if (escaped) {
+                escaped = false;
+            } else if (c == '\\') {
+                escaped = true;
+            } else if (c == '"') {
+                inString = false;
+            }
+        } else if (c != ' ' && c != '\t' && c != '\n' && c != '\r') {
+            inString = c == '"';
+            key += c;
+        }
+    }
+    return key;
+}
+
+bool ImmutableResultCache::lookup(const std::string& key, std::string& out)
+{
+    const uint64_t           hash = Hash(key.data(), key.size());
+    std::shared_ptr<Segment> segment;
+    uint32_t                 offset = 0;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto                        it = index.find(hash);
+        if (it != index.end()) {
+            segment = findSegment(it->second.segment);
+            offset  = it->second.offset;
+        }
+    }
+    if (!segment) {
+        misses++;
+        return false;
+    }
+    // records are never changed once indexed, and the segment stays mapped while it's referenced
+    RecordHeader header;
+    std::memcpy(&header, segment->data + offset, sizeof(header));
+    const char* stored = segment->data + offset + sizeof(header);
+    if (header.keySize != key.size() || std::memcmp(stored, key.data(), key.size()) != 0) {
+        misses++; // another key with the same hash
+        return false;
+    }
+    out.append(stored + header.keySize, header.valueSize);
+    hits++;
+    return true;
+}
+
+bool ImmutableResultCache::store(const std::string& method,
+                                 const std::string& key,
+                                 boost::string_view response)
+{
+    auto requirement = options.methods.find(method);
+    if (requirement == options.methods.cend()) {
+        return false;
+    }
+    JsonSpan resultSpan;
+    JsonSpan errorSpan;
+    if (!JsonRpcScanner::FindMember(response, "result", resultSpan) ||
+        (JsonRpcScanner::FindMember(response, "error", errorSpan) &&
+         response.substr(errorSpan.offset, errorSpan.size) != "null")) {
+        return false;
+    }
+    const boost::string_view result = response.substr(resultSpan.offset, resultSpan.size);
+    JsonSpan                 member;
+    if (result == "null" || (!requirement->second.empty() &&
+                             !JsonRpcScanner::FindMember(result, requirement->second, member))) {
+        return false;
+    }
+    const uint64_t size = RecordSize(key.size(), result.size());
+    if (sizeof(FileHeader) + size > options.segmentBytes) {
+        return false;
+    }
+
+    const uint64_t              hash = Hash(key.data(), key.size());
+    std::lock_guard<std::mutex> lock(mutex);
+    if (index.count(hash) > 0) {
+        return false; // e.g., stored by a concurrent call
+    }
+    if (segments.empty() || segments.back()->end + size > segments.back()->size) {
+        if (!openSegment()) {
+            return false;
+        }
+    }
+    Segment&       segment = *segments.back();
+    char*          record  = segment.data + segment.end;
+    const uint32_t offset  = static_cast<uint32_t>(segment.end);
+
+    RecordHeader header;
+    header.magic     = 0;
+    header.keySize   = static_cast<uint32_t>(key.size());
+    header.valueSize = static_cast<uint32_t>(result.size());
+    header.keyHash   = hash;
+    header.checksum  = Checksum(key.data(), key.size(), result.data(), result.size());
+    std::memcpy(record + sizeof(header), key.data(), key.size());
+    std::memcpy(record + sizeof(header) + key.size(), result.data(), result.size());
+    std::memcpy(record, &header, sizeof(header));
+    // the magic goes last, so that a record is only valid once it's complete
+    std::memcpy(record, &RECORD_MAGIC, sizeof(RECORD_MAGIC));
+
+    segment.end += size;
+    index[hash] = Location{segment.id, offset};
+    stores++;
+    return true;
+}
+
+ImmutableResultCache::Stats ImmutableResultCache::getStats() const
+{
+    Stats s;
+    s.hits   = hits.load();
+    s.misses = misses.load();
+    s.stores = stores.load();
+    std::lock_guard<std::mutex> lock(mutex);
+    s.entries         = index.size();
+    s.segments        = segments.size();
+    s.evictedSegments = evictedSegments;
+    return s;
+}
@@ -0,0 +1,119 @@
+#ifndef IMMUTABLERESULTCACHE_H
+#define IMMUTABLERESULTCACHE_H
+
+#include <atomic>
+#include <boost/utility/string_view.hpp>
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+struct ImmutableCacheOptions
+{
+    // where the segment files are kept; created if it doesn't exist
+    std::string directory;
+    /**
+     * The methods whose results are cached, with a member that a result must have to be cached, or
+     * empty; e.g., getrawtransaction with "blockhash", which only confirmed transactions have
+     */
+    std::map<std::string, std::string> methods;
+    // the size of a segment file; a result that doesn't fit in one isn't cached
+    uint64_t segmentBytes = 64ull << 20;
+    // the segment files together; the oldest segment is removed to make room for a new one
+    uint64_t maxBytes = 1ull << 30;
+
+    // comma separated list of method[:required_member] (e.g., getblock,getrawtransaction:blockhash)
+    static std::map<std::string, std::string> ParseMethods(const std::string& text);
+};
+
+/**
+ * A persistent cache of json-rpc results that never change, such as blocks and confirmed transactions
+ * by hash, keyed by method and params. Results are appended to memory-mapped segment files, and found
+ * through an in-memory index of 64-bit key hashes that is rebuilt from the segments on start, so the
+ * cache survives restarts. A hit is copied once, straight from the mapping into the response.
+ *
+ * Segment files (<directory>/<id>.seg) are written in the byte order of the host. A record whose
+ * checksum doesn't match (e.g., after a crash in the middle of an append) ends its segment. The
+ * directory is locked, so only one process uses it at a time.
+ *
+ * Thread-safe.
+ */
+class ImmutableResultCache
+{
+    struct Segment;
+
+    // where a record is; 16 bytes per entry with the hash
+    struct Location
+    {
+        uint32_t segment = 0;
+        uint32_t offset  = 0;
+    };
+
+    const ImmutableCacheOptions options;
+    int                         lockFd = -1;
+
+    mutable std::mutex                     mutex;
+    std::deque<std::shared_ptr<Segment>>   segments; // by id, the oldest first; the last one is written
+    std::unordered_map<uint64_t, Location> index;    // by the hash of the key
+    uint32_t                               nextSegmentId   = 0;
+    uint64_t                               evictedSegments = 0;
+    std::atomic<uint64_t>                  hits{0};
+    std::atomic<uint64_t>                  misses{0};
+    std::atomic<uint64_t>                  stores{0};
+
+    ImmutableResultCache(ImmutableCacheOptions Options, int LockFd);
+
+    // maps and indexes the segment files of the directory
+    void loadSegments();
+    // adds the records of the segment to the index; returns the offset after the last valid one
+    uint64_t indexSegment(Segment& segment);
+    // needs the lock; removes the oldest segments until a new one fits, then creates it
+    bool openSegment();
+    // needs the lock
+    void evictOldestSegment();
+    // needs the lock; null if the segment was evicted
+    std::shared_ptr<Segment> findSegment(uint32_t id) const;
+
+public:
+    struct Stats
+    {
+        uint64_t hits            = 0;
+        uint64_t misses          = 0;
+        uint64_t stores          = 0;
+        uint64_t entries         = 0;
+        uint64_t segments        = 0;
+        uint64_t evictedSegments = 0;
+    };
+
+    /**
+     * Opens the cache in options.directory, and indexes the segments already there. Returns nullptr
+     * if another process uses the directory; throws std::runtime_error on other failures.
+     */
+    static std::shared_ptr<ImmutableResultCache> Open(ImmutableCacheOptions options);
+
+    ~ImmutableResultCache();
+
+    ImmutableResultCache(const ImmutableResultCache&) = delete;
+    ImmutableResultCache& operator=(const ImmutableResultCache&) = delete;
+
+    bool isCached(const std::string& method) const { return options.methods.count(method) > 0; }
+
+    // the key of a call; whitespace outside of strings in params doesn't change it
+    static std::string MakeKey(boost::string_view method, boost::string_view params);
+
+    // appends the cached result (raw json) of the key to out; false if it isn't cached
+    bool lookup(const std::string& key, std::string& out);
+
+    /**
+     * Caches the result of the json-rpc response to a call of the method, if it's a success (and has
+     * the member that the method requires); returns whether it was stored
+     */
+    bool store(const std::string& method, const std::string& key, boost::string_view response);
+
+    Stats getStats() const;
+};
+
+#endif // IMMUTABLERESULTCACHE_H
@@ -0,0 +1,327 @@
+#include "PrefetchEngine.h"
+
+#include "Filters/JsonRpcScanner.h"
+#include "ImmutableResultCache.h"
+#include <algorithm>
+#include <boost/algorithm/string.hpp>
+#include <jsoncpp/json/json.h>
+#include <stdexcept>
+
+namespace {
+
+// splits text at the commas that are outside of strings and brackets
+std::vector<std::string> SplitTopLevel(const std::string& text)
+{
+    std::vector<std::string> parts;
+    std::size_t              start    = 0;
+    int                      depth    = 0;
+    bool                     inString = false;
+    for (std::size_t i = 0; i < text.size(); i++) {
+        const char c = text[i];
+        if (inString) {
+            if (c == '\\') {
+                i++;
+            } else if (c == '"') {
+                inString = false;
+            }
+        } else if (c == '"') {
+            inString = true;
+        } else if (c == '[' || c == '{') {
+            depth++;
+        } else if (c == ']' || c == '}') {
+            depth--;
+        } else if (c == ',' && depth == 0) {
+            parts.push_back(text.substr(start, i - start));
+            start = i + 1;
+        }
+    }
+    parts.push_back(text.substr(start));
+    return parts;
+}
+
+bool IsNumber(const std::string& text, bool allowSign)
+{
+    const std::size_t digits = allowSign && !text.empty() && text[0] == '-' ? 1 : 0;
+    return text.size() > digits && text.size() - digits <= 18 &&
+           text.find_first_not_of("0123456789", digits) == std::string::npos;
+}
+
+} // namespace
+
+PrefetchRule PrefetchRule::Parse(const std::string& text)
+{
+    const std::size_t arrow = text.find('>');
+    const std::size_t open  = text.find('(', arrow == std::string::npos ? 0 : arrow);
+    const std::size_t close = text.rfind(')');
+    if (arrow == std::string::npos || open == std::string::npos || close == std::string::npos ||
+        close < open || !boost::trim_copy(text.substr(close + 1)).empty()) {
+        throw std::runtime_error("Invalid prefetch rule (expected trigger>method(params)): " + text);
+    }
+
+    PrefetchRule rule;
+    rule.trigger = boost::trim_copy(text.substr(0, arrow));
+    rule.method  = boost::trim_copy(text.substr(arrow + 1, open - arrow - 1));
+    if (rule.trigger.empty() || rule.method.empty()) {
+        throw std::runtime_error("Invalid prefetch rule (a method is missing): " + text);
+    }
+
+    const std::string params = boost::trim_copy(text.substr(open + 1, close - open - 1));
+    if (params.empty()) {
+        return rule;
+    }
+    for (const std::string& part : SplitTopLevel(params)) {
+        const std::string item = boost::trim_copy(part);
+        Param             param;
+        if (item.empty()) {
+            throw std::runtime_error("Invalid prefetch rule (empty param): " + text);
+        } else if (item == "$result") {
+            param.kind = Param::Kind::Result;
+        } else if (item.compare(0, 8, "$result.") == 0 && item.size() > 8) {
+            param.kind = Param::Kind::Result;
+            param.text = item.substr(8);
+        } else if (item[0] == '$') {
+            const std::size_t sign  = item.find_first_of("+-");
+            const std::string index = item.substr(1, sign == std::string::npos ? sign : sign - 1);
+            const std::string delta = sign == std::string::npos ? std::string() : item.substr(sign + 1);
+            if (!IsNumber(index, false) || (sign != std::string::npos && !IsNumber(delta, false))) {
+                throw std::runtime_error("Invalid prefetch rule placeholder: " + item);
+            }
+            param.kind   = Param::Kind::TriggerParam;
+            param.index  = std::stoul(index);
+            param.offset = sign == std::string::npos ? 0 : std::stoll(delta);
+            if (sign != std::string::npos && item[sign] == '-') {
+                param.offset = -param.offset;
+            }
+        } else {
+            param.text = item;
+        }
+        rule.params.push_back(std::move(param));
+    }
+    return rule;
+}
+
+bool PrefetchRule::render(boost::string_view triggerParams,
+                          boost::string_view result,
+                          std::string&       out) const
+{
+    std::vector<JsonSpan> elements;
+    if (!triggerParams.empty() && !JsonRpcScanner::SplitArray(triggerParams, elements)) {
+        elements.clear(); // named params; only $result resolves
+    }
+
+    out = "[";
+    for (const Param& param : params) {
+        if (out.size() > 1) {
+            out += ',';
+        }
+        switch (param.kind) {
+        case Param::Kind::Literal:
+            out += param.text;
+            break;
+        case Param::Kind::Result: {
+            boost::string_view value = result;
+            std::size_t        start = 0;
+            while (start < param.text.size()) {
+                const std::size_t dot    = std::min(param.text.find('.', start), param.text.size());
+                JsonSpan          member;
+                if (!JsonRpcScanner::FindMember(value, param.text.substr(start, dot - start), member)) {
+                    return false;
+                }
+                value = value.substr(member.offset, member.size);
+                start = dot + 1;
+            }
+            if (value == "null") {
+                return false;
+            }
+            out.append(value.data(), value.size());
+            break;
+        }
+        case Param::Kind::TriggerParam: {
+            if (param.index >= elements.size()) {
+                return false;
+            }
+            const JsonSpan&   span  = elements[param.index];
+            const std::string value = triggerParams.substr(span.offset, span.size).to_string();
+            if (param.offset == 0) {
+                out += value;
+            } else if (IsNumber(value, true)) {
+                out += std::to_string(std::stoll(value) + param.offset);
+            } else {
+                return false;
+            }
+            break;
+        }
+        }
+    }
+    out += ']';
+    return true;
+}
+
+std::string PrefetchEngine::Stats::toJson() const
+{
+    Json::Value root;
+    root["issued"]   = Json::UInt64(issued);
+    root["skipped"]  = Json::UInt64(skipped);
+    root["failed"]   = Json::UInt64(failed);
+    root["hits"]     = Json::UInt64(hits);
+    root["joined"]   = Json::UInt64(joined);
+    root["misses"]   = Json::UInt64(misses);
+    root["wasted"]   = Json::UInt64(wasted);
+    root["entries"]  = Json::UInt64(entries);
+    root["hit_rate"] = hitRate();
+
+    Json::StyledWriter writer;
+    return writer.write(root);
+}
+
+PrefetchEngine::PrefetchEngine(PrefetchOptions Options) : options(std::move(Options)) {}
+
+bool PrefetchEngine::isTrigger(const std::string& method) const
+{
+    return std::any_of(options.rules.cbegin(), options.rules.cend(), [&](const PrefetchRule& rule) {
+        return rule.trigger == method;
+    });
+}
+
+bool PrefetchEngine::isPrefetched(const std::string& method) const
+{
+    return std::any_of(options.rules.cbegin(), options.rules.cend(), [&](const PrefetchRule& rule) {
+        return rule.method == method;
+    });
+}
+
+void PrefetchEngine::dropEntries(std::chrono::steady_clock::time_point now, std::size_t room)
+{
+    while (!order.empty() &&
+           (order.front().second <= now || entries.size() + room > options.maxEntries)) {
+        // the entry of a key may have been replaced since; its time tells
+        auto it = entries.find(order.front().first);
+        if (it != entries.end() && it->second.expiry == order.front().second) {
+            if (!it->second.used) {
+                stats.wasted++;
+            }
+            entries.erase(it);
+        }
+        order.pop_front();
+    }
+}
+
+bool PrefetchEngine::lookup(const std::string& key, std::string& out)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    dropEntries(std::chrono::steady_clock::now(), 0);
+    auto it = entries.find(key);
+    if (it == entries.end()) {
+        return false;
+    }
+    out += it->second.result;
+    it->second.used = true;
+    stats.hits++;
+    return true;
+}
+
+bool PrefetchEngine::wait(const std::string& key, ResultCallback ready)
+{
+    std::string result;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto                        waiting = inFlight.find(key);
+        if (waiting != inFlight.end()) {
+            waiting->second.push_back(std::move(ready));
+            stats.joined++;
+            return true;
+        }
+        auto it = entries.find(key);
+        if (it == entries.end()) {
+            stats.misses++;
+            return false;
+        }
+        result          = it->second.result;
+        it->second.used = true;
+        stats.hits++;
+    }
+    ready(&result);
+    return true;
+}
+
+std::vector<PrefetchEngine::Call> PrefetchEngine::plan(const std::string& method,
+                                                       boost::string_view params,
+                                                       boost::string_view result,
+                                                       uint32_t           level)
+{
+    std::vector<Call> calls;
+    if (level >= options.depth) {
+        return calls;
+    }
+    for (const PrefetchRule& rule : options.rules) {
+        Call call;
+        if (rule.trigger != method || !rule.render(params, result, call.params)) {
+            continue;
+        }
+        call.method = rule.method;
+        call.key    = ImmutableResultCache::MakeKey(call.method, call.params);
+        call.level  = level + 1;
+
+        std::lock_guard<std::mutex> lock(mutex);
+        if (entries.count(call.key) > 0 || inFlight.count(call.key) > 0) {
+            continue;
+        }
+        if (inFlight.size() >= options.maxInFlight) {
+            stats.skipped++;
+            continue;
+        }
+        inFlight[call.key];
+        stats.issued++;
+        calls.push_back(std::move(call));
+    }
+    return calls;
+}
+
+void PrefetchEngine::complete(const Call& call, const std::string* result)
+{
+    std::vector<ResultCallback> waiting;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto                        it = inFlight.find(call.key);
+        if (it != inFlight.end()) {
+            waiting = std::move(it->second);
+            inFlight.erase(it);
+        }
+        if (!result) {
+            stats.failed++;
+        } else if (waiting.empty()) {
+            // kept for the call it was made for; a call that waited for it already has it
+            const auto now = std::chrono::steady_clock::now();
+            dropEntries(now, 1);
+            Entry& entry = entries[call.key];
+            entry.result = *result;
+            entry.expiry = now + options.ttl;
+            order.emplace_back(call.key, entry.expiry);
+        }
+    }
+    for (ResultCallback& ready : waiting) {
+        ready(result);
+    }
+}
+
+PrefetchEngine::Stats PrefetchEngine::getStats() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    Stats                       s = stats;
+
+    s.entries = entries.size();
+    return s;
+}
+
+bool PrefetchEngine::FindResult(boost::string_view response, boost::string_view& result)
+{
+    JsonSpan resultSpan;
+    JsonSpan errorSpan;
+    if (!JsonRpcScanner::FindMember(response, "result", resultSpan) ||
+        (JsonRpcScanner::FindMember(response, "error", errorSpan) &&
+         response.substr(errorSpan.offset, errorSpan.size) != "null")) {
+        return false;
+    }
+    result = response.substr(resultSpan.offset, resultSpan.size);
+    return result != "null";
+}
@@ -0,0 +1,177 @@
+#ifndef PREFETCHENGINE_H
+#define PREFETCHENGINE_H
+
+#include <boost/utility/string_view.hpp>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/**
+ * A call to make once a call of the trigger method succeeds, because clients usually make it next;
+ * written as trigger>method(params), e.g.,
+ *
+ *     getblockhash>getblock($result,1)      the block of the hash that getblockhash returned
+ *     getblockhash>getblockhash($0+1)       the hash of the next height
+ *     getblock>getblock($result.nextblockhash,1)
+ *
+ * Params are json values or placeholders: $result (the result of the trigger call), $result.a.b (a
+ * member of it), $N (the Nth param of the trigger call) and $N+K or $N-K (an integer param plus or
+ * minus K). A rule whose placeholders don't resolve (e.g., a missing member) is skipped.
+ */
+struct PrefetchRule
+{
+    struct Param
+    {
+        enum class Kind
+        {
+            Literal,
+            Result,
+            TriggerParam
+        };
+        Kind        kind = Kind::Literal;
+        std::string text;       // the json of a literal, or the member path of a result (a.b)
+        std::size_t index  = 0; // of a trigger param
+        int64_t     offset = 0; // added to an integer trigger param
+    };
+
+    std::string        trigger;
+    std::string        method;
+    std::vector<Param> params;
+
+    // throws std::runtime_error if text is not a rule
+    static PrefetchRule Parse(const std::string& text);
+
+    /**
+     * The params (a json array) of the call to prefetch after a call of the trigger with the params
+     * (a json array, or empty) returned the result; false if a placeholder doesn't resolve
+     */
+    bool render(boost::string_view triggerParams, boost::string_view result, std::string& out) const;
+};
+
+struct PrefetchOptions
+{
+    std::vector<PrefetchRule> rules;
+    // how long a prefetched result is kept for the call it was made for
+    std::chrono::milliseconds ttl{5000};
+    // prefetched results kept at once; the oldest one is dropped for a new one
+    std::size_t maxEntries = 1024;
+    // prefetches in flight upstream at once; beyond this, prefetches are skipped
+    std::size_t maxInFlight = 4;
+    // the rules also apply to prefetched results, so many calls ahead are prefetched
+    uint32_t depth = 1;
+};
+
+/**
+ * Prefetches the results of the calls that clients make next in predictable sequences (e.g., the
+ * getblockhash, getblock, getblockhash of the next height, ... of indexers), so that they're answered
+ * without a round trip to the upstream. The engine plans the prefetches by its rules and keeps their
+ * results for a short time; the relay sends them upstream (see Relay::setPrefetchEngine()).
+ *
+ * Calls are told apart by method and params, like in ImmutableResultCache; only successful results
+ * are kept. A call whose prefetch is in flight waits for it instead of being sent again.
+ *
+ * Thread-safe.
+ */
+class PrefetchEngine
+{
+public:
+    // a planned prefetch
+    struct Call
+    {
+        std::string method;
+        std::string params;
+        std::string key;
+        uint32_t    level = 0; // the number of prefetches that led to this one, itself included
+    };
+
+    // gets a prefetched result, or null if the prefetch failed
+    using ResultCallback = std::function<void(const std::string* result)>;
+
+    struct Stats
+    {
+        uint64_t issued  = 0; // prefetches sent upstream
+        uint64_t skipped = 0; // prefetches not sent, as maxInFlight were already in flight
+        uint64_t failed  = 0; // prefetches without a successful result
+        uint64_t hits    = 0; // calls answered with a prefetched result
+        uint64_t joined  = 0; // calls that waited for a prefetch in flight
+        uint64_t misses  = 0; // calls of prefetched methods that were neither prefetched nor in flight
+        uint64_t wasted  = 0; // prefetched results dropped without being used
+        uint64_t entries = 0;
+
+        // the share of the calls of prefetched methods that didn't go upstream themselves
+        double hitRate() const
+        {
+            const uint64_t calls = hits + joined + misses;
+            return calls == 0 ? 0 : static_cast<double>(hits + joined) / calls;
+        }
+        std::string toJson() const;
+    };
+
+private:
+    struct Entry
+    {
+        std::string                           result;
+        std::chrono::steady_clock::time_point expiry;
+        bool                                  used = false;
+    };
+
+    using Expiry = std::pair<std::string, std::chrono::steady_clock::time_point>;
+
+    const PrefetchOptions options;
+
+    mutable std::mutex                                           mutex;
+    std::unordered_map<std::string, Entry>                       entries;
+    std::deque<Expiry>                                           order;    // of entries, by expiry
+    std::unordered_map<std::string, std::vector<ResultCallback>> inFlight; // the calls waiting
+    Stats                                                        stats;
+
+    // needs the lock; drops the expired entries, and the oldest ones beyond maxEntries - room
+    void dropEntries(std::chrono::steady_clock::time_point now, std::size_t room);
+
+public:
+    explicit PrefetchEngine(PrefetchOptions Options);
+
+    const PrefetchOptions& getOptions() const { return options; }
+
+    // whether a rule is triggered by the method
+    bool isTrigger(const std::string& method) const;
+    // whether a rule prefetches the method
+    bool isPrefetched(const std::string& method) const;
+
+    // appends the prefetched result of the key to out, and counts a hit; false if it isn't there
+    bool lookup(const std::string& key, std::string& out);
+
+    /**
+     * Calls ready with the prefetched result of the key: at once if it's there (e.g., the prefetch
+     * completed since lookup()), or once the prefetch in flight completes, counting the call as joined;
+     * false, counting a miss, if it's neither there nor in flight
+     */
+    bool wait(const std::string& key, ResultCallback ready);
+
+    /**
+     * The calls to prefetch after a call of the method with the params (a json array, or empty)
+     * returned the result, at the level of that call (0 for the calls of clients); they're counted as
+     * in flight until complete(). Calls already prefetched or in flight, and calls beyond the depth or
+     * the budget are left out
+     */
+    std::vector<Call> plan(const std::string& method,
+                           boost::string_view params,
+                           boost::string_view result,
+                           uint32_t           level);
+
+    // keeps the result of a planned call (null if it failed), and passes it to the calls waiting for it
+    void complete(const Call& call, const std::string* result);
+
+    Stats getStats() const;
+
+    // the result of a successful json-rpc response; false if it's an error, or the result is null
+    static bool FindResult(boost::string_view response, boost::string_view& result);
+};
+
+#endif // PREFETCHENGINE_H
@@ -0,0 +1,87 @@
+#ifndef PERTHREAD_H
+#define PERTHREAD_H
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace PerThreadDetail {
+
+struct Entry
+{
+    uint64_t            owner;
+    std::weak_ptr<void> slot; // expires with its PerThread, to prune the entry
+    void*               raw;
+};
+
+// the entries of the calling thread, of all the PerThread instances it used
+inline std::vector<Entry>& LocalEntries()
+{
+    thread_local std::vector<Entry> entries;
+    return entries;
+}
+
+inline uint64_t NextOwner()
+{
+    static std::atomic<uint64_t> counter{0};
+    return ++counter;
+}
+
+} // namespace PerThreadDetail
+
+/**
+ * One T per thread and per instance, e.g., a buffer that request threads append to without contention
+ * and that a background thread drains. The slot of a thread is created on its first use of the instance
+ * and registered with it, so registration takes a lock once per thread; later uses find it in a short
+ * thread-local list, whichever instances the thread alternates between. Slots live as long as the
+ * instance, and the entries of destroyed instances are pruned from the lists of the threads.
+ */
+template <typename T>
+class PerThread
+{
+    const uint64_t                  owner;
+    mutable std::mutex              mtx; // only for registration and snapshots
+    std::vector<std::shared_ptr<T>> slots;
+
+public:
+    PerThread() : owner(PerThreadDetail::NextOwner()) {}
+
+    PerThread(const PerThread&) = delete;
+    PerThread& operator=(const PerThread&) = delete;
+
+    // the slot of the calling thread, created with make() on its first use
+    template <typename Make>
+    T& local(Make make)
+    {
+        std::vector<PerThreadDetail::Entry>& entries = PerThreadDetail::LocalEntries();
+        for (const PerThreadDetail::Entry& entry : entries) {
+            if (entry.owner == owner) {
+                return *static_cast<T*>(entry.raw);
+            }
+        }
+
+        std::shared_ptr<T> slot = make();
+        {
+            std::lock_guard<std::mutex> lg(mtx);
+            slots.push_back(slot);
+        }
+        entries.erase(std::remove_if(entries.begin(),
+                                     entries.end(),
+                                     [](const PerThreadDetail::Entry& e) { return e.slot.expired(); }),
+                      entries.end());
+        entries.push_back(PerThreadDetail::Entry{owner, slot, slot.get()});
+        return *slot;
+    }
+
+    // the slots of all the threads so far
+    std::vector<std::shared_ptr<T>> snapshot() const
+    {
+        std::lock_guard<std::mutex> lg(mtx);
+        return slots;
+    }
+};
+
+#endif // PERTHREAD_H
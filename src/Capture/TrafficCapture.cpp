@@ -0,0 +1,203 @@
+#include "TrafficCapture.h"
+
+#include "Logging/DefaultLogger.h"
+#include <jsoncpp/json/json.h>
+#include <stdexcept>
+
+const char TrafficCapture::MAGIC[8] = {'H', 'R', 'R', 'C', 'A', 'P', '0', '1'};
+
+namespace {
+
+template <typename T>
+void AppendLittleEndian(std::string& out, T value)
+{
+    for (std::size_t i = 0; i < sizeof(T); i++) {
+        out.push_back(static_cast<char>((static_cast<uint64_t>(value) >> (8 * i)) & 0xFF));
+    }
+}
+
+template <typename T>
+T ReadLittleEndian(const char* data)
+{
+    uint64_t result = 0;
+    for (std::size_t i = 0; i < sizeof(T); i++) {
+        result |= static_cast<uint64_t>(static_cast<unsigned char>(data[i])) << (8 * i);
+    }
+    return static_cast<T>(result);
+}
+
+// raw in-memory entry (before the method is extracted): arrivalNs | latencyNs | bodyLength | body
+const std::size_t RAW_HEADER_SIZE = 8 + 8 + 4;
+
+std::string ExtractMethod(const char* body, std::size_t size)
+{
+    Json::Reader reader;
+    Json::Value  root;
+    if (!reader.parse(body, body + size, root, false) || !root.isObject() || !root.isMember("method")) {
+        return std::string();
+    }
+    return root["method"].isString() ? root["method"].asString() : std::string();
+}
+
+} // namespace
+
+TrafficCapture::TrafficCapture(const std::string&        filename,
+                               std::chrono::milliseconds FlushInterval,
+                               std::size_t               MaxBufferedBytesPerThread)
+    : maxBufferedBytesPerThread(MaxBufferedBytesPerThread), flushInterval(FlushInterval)
+{
+    file.open(filename, std::ios::binary | std::ios::app | std::ios::ate);
+    if (!file.is_open()) {
+        throw std::runtime_error("Failed to open capture file: " + filename);
+    }
+    if (file.tellp() == std::streampos(0)) {
+        file.write(MAGIC, sizeof(MAGIC));
+    }
+    flusherThread = std::thread([this] { flusherLoop(); });
+}
+
+TrafficCapture::~TrafficCapture()
+{
+    {
+        std::lock_guard<std::mutex> lg(flusherMutex);
+        stopFlusher = true;
+    }
+    flusherCondition.notify_all();
+    flusherThread.join();
+    flush();
+}
+
+TrafficCapture::ThreadBuffer& TrafficCapture::localBuffer()
+{
+    return buffers.local([] { return std::make_shared<ThreadBuffer>(); });
+}
+
+void TrafficCapture::record(std::chrono::system_clock::time_point arrival,
+                            std::chrono::nanoseconds              latency,
+                            boost::string_view                    body)
+{
+    ThreadBuffer& buffer = localBuffer();
+
+    std::lock_guard<std::mutex> lg(buffer.mtx); // only contended while the flusher swaps buffers
+    if (buffer.active.size() + RAW_HEADER_SIZE + body.size() > maxBufferedBytesPerThread) {
+        recordsDropped++;
+        return;
+    }
+    const uint64_t arrivalNs = static_cast<uint64_t>(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(arrival.time_since_epoch()).count());
+    AppendLittleEndian<uint64_t>(buffer.active, arrivalNs);
+    AppendLittleEndian<uint64_t>(buffer.active, static_cast<uint64_t>(latency.count()));
+    AppendLittleEndian<uint32_t>(buffer.active, static_cast<uint32_t>(body.size()));
+    buffer.active.append(body.data(), body.size());
+}
+
+void TrafficCapture::flusherLoop()
+{
+    std::unique_lock<std::mutex> lock(flusherMutex);
+    while (!stopFlusher) {
+        flusherCondition.wait_for(lock, flushInterval);
+        lock.unlock();
+        flush();
+        lock.lock();
+    }
+}
+
+void TrafficCapture::flush()
+{
+    const std::vector<std::shared_ptr<ThreadBuffer>> buffersCopy = buffers.snapshot();
+
+    std::lock_guard<std::mutex> lg(fileMutex);
+    for (const auto& buffer : buffersCopy) {
+        {
+            std::lock_guard<std::mutex> bufferLock(buffer->mtx);
+            buffer->active.swap(buffer->spare);
+        }
+        writeBuffer(buffer->spare);
+        buffer->spare.clear(); // keeps the capacity for the next swap
+    }
+    file.flush();
+}
+
+void TrafficCapture::writeBuffer(const std::string& raw)
+{
+    std::string out;
+    std::size_t pos = 0;
+    while (pos + RAW_HEADER_SIZE <= raw.size()) {
+        const char*    entry     = raw.data() + pos;
+        const uint64_t arrivalNs = ReadLittleEndian<uint64_t>(entry);
+        const uint64_t latencyNs = ReadLittleEndian<uint64_t>(entry + 8);
+        const uint32_t bodySize  = ReadLittleEndian<uint32_t>(entry + 16);
+        const char*    body      = entry + RAW_HEADER_SIZE;
+
+        std::string method = ExtractMethod(body, bodySize);
+        if (method.size() > UINT16_MAX) {
+            method.clear();
+        }
+
+        out.clear();
+        AppendLittleEndian<uint64_t>(out, arrivalNs);
+        AppendLittleEndian<uint64_t>(out, latencyNs);
+        AppendLittleEndian<uint16_t>(out, static_cast<uint16_t>(method.size()));
+        AppendLittleEndian<uint32_t>(out, bodySize);
+        out.append(method);
+        out.append(body, bodySize);
+        file.write(out.data(), static_cast<std::streamsize>(out.size()));
+
+        recordsWritten++;
+        pos += RAW_HEADER_SIZE + bodySize;
+    }
+    if (!file) {
+        LogWrite("Failed to write to capture file", b_sev::err);
+        file.clear();
+    }
+}
+
+uint64_t TrafficCapture::getRecordsWritten() const { return recordsWritten.load(); }
+
+uint64_t TrafficCapture::getRecordsDropped() const { return recordsDropped.load(); }
+
+CaptureReader::CaptureReader(const std::string& filename) : file(filename, std::ios::binary)
+{
+    if (!file.is_open()) {
+        throw std::runtime_error("Failed to open capture file: " + filename);
+    }
+    char magic[sizeof(TrafficCapture::MAGIC)];
+    if (!file.read(magic, sizeof(magic)) ||
+        !std::equal(std::begin(magic), std::end(magic), std::begin(TrafficCapture::MAGIC))) {
+        throw std::runtime_error("Not a capture file (invalid magic): " + filename);
+    }
+}
+
+bool CaptureReader::next(CaptureRecord& record)
+{
+    char header[8 + 8 + 2 + 4];
+    file.read(header, sizeof(header));
+    if (file.gcount() == 0) {
+        return false;
+    }
+    if (file.gcount() != static_cast<std::streamsize>(sizeof(header))) {
+        throw std::runtime_error("Truncated record header in capture file");
+    }
+    record.arrivalNs          = ReadLittleEndian<uint64_t>(header);
+    record.latencyNs          = ReadLittleEndian<uint64_t>(header + 8);
+    const uint16_t methodSize = ReadLittleEndian<uint16_t>(header + 16);
+    const uint32_t bodySize   = ReadLittleEndian<uint32_t>(header + 18);
+
+    record.method.resize(methodSize);
+    record.body.resize(bodySize);
+    if (!file.read(&record.method[0], methodSize) || !file.read(&record.body[0], bodySize)) {
+        throw std::runtime_error("Truncated record in capture file");
+    }
+    return true;
+}
+
+std::vector<CaptureRecord> CaptureReader::ReadAll(const std::string& filename)
+{
+    CaptureReader              reader(filename);
+    std::vector<CaptureRecord> result;
+    CaptureRecord              record;
+    while (reader.next(record)) {
+        result.push_back(record);
+    }
+    return result;
+}
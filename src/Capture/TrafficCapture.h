@@ -0,0 +1,109 @@
+#ifndef TRAFFICCAPTURE_H
+#define TRAFFICCAPTURE_H
+
+#include "PerThread.h"
+#include <atomic>
+#include <boost/utility/string_view.hpp>
+#include <chrono>
+#include <condition_variable>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+/**
+ * One captured request, as stored in a capture file
+ */
+struct CaptureRecord
+{
+    uint64_t    arrivalNs; // arrival time, nanoseconds since epoch
+    uint64_t    latencyNs; // from the request being read to its response being ready (upstream included)
+    std::string method;
+    std::string body;
+};
+
+/**
+ * Append-only binary log of the requests a relay receives, to be replayed later with relay_replay.
+ *
+ * File layout: the 8-byte magic "HRRCAP01", followed by records of
+ *   uint64 arrivalNs | uint64 latencyNs | uint16 methodLength | uint32 bodyLength | method | body
+ * with all integers in little-endian.
+ *
+ * Recording threads only append raw bytes to a buffer that belongs to their thread; the method name
+ * is extracted and the file is written by a background flusher thread, so the request path never
+ * touches the file nor parses json.
+ */
+class TrafficCapture
+{
+    struct ThreadBuffer
+    {
+        std::mutex  mtx;
+        std::string active; // appended to by the owning thread
+        std::string spare;  // owned by the flusher while writing
+    };
+
+    const std::size_t         maxBufferedBytesPerThread;
+    std::chrono::milliseconds flushInterval;
+
+    PerThread<ThreadBuffer> buffers;
+
+    std::mutex              fileMutex;
+    std::ofstream           file;
+    std::atomic<uint64_t>   recordsWritten{0};
+    std::atomic<uint64_t>   recordsDropped{0};
+    std::mutex              flusherMutex;
+    std::condition_variable flusherCondition;
+    bool                    stopFlusher = false;
+    std::thread             flusherThread;
+
+    ThreadBuffer& localBuffer();
+    void          flusherLoop();
+    void          writeBuffer(const std::string& raw);
+
+public:
+    static const char MAGIC[8];
+
+    /**
+     * @param filename the file to append to; it's created with the magic header if it's empty
+     * @param flushInterval how often the background thread writes buffered records
+     * @param maxBufferedBytesPerThread records that don't fit in a thread's buffer before the next
+     * flush are dropped (and counted) instead of growing the buffer without a limit
+     */
+    explicit TrafficCapture(const std::string&        filename,
+                            std::chrono::milliseconds flushInterval = std::chrono::milliseconds(200),
+                            std::size_t               maxBufferedBytesPerThread = (1 << 23));
+    ~TrafficCapture();
+
+    TrafficCapture(const TrafficCapture&) = delete;
+    TrafficCapture& operator=(const TrafficCapture&) = delete;
+
+    void record(std::chrono::system_clock::time_point arrival,
+                std::chrono::nanoseconds              latency,
+                boost::string_view                    body);
+
+    // writes everything buffered so far to the file
+    void flush();
+
+    uint64_t getRecordsWritten() const;
+    uint64_t getRecordsDropped() const;
+};
+
+/**
+ * Sequential reader of capture files written by TrafficCapture
+ */
+class CaptureReader
+{
+    std::ifstream file;
+
+public:
+    explicit CaptureReader(const std::string& filename);
+
+    // returns false at the end of the file; throws on a truncated or corrupt record
+    bool next(CaptureRecord& record);
+
+    static std::vector<CaptureRecord> ReadAll(const std::string& filename);
+};
+
+#endif // TRAFFICCAPTURE_H
@@ -0,0 +1,300 @@
+#include "AsyncClient.h"
+
+#include <algorithm>
+
+namespace beast = boost::beast;
+namespace http  = beast::http;
+namespace net   = boost::asio;
+using tcp       = boost::asio::ip::tcp;
+
+class AsyncClient::Connection : public std::enable_shared_from_this<AsyncClient::Connection>
+{
+    std::weak_ptr<AsyncClient> client;
+    beast::tcp_stream          stream;
+    tcp::resolver              resolver;
+    beast::flat_buffer         buffer;
+    Response                   res;
+    std::string                host;
+    std::string                port;
+
+    PendingRequest pending;
+    uint64_t       stepStartNs = 0;
+    bool           connected   = false;
+    bool           reused      = false; // the current request was sent on an already open connection
+    bool           retried     = false; // the current request is being retried on a new connection
+    bool           stopped     = false;
+
+    // closes the current step of the trace under the given name, and starts the next one
+    void traceStep(const char* name)
+    {
+        if (pending.trace) {
+            const uint64_t now = RequestTrace::Now();
+            pending.trace->addSpan(name, stepStartNs, now);
+            stepStartNs = now;
+        }
+    }
+
+    void begin()
+    {
+        if (std::chrono::steady_clock::now() >= pending.deadline) {
+            return finish(beast::error::timeout);
+        }
+        stream.expires_at(pending.deadline);
+        if (connected) {
+            reused = true;
+            return write();
+        }
+        reused = false;
+        resolver.async_resolve(
+            host, port, beast::bind_front_handler(&Connection::on_resolve, shared_from_this()));
+    }
+
+    void on_resolve(beast::error_code ec, tcp::resolver::results_type results)
+    {
+        if (ec) {
+            return finish(ec);
+        }
+        stream.expires_at(pending.deadline);
+        stream.async_connect(results,
+                             beast::bind_front_handler(&Connection::on_connect, shared_from_this()));
+    }
+
+    void on_connect(beast::error_code ec, tcp::resolver::results_type::endpoint_type)
+    {
+        traceStep("upstream connect");
+        if (ec) {
+            return finish(ec);
+        }
+        connected = true;
+        write();
+    }
+
+    void write()
+    {
+        http::async_write(stream,
+                          pending.request,
+                          beast::bind_front_handler(&Connection::on_write, shared_from_this()));
+    }
+
+    void on_write(beast::error_code ec, std::size_t)
+    {
+        traceStep("upstream write");
+        if (ec) {
+            return fail(ec);
+        }
+        res = {};
+        http::async_read(
+            stream, buffer, res, beast::bind_front_handler(&Connection::on_read, shared_from_this()));
+    }
+
+    void on_read(beast::error_code ec, std::size_t)
+    {
+        traceStep("upstream read");
+        if (ec) {
+            return fail(ec);
+        }
+        if (!res.keep_alive()) {
+            close();
+        }
+        finish(beast::error_code());
+    }
+
+    void fail(beast::error_code ec)
+    {
+        close();
+        if (reused && !retried && !stopped && ec != beast::error::timeout) {
+            // the server may have closed the idle connection; try once more on a new one
+            retried = true;
+            return begin();
+        }
+        finish(ec);
+    }
+
+    void finish(beast::error_code ec)
+    {
+        if (ec) {
+            close();
+        }
+        Callback done     = std::move(pending.done);
+        Response response = ec ? Response() : std::move(res);
+        pending           = PendingRequest();
+
+        // the connection is free before the callback runs, so that the callback can reuse it
+        std::shared_ptr<AsyncClient> owner = client.lock();
+        if (owner) {
+            owner->release(shared_from_this(), connected && !stopped);
+        }
+        done(ec, std::move(response));
+    }
+
+    void close()
+    {
+        beast::error_code ec;
+        stream.socket().shutdown(tcp::socket::shutdown_both, ec);
+        stream.socket().close(ec);
+        buffer.consume(buffer.size());
+        connected = false;
+    }
+
+public:
+    Connection(net::io_context&           ioc,
+               std::weak_ptr<AsyncClient> Client,
+               std::string                Host,
+               std::string                Port)
+        : client(std::move(Client)), stream(net::make_strand(ioc)), resolver(stream.get_executor()),
+          host(std::move(Host)), port(std::move(Port))
+    {
+    }
+
+    void start(PendingRequest&& request)
+    {
+        auto self = shared_from_this();
+        auto sp   = std::make_shared<PendingRequest>(std::move(request));
+        // posted, so that a callback that sends the next request returns before it starts
+        net::post(stream.get_executor(), [self, sp]() {
+            self->pending     = std::move(*sp);
+            self->retried     = false;
+            self->stepStartNs = self->pending.queuedNs;
+            self->traceStep("upstream pool wait");
+            if (self->stopped) {
+                return self->finish(net::error::operation_aborted);
+            }
+            self->begin();
+        });
+    }
+
+    void stop()
+    {
+        auto self = shared_from_this();
+        net::dispatch(stream.get_executor(), [self]() {
+            self->stopped = true;
+            self->resolver.cancel();
+            self->close();
+        });
+    }
+};
+
+AsyncClient::AsyncClient(net::io_context&   Ioc,
+                         std::string        Host,
+                         std::string        Port,
+                         AsyncClientOptions Options)
+    : ioc(Ioc), host(std::move(Host)), port(std::move(Port)), options(std::move(Options))
+{
+}
+
+AsyncClient::~AsyncClient() { stop(); }
+
+std::shared_ptr<AsyncClient::Connection> AsyncClient::openConnection()
+{
+    auto connection =
+        std::make_shared<Connection>(ioc, std::weak_ptr<AsyncClient>(shared_from_this()), host, port);
+    connections.push_back(connection);
+    connectionsOpened++;
+    return connection;
+}
+
+void AsyncClient::send(Request                   request,
+                       Callback                  done,
+                       std::chrono::milliseconds timeout,
+                       RequestTrace*             trace)
+{
+    PendingRequest pending;
+    if (request[http::field::host].empty()) {
+        request.set(http::field::host, host);
+    }
+    request.keep_alive(true);
+    request.prepare_payload();
+    pending.request  = std::move(request);
+    pending.done     = std::move(done);
+    pending.deadline = std::chrono::steady_clock::now() +
+                       (timeout > std::chrono::milliseconds::zero() ? timeout : options.requestTimeout);
+    pending.trace    = trace;
+    pending.queuedNs = trace ? RequestTrace::Now() : 0;
+
+    std::shared_ptr<Connection> connection;
+    beast::error_code           ec;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (stopped) {
+            ec = net::error::operation_aborted;
+        } else if (!idle.empty()) {
+            connection = std::move(idle.back());
+            idle.pop_back();
+        } else if (connections.size() < std::max<std::size_t>(options.maxConnections, 1)) {
+            connection = openConnection();
+        } else if (options.maxQueueLength > 0 && queue.size() >= options.maxQueueLength) {
+            ec = boost::system::errc::make_error_code(
+                boost::system::errc::resource_unavailable_try_again);
+        } else {
+            queue.push_back(std::move(pending));
+            return;
+        }
+    }
+    if (ec) {
+        return pending.done(ec, Response());
+    }
+    connection->start(std::move(pending));
+}
+
+void AsyncClient::release(const std::shared_ptr<Connection>& connection, bool keep)
+{
+    std::shared_ptr<Connection> next;
+    PendingRequest              pending;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!keep || stopped) {
+            connections.erase(std::remove(connections.begin(), connections.end(), connection),
+                              connections.end());
+        }
+        if (stopped) {
+            return;
+        }
+        if (queue.empty()) {
+            if (keep) {
+                idle.push_back(connection);
+            }
+            return;
+        }
+        pending = std::move(queue.front());
+        queue.pop_front();
+        next = keep ? connection : openConnection();
+    }
+    next->start(std::move(pending));
+}
+
+void AsyncClient::stop()
+{
+    std::vector<std::shared_ptr<Connection>> open;
+    std::deque<PendingRequest>               waiting;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopped = true;
+        open.swap(connections);
+        waiting.swap(queue);
+        idle.clear();
+    }
+    for (auto& c : open) {
+        c->stop();
+    }
+    for (PendingRequest& p : waiting) {
+        p.done(net::error::operation_aborted, Response());
+    }
+}
+
+std::size_t AsyncClient::getOpenConnectionCount()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return connections.size();
+}
+
+std::size_t AsyncClient::getIdleConnectionCount()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return idle.size();
+}
+
+std::size_t AsyncClient::getQueueLength()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return queue.size();
+}
@@ -0,0 +1,125 @@
+#ifndef ASYNCCLIENT_H
+#define ASYNCCLIENT_H
+
+#include <atomic>
+#include <boost/asio.hpp>
+#include <boost/beast.hpp>
+#include <chrono>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "Tracing/RequestTracer.h"
+
+struct AsyncClientOptions
+{
+    // connections open at once; requests beyond this wait for a connection to be free
+    std::size_t maxConnections = 16;
+    // requests waiting for a connection; beyond this, requests fail at once (0 is unlimited)
+    std::size_t maxQueueLength = 0;
+    // from the call to the response, including the wait for a connection
+    std::chrono::milliseconds requestTimeout{30000};
+};
+
+/**
+ * An http client for many requests in flight to one host, over a pool of keep-alive connections: a
+ * request takes the most recently used idle connection, or opens a new one while there are less than
+ * maxConnections, or waits for one to be free. Every connection sends one request at a time. A request
+ * that fails on a reused connection is retried once on a new one, as the server may have closed it
+ * while it was idle.
+ *
+ * Results come through a callback (send()) or any asio completion token (asyncSend()), e.g.,
+ * boost::asio::use_future or a yield_context. Callbacks run on the threads of the io_context.
+ *
+ * Must be owned by a std::shared_ptr; it's thread-safe.
+ */
+class AsyncClient : public std::enable_shared_from_this<AsyncClient>
+{
+public:
+    using Request  = boost::beast::http::request<boost::beast::http::string_body>;
+    using Response = boost::beast::http::response<boost::beast::http::string_body>;
+    // called with either an error or the response
+    using Callback = std::function<void(boost::beast::error_code, Response&&)>;
+
+private:
+    struct PendingRequest
+    {
+        Request                               request;
+        Callback                              done;
+        std::chrono::steady_clock::time_point deadline;
+        RequestTrace*                         trace    = nullptr;
+        uint64_t                              queuedNs = 0;
+    };
+
+    class Connection;
+
+    boost::asio::io_context& ioc;
+    const std::string        host;
+    const std::string        port;
+    const AsyncClientOptions options;
+
+    std::mutex                               mutex;
+    std::vector<std::shared_ptr<Connection>> connections; // all open ones
+    std::vector<std::shared_ptr<Connection>> idle;        // the most recently used last
+    std::deque<PendingRequest>               queue;
+    bool                                     stopped = false;
+    std::atomic<uint64_t>                    connectionsOpened{0};
+
+    // needs the lock
+    std::shared_ptr<Connection> openConnection();
+    // called by a connection once its request completed; keep is false if the connection is closed
+    void release(const std::shared_ptr<Connection>& connection, bool keep);
+
+public:
+    AsyncClient(boost::asio::io_context& Ioc,
+                std::string              Host,
+                std::string              Port,
+                AsyncClientOptions       Options = AsyncClientOptions());
+    ~AsyncClient();
+
+    AsyncClient(const AsyncClient&) = delete;
+    AsyncClient& operator=(const AsyncClient&) = delete;
+
+    /**
+     * Sends the request, and calls done with the response or an error (beast::error::timeout once the
+     * timeout, or the requestTimeout of the options if it's zero, has passed). The steps of the request
+     * are added to the trace, if any, which must outlive the request.
+     */
+    void send(Request                   request,
+              Callback                  done,
+              std::chrono::milliseconds timeout = std::chrono::milliseconds::zero(),
+              RequestTrace*             trace   = nullptr);
+
+    // send() with an asio completion token; the handler runs on its associated executor
+    template <typename CompletionToken>
+    BOOST_ASIO_INITFN_RESULT_TYPE(CompletionToken, void(boost::beast::error_code, Response))
+    asyncSend(Request request, CompletionToken&& token)
+    {
+        return boost::asio::async_initiate<CompletionToken, void(boost::beast::error_code, Response)>(
+            [this](auto handler, Request req) {
+                using Handler = decltype(handler);
+                auto h        = std::make_shared<Handler>(std::move(handler));
+                auto executor = boost::asio::get_associated_executor(*h, ioc.get_executor());
+                send(std::move(req), [h, executor](boost::beast::error_code ec, Response&& res) {
+                    auto r = std::make_shared<Response>(std::move(res));
+                    boost::asio::dispatch(executor, [h, ec, r]() { (*h)(ec, std::move(*r)); });
+                });
+            },
+            token,
+            std::move(request));
+    }
+
+    // closes all connections; requests in flight and queued requests fail with operation_aborted
+    void stop();
+
+    std::size_t getOpenConnectionCount();
+    std::size_t getIdleConnectionCount();
+    std::size_t getQueueLength();
+    // connections opened over the lifetime of the client
+    uint64_t getConnectionsOpened() const { return connectionsOpened.load(); }
+};
+
+#endif // ASYNCCLIENT_H
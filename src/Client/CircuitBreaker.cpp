@@ -0,0 +1,76 @@
+#include "CircuitBreaker.h"
+
+CircuitBreaker::CircuitBreaker(CircuitBreakerOptions Options) : options(Options) {}
+
+int64_t CircuitBreaker::Now()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+}
+
+void CircuitBreaker::open()
+{
+    openUntilNs =
+        Now() + std::chrono::duration_cast<std::chrono::nanoseconds>(options.openDuration).count();
+    state = static_cast<int>(State::Open);
+}
+
+bool CircuitBreaker::allowRequest()
+{
+    int current = state.load(std::memory_order_relaxed);
+    if (current == static_cast<int>(State::Closed)) {
+        return true;
+    }
+    if (current == static_cast<int>(State::Open)) {
+        if (Now() < openUntilNs.load(std::memory_order_relaxed)) {
+            return false;
+        }
+        // the first request after the open period switches to half-open
+        if (state.compare_exchange_strong(current, static_cast<int>(State::HalfOpen))) {
+            trials = 0;
+        }
+    }
+    if (state.load() != static_cast<int>(State::HalfOpen)) {
+        return state.load() == static_cast<int>(State::Closed);
+    }
+    return trials.fetch_add(1) < options.halfOpenTrials;
+}
+
+void CircuitBreaker::recordSuccess()
+{
+    int current = state.load();
+    if (current == static_cast<int>(State::Closed)) {
+        consecutiveFailures = 0;
+        return;
+    }
+    // a late success of a request sent before the breaker opened doesn't close it; only a trial does
+    if (current == static_cast<int>(State::HalfOpen) &&
+        state.compare_exchange_strong(current, static_cast<int>(State::Closed))) {
+        consecutiveFailures = 0;
+    }
+}
+
+void CircuitBreaker::recordFailure()
+{
+    const uint32_t failures = ++consecutiveFailures;
+    const int      current  = state.load();
+    if (current == static_cast<int>(State::HalfOpen) ||
+        (current == static_cast<int>(State::Closed) && failures >= options.failureThreshold)) {
+        open();
+    }
+}
+
+void CircuitBreaker::recordProbe(bool healthy)
+{
+    if (!healthy) {
+        consecutiveFailures = options.failureThreshold;
+        open();
+        return;
+    }
+    // let trial traffic through right away instead of waiting for the open period to pass
+    int expected = static_cast<int>(State::Open);
+    if (state.compare_exchange_strong(expected, static_cast<int>(State::HalfOpen))) {
+        trials = 0;
+    }
+}
@@ -0,0 +1,65 @@
+#ifndef CIRCUITBREAKER_H
+#define CIRCUITBREAKER_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+struct CircuitBreakerOptions
+{
+    // consecutive failures that open the breaker
+    uint32_t failureThreshold = 5;
+    // how long an open breaker rejects requests before it lets trial requests through
+    std::chrono::milliseconds openDuration{2000};
+    // requests that may be in flight to test the upstream while half-open
+    uint32_t halfOpenTrials = 1;
+};
+
+/**
+ * Tracks the health of one upstream from the outcome of real requests and of health probes, and
+ * decides whether requests may be sent to it:
+ *
+ * - closed: all requests pass; failureThreshold consecutive failures (or a failed probe) open it;
+ * - open: requests fail fast, until openDuration passes or a probe succeeds; successes of requests
+ *   sent before it opened are ignored;
+ * - half-open: only halfOpenTrials requests pass; a success closes the breaker, a failure opens it.
+ *
+ * All members are lock-free, since allowRequest() is called for every request.
+ */
+class CircuitBreaker
+{
+public:
+    enum class State : int
+    {
+        Closed,
+        Open,
+        HalfOpen
+    };
+
+private:
+    const CircuitBreakerOptions options;
+
+    std::atomic<int>      state{static_cast<int>(State::Closed)};
+    std::atomic<uint32_t> consecutiveFailures{0};
+    std::atomic<uint32_t> trials{0};
+    std::atomic<int64_t>  openUntilNs{0};
+
+    static int64_t Now();
+    void           open();
+
+public:
+    explicit CircuitBreaker(CircuitBreakerOptions Options = CircuitBreakerOptions());
+
+    // whether a request may be sent now; in half-open state, this takes one of the trials
+    bool allowRequest();
+
+    void recordSuccess();
+    void recordFailure();
+
+    // the result of an active health check
+    void recordProbe(bool healthy);
+
+    State getState() const { return static_cast<State>(state.load()); }
+};
+
+#endif // CIRCUITBREAKER_H
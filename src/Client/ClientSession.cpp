@@ -7,6 +7,11 @@ ClientSession::ClientSession(boost::asio::io_context& ioc)
 {
 }
 
+ClientSession::ClientSession(const beast::tcp_stream::executor_type& executor)
+    : resolver_(executor), stream_(executor)
+{
+}
+
 void ClientSession::run(http::verb                                verb,
                         const std::string&                        host,
                         const std::string&                        port,
@@ -28,9 +33,7 @@ void ClientSession::run(http::verb                                verb,
         req_.insert(f.first, f.second);
     }
 
-    // Look up the domain name
-    resolver_.async_resolve(
-        host, port, beast::bind_front_handler(&ClientSession::on_resolve, shared_from_this()));
+    start_resolve(host, port);
 }
 
 void ClientSession::run(const std::string&                             host,
@@ -39,16 +42,61 @@ void ClientSession::run(const std::string&                             host,
 {
     req_ = std::move(request);
 
-    resolver_.async_resolve(
-        host, port, beast::bind_front_handler(&ClientSession::on_resolve, shared_from_this()));
+    start_resolve(host, port);
+}
+
+void ClientSession::setTrace(RequestTrace* trace) { trace_ = trace; }
+
+void ClientSession::setCompletionHandler(CompletionHandler handler)
+{
+    completionHandler_ = std::move(handler);
+}
+
+void ClientSession::fail(beast::error_code ec)
+{
+    if (completionHandler_) {
+        completionHandler_(ec, http::response<http::string_body>());
+    } else {
+        finished_promise.set_exception(std::make_exception_ptr(boost::system::system_error(ec)));
+    }
+}
+
+void ClientSession::trace_step(const char* name)
+{
+    if (trace_) {
+        const uint64_t now = RequestTrace::Now();
+        trace_->addSpan(name, stepStartNs_, now);
+        stepStartNs_ = now;
+    }
+}
+
+void ClientSession::start_resolve(const std::string& host, const std::string& port)
+{
+    if (!trace_) {
+        // Look up the domain name
+        resolver_.async_resolve(
+            host, port, beast::bind_front_handler(&ClientSession::on_resolve, shared_from_this()));
+        return;
+    }
+
+    // when tracing, go through the session's executor first to measure how long the request waits for
+    // a client thread
+    stepStartNs_ = RequestTrace::Now();
+    auto self    = shared_from_this();
+    net::post(stream_.get_executor(), [self, host, port]() {
+        self->trace_step("queue wait");
+        self->resolver_.async_resolve(
+            host, port, beast::bind_front_handler(&ClientSession::on_resolve, self));
+    });
 }
 
 void ClientSession::on_resolve(beast::error_code ec, tcp::resolver::results_type results)
 {
+    trace_step("upstream resolve");
+
     if (ec) {
         LogWrite("Failed to resolve: " + ec.message(), b_sev::err);
-        finished_promise.set_exception(std::make_exception_ptr(boost::system::system_error(ec)));
-        return;
+        return fail(ec);
     }
 
     // Set a timeout on the operation
@@ -61,10 +109,11 @@ void ClientSession::on_resolve(beast::error_code ec, tcp::resolver::results_type
 
 void ClientSession::on_connect(beast::error_code ec, tcp::resolver::results_type::endpoint_type)
 {
+    trace_step("upstream connect");
+
     if (ec) {
         LogWrite("Failed to connect: " + ec.message(), b_sev::err);
-        finished_promise.set_exception(std::make_exception_ptr(boost::system::system_error(ec)));
-        return;
+        return fail(ec);
     }
 
     // Set a timeout on the operation
@@ -79,10 +128,11 @@ void ClientSession::on_write(beast::error_code ec, std::size_t bytes_transferred
 {
     boost::ignore_unused(bytes_transferred);
 
+    trace_step("upstream write");
+
     if (ec) {
         LogWrite("Failed to write: " + ec.message(), b_sev::err);
-        finished_promise.set_exception(std::make_exception_ptr(boost::system::system_error(ec)));
-        return;
+        return fail(ec);
     }
 
     // Receive the HTTP response
@@ -94,10 +144,11 @@ void ClientSession::on_read(beast::error_code ec, std::size_t bytes_transferred)
 {
     boost::ignore_unused(bytes_transferred);
 
+    trace_step("upstream read");
+
     if (ec) {
         LogWrite("Failed to read: " + ec.message(), b_sev::err);
-        finished_promise.set_exception(std::make_exception_ptr(boost::system::system_error(ec)));
-        return;
+        return fail(ec);
     }
 
     // Gracefully close the socket
@@ -106,12 +157,15 @@ void ClientSession::on_read(beast::error_code ec, std::size_t bytes_transferred)
     // not_connected happens sometimes so don't bother reporting it.
     if (ec && ec != beast::errc::not_connected) {
         LogWrite("Failed to shutdown: " + ec.message(), b_sev::err);
-        finished_promise.set_exception(std::make_exception_ptr(boost::system::system_error(ec)));
-        return;
+        return fail(ec);
     }
 
-    finished_promise.set_value(res_);
     // If we get here then the connection is closed gracefully
+    if (completionHandler_) {
+        completionHandler_(beast::error_code(), std::move(res_));
+    } else {
+        finished_promise.set_value(res_);
+    }
 }
 
 std::future<http::response<http::string_body>> ClientSession::getResponse()
@@ -5,6 +5,8 @@
 #include <boost/beast.hpp>
 #include <iostream>
 
+#include "Tracing/RequestTracer.h"
+
 namespace beast = boost::beast;         // from <boost/beast.hpp>
 namespace http  = beast::http;          // from <boost/beast/http.hpp>
 namespace net   = boost::asio;          // from <boost/asio.hpp>
@@ -12,18 +14,38 @@ using tcp       = boost::asio::ip::tcp; // from <boost/asio/ip/tcp.hpp>
 
 class ClientSession : public std::enable_shared_from_this<ClientSession>
 {
+public:
+    // called on the session's executor with either an error or the response
+    using CompletionHandler =
+        std::function<void(beast::error_code, http::response<http::string_body>&&)>;
+
+private:
     tcp::resolver                                   resolver_;
     beast::tcp_stream                               stream_;
     beast::flat_buffer                              buffer_; // (Must persist between reads)
     http::request<http::string_body>                req_;
     http::response<http::string_body>               res_;
     std::promise<http::response<http::string_body>> finished_promise;
+    CompletionHandler                               completionHandler_;
+
+    // optional timeline of the relayed request this session belongs to (not owned)
+    RequestTrace* trace_       = nullptr;
+    uint64_t      stepStartNs_ = 0;
+
+    void start_resolve(const std::string& host, const std::string& port);
+    // closes the current step of the trace under the given name, and starts the next one
+    void trace_step(const char* name);
+    void fail(beast::error_code ec);
 
 public:
     // Objects are constructed with a strand to
     // ensure that handlers do not execute concurrently.
     explicit ClientSession(net::io_context& ioc);
 
+    // Runs all operations on the given executor (e.g., the strand of the server session that relays
+    // the request), so that no thread switch is needed between the two sessions
+    explicit ClientSession(const beast::tcp_stream::executor_type& executor);
+
     // Start the asynchronous operation
     void run(boost::beast::http::verb verb, const std::string& host, const std::string& port, const std::string& target,
              const std::string& body, int version,
@@ -33,6 +55,18 @@ public:
     void run(const std::string& host, const std::string& port,
              boost::beast::http::request<boost::beast::http::string_body> request);
 
+    /**
+     * Record the steps of this session in the given trace, which must outlive the session's operation.
+     * Must be called before run().
+     */
+    void setTrace(RequestTrace* trace);
+
+    /**
+     * Receive the result through the handler instead of the future of getResponse().
+     * Must be called before run().
+     */
+    void setCompletionHandler(CompletionHandler handler);
+
     void on_resolve(beast::error_code ec, tcp::resolver::results_type results);
 
     void on_connect(beast::error_code ec, tcp::resolver::results_type::endpoint_type);
@@ -3,6 +3,7 @@
 
 #include "ClientSession.h"
 
+// a single request on a thread of its own; see AsyncClient for many requests over pooled connections
 class EasyClient
 {
     std::unique_ptr<net::io_context> ioc;
@@ -0,0 +1,93 @@
+#ifndef FAIRQUEUE_H
+#define FAIRQUEUE_H
+
+#include <cstddef>
+#include <deque>
+#include <iterator>
+#include <list>
+#include <string>
+#include <unordered_map>
+
+/**
+ * A queue with one FIFO per flow (e.g., per client), dequeued round robin over the flows that have
+ * items: a flow with many items waiting gets one item out per round, like any other flow, so it can't
+ * starve the others. This is deficit round robin with equal costs. push() and pop() are O(1).
+ *
+ * A flow that runs empty is kept (up to maxIdleFlows of them, the least recently used ones dropped
+ * first), so the items of a client that comes back reuse its key, its map and list nodes and the
+ * buffer of its FIFO instead of allocating them again.
+ *
+ * Not thread-safe.
+ */
+template <typename T>
+class FairQueue
+{
+    struct Flow
+    {
+        std::deque<T>                    items;
+        std::list<std::string>::iterator position; // in rotation while it has items, else in idle
+    };
+
+    std::unordered_map<std::string, Flow> flows;
+    std::list<std::string>                rotation; // keys of the flows with items, next one first
+    std::list<std::string>                idle;     // keys of the empty flows, least recently used first
+    std::size_t                           count = 0;
+    const std::size_t                     maxIdleFlows;
+
+public:
+    explicit FairQueue(std::size_t MaxIdleFlows = 256) : maxIdleFlows(MaxIdleFlows) {}
+
+    // false if the flow already has maxPerFlow items (0 is unlimited); the item is dropped then
+    bool push(const std::string& flow, T item, std::size_t maxPerFlow = 0)
+    {
+        auto it = flows.find(flow);
+        if (it == flows.end()) {
+            rotation.push_back(flow);
+            it = flows.emplace(flow, Flow{std::deque<T>(), std::prev(rotation.end())}).first;
+        } else if (it->second.items.empty()) {
+            rotation.splice(rotation.end(), idle, it->second.position);
+        } else if (maxPerFlow > 0 && it->second.items.size() >= maxPerFlow) {
+            return false;
+        }
+        it->second.items.push_back(std::move(item));
+        count++;
+        return true;
+    }
+
+    // the first item of the next flow; the queue must not be empty
+    T pop()
+    {
+        auto it   = flows.find(rotation.front());
+        T    item = std::move(it->second.items.front());
+        it->second.items.pop_front();
+        count--;
+        if (it->second.items.empty()) {
+            idle.splice(idle.end(), rotation, rotation.begin());
+            if (idle.size() > maxIdleFlows) {
+                flows.erase(idle.front());
+                idle.pop_front();
+            }
+        } else {
+            // the flow goes to the end of the round
+            rotation.splice(rotation.end(), rotation, rotation.begin());
+        }
+        return item;
+    }
+
+    bool        empty() const { return count == 0; }
+    std::size_t size() const { return count; }
+    // the flows that have items
+    std::size_t getFlowCount() const { return rotation.size(); }
+    // the empty flows kept for reuse
+    std::size_t getIdleFlowCount() const { return idle.size(); }
+
+    void clear()
+    {
+        flows.clear();
+        rotation.clear();
+        idle.clear();
+        count = 0;
+    }
+};
+
+#endif // FAIRQUEUE_H
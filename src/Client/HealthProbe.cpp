@@ -0,0 +1,157 @@
+#include "HealthProbe.h"
+
+#include "Filters/JsonRpcScanner.h"
+
+namespace beast = boost::beast;
+namespace http  = beast::http;
+namespace net   = boost::asio;
+using tcp       = boost::asio::ip::tcp;
+
+namespace {
+
+bool IsSuccessfulCall(const http::response<http::string_body>& res)
+{
+    if (res.result() != http::status::ok) {
+        return false;
+    }
+    JsonSpan error;
+    if (!JsonRpcScanner::FindMember(res.body(), "error", error)) {
+        // a result without an error member is fine, as long as there's a result
+        return JsonRpcScanner::FindMember(res.body(), "result", error);
+    }
+    return res.body().compare(error.offset, error.size, "null") == 0;
+}
+
+// the connection of one probe; done is called once, with whether the upstream is healthy
+class ProbeSession : public std::enable_shared_from_this<ProbeSession>
+{
+    beast::tcp_stream                       stream;
+    tcp::resolver                           resolver;
+    beast::flat_buffer                      buffer;
+    const http::request<http::string_body>* request; // null to only connect
+    http::response<http::string_body>       res;
+    std::function<void(bool)>               done;
+
+    void finish(bool healthy)
+    {
+        beast::error_code ec;
+        stream.socket().close(ec);
+        done(healthy);
+    }
+
+    void on_resolve(beast::error_code ec, tcp::resolver::results_type results)
+    {
+        if (ec) {
+            return finish(false);
+        }
+        stream.async_connect(results,
+                             beast::bind_front_handler(&ProbeSession::on_connect, shared_from_this()));
+    }
+
+    void on_connect(beast::error_code ec, tcp::resolver::results_type::endpoint_type)
+    {
+        if (ec || !request) {
+            return finish(!ec);
+        }
+        http::async_write(
+            stream, *request, beast::bind_front_handler(&ProbeSession::on_write, shared_from_this()));
+    }
+
+    void on_write(beast::error_code ec, std::size_t)
+    {
+        if (ec) {
+            return finish(false);
+        }
+        http::async_read(
+            stream, buffer, res, beast::bind_front_handler(&ProbeSession::on_read, shared_from_this()));
+    }
+
+    void on_read(beast::error_code ec, std::size_t) { finish(!ec && IsSuccessfulCall(res)); }
+
+public:
+    ProbeSession(net::io_context&                        ioc,
+                 const http::request<http::string_body>* Request,
+                 std::function<void(bool)>               Done)
+        : stream(net::make_strand(ioc)), resolver(stream.get_executor()), request(Request),
+          done(std::move(Done))
+    {
+    }
+
+    void run(const std::string& host, const std::string& port, std::chrono::milliseconds timeout)
+    {
+        stream.expires_after(timeout);
+        resolver.async_resolve(
+            host, port, beast::bind_front_handler(&ProbeSession::on_resolve, shared_from_this()));
+    }
+};
+
+} // namespace
+
+HealthProbe::HealthProbe(net::io_context&                Ioc,
+                         std::string                     Host,
+                         std::string                     Port,
+                         HealthCheckOptions              Options,
+                         std::shared_ptr<CircuitBreaker> Breaker)
+    : ioc(Ioc), timer(net::make_strand(Ioc)), host(std::move(Host)), port(std::move(Port)),
+      options(std::move(Options)), breaker(std::move(Breaker))
+{
+    if (!options.method.empty()) {
+        request = {http::verb::post, "/", 11};
+        request.set(http::field::host, host);
+        request.set(http::field::content_type, "application/json");
+        if (!options.authorization.empty()) {
+            request.set(http::field::authorization, options.authorization);
+        }
+        request.body() =
+            R"({"jsonrpc":"2.0","method":")" + options.method + R"(","params":[],"id":"health"})";
+        request.prepare_payload();
+    }
+}
+
+void HealthProbe::run()
+{
+    auto self = shared_from_this();
+    net::dispatch(timer.get_executor(), [self]() { self->probe(); });
+}
+
+void HealthProbe::stop()
+{
+    stopped   = true;
+    auto self = shared_from_this();
+    net::dispatch(timer.get_executor(), [self]() { self->timer.cancel(); });
+}
+
+void HealthProbe::schedule()
+{
+    if (stopped) {
+        return;
+    }
+    auto self = shared_from_this();
+    timer.expires_after(options.interval);
+    timer.async_wait([self](boost::system::error_code ec) {
+        if (!ec) {
+            self->probe();
+        }
+    });
+}
+
+void HealthProbe::probe()
+{
+    if (stopped) {
+        return;
+    }
+
+    // the request is a member, and the probe outlives the session through the callback
+    auto self    = shared_from_this();
+    auto session = std::make_shared<ProbeSession>(
+        ioc, options.method.empty() ? nullptr : &request, [self](bool healthy) {
+            net::dispatch(self->timer.get_executor(), [self, healthy]() {
+                if (self->stopped) {
+                    return;
+                }
+                self->breaker->recordProbe(healthy);
+                self->schedule();
+            });
+        });
+    session->run(host, port, options.timeout);
+}
@@ -0,0 +1,56 @@
+#ifndef HEALTHPROBE_H
+#define HEALTHPROBE_H
+
+#include "CircuitBreaker.h"
+#include <boost/asio.hpp>
+#include <boost/beast.hpp>
+#include <memory>
+#include <string>
+
+struct HealthCheckOptions
+{
+    // time between two probes of an upstream
+    std::chrono::milliseconds interval{1000};
+    // a probe that takes longer fails
+    std::chrono::milliseconds timeout{500};
+    // a json-rpc method (without params) that must succeed, e.g., getblockchaininfo; with none, a probe
+    // only connects
+    std::string method;
+    // the Authorization header of the probe call, if the upstream needs one
+    std::string authorization;
+
+    CircuitBreakerOptions breaker;
+};
+
+/**
+ * Periodically checks that an upstream accepts connections (and answers a json-rpc call, if one is
+ * configured), and reports the results to the breaker of the upstream
+ */
+class HealthProbe : public std::enable_shared_from_this<HealthProbe>
+{
+    boost::asio::io_context&                                     ioc;
+    boost::asio::steady_timer                                    timer;
+    std::string                                                  host;
+    std::string                                                  port;
+    HealthCheckOptions                                           options;
+    std::shared_ptr<CircuitBreaker>                              breaker;
+    boost::beast::http::request<boost::beast::http::string_body> request;
+    std::atomic<bool>                                            stopped{false};
+
+    void schedule();
+    void probe();
+
+public:
+    HealthProbe(boost::asio::io_context&        Ioc,
+                std::string                     Host,
+                std::string                     Port,
+                HealthCheckOptions              Options,
+                std::shared_ptr<CircuitBreaker> Breaker);
+
+    // probes right away, then every interval
+    void run();
+
+    void stop();
+};
+
+#endif // HEALTHPROBE_H
@@ -0,0 +1,84 @@
+#include "LongPollCollapser.h"
+
+#include "Cache/ImmutableResultCache.h"
+#include "Filters/JsonRpcScanner.h"
+#include <algorithm>
+#include <boost/algorithm/string.hpp>
+#include <stdexcept>
+
+std::set<std::string> LongPollCollapser::ParseMethods(const std::string& text)
+{
+    std::set<std::string> methods;
+
+    std::vector<std::string> entries;
+    boost::split(entries, text, boost::is_any_of(","));
+    for (std::string& entry : entries) {
+        boost::trim(entry);
+        if (entry.empty()) {
+            throw std::runtime_error("Invalid long-poll methods (empty method): " + text);
+        }
+        methods.insert(entry);
+    }
+    return methods;
+}
+
+std::string LongPollCollapser::MakeKey(boost::string_view method,
+                                       boost::string_view params,
+                                       boost::string_view authorization)
+{
+    // a newline can't be in a header value
+    std::string key = authorization.to_string();
+    key += '\n';
+    key += ImmutableResultCache::MakeKey(method, params);
+    return key;
+}
+
+bool LongPollCollapser::join(const std::string& key, std::string id, Callback done)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    auto                        it = inFlight.find(key);
+    if (it == inFlight.end()) {
+        inFlight[key];
+        stats.sent++;
+        return false;
+    }
+    it->second.push_back(Waiter{std::move(id), std::move(done)});
+    stats.joined++;
+    stats.waiting++;
+    stats.maxWaiting = std::max(stats.maxWaiting, stats.waiting);
+    return true;
+}
+
+void LongPollCollapser::complete(const std::string&         key,
+                                 boost::beast::http::status status,
+                                 const std::string&         body)
+{
+    std::vector<Waiter> waiters;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto                        it = inFlight.find(key);
+        if (it == inFlight.end()) {
+            return;
+        }
+        waiters = std::move(it->second);
+        inFlight.erase(it);
+        stats.waiting -= waiters.size();
+    }
+
+    // every call gets the response with its own id; errors of the relay (not json) are passed as is
+    JsonSpan   idSpan;
+    const bool hasId = JsonRpcScanner::FindMember(body, "id", idSpan);
+    for (Waiter& waiter : waiters) {
+        std::string response = body;
+        if (hasId) {
+            response.replace(idSpan.offset, idSpan.size, waiter.id);
+        }
+        waiter.done(status, std::move(response));
+    }
+}
+
+LongPollCollapser::Stats LongPollCollapser::getStats() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return stats;
+}
@@ -0,0 +1,77 @@
+#ifndef LONGPOLLCOLLAPSER_H
+#define LONGPOLLCOLLAPSER_H
+
+#include <boost/beast/http/status.hpp>
+#include <boost/utility/string_view.hpp>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <set>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/**
+ * Collapses the identical calls of long-poll methods (e.g., waitfornewblock or waitforblock), which
+ * each hold an upstream connection and an rpc thread of the node until they return. The first call of
+ * a wait condition (its method, params and Authorization header) goes upstream; the ones that come
+ * while it waits are parked without a connection or a thread, and get its response, with their own
+ * ids, once it returns. So however many clients wait, the node serves one call per condition.
+ *
+ * A call that joins late gets the same response as the first one; for a wait with a timeout, that
+ * means the timeout of the first call applies.
+ *
+ * Thread-safe.
+ */
+class LongPollCollapser
+{
+public:
+    // gets the response to a call that joined another one, with the id of the call
+    using Callback = std::function<void(boost::beast::http::status status, std::string&& body)>;
+
+    struct Stats
+    {
+        uint64_t sent       = 0; // calls that went upstream
+        uint64_t joined     = 0; // calls that got the response of another one
+        uint64_t waiting    = 0; // calls parked now
+        uint64_t maxWaiting = 0;
+    };
+
+private:
+    struct Waiter
+    {
+        std::string id;
+        Callback    done;
+    };
+
+    const std::set<std::string> methods;
+
+    mutable std::mutex                                   mutex;
+    std::unordered_map<std::string, std::vector<Waiter>> inFlight; // by key
+    Stats                                                stats;
+
+public:
+    explicit LongPollCollapser(std::set<std::string> Methods) : methods(std::move(Methods)) {}
+
+    // parses a comma separated list of methods; throws std::runtime_error on an empty one
+    static std::set<std::string> ParseMethods(const std::string& text);
+
+    bool isCollapsed(const std::string& method) const { return methods.count(method) > 0; }
+
+    // the key of a wait condition
+    static std::string
+    MakeKey(boost::string_view method, boost::string_view params, boost::string_view authorization);
+
+    /**
+     * Parks a call (with its raw json id) on the call of the key in flight, if there's one; otherwise
+     * returns false, and the call has to be sent upstream, then passed to complete()
+     */
+    bool join(const std::string& key, std::string id, Callback done);
+
+    // gives the response of the call of the key that went upstream to the calls parked on it
+    void complete(const std::string& key, boost::beast::http::status status, const std::string& body);
+
+    Stats getStats() const;
+};
+
+#endif // LONGPOLLCOLLAPSER_H
@@ -0,0 +1,233 @@
+#include "MicroBatcher.h"
+
+#include "Logging/DefaultLogger.h"
+#include <boost/algorithm/string.hpp>
+
+namespace net = boost::asio;
+
+namespace {
+
+// the index of a call in its batch, from the id of its response; false if it's not one
+bool ParseIndex(boost::string_view id, std::size_t& index)
+{
+    if (id.empty() || id.size() > 9) {
+        return false;
+    }
+    index = 0;
+    for (char c : id) {
+        if (c < '0' || c > '9') {
+            return false;
+        }
+        index = index * 10 + static_cast<std::size_t>(c - '0');
+    }
+    return true;
+}
+
+boost::system::error_code MismatchError()
+{
+    return boost::system::errc::make_error_code(boost::system::errc::protocol_error);
+}
+
+} // namespace
+
+std::map<std::string, std::chrono::microseconds> MicroBatchOptions::ParseMethods(const std::string& text)
+{
+    std::map<std::string, std::chrono::microseconds> methods;
+
+    std::vector<std::string> entries;
+    boost::split(entries, text, boost::is_any_of(","));
+    for (std::string& entry : entries) {
+        boost::trim(entry);
+        if (entry.empty()) {
+            continue;
+        }
+        const std::size_t colon = entry.find(':');
+        const std::string method =
+            boost::trim_copy(entry.substr(0, colon == std::string::npos ? entry.size() : colon));
+        const std::string budget =
+            colon == std::string::npos ? std::string() : boost::trim_copy(entry.substr(colon + 1));
+        if (method.empty() || budget.empty() ||
+            budget.find_first_not_of("0123456789") != std::string::npos || budget.size() > 9) {
+            throw std::runtime_error("Invalid batched method (expected method:budget_us): " + entry);
+        }
+        methods[method] = std::chrono::microseconds(std::stoul(budget));
+    }
+    return methods;
+}
+
+MicroBatcher::MicroBatcher(net::io_context&  ioc,
+                           std::string       Host,
+                           std::string       Port,
+                           std::size_t       ConnectionCount,
+                           MicroBatchOptions Options)
+    : strand(net::make_strand(ioc)),
+      pool(std::make_shared<UpstreamPool>(ioc, std::move(Host), std::move(Port), ConnectionCount)),
+      options(std::move(Options))
+{
+    if (options.maxBatchSize < 1) {
+        options.maxBatchSize = 1;
+    }
+}
+
+std::chrono::microseconds MicroBatcher::getBudget(const std::string& method) const
+{
+    auto it = options.methods.find(method);
+    return it != options.methods.cend() ? it->second : std::chrono::microseconds::zero();
+}
+
+void MicroBatcher::submit(std::string               body,
+                          JsonSpan                  idSpan,
+                          std::chrono::microseconds budget,
+                          std::string               authorization,
+                          Callback                  done)
+{
+    auto call        = std::make_shared<Call>();
+    call->originalId = body.substr(idSpan.offset, idSpan.size);
+    call->body       = std::move(body);
+    call->id         = idSpan;
+    call->done       = std::move(done);
+
+    auto self = shared_from_this();
+    auto auth = std::make_shared<std::string>(std::move(authorization));
+    net::dispatch(strand, [self, call, budget, auth]() { self->add(std::move(*call), budget, *auth); });
+}
+
+void MicroBatcher::add(Call&& call, std::chrono::microseconds budget, const std::string& authorization)
+{
+    if (stopped) {
+        return call.done(net::error::operation_aborted, {});
+    }
+
+    std::unique_ptr<Batch>& batch = batches[authorization];
+    if (!batch) {
+        batch.reset(new Batch(strand));
+        batch->deadline   = std::chrono::steady_clock::time_point::max();
+        batch->generation = nextGeneration++;
+    }
+
+    call.body.replace(call.id.offset, call.id.size, std::to_string(batch->calls.size()));
+    batch->calls.push_back(std::move(call));
+    if (batch->calls.size() >= options.maxBatchSize) {
+        return flush(authorization);
+    }
+
+    // the batch leaves when the call with the smallest budget left in it has to
+    const auto deadline = std::chrono::steady_clock::now() + budget;
+    if (deadline >= batch->deadline) {
+        return;
+    }
+    batch->deadline = deadline;
+    batch->timer.expires_at(deadline);
+
+    auto           self       = shared_from_this();
+    const uint64_t generation = batch->generation;
+    batch->timer.async_wait([self, authorization, generation](boost::system::error_code ec) {
+        if (ec == net::error::operation_aborted) {
+            return;
+        }
+        // the timer may have expired just before the batch was sent or its deadline was moved
+        auto it = self->batches.find(authorization);
+        if (it != self->batches.end() && it->second->generation == generation) {
+            self->flush(authorization);
+        }
+    });
+}
+
+void MicroBatcher::flush(const std::string& authorization)
+{
+    auto it = batches.find(authorization);
+    if (it == batches.end()) {
+        return;
+    }
+    auto calls = std::make_shared<std::vector<Call>>(std::move(it->second->calls));
+    batches.erase(it);
+
+    // a single call is sent as it is, since there's nothing to gain from wrapping it
+    std::string body;
+    if (calls->size() == 1) {
+        body = std::move(calls->front().body);
+    } else {
+        body = "[";
+        for (Call& c : *calls) {
+            if (body.size() > 1) {
+                body += ',';
+            }
+            body += c.body;
+            std::string().swap(c.body);
+        }
+        body += ']';
+    }
+
+    pool->call(std::move(body),
+               JsonSpan(),
+               authorization,
+               [calls](boost::system::error_code ec, std::string&& response) {
+                   if (ec) {
+                       for (Call& c : *calls) {
+                           c.done(ec, {});
+                       }
+                       return;
+                   }
+                   Complete(*calls, std::move(response));
+               });
+}
+
+void MicroBatcher::Complete(std::vector<Call>& calls, std::string&& response)
+{
+    if (calls.size() == 1) {
+        JsonSpan span;
+        if (!JsonRpcScanner::FindMember(response, "id", span) ||
+            response.compare(span.offset, span.size, "0") != 0) {
+            LogWrite("Upstream response does not match the id of the call: " + response, b_sev::err);
+            return calls.front().done(MismatchError(), {});
+        }
+        response.replace(span.offset, span.size, calls.front().originalId);
+        return calls.front().done(boost::system::error_code(), std::move(response));
+    }
+
+    std::vector<JsonSpan> elements;
+    if (!JsonRpcScanner::SplitArray(response, elements)) {
+        LogWrite("Upstream response to a batch is not a json array: " + response, b_sev::err);
+    }
+
+    std::vector<bool> answered(calls.size(), false);
+    for (const JsonSpan& e : elements) {
+        const boost::string_view element(response.data() + e.offset, e.size);
+        JsonSpan                 id;
+        std::size_t              index = 0;
+        if (!JsonRpcScanner::FindMember(element, "id", id) ||
+            !ParseIndex(element.substr(id.offset, id.size), index) || index >= calls.size() ||
+            answered[index]) {
+            continue;
+        }
+        answered[index] = true;
+
+        std::string result;
+        result.reserve(element.size() + calls[index].originalId.size());
+        result.append(element.data(), id.offset);
+        result += calls[index].originalId;
+        result.append(element.data() + id.offset + id.size, element.size() - id.offset - id.size);
+        calls[index].done(boost::system::error_code(), std::move(result));
+    }
+
+    for (std::size_t i = 0; i < calls.size(); i++) {
+        if (!answered[i]) {
+            calls[i].done(MismatchError(), {});
+        }
+    }
+}
+
+void MicroBatcher::stop()
+{
+    auto self = shared_from_this();
+    net::dispatch(strand, [self]() {
+        self->stopped = true;
+        for (auto& b : self->batches) {
+            for (Call& c : b.second->calls) {
+                c.done(net::error::operation_aborted, {});
+            }
+        }
+        self->batches.clear();
+        self->pool->stop();
+    });
+}
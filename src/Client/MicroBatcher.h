@@ -0,0 +1,91 @@
+#ifndef MICROBATCHER_H
+#define MICROBATCHER_H
+
+#include "UpstreamPool.h"
+#include <chrono>
+#include <map>
+
+struct MicroBatchOptions
+{
+    // the methods whose calls may be batched, with the longest time a call may wait for its batch
+    std::map<std::string, std::chrono::microseconds> methods;
+    // a batch is sent as soon as it has this many calls
+    std::size_t maxBatchSize = 32;
+
+    // parses a comma separated list of method:budget_in_microseconds; throws on invalid input
+    static std::map<std::string, std::chrono::microseconds> ParseMethods(const std::string& text);
+};
+
+/**
+ * Combines single json-rpc calls that arrive close together into one json-rpc batch, so that the
+ * upstream handles one http exchange instead of many. Only the methods of MicroBatchOptions are
+ * batched; a batch is sent when it's full, or when the call with the smallest latency budget in it
+ * has waited for its budget.
+ *
+ * The ids of the calls are replaced by their index in the batch, and the elements of the batch
+ * response are given back to their calls with the original ids. Calls with different Authorization
+ * headers go into different batches.
+ */
+class MicroBatcher : public std::enable_shared_from_this<MicroBatcher>
+{
+public:
+    using Callback = UpstreamPool::Callback;
+
+private:
+    struct Call
+    {
+        std::string originalId;
+        std::string body;
+        JsonSpan    id; // in body, until it's replaced by the index of the call in its batch
+        Callback    done;
+    };
+
+    struct Batch
+    {
+        using Strand = boost::asio::strand<boost::asio::io_context::executor_type>;
+
+        explicit Batch(const Strand& strand) : timer(strand) {}
+
+        std::vector<Call>                     calls;
+        std::chrono::steady_clock::time_point deadline;
+        boost::asio::steady_timer             timer;
+        uint64_t                              generation = 0;
+    };
+
+    boost::asio::strand<boost::asio::io_context::executor_type> strand;
+    std::shared_ptr<UpstreamPool>                               pool;
+    MicroBatchOptions                                           options;
+    std::map<std::string, std::unique_ptr<Batch>>               batches; // by authorization
+    uint64_t                                                    nextGeneration = 0;
+    bool                                                        stopped        = false;
+
+    void add(Call&& call, std::chrono::microseconds budget, const std::string& authorization);
+    void flush(const std::string& authorization);
+
+    static void Complete(std::vector<Call>& calls, std::string&& response);
+
+public:
+    MicroBatcher(boost::asio::io_context& ioc,
+                 std::string              Host,
+                 std::string              Port,
+                 std::size_t              ConnectionCount,
+                 MicroBatchOptions        Options);
+
+    // the latency budget of the calls of method, or zero if they're not batched
+    std::chrono::microseconds getBudget(const std::string& method) const;
+
+    /**
+     * Adds a call, whose id is at idSpan of the body, to the next batch. The callback is called with
+     * either an error or the json response of the call, on a thread of the io_context.
+     */
+    void submit(std::string               body,
+                JsonSpan                  idSpan,
+                std::chrono::microseconds budget,
+                std::string               authorization,
+                Callback                  done);
+
+    // fails the calls that wait for a batch, and closes the upstream connections
+    void stop();
+};
+
+#endif // MICROBATCHER_H
@@ -0,0 +1,192 @@
+#include "PriorityScheduler.h"
+
+#include <boost/algorithm/string.hpp>
+#include <stdexcept>
+
+namespace {
+
+const char* const DEFAULT_CLASS = "default";
+
+bool ParseNumber(const std::string& text, uint64_t& value)
+{
+    if (text.empty() || text.size() > 9 || text.find_first_not_of("0123456789") != std::string::npos) {
+        return false;
+    }
+    value = std::stoul(text);
+    return true;
+}
+
+} // namespace
+
+std::vector<PriorityClassOptions> PriorityOptions::ParseClasses(const std::string& text)
+{
+    std::vector<PriorityClassOptions> classes;
+
+    std::vector<std::string> entries;
+    boost::split(entries, text, boost::is_any_of(","));
+    for (std::string& entry : entries) {
+        boost::trim(entry);
+        if (entry.empty()) {
+            continue;
+        }
+        std::vector<std::string> fields;
+        boost::split(fields, entry, boost::is_any_of(":"));
+        for (std::string& field : fields) {
+            boost::trim(field);
+        }
+
+        PriorityClassOptions c;
+        c.name               = fields[0];
+        uint64_t weight      = 0;
+        uint64_t concurrency = 0;
+        uint64_t queue       = c.maxQueueLength;
+        if (c.name.empty() || fields.size() < 2 || fields.size() > 4 ||
+            !ParseNumber(fields[1], weight) || weight == 0 ||
+            (fields.size() > 2 && !ParseNumber(fields[2], concurrency)) ||
+            (fields.size() > 3 && !ParseNumber(fields[3], queue))) {
+            throw std::runtime_error(
+                "Invalid priority class (expected name:weight[:max_concurrency[:max_queue_length]]): " +
+                entry);
+        }
+        c.weight         = static_cast<uint32_t>(weight);
+        c.maxConcurrency = static_cast<uint32_t>(concurrency);
+        c.maxQueueLength = static_cast<std::size_t>(queue);
+        classes.push_back(std::move(c));
+    }
+    return classes;
+}
+
+PriorityScheduler::PriorityScheduler(PriorityOptions options)
+    : maxConcurrency(options.maxConcurrency >= 1 ? options.maxConcurrency : 1),
+      clientIdentity(options.clientIdentity), identityHeader(std::move(options.identityHeader)),
+      maxQueuePerClient(options.clientIdentity == ClientIdentity::None ? 0 : options.maxQueuePerClient)
+{
+    for (PriorityClassOptions& c : options.classes) {
+        PriorityClass pc;
+        pc.options        = std::move(c);
+        pc.options.weight = pc.options.weight >= 1 ? pc.options.weight : 1;
+        classes.push_back(std::move(pc));
+    }
+    defaultClass = classes.size();
+    defaultClass = getClassIndex(DEFAULT_CLASS);
+    if (defaultClass == classes.size()) {
+        PriorityClass pc;
+        pc.options.name = DEFAULT_CLASS;
+        classes.push_back(std::move(pc));
+    }
+}
+
+std::size_t PriorityScheduler::getClassIndex(const std::string& name) const
+{
+    for (std::size_t i = 0; i < classes.size(); i++) {
+        if (classes[i].options.name == name) {
+            return i;
+        }
+    }
+    return defaultClass;
+}
+
+bool PriorityScheduler::canRun(const PriorityClass& c) const
+{
+    return running < maxConcurrency &&
+           (c.options.maxConcurrency == 0 || c.running < c.options.maxConcurrency);
+}
+
+std::size_t PriorityScheduler::pickNext()
+{
+    // smooth weighted round robin over the classes that have a job that can run
+    int64_t     total = 0;
+    std::size_t next  = classes.size();
+    for (std::size_t i = 0; i < classes.size(); i++) {
+        PriorityClass& c = classes[i];
+        if (c.queue.empty() || !canRun(c)) {
+            continue;
+        }
+        c.credit += c.options.weight;
+        total += c.options.weight;
+        if (next == classes.size() || c.credit > classes[next].credit) {
+            next = i;
+        }
+    }
+    if (next != classes.size()) {
+        classes[next].credit -= total;
+    }
+    return next;
+}
+
+bool PriorityScheduler::submit(std::size_t index, const std::string& client, Job job)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        PriorityClass&              c = classes[index];
+        if (stopped) {
+            return false;
+        }
+        // jobs of other classes only wait while their class is at its own limit, so they're not
+        // overtaken here
+        if (!c.queue.empty() || !canRun(c)) {
+            if (c.queue.size() >= c.options.maxQueueLength) {
+                return false;
+            }
+            return c.queue.push(client, std::move(job), maxQueuePerClient);
+        }
+        running++;
+        c.running++;
+    }
+    job(true);
+    return true;
+}
+
+void PriorityScheduler::release(std::size_t index)
+{
+    std::vector<Job> ready;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        running--;
+        classes[index].running--;
+        for (std::size_t next = pickNext(); next != classes.size(); next = pickNext()) {
+            PriorityClass& c = classes[next];
+            ready.push_back(c.queue.pop());
+            running++;
+            c.running++;
+        }
+    }
+    for (Job& job : ready) {
+        job(true);
+    }
+}
+
+void PriorityScheduler::stop()
+{
+    std::vector<Job> dropped;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopped = true;
+        for (PriorityClass& c : classes) {
+            while (!c.queue.empty()) {
+                dropped.push_back(c.queue.pop());
+            }
+        }
+    }
+    for (Job& job : dropped) {
+        job(false);
+    }
+}
+
+std::size_t PriorityScheduler::getQueueLength(std::size_t index)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return classes[index].queue.size();
+}
+
+std::size_t PriorityScheduler::getQueuedClientCount(std::size_t index)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return classes[index].queue.getFlowCount();
+}
+
+uint32_t PriorityScheduler::getRunningCount(std::size_t index)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return classes[index].running;
+}
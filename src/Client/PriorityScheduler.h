@@ -0,0 +1,124 @@
+#ifndef PRIORITYSCHEDULER_H
+#define PRIORITYSCHEDULER_H
+
+#include "FairQueue.h"
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <vector>
+
+struct PriorityClassOptions
+{
+    std::string name;
+    // the share of the upstream slots the class gets while other classes wait too
+    uint32_t weight = 1;
+    // upstream calls of the class in flight at once; 0 limits the class only by the total
+    uint32_t maxConcurrency = 0;
+    // calls of the class waiting for a slot; beyond this, calls are rejected
+    std::size_t maxQueueLength = 1024;
+};
+
+// how the clients of the relay are told apart, for fair queueing
+enum class ClientIdentity
+{
+    None,          // all requests of a class share one queue
+    SourceAddress, // the remote address of the connection
+    Header         // a header (e.g., Authorization or X-Api-Key); the address for requests without it
+};
+
+struct PriorityOptions
+{
+    // requests with no class, or with a class that isn't configured, get the "default" class, which is
+    // added with weight 1 if it's not in the list
+    std::vector<PriorityClassOptions> classes;
+    // upstream calls in flight at once, over all classes
+    uint32_t maxConcurrency = 64;
+
+    // within a class, the calls of every client wait in their own queue, and clients take turns
+    ClientIdentity clientIdentity = ClientIdentity::None;
+    // the header that identifies clients, with ClientIdentity::Header. The relay doesn't check it, so
+    // a client can claim any value (e.g., a new one per call, to get more turns); use it only behind a
+    // proxy that authenticates clients and sets or verifies the header
+    std::string identityHeader;
+    // calls of one client waiting in one class (0 is unlimited); beyond this, its calls are rejected
+    std::size_t maxQueuePerClient = 64;
+
+    // parses a comma separated list of name:weight[:max_concurrency[:max_queue_length]]; throws on
+    // invalid input
+    static std::vector<PriorityClassOptions> ParseClasses(const std::string& text);
+};
+
+/**
+ * Admission control for upstream calls by priority class. Every class has its own queue and its own
+ * concurrency limit, and all classes share a total number of upstream slots. When a slot frees up,
+ * the classes that have calls waiting (and are below their own limit) take turns by weighted round
+ * robin, so a burst of heavy calls in one class can't delay the calls of another class for more than
+ * its share of the slots.
+ *
+ * Within a class, calls wait in a FairQueue by client: the clients that have calls waiting take
+ * turns, so the client that sends the most calls gets the same share of the upstream as the others
+ * instead of all of it.
+ *
+ * Jobs run either in submit(), when a slot is free, or in the release() of the call whose slot they
+ * take; they must call release() with their class once their upstream call completes. The jobs still
+ * queued when the scheduler stops are called with admitted = false instead, to answer their calls.
+ */
+class PriorityScheduler
+{
+public:
+    using Job = std::function<void(bool admitted)>;
+
+private:
+    struct PriorityClass
+    {
+        PriorityClassOptions options;
+        FairQueue<Job>       queue;
+        uint32_t             running = 0;
+        int64_t              credit  = 0; // of the smooth weighted round robin
+    };
+
+    std::mutex                 mutex;
+    std::vector<PriorityClass> classes;
+    std::size_t                defaultClass;
+    const uint32_t             maxConcurrency;
+    const ClientIdentity       clientIdentity;
+    const std::string          identityHeader;
+    const std::size_t          maxQueuePerClient;
+    uint32_t                   running = 0;
+    bool                       stopped = false;
+
+    bool canRun(const PriorityClass& c) const;
+    // the class whose job runs next, or classes.size() if none can run; needs the lock
+    std::size_t pickNext();
+
+public:
+    explicit PriorityScheduler(PriorityOptions options);
+
+    // the index of the class with this name, or of the default class
+    std::size_t getClassIndex(const std::string& name) const;
+
+    const std::string& getClassName(std::size_t index) const { return classes[index].options.name; }
+
+    ClientIdentity     getClientIdentity() const { return clientIdentity; }
+    const std::string& getIdentityHeader() const { return identityHeader; }
+
+    /**
+     * Runs the job now or queues it with the other calls of the client; false if the queue of the class
+     * or of the client is full (the job is dropped)
+     */
+    bool submit(std::size_t index, const std::string& client, Job job);
+
+    // frees the slot of a completed call of the class, and runs the jobs that can take a slot now
+    void release(std::size_t index);
+
+    // calls the queued jobs with admitted = false; later submits fail
+    void stop();
+
+    std::size_t getQueueLength(std::size_t index);
+    // the clients with calls waiting in the class
+    std::size_t getQueuedClientCount(std::size_t index);
+    uint32_t    getRunningCount(std::size_t index);
+};
+
+#endif // PRIORITYSCHEDULER_H
@@ -0,0 +1,136 @@
+#include "TrafficMirror.h"
+
+#include "Filters/JsonRpcScanner.h"
+#include "Logging/DefaultLogger.h"
+#include <boost/asio/post.hpp>
+#include <jsoncpp/json/json.h>
+
+namespace http = boost::beast::http;
+
+namespace {
+
+// whether a response is an http error, or a json-rpc error
+bool IsError(http::status status, boost::string_view body)
+{
+    JsonSpan error;
+    return static_cast<unsigned>(status) >= 400 ||
+           (JsonRpcScanner::FindMember(body, "error", error) &&
+            body.substr(error.offset, error.size) != "null");
+}
+
+Json::Value LatencyJson(const DDSketch& sketch)
+{
+    Json::Value latency;
+    latency["count"]  = Json::UInt64(sketch.getCount());
+    latency["p50_us"] = sketch.getQuantile(0.5);
+    latency["p90_us"] = sketch.getQuantile(0.9);
+    latency["p99_us"] = sketch.getQuantile(0.99);
+    return latency;
+}
+
+} // namespace
+
+std::string TrafficMirror::Stats::toJson() const
+{
+    Json::Value root;
+    root["mirrored"]          = Json::UInt64(mirrored);
+    root["dropped"]           = Json::UInt64(dropped);
+    root["shadow_failures"]   = Json::UInt64(shadowFailures);
+    root["error_mismatches"]  = Json::UInt64(errorMismatches);
+    root["result_mismatches"] = Json::UInt64(resultMismatches);
+    root["queued"]            = Json::UInt64(queued);
+    root["primary_latency"]   = LatencyJson(primaryLatency);
+    root["shadow_latency"]    = LatencyJson(shadowLatency);
+
+    Json::StyledWriter writer;
+    return writer.write(root);
+}
+
+TrafficMirror::TrafficMirror(MirrorOptions Options)
+    : options(std::move(Options)),
+      work(boost::asio::make_work_guard(ioc)),
+      client(std::make_shared<AsyncClient>(
+          ioc, options.address, std::to_string(options.port), options.client))
+{
+    thread = std::thread([this] { ioc.run(); });
+}
+
+TrafficMirror::~TrafficMirror()
+{
+    client->stop();
+    ioc.stop();
+    thread.join();
+}
+
+bool TrafficMirror::admit()
+{
+    if (options.sampleEvery > 1 &&
+        requests.fetch_add(1, std::memory_order_relaxed) % options.sampleEvery != 0) {
+        return false;
+    }
+    if (queued.fetch_add(1) >= options.maxQueueLength) {
+        queued--;
+        std::lock_guard<std::mutex> lock(mutex);
+        stats.dropped++;
+        return false;
+    }
+    return true;
+}
+
+TrafficMirror::Job TrafficMirror::capture(const Request&            request,
+                                          const Response&           response,
+                                          std::chrono::microseconds latency)
+{
+    Job job{request, response.result(), response.body(), latency};
+    job.request.keep_alive(true);
+    return job;
+}
+
+void TrafficMirror::submit(Job job)
+{
+    auto shared = std::make_shared<Job>(std::move(job));
+    boost::asio::post(ioc, [this, shared]() {
+        const auto start = std::chrono::steady_clock::now();
+        client->send(std::move(shared->request),
+                     [this, shared, start](boost::beast::error_code ec, Response&& res) {
+                         const std::chrono::duration<double, std::micro> latency =
+                             std::chrono::steady_clock::now() - start;
+                         compare(*shared, ec, res, latency.count());
+                         queued--;
+                     });
+    });
+}
+
+void TrafficMirror::compare(const Job&               job,
+                            boost::beast::error_code ec,
+                            const Response&          shadow,
+                            double                   latencyUs)
+{
+    // the responses are compared as they are; both have the id of the same request
+    const bool primaryError = IsError(job.status, job.body);
+    const bool shadowError  = !ec && IsError(shadow.result(), shadow.body());
+
+    std::lock_guard<std::mutex> lock(mutex);
+    stats.mirrored++;
+    stats.primaryLatency.add(static_cast<double>(job.latency.count()));
+    if (ec) {
+        stats.shadowFailures++;
+        LogWrite("Mirrored request failed: " + ec.message(), b_sev::warn);
+        return;
+    }
+    stats.shadowLatency.add(latencyUs);
+    if (primaryError != shadowError) {
+        stats.errorMismatches++;
+    } else if (!primaryError && job.body != shadow.body()) {
+        stats.resultMismatches++;
+    }
+}
+
+TrafficMirror::Stats TrafficMirror::getStats() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    Stats                       s = stats;
+
+    s.queued = queued.load();
+    return s;
+}
@@ -0,0 +1,107 @@
+#ifndef TRAFFICMIRROR_H
+#define TRAFFICMIRROR_H
+
+#include "AsyncClient.h"
+#include "Metrics/Sketches.h"
+#include <atomic>
+#include <boost/asio/executor_work_guard.hpp>
+#include <boost/asio/io_context.hpp>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+struct MirrorOptions
+{
+    std::string address;
+    uint16_t    port = 0;
+    // mirror one of every N allowed requests
+    uint32_t sampleEvery = 1;
+    // mirrored requests not answered by the shadow yet; beyond this, requests are dropped, not mirrored
+    std::size_t maxQueueLength = 256;
+    // the connections to the shadow, kept apart from the ones to the real upstreams
+    AsyncClientOptions client;
+};
+
+/**
+ * Copies a sample of the allowed requests to a shadow upstream (e.g., a new node version), and compares
+ * its responses with the ones of the real upstream, to try it under production load without clients
+ * noticing. The relay keeps the response of the real upstream for the client; the one of the shadow
+ * is only compared and dropped.
+ *
+ * A mirrored request is copied, with the response of the real upstream, once that response is ready,
+ * and is sent after it was handed to the client. The shadow has a connection pool and a thread of its
+ * own, so a slow or dead shadow only fills its bounded queue, and requests beyond it are dropped;
+ * requests that aren't sampled cost an atomic increment.
+ *
+ * Thread-safe.
+ */
+class TrafficMirror
+{
+public:
+    using Request  = AsyncClient::Request;
+    using Response = AsyncClient::Response;
+
+    // a request to mirror, with what the real upstream made of it
+    struct Job
+    {
+        Request                    request;
+        boost::beast::http::status status;
+        std::string                body;
+        std::chrono::microseconds  latency;
+    };
+
+    struct Stats
+    {
+        uint64_t mirrored         = 0; // requests the shadow answered or failed
+        uint64_t dropped          = 0; // sampled requests not mirrored, as the queue was full
+        uint64_t shadowFailures   = 0; // requests without a response from the shadow (e.g., timeouts)
+        uint64_t errorMismatches  = 0; // only one of the upstreams answered with an error
+        uint64_t resultMismatches = 0; // both succeeded, with different responses
+        uint64_t queued           = 0;
+        DDSketch primaryLatency; // microseconds, of the mirrored requests
+        DDSketch shadowLatency;  // microseconds, including the wait for a connection to the shadow
+
+        std::string toJson() const;
+    };
+
+private:
+    const MirrorOptions options;
+
+    boost::asio::io_context                                                  ioc;
+    boost::asio::executor_work_guard<boost::asio::io_context::executor_type> work;
+    std::shared_ptr<AsyncClient>                                             client;
+    std::thread                                                              thread;
+
+    std::atomic<uint64_t>    requests{0};
+    std::atomic<std::size_t> queued{0};
+
+    mutable std::mutex mutex;
+    Stats              stats;
+
+    void compare(const Job& job, boost::beast::error_code ec, const Response& shadow, double latencyUs);
+
+public:
+    explicit TrafficMirror(MirrorOptions Options);
+    ~TrafficMirror();
+
+    TrafficMirror(const TrafficMirror&) = delete;
+    TrafficMirror& operator=(const TrafficMirror&) = delete;
+
+    /**
+     * Whether to mirror an allowed request: if it's sampled and there's room in the queue; an admitted
+     * request takes a place in the queue, which has to be given to capture() and submit()
+     */
+    bool admit();
+
+    // copies an admitted request and the response of the real upstream, which took the latency
+    Job capture(const Request& request, const Response& response, std::chrono::microseconds latency);
+
+    // sends a captured request to the shadow, on the thread of the mirror
+    void submit(Job job);
+
+    Stats getStats() const;
+};
+
+#endif // TRAFFICMIRROR_H
@@ -0,0 +1,226 @@
+#include "UpstreamPool.h"
+
+#include "Logging/DefaultLogger.h"
+
+namespace beast = boost::beast;
+namespace http  = beast::http;
+namespace net   = boost::asio;
+using tcp       = boost::asio::ip::tcp;
+
+class UpstreamPool::Connection : public std::enable_shared_from_this<UpstreamPool::Connection>
+{
+    beast::tcp_stream                 stream;
+    tcp::resolver                     resolver;
+    beast::flat_buffer                buffer;
+    http::response<http::string_body> res;
+    std::string                       host;
+    std::string                       port;
+
+    std::deque<PendingCall> queue;
+    bool                    busy      = false;
+    bool                    connected = false;
+    bool                    reused    = false; // the current call was sent on an already open connection
+    bool                    retried   = false; // the current call is being retried on a new connection
+    bool                    stopped   = false;
+
+    void next()
+    {
+        if (busy || queue.empty() || stopped) {
+            return;
+        }
+        busy = true;
+        if (connected) {
+            reused = true;
+            return write();
+        }
+        reused = false;
+        resolver.async_resolve(
+            host, port, beast::bind_front_handler(&Connection::on_resolve, shared_from_this()));
+    }
+
+    void on_resolve(beast::error_code ec, tcp::resolver::results_type results)
+    {
+        if (ec) {
+            return fail(ec);
+        }
+        stream.expires_after(std::chrono::seconds(30));
+        stream.async_connect(results,
+                             beast::bind_front_handler(&Connection::on_connect, shared_from_this()));
+    }
+
+    void on_connect(beast::error_code ec, tcp::resolver::results_type::endpoint_type)
+    {
+        if (ec) {
+            return fail(ec);
+        }
+        connected = true;
+        write();
+    }
+
+    void write()
+    {
+        stream.expires_after(std::chrono::seconds(30));
+        http::async_write(stream,
+                          queue.front().request,
+                          beast::bind_front_handler(&Connection::on_write, shared_from_this()));
+    }
+
+    void on_write(beast::error_code ec, std::size_t)
+    {
+        if (ec) {
+            return fail(ec, true);
+        }
+        res = {};
+        http::async_read(
+            stream, buffer, res, beast::bind_front_handler(&Connection::on_read, shared_from_this()));
+    }
+
+    void on_read(beast::error_code ec, std::size_t)
+    {
+        if (ec) {
+            return fail(ec);
+        }
+
+        PendingCall call = std::move(queue.front());
+        queue.pop_front();
+        busy    = false;
+        retried = false;
+        if (!res.keep_alive()) {
+            close();
+        }
+
+        std::string body = std::move(res.body());
+        if (!call.originalId.empty()) {
+            // the response must be the one of this call; put the id of the client back
+            JsonSpan          span;
+            const std::string upstreamId = std::to_string(call.upstreamId);
+            if (!JsonRpcScanner::FindMember(body, "id", span) ||
+                body.compare(span.offset, span.size, upstreamId) != 0) {
+                LogWrite("Upstream response does not match the id of the call: " + body, b_sev::err);
+                // later responses on this connection can't be trusted to match their calls either
+                close();
+                call.done(boost::system::errc::make_error_code(boost::system::errc::protocol_error), {});
+                return next();
+            }
+            body.replace(span.offset, span.size, call.originalId);
+        }
+        call.done(beast::error_code(), std::move(body));
+        next();
+    }
+
+    /**
+     * Fails the current call, or retries it once on a new connection if it couldn't be written to a
+     * reused one (the upstream may have closed the idle connection). A call that was written is never
+     * sent again, as the upstream may have run it (e.g., sendrawtransaction).
+     */
+    void fail(beast::error_code ec, bool writeFailed = false)
+    {
+        close();
+        busy = false;
+        if (queue.empty()) {
+            return;
+        }
+        if (writeFailed && reused && !retried && !stopped) {
+            retried = true;
+            return next();
+        }
+        retried          = false;
+        PendingCall call = std::move(queue.front());
+        queue.pop_front();
+        call.done(ec, {});
+        next();
+    }
+
+    void close()
+    {
+        beast::error_code ec;
+        stream.socket().shutdown(tcp::socket::shutdown_both, ec);
+        stream.socket().close(ec);
+        buffer.consume(buffer.size());
+        connected = false;
+    }
+
+public:
+    Connection(net::io_context& ioc, std::string Host, std::string Port)
+        : stream(net::make_strand(ioc)), resolver(stream.get_executor()), host(std::move(Host)),
+          port(std::move(Port))
+    {
+    }
+
+    void enqueue(PendingCall&& call)
+    {
+        auto self = shared_from_this();
+        auto sp   = std::make_shared<PendingCall>(std::move(call));
+        net::dispatch(stream.get_executor(), [self, sp]() {
+            if (self->stopped) {
+                return sp->done(net::error::operation_aborted, {});
+            }
+            self->queue.push_back(std::move(*sp));
+            self->next();
+        });
+    }
+
+    void stop()
+    {
+        auto self = shared_from_this();
+        net::dispatch(stream.get_executor(), [self]() {
+            self->stopped = true;
+            self->close();
+            std::deque<PendingCall> calls = std::move(self->queue);
+            self->queue.clear();
+            for (PendingCall& c : calls) {
+                c.done(net::error::operation_aborted, {});
+            }
+        });
+    }
+};
+
+UpstreamPool::UpstreamPool(net::io_context& Ioc,
+                           std::string      Host,
+                           std::string      Port,
+                           std::size_t      ConnectionCount)
+    : ioc(Ioc), host(std::move(Host)), port(std::move(Port))
+{
+    const std::size_t count = ConnectionCount >= 1 ? ConnectionCount : 1;
+    connections.reserve(count);
+    for (std::size_t i = 0; i < count; i++) {
+        connections.push_back(std::make_shared<Connection>(ioc, host, port));
+    }
+}
+
+UpstreamPool::~UpstreamPool() = default;
+
+void UpstreamPool::call(std::string        body,
+                        JsonSpan           idSpan,
+                        const std::string& authorization,
+                        Callback           done)
+{
+    PendingCall call;
+    call.upstreamId = nextId.fetch_add(1, std::memory_order_relaxed);
+    if (!idSpan.empty()) {
+        call.originalId = body.substr(idSpan.offset, idSpan.size);
+        body.replace(idSpan.offset, idSpan.size, std::to_string(call.upstreamId));
+    }
+
+    call.request = {http::verb::post, "/", 11};
+    call.request.set(http::field::host, host);
+    call.request.set(http::field::content_type, "application/json");
+    if (!authorization.empty()) {
+        call.request.set(http::field::authorization, authorization);
+    }
+    call.request.keep_alive(true);
+    call.request.body() = std::move(body);
+    call.request.prepare_payload();
+    call.done = std::move(done);
+
+    // round robin; every connection sends its calls in order
+    const uint64_t index = nextConnection.fetch_add(1, std::memory_order_relaxed) % connections.size();
+    connections[index]->enqueue(std::move(call));
+}
+
+void UpstreamPool::stop()
+{
+    for (auto& c : connections) {
+        c->stop();
+    }
+}
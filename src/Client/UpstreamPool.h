@@ -0,0 +1,68 @@
+#ifndef UPSTREAMPOOL_H
+#define UPSTREAMPOOL_H
+
+#include <atomic>
+#include <boost/asio.hpp>
+#include <boost/beast.hpp>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "Filters/JsonRpcScanner.h"
+
+/**
+ * A fixed set of keep-alive connections to one upstream, shared by all the clients of the relay that
+ * don't need a connection of their own (e.g., websocket clients). Calls are spread over the
+ * connections, and each connection sends its calls one after the other.
+ *
+ * Since calls of different clients share the connections, their ids may collide; the id of every call
+ * is replaced by a number that's unique in the pool, and the original id is put back in the response
+ * after checking that the response matches the call.
+ */
+class UpstreamPool : public std::enable_shared_from_this<UpstreamPool>
+{
+public:
+    // called with either an error or the json body of the upstream response
+    using Callback = std::function<void(boost::system::error_code, std::string&&)>;
+
+private:
+    struct PendingCall
+    {
+        uint64_t    upstreamId;
+        std::string originalId; // raw json; empty if the call had no id
+        boost::beast::http::request<boost::beast::http::string_body> request;
+        Callback                                                     done;
+    };
+
+    class Connection;
+
+    boost::asio::io_context&                 ioc;
+    std::string                              host;
+    std::string                              port;
+    std::vector<std::shared_ptr<Connection>> connections;
+    std::atomic<uint64_t>                    nextId{1};
+    std::atomic<uint64_t>                    nextConnection{0};
+
+public:
+    UpstreamPool(boost::asio::io_context& Ioc,
+                 std::string              Host,
+                 std::string              Port,
+                 std::size_t              ConnectionCount);
+    ~UpstreamPool();
+
+    /**
+     * Sends a json-rpc call, whose id is at idSpan of the body (empty if it has none). The
+     * authorization (if not empty) is sent as the Authorization header of the call.
+     * The callback is called on one of the threads of the io_context.
+     */
+    void call(std::string body, JsonSpan idSpan, const std::string& authorization, Callback done);
+
+    // closes all connections; pending calls fail with operation_aborted
+    void stop();
+
+    std::size_t getConnectionCount() const { return connections.size(); }
+};
+
+#endif // UPSTREAMPOOL_H
@@ -0,0 +1,160 @@
+#ifndef FILTERCHAIN_H
+#define FILTERCHAIN_H
+
+#include "FilterDecision.h"
+#include "JsonRpcScanner.h"
+#include <boost/beast/http.hpp>
+#include <tuple>
+#include <type_traits>
+
+/**
+ * A json-rpc request as seen by the policies of a FilterChain. The body is scanned at most once (see
+ * JsonRpcScanner), the first time a policy asks for the call, so that policies that only look at the
+ * http message (like size limits) reject before any parsing happens. No DOM is built: params and id
+ * are spans of the raw json of the body.
+ */
+class ParsedRpcRequest
+{
+    const boost::beast::http::request<boost::beast::http::string_body>& req;
+
+    bool        parseAttempted = false;
+    bool        valid          = false;
+    JsonRpcCall call;
+
+    void parse();
+
+    boost::string_view span(const JsonSpan& s) const
+    {
+        return boost::string_view(req.body()).substr(s.offset, s.size);
+    }
+
+public:
+    explicit ParsedRpcRequest(const boost::beast::http::request<boost::beast::http::string_body>& Req)
+        : req(Req)
+    {
+    }
+
+    const boost::beast::http::request<boost::beast::http::string_body>& http() const { return req; }
+
+    // whether a policy has asked for the json, i.e., whether getMethod() is free
+    bool isParsed() const { return parseAttempted; }
+
+    // whether the body is a single json-rpc call, i.e., a json object with a string "method"
+    bool isValidCall()
+    {
+        parse();
+        return valid;
+    }
+
+    // empty if the body is not a valid call
+    const std::string& getMethod()
+    {
+        parse();
+        return call.method;
+    }
+
+    // the raw json of the params; empty if the body is not a valid call or has no params
+    boost::string_view getParams()
+    {
+        parse();
+        return span(call.params);
+    }
+
+    // the raw json of the id; empty if the body is not a valid call or has no id
+    boost::string_view getId()
+    {
+        parse();
+        return span(call.id);
+    }
+};
+
+inline void ParsedRpcRequest::parse()
+{
+    if (parseAttempted) {
+        return;
+    }
+    parseAttempted = true;
+
+    valid = JsonRpcScanner::Scan(req.body(), nullptr, call);
+    if (!valid) {
+        call = JsonRpcCall();
+    }
+}
+
+/**
+ * A filter made of policies that are composed at compile time; every policy is a class with
+ *
+ *     FilterDecision operator()(ParsedRpcRequest& req) const;
+ *
+ * Policies are applied in order on the same ParsedRpcRequest. A Deny or a ServeFromCache decision
+ * ends the chain immediately. A Route decision is remembered, and the remaining policies still run
+ * (so a later policy can deny a routed request; the last route wins). The last priority class given
+ * by an Allow or a Route decision is kept. The calls are resolved
+ * statically, so policies are inlined into the chain.
+ */
+template <typename... Policies>
+class FilterChain
+{
+    std::tuple<Policies...> policies;
+
+    template <std::size_t I>
+    typename std::enable_if<I == sizeof...(Policies), FilterDecision>::type
+    apply(ParsedRpcRequest&, FilterDecision&& result) const
+    {
+        return std::move(result);
+    }
+
+    template <std::size_t I>
+    typename std::enable_if<(I < sizeof...(Policies)), FilterDecision>::type
+    apply(ParsedRpcRequest& req, FilterDecision&& result) const
+    {
+        FilterDecision d = std::get<I>(policies)(req);
+        switch (d.verdict) {
+        case FilterDecision::Verdict::Deny:
+        case FilterDecision::Verdict::ServeFromCache:
+            return d;
+        case FilterDecision::Verdict::Route:
+            if (d.priorityClass.empty()) {
+                d.priorityClass = std::move(result.priorityClass);
+            }
+            return apply<I + 1>(req, std::move(d));
+        case FilterDecision::Verdict::Allow:
+            if (!d.priorityClass.empty()) {
+                result.priorityClass = std::move(d.priorityClass);
+            }
+            break;
+        }
+        return apply<I + 1>(req, std::move(result));
+    }
+
+public:
+    FilterChain() = default;
+
+    explicit FilterChain(Policies... Policies_) : policies(std::move(Policies_)...) {}
+
+    FilterDecision
+    operator()(const boost::beast::http::request<boost::beast::http::string_body>& req) const
+    {
+        ParsedRpcRequest parsed(req);
+        FilterDecision   decision = apply<0>(parsed, FilterDecision::Allow());
+        if (parsed.isParsed()) {
+            decision.method = parsed.getMethod();
+        }
+        return decision;
+    }
+
+    // access a policy by type, e.g., to configure it
+    template <typename Policy>
+    Policy& get()
+    {
+        return std::get<Policy>(policies);
+    }
+
+    template <std::size_t I>
+    typename std::tuple_element<I, std::tuple<Policies...>>::type& get()
+    {
+        return std::get<I>(policies);
+    }
+};
+
+#endif // FILTERCHAIN_H
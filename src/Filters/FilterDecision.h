@@ -0,0 +1,70 @@
+#ifndef FILTERDECISION_H
+#define FILTERDECISION_H
+
+#include "JsonRpcScanner.h"
+#include <string>
+
+/**
+ * What the relay should do with a request, as decided by its filter
+ */
+struct FilterDecision
+{
+    enum class Verdict
+    {
+        Allow,          // forward to the default upstream
+        Deny,           // reject with `reason`
+        ServeFromCache, // answer with `body` without contacting any upstream
+        Route           // forward to the upstream pool named `pool`
+    };
+
+    Verdict     verdict = Verdict::Allow;
+    std::string reason;
+    std::string pool;
+    std::string body;
+    // the priority class of an allowed or routed request (see PriorityScheduler); empty for the default
+    std::string priorityClass;
+    // the json-rpc method of the request, if the filter read it; for metrics
+    std::string method;
+    // whether the filter scanned the body as a single call; then the spans are the ones of the call in
+    // the body (empty if the call has no id or no params), so the relay doesn't scan it again
+    bool     scanned = false;
+    JsonSpan id;
+    JsonSpan params;
+
+    static FilterDecision Allow() { return FilterDecision(); }
+
+    static FilterDecision Allow(std::string PriorityClass)
+    {
+        FilterDecision d;
+        d.priorityClass = std::move(PriorityClass);
+        return d;
+    }
+
+    static FilterDecision Deny(std::string Reason)
+    {
+        FilterDecision d;
+        d.verdict = Verdict::Deny;
+        d.reason  = std::move(Reason);
+        return d;
+    }
+
+    static FilterDecision ServeFromCache(std::string Body)
+    {
+        FilterDecision d;
+        d.verdict = Verdict::ServeFromCache;
+        d.body    = std::move(Body);
+        return d;
+    }
+
+    static FilterDecision Route(std::string Pool)
+    {
+        FilterDecision d;
+        d.verdict = Verdict::Route;
+        d.pool    = std::move(Pool);
+        return d;
+    }
+
+    bool isAllowed() const { return verdict == Verdict::Allow || verdict == Verdict::Route; }
+};
+
+#endif // FILTERDECISION_H
@@ -0,0 +1,207 @@
+#ifndef FILTERPOLICIES_H
+#define FILTERPOLICIES_H
+
+#include "FilterChain.h"
+#include <unordered_map>
+#include <unordered_set>
+
+/**
+ * Policies to be composed with FilterChain. They're configured before the chain is used, and are
+ * read-only while filtering, so one chain can be shared by all threads.
+ */
+
+/**
+ * Denies requests with a body larger than a limit, without parsing them
+ */
+class BodySizePolicy
+{
+    std::size_t maxBodySize;
+
+public:
+    explicit BodySizePolicy(std::size_t MaxBodySize = (1 << 20)) : maxBodySize(MaxBodySize) {}
+
+    void setMaxBodySize(std::size_t size) { maxBodySize = size; }
+
+    FilterDecision operator()(ParsedRpcRequest& req) const
+    {
+        if (req.http().body().size() > maxBodySize) {
+            return FilterDecision::Deny("Request body is too large\n");
+        }
+        return FilterDecision::Allow();
+    }
+};
+
+/**
+ * Denies requests that are not a json-rpc call, or whose method is not in the list
+ */
+class MethodAllowlistPolicy
+{
+    std::unordered_set<std::string> allowedMethods;
+
+public:
+    void addAllowedMethod(const std::string& method) { allowedMethods.insert(method); }
+
+    FilterDecision operator()(ParsedRpcRequest& req) const
+    {
+        if (!req.isValidCall()) {
+            return FilterDecision::Deny("Request is not a valid json-rpc call\n");
+        }
+        if (allowedMethods.find(req.getMethod()) == allowedMethods.cend()) {
+            return FilterDecision::Deny("Method is not allowed\n");
+        }
+        return FilterDecision::Allow();
+    }
+};
+
+/**
+ * Constrains the shape of the params of some methods; methods without a rule are not checked
+ */
+class ParamsShapePolicy
+{
+public:
+    struct Shape
+    {
+        enum class Kind
+        {
+            Any,    // anything, including no params
+            None,   // no params, null, or an empty array/object
+            Array,  // positional params
+            Object, // named params
+        };
+
+        Kind        kind     = Kind::Any;
+        std::size_t minCount = 0;
+        std::size_t maxCount = SIZE_MAX;
+    };
+
+private:
+    std::unordered_map<std::string, Shape> shapes;
+
+public:
+    void setShape(const std::string& method, Shape shape) { shapes[method] = shape; }
+
+    FilterDecision operator()(ParsedRpcRequest& req) const
+    {
+        if (shapes.empty()) {
+            return FilterDecision::Allow();
+        }
+        auto it = shapes.find(req.getMethod());
+        if (it == shapes.cend() || it->second.kind == Shape::Kind::Any) {
+            return FilterDecision::Allow();
+        }
+        const Shape&             shape    = it->second;
+        const boost::string_view params   = req.getParams();
+        const bool               isArray  = !params.empty() && params.front() == '[';
+        const bool               isObject = !params.empty() && params.front() == '{';
+        std::size_t              count    = 0;
+        if ((isArray || isObject) && !JsonRpcScanner::Count(params, count)) {
+            return FilterDecision::Deny("Invalid params\n");
+        }
+
+        switch (shape.kind) {
+        case Shape::Kind::None:
+            // a scalar is a param too
+            if (!params.empty() && params != "null" && (count > 0 || (!isArray && !isObject))) {
+                return FilterDecision::Deny("Method takes no params\n");
+            }
+            return FilterDecision::Allow();
+        case Shape::Kind::Array:
+            if (!isArray) {
+                return FilterDecision::Deny("Method requires positional params\n");
+            }
+            break;
+        case Shape::Kind::Object:
+            if (!isObject) {
+                return FilterDecision::Deny("Method requires named params\n");
+            }
+            break;
+        case Shape::Kind::Any:
+            break;
+        }
+        if (count < shape.minCount || count > shape.maxCount) {
+            return FilterDecision::Deny("Invalid number of params\n");
+        }
+        return FilterDecision::Allow();
+    }
+};
+
+/**
+ * Routes methods to named upstream pools; methods without a route go to the default upstream
+ */
+class MethodRoutingPolicy
+{
+    std::unordered_map<std::string, std::string> routes;
+
+public:
+    void setRoute(const std::string& method, const std::string& pool) { routes[method] = pool; }
+
+    FilterDecision operator()(ParsedRpcRequest& req) const
+    {
+        if (routes.empty()) {
+            return FilterDecision::Allow();
+        }
+        auto it = routes.find(req.getMethod());
+        if (it == routes.cend()) {
+            return FilterDecision::Allow();
+        }
+        return FilterDecision::Route(it->second);
+    }
+};
+
+/**
+ * Gives the calls of some methods a priority class, for the scheduling of their upstream calls
+ * (see Relay::enablePriorityClasses); other methods get the default class
+ */
+class MethodPriorityPolicy
+{
+    std::unordered_map<std::string, std::string> classes;
+
+public:
+    void setPriorityClass(const std::string& method, const std::string& priorityClass)
+    {
+        classes[method] = priorityClass;
+    }
+
+    FilterDecision operator()(ParsedRpcRequest& req) const
+    {
+        if (classes.empty()) {
+            return FilterDecision::Allow();
+        }
+        auto it = classes.find(req.getMethod());
+        if (it == classes.cend()) {
+            return FilterDecision::Allow();
+        }
+        return FilterDecision::Allow(it->second);
+    }
+};
+
+/**
+ * Answers methods whose result never changes (e.g., constants of the node) from a fixed table,
+ * without contacting the upstream
+ */
+class StaticResultPolicy
+{
+    std::unordered_map<std::string, std::string> results; // method -> json result
+
+public:
+    void setResult(const std::string& method, const std::string& jsonResult)
+    {
+        results[method] = jsonResult;
+    }
+
+    FilterDecision operator()(ParsedRpcRequest& req) const
+    {
+        if (results.empty()) {
+            return FilterDecision::Allow();
+        }
+        auto it = results.find(req.getMethod());
+        if (it == results.cend()) {
+            return FilterDecision::Allow();
+        }
+        const boost::string_view id = req.getId();
+        return FilterDecision::ServeFromCache(R"({"result":)" + it->second + R"(,"error":null,"id":)" +
+                                              (id.empty() ? std::string("null") : id.to_string()) + "}");
+    }
+};
+
+#endif // FILTERPOLICIES_H
@@ -1,67 +1,77 @@
 #include "JsonRPCFilter.h"
 
-#include "JsonStringQueue.h"
+#include "JsonRpcScanner.h"
 #include "Logging/DefaultLogger.h"
 #include <boost/algorithm/string.hpp>
 #include <boost/algorithm/string/split.hpp>
 #include <iostream>
-#include <jsoncpp/json/json.h>
 
 JsonRPCFilter::JsonRPCFilter() {}
 
 bool JsonRPCFilter::operator()(const boost::beast::http::request<boost::beast::http::string_body>& req)
 {
-    try {
-        std::string body = req.body();
-        {
-            JsonStringQueue jsonStringQueue; // used to ensure that only one json command is there
-            jsonStringQueue.pushData(body);
-            auto vec = jsonStringQueue.pullDataAndClear();
-            if (vec.size() == 0) {
-                LogWrite("No json input found in body: " + body, b_sev::warn);
-                return false;
-            }
-            if (vec.size() > 1) {
-                LogWrite("Multiple json calls were found in the body: " + body, b_sev::warn);
-                return false;
-            }
-            assert(vec.size() == 1);
-        }
+    return decide(req).isAllowed();
+}
 
-        Json::Reader reader;
-        Json::Value  root;
-        if (!reader.parse(body, root, false)) {
-            LogWrite("Failed to parse json: " + body, b_sev::warn);
-            return false;
-        }
+FilterDecision
+JsonRPCFilter::decide(const boost::beast::http::request<boost::beast::http::string_body>& req)
+{
+    static const char* const DENIED = "Failed to validate request\n";
 
-        if (!root.isMember("method")) {
-            LogWrite("Failed to find method key in json: " + body, b_sev::warn);
-            return false;
-        }
+    try {
+        const std::string& body = req.body();
 
-        std::string methodName = root["method"].asString();
+        // one pass checks that the body is exactly one call, extracts the method and checks the params
+        JsonRpcCall call;
+        if (!JsonRpcScanner::Scan(body, &paramsRules, call)) {
+            LogWrite("Rejected json-rpc call (" + call.error + "): " + body, b_sev::warn);
+            return FilterDecision::Deny(DENIED);
+        }
 
-        auto it = allowedMethods.find(methodName);
+        auto it = allowedMethods.find(call.method);
 
         if (it == allowedMethods.cend()) {
-            // method is not in the list of allowed methods, return false
+            // method is not in the list of allowed methods, deny it
             LogWrite(
                 "The following jsonrpc with method is not allowed, but was attempted to be executed: " +
                     body,
                 b_sev::warn);
-            return false;
+            FilterDecision denied = FilterDecision::Deny(DENIED);
+            denied.method         = std::move(call.method);
+            denied.scanned        = true;
+            denied.id             = call.id;
+            denied.params         = call.params;
+            return denied;
         }
 
-        return true;
+        FilterDecision allowed;
+        if (!priorityClasses.empty()) {
+            auto priority = priorityClasses.find(call.method);
+            if (priority != priorityClasses.cend()) {
+                allowed.priorityClass = priority->second;
+            }
+        }
+        if (!routingTable.empty()) {
+            const std::string* pool = routingTable.route(
+                call.method, boost::string_view(body).substr(call.params.offset, call.params.size));
+            if (pool) {
+                allowed.verdict = FilterDecision::Verdict::Route;
+                allowed.pool    = *pool;
+            }
+        }
+        allowed.method  = std::move(call.method);
+        allowed.scanned = true;
+        allowed.id      = call.id;
+        allowed.params  = call.params;
+        return allowed;
 
     } catch (std::exception& ex) {
         LogWrite("Error (std::exception) while testing json data: " + std::string(ex.what()),
                  b_sev::warn);
-        return false;
+        return FilterDecision::Deny(DENIED);
     } catch (...) {
         LogWrite("Error (unknown exception) while testing json data", b_sev::warn);
-        return false;
+        return FilterDecision::Deny(DENIED);
     }
 }
 
@@ -75,19 +85,43 @@ void JsonRPCFilter::removeAllowedMethodIfExists(const std::string& methodName)
     allowedMethods.erase(methodName);
 }
 
-bool JsonRPCFilter::allowedMethodExists(const std::string& methodName)
+bool JsonRPCFilter::allowedMethodExists(const std::string& methodName) const
 {
     return allowedMethods.find(methodName) != allowedMethods.cend();
 }
 
 void JsonRPCFilter::applyOptions(const std::string& options)
 {
-    // options here is a comma separated list of methods to be allowed
+    // options here is a comma separated list of methods to be allowed, optionally as method:class
     std::vector<std::string> methods;
     boost::split(methods, options, boost::is_any_of(","), boost::token_compress_on);
     for (std::string& m : methods) {
+        const std::size_t colon = m.find(':');
+        if (colon != std::string::npos) {
+            setPriorityClass(boost::trim_copy(m.substr(0, colon)),
+                             boost::trim_copy(m.substr(colon + 1)));
+            m.erase(colon);
+        }
         boost::trim(m);
     }
     allowedMethods.insert(std::make_move_iterator(methods.begin()),
                           std::make_move_iterator(methods.end()));
 }
+
+void JsonRPCFilter::setPriorityClass(const std::string& methodName, const std::string& priorityClass)
+{
+    if (priorityClass.empty()) {
+        priorityClasses.erase(methodName);
+    } else {
+        priorityClasses[methodName] = priorityClass;
+    }
+}
+
+void JsonRPCFilter::setParamsRules(ParamsRuleSet rules) { paramsRules = std::move(rules); }
+
+void JsonRPCFilter::setRoutingTable(RoutingTable table) { routingTable = std::move(table); }
+
+void JsonRPCFilter::applyParamsRules(const std::string& rulesText)
+{
+    paramsRules = ParamsRuleSet::Compile(rulesText);
+}
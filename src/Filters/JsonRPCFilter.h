@@ -1,23 +1,47 @@
 #ifndef JSONRPCFILTER_H
 #define JSONRPCFILTER_H
 
+#include "FilterDecision.h"
+#include "ParamsRules.h"
+#include "RoutingTable.h"
 #include <boost/beast/http.hpp>
 #include <string>
+#include <unordered_map>
 #include <unordered_set>
 
 class JsonRPCFilter
 {
-    std::unordered_set<std::string> allowedMethods;
+    std::unordered_set<std::string>              allowedMethods;
+    std::unordered_map<std::string, std::string> priorityClasses;
+    ParamsRuleSet                                paramsRules;
+    RoutingTable                                 routingTable;
 
 public:
     JsonRPCFilter();
 
     bool operator()(const boost::beast::http::request<boost::beast::http::string_body>& req);
 
+    // allows or denies the request, gives allowed calls the priority class of their method, and routes
+    // them to the upstream pool of their route, if there's one
+    FilterDecision decide(const boost::beast::http::request<boost::beast::http::string_body>& req);
+
     void addAllowedMethod(const std::string& methodName);
     void removeAllowedMethodIfExists(const std::string& methodName);
-    bool allowedMethodExists(const std::string& methodName);
+    bool allowedMethodExists(const std::string& methodName) const;
+    // a comma separated list of allowed methods; method:class also gives the method a priority class
     void applyOptions(const std::string& options);
+
+    // the priority class of the calls of an allowed method; see Relay::enablePriorityClasses
+    void setPriorityClass(const std::string& methodName, const std::string& priorityClass);
+
+    // params constraints of allowed methods, checked while the request is scanned; see ParamsRules.h
+    void setParamsRules(ParamsRuleSet rules);
+    // compiles the rules; throws std::runtime_error if they're invalid
+    void applyParamsRules(const std::string& rulesText);
+
+    // the upstream pools of allowed calls, picked while the request is scanned; see RoutingTable.h
+    void setRoutingTable(RoutingTable table);
+    const RoutingTable& getRoutingTable() const { return routingTable; }
 };
 
 #endif // JSONRPCFILTER_H
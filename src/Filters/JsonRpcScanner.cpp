@@ -0,0 +1,597 @@
+#include "JsonRpcScanner.h"
+
+#include <cstdlib>
+#include <cstring>
+
+namespace {
+
+class Cursor
+{
+    static const int MAX_DEPTH = 64;
+
+    const char*          begin;
+    const char*          p;
+    const char*          end;
+    const ParamsRuleSet* rules;
+    int                  depth = 0;
+    std::string&         error;
+
+public:
+    Cursor(boost::string_view text, const ParamsRuleSet* Rules, std::string& Error)
+        : begin(text.data()), p(text.data()), end(text.data() + text.size()), rules(Rules), error(Error)
+    {
+    }
+
+    std::size_t offset() const { return static_cast<std::size_t>(p - begin); }
+
+    bool fail(const char* why)
+    {
+        if (error.empty()) {
+            error = why;
+        }
+        return false;
+    }
+
+    void ws()
+    {
+        while (p < end && (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r')) {
+            ++p;
+        }
+    }
+
+    bool atEnd()
+    {
+        ws();
+        return p == end;
+    }
+
+    bool consume(char c)
+    {
+        ws();
+        if (p < end && *p == c) {
+            ++p;
+            return true;
+        }
+        return false;
+    }
+
+    static int HexValue(char c)
+    {
+        if (c >= '0' && c <= '9') {
+            return c - '0';
+        }
+        if (c >= 'a' && c <= 'f') {
+            return c - 'a' + 10;
+        }
+        if (c >= 'A' && c <= 'F') {
+            return c - 'A' + 10;
+        }
+        return -1;
+    }
+
+    static void AppendUtf8(std::string& out, uint32_t cp)
+    {
+        if (cp < 0x80) {
+            out += static_cast<char>(cp);
+        } else if (cp < 0x800) {
+            out += static_cast<char>(0xC0 | (cp >> 6));
+            out += static_cast<char>(0x80 | (cp & 0x3F));
+        } else {
+            out += static_cast<char>(0xE0 | (cp >> 12));
+            out += static_cast<char>(0x80 | ((cp >> 6) & 0x3F));
+            out += static_cast<char>(0x80 | (cp & 0x3F));
+        }
+    }
+
+    /**
+     * A string at p; it's decoded into out if given, and checked against check if given. Surrogate pairs
+     * are decoded as two separate characters, which is enough for method names and ascii patterns.
+     */
+    bool string(std::string* out, const ParamCheck* check)
+    {
+        ++p; // '"'
+        uint32_t length = 0;
+        while (true) {
+            if (p == end) {
+                return fail("Unterminated string");
+            }
+            const unsigned char c = static_cast<unsigned char>(*p++);
+            uint32_t            decoded;
+            if (c == '"') {
+                break;
+            } else if (c == '\\') {
+                if (p == end) {
+                    return fail("Unterminated string");
+                }
+                switch (*p++) {
+                case '"': decoded = '"'; break;
+                case '\\': decoded = '\\'; break;
+                case '/': decoded = '/'; break;
+                case 'b': decoded = '\b'; break;
+                case 'f': decoded = '\f'; break;
+                case 'n': decoded = '\n'; break;
+                case 'r': decoded = '\r'; break;
+                case 't': decoded = '\t'; break;
+                case 'u': {
+                    if (end - p < 4) {
+                        return fail("Invalid escape in string");
+                    }
+                    decoded = 0;
+                    for (int i = 0; i < 4; i++) {
+                        const int h = HexValue(*p++);
+                        if (h < 0) {
+                            return fail("Invalid escape in string");
+                        }
+                        decoded = (decoded << 4) | static_cast<uint32_t>(h);
+                    }
+                    break;
+                }
+                default:
+                    return fail("Invalid escape in string");
+                }
+            } else if (c < 0x20) {
+                return fail("Control character in string");
+            } else {
+                decoded = c;
+            }
+
+            if (check && check->hasCharset &&
+                (decoded >= 128 || !check->allowsChar(static_cast<unsigned char>(decoded)))) {
+                return fail("String param has a character that is not allowed");
+            }
+            if (out) {
+                if (c == '\\') {
+                    AppendUtf8(*out, decoded);
+                } else {
+                    *out += static_cast<char>(c); // raw utf-8 bytes are kept as they are
+                }
+            }
+            length++;
+        }
+        if (check && (length < check->minLength || length > check->maxLength)) {
+            return fail("String param has an invalid length");
+        }
+        return true;
+    }
+
+    bool number(const ParamCheck* check)
+    {
+        const char* start    = p;
+        bool        integral = true;
+        auto        digits   = [this]() {
+            const char* s = p;
+            while (p < end && *p >= '0' && *p <= '9') {
+                ++p;
+            }
+            return p != s;
+        };
+
+        if (*p == '-') {
+            ++p;
+        }
+        if (p < end && *p == '0') {
+            ++p;
+        } else if (!digits()) {
+            return fail("Invalid number");
+        }
+        if (p < end && *p == '.') {
+            ++p;
+            integral = false;
+            if (!digits()) {
+                return fail("Invalid number");
+            }
+        }
+        if (p < end && (*p == 'e' || *p == 'E')) {
+            ++p;
+            integral = false;
+            if (p < end && (*p == '+' || *p == '-')) {
+                ++p;
+            }
+            if (!digits()) {
+                return fail("Invalid number");
+            }
+        }
+
+        if (check) {
+            if (check->integerOnly && !integral) {
+                return fail("Param must be an integer");
+            }
+            if (check->hasRange) {
+                const double value = std::strtod(std::string(start, p).c_str(), nullptr);
+                if (value < check->minValue || value > check->maxValue) {
+                    return fail("Numeric param is out of range");
+                }
+            }
+        }
+        return true;
+    }
+
+    bool literal(const char* word, std::size_t size)
+    {
+        if (static_cast<std::size_t>(end - p) < size || std::memcmp(p, word, size) != 0) {
+            return fail("Invalid literal");
+        }
+        p += size;
+        return true;
+    }
+
+    bool kindAllowed(const ParamCheck* check, uint8_t kind)
+    {
+        if (check && !(check->kinds & kind)) {
+            return fail("Param has the wrong type");
+        }
+        return true;
+    }
+
+    // any value; checked against check if given
+    bool value(const ParamCheck* check)
+    {
+        ws();
+        if (p == end) {
+            return fail("Unexpected end of json");
+        }
+        switch (*p) {
+        case '"':
+            return kindAllowed(check, ParamsKind::String) && string(nullptr, check);
+        case '{':
+            return kindAllowed(check, ParamsKind::Object) && object();
+        case '[':
+            return kindAllowed(check, ParamsKind::Array) && array(check);
+        case 't':
+            return kindAllowed(check, ParamsKind::Bool) && literal("true", 4);
+        case 'f':
+            return kindAllowed(check, ParamsKind::Bool) && literal("false", 5);
+        case 'n':
+            return kindAllowed(check, ParamsKind::Null) && literal("null", 4);
+        default:
+            if (*p == '-' || (*p >= '0' && *p <= '9')) {
+                return kindAllowed(check, ParamsKind::Number) && number(check);
+            }
+            return fail("Invalid json value");
+        }
+    }
+
+    bool array(const ParamCheck* check)
+    {
+        if (++depth > MAX_DEPTH) {
+            return fail("Json is nested too deeply");
+        }
+        ++p; // '['
+        const ParamCheck* element = check && check->element >= 0
+                                        ? &rules->getCheck(static_cast<uint32_t>(check->element))
+                                        : nullptr;
+        uint32_t count = 0;
+        if (!consume(']')) {
+            do {
+                if (!value(element)) {
+                    return false;
+                }
+                count++;
+            } while (consume(','));
+            if (!consume(']')) {
+                return fail("Expected ',' or ']' in array");
+            }
+        }
+        if (check && (count < check->minItems || count > check->maxItems)) {
+            return fail("Array param has an invalid number of elements");
+        }
+        depth--;
+        return true;
+    }
+
+    // the key of an object member, up to and including the ':'
+    bool key(std::string& out)
+    {
+        ws();
+        if (p == end || *p != '"') {
+            return fail("Expected a string key in object");
+        }
+        out.clear();
+        if (!string(&out, nullptr)) {
+            return false;
+        }
+        if (!consume(':')) {
+            return fail("Expected ':' in object");
+        }
+        return true;
+    }
+
+    bool object()
+    {
+        if (++depth > MAX_DEPTH) {
+            return fail("Json is nested too deeply");
+        }
+        ++p; // '{'
+        std::string k;
+        if (!consume('}')) {
+            do {
+                if (!key(k) || !value(nullptr)) {
+                    return false;
+                }
+            } while (consume(','));
+            if (!consume('}')) {
+                return fail("Expected ',' or '}' in object");
+            }
+        }
+        depth--;
+        return true;
+    }
+
+    // the params value, checked against the rule of the method if there's one
+    bool params(const MethodParamsRule* rule)
+    {
+        if (!rule) {
+            return value(nullptr);
+        }
+        ws();
+        if (p == end) {
+            return fail("Unexpected end of json");
+        }
+
+        if (*p == '[') {
+            ++p;
+            std::size_t index = 0;
+            if (!consume(']')) {
+                do {
+                    if (index >= rule->params.size()) {
+                        return fail("Too many params");
+                    }
+                    if (!value(&rules->getCheck(rule->params[index].check))) {
+                        return false;
+                    }
+                    index++;
+                } while (consume(','));
+                if (!consume(']')) {
+                    return fail("Expected ',' or ']' in array");
+                }
+            }
+            if (index < rule->requiredCount) {
+                return fail("Missing params");
+            }
+            return true;
+        }
+
+        if (*p == '{') {
+            if (!rule->allNamed) {
+                return fail("Method does not accept named params");
+            }
+            ++p;
+            uint64_t    seen = 0;
+            std::string k;
+            if (!consume('}')) {
+                do {
+                    if (!key(k)) {
+                        return false;
+                    }
+                    std::size_t index = 0;
+                    while (index < rule->params.size() && rule->params[index].name != k) {
+                        index++;
+                    }
+                    if (index == rule->params.size()) {
+                        return fail("Unknown named param");
+                    }
+                    if (seen & (uint64_t(1) << index)) {
+                        return fail("Duplicate named param");
+                    }
+                    seen |= uint64_t(1) << index;
+                    if (!value(&rules->getCheck(rule->params[index].check))) {
+                        return false;
+                    }
+                } while (consume(','));
+                if (!consume('}')) {
+                    return fail("Expected ',' or '}' in object");
+                }
+            }
+            for (std::size_t i = 0; i < rule->requiredCount; i++) {
+                if (!(seen & (uint64_t(1) << i))) {
+                    return fail("Missing params");
+                }
+            }
+            return true;
+        }
+
+        if (*p == 'n') {
+            if (!literal("null", 4)) {
+                return false;
+            }
+            return rule->requiredCount == 0 ? true : fail("Missing params");
+        }
+
+        return fail("Params must be an array or an object");
+    }
+
+    // the span of the value of a member of the top level object
+    bool member(boost::string_view name, JsonSpan& span)
+    {
+        ws();
+        if (p == end || *p != '{') {
+            return fail("Body is not a json object");
+        }
+        ++p;
+        depth++;
+
+        bool        found = false;
+        std::string k;
+        if (!consume('}')) {
+            do {
+                if (!key(k)) {
+                    return false;
+                }
+                ws();
+                const std::size_t valueStart = offset();
+                if (!value(nullptr)) {
+                    return false;
+                }
+                if (!found && k == name) {
+                    found = true;
+                    span  = JsonSpan{valueStart, offset() - valueStart};
+                }
+            } while (consume(','));
+            if (!consume('}')) {
+                return fail("Expected ',' or '}' in object");
+            }
+        }
+        return found ? true : fail("Member not found");
+    }
+
+    // the spans of the elements of a top level array (e.g., a batch response)
+    bool elements(std::vector<JsonSpan>& spans)
+    {
+        ws();
+        if (p == end || *p != '[') {
+            return fail("Body is not a json array");
+        }
+        ++p;
+        depth++;
+
+        if (!consume(']')) {
+            do {
+                ws();
+                const std::size_t valueStart = offset();
+                if (!value(nullptr)) {
+                    return false;
+                }
+                spans.push_back(JsonSpan{valueStart, offset() - valueStart});
+            } while (consume(','));
+            if (!consume(']')) {
+                return fail("Expected ',' or ']' in array");
+            }
+        }
+        return atEnd() ? true : fail("Body has data after the json array");
+    }
+
+    // the number of elements of an array or members of an object, at the top level
+    bool count(std::size_t& n)
+    {
+        ws();
+        if (p == end || (*p != '[' && *p != '{')) {
+            return fail("Json is not an array or an object");
+        }
+        const bool  isObject = *p == '{';
+        const char  close    = isObject ? '}' : ']';
+        std::string k;
+        ++p;
+        depth++;
+
+        n = 0;
+        if (!consume(close)) {
+            do {
+                if ((isObject && !key(k)) || !value(nullptr)) {
+                    return false;
+                }
+                n++;
+            } while (consume(','));
+            if (!consume(close)) {
+                return fail(isObject ? "Expected ',' or '}' in object" : "Expected ',' or ']' in array");
+            }
+        }
+        return atEnd() ? true : fail("Json has data after its end");
+    }
+
+    bool call(JsonRpcCall& result)
+    {
+        ws();
+        if (p == end || *p != '{') {
+            return fail("Body is not a json object");
+        }
+        ++p;
+        depth++;
+
+        bool        haveMethod = false;
+        bool        haveParams = false;
+        bool        haveId     = false;
+        bool        deferred   = false; // params came before the method
+        std::string k;
+        if (!consume('}')) {
+            do {
+                if (!key(k)) {
+                    return false;
+                }
+                ws();
+                const std::size_t valueStart = offset();
+                if (k == "method") {
+                    if (haveMethod) {
+                        return fail("Duplicate method");
+                    }
+                    haveMethod = true;
+                    if (p == end || *p != '"') {
+                        return fail("Method is not a string");
+                    }
+                    if (!string(&result.method, nullptr)) {
+                        return false;
+                    }
+                } else if (k == "params") {
+                    if (haveParams) {
+                        return fail("Duplicate params");
+                    }
+                    haveParams = true;
+                    const MethodParamsRule* rule =
+                        rules && haveMethod ? rules->find(result.method) : nullptr;
+                    deferred = rules && !haveMethod;
+                    if (!params(rule)) {
+                        return false;
+                    }
+                    result.params = JsonSpan{valueStart, offset() - valueStart};
+                } else if (k == "id") {
+                    if (haveId) {
+                        return fail("Duplicate id");
+                    }
+                    haveId = true;
+                    if (!value(nullptr)) {
+                        return false;
+                    }
+                    result.id = JsonSpan{valueStart, offset() - valueStart};
+                } else if (!value(nullptr)) {
+                    return false;
+                }
+            } while (consume(','));
+            if (!consume('}')) {
+                return fail("Expected ',' or '}' in object");
+            }
+        }
+        if (!atEnd()) {
+            return fail("Body has data after the json call");
+        }
+        if (!haveMethod) {
+            return fail("Method not found");
+        }
+
+        const MethodParamsRule* rule = rules ? rules->find(result.method) : nullptr;
+        if (rule && deferred) {
+            boost::string_view paramsText(begin + result.params.offset, result.params.size);
+            return Cursor(paramsText, rules, error).params(rule);
+        }
+        if (rule && !haveParams && rule->requiredCount > 0) {
+            return fail("Missing params");
+        }
+        return true;
+    }
+};
+
+} // namespace
+
+bool JsonRpcScanner::Scan(boost::string_view body, const ParamsRuleSet* rules, JsonRpcCall& call)
+{
+    call = JsonRpcCall();
+    Cursor cursor(body, rules && !rules->empty() ? rules : nullptr, call.error);
+    return cursor.call(call);
+}
+
+bool JsonRpcScanner::FindMember(boost::string_view body, boost::string_view name, JsonSpan& span)
+{
+    std::string error;
+    return Cursor(body, nullptr, error).member(name, span);
+}
+
+bool JsonRpcScanner::SplitArray(boost::string_view body, std::vector<JsonSpan>& elements)
+{
+    std::string error;
+    elements.clear();
+    return Cursor(body, nullptr, error).elements(elements);
+}
+
+bool JsonRpcScanner::Count(boost::string_view json, std::size_t& count)
+{
+    std::string error;
+    return Cursor(json, nullptr, error).count(count);
+}
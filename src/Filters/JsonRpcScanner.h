@@ -0,0 +1,52 @@
+#ifndef JSONRPCSCANNER_H
+#define JSONRPCSCANNER_H
+
+#include "ParamsRules.h"
+#include <boost/utility/string_view.hpp>
+#include <string>
+#include <vector>
+
+// a range of bytes of the scanned body
+struct JsonSpan
+{
+    std::size_t offset = 0;
+    std::size_t size   = 0;
+
+    bool empty() const { return size == 0; }
+};
+
+struct JsonRpcCall
+{
+    std::string method;
+    JsonSpan    id;     // the raw json of the id; empty if there's none
+    JsonSpan    params; // the raw json of the params; empty if there are none
+    std::string error;  // why the body was rejected
+};
+
+/**
+ * Validates a json-rpc call in one pass over the body, without building a DOM: the body must be
+ * exactly one json object (strict json, no trailing data) with a string "method" and at most one
+ * "method", "params" and "id" each. If a rule set is given, the params of methods with a rule are
+ * checked against it while they're scanned, and scanning stops at the first violation.
+ *
+ * Params are checked in the same pass when "method" comes before "params", as clients normally send
+ * them. Otherwise, the span of the params is remembered and only that span is scanned again once the
+ * method is known.
+ */
+class JsonRpcScanner
+{
+public:
+    // returns false, with call.error set, if the body is not a valid call or violates the rules
+    static bool Scan(boost::string_view body, const ParamsRuleSet* rules, JsonRpcCall& call);
+
+    // finds a member of the top level object (e.g., the id of a response); false if it's not there
+    static bool FindMember(boost::string_view body, boost::string_view name, JsonSpan& span);
+
+    // the elements of a json array (e.g., the responses of a batch); false if body is not an array
+    static bool SplitArray(boost::string_view body, std::vector<JsonSpan>& elements);
+
+    // the number of elements of a json array or members of a json object; false if json is neither
+    static bool Count(boost::string_view json, std::size_t& count);
+};
+
+#endif // JSONRPCSCANNER_H
@@ -1,84 +1,227 @@
 #ifndef JSONSTRINGQUEUE_H
 #define JSONSTRINGQUEUE_H
 
-#include <cassert>
-#include <deque>
+#include <algorithm>
+#include <boost/utility/string_view.hpp>
+#include <cstdint>
+#include <cstring>
 #include <stdexcept>
 #include <string>
+#include <utility>
 #include <vector>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
+/**
+ * Splits a stream of json values (objects or arrays, e.g., one per line, as they're read from a socket)
+ * into the values, without parsing them. The stream is kept in one contiguous buffer, and scanned once:
+ * brackets are counted outside of strings only, and escapes in strings are taken into account. Between
+ * values, only whitespace is allowed.
+ *
+ * The values come out as spans into the buffer, which stay valid until the next prepare(), pushData()
+ * or clear(). After an error, nothing more is scanned until clear().
+ */
 class JsonStringQueue
 {
-    static const char     _openChar             = '{';
-    static const char     _closeChar            = '}';
-    static const uint32_t LARGEST_EXPECTED_JSON = (1 << 14);
+public:
+    static const std::size_t DEFAULT_MAX_VALUE_SIZE = 8u << 20;
+
+private:
+    const std::size_t maxValueSize;
+
+    std::string                                      buffer;
+    std::size_t                                      filled      = 0; // the bytes of buffer in use
+    std::size_t                                      scanned     = 0;
+    std::size_t                                      valueStart  = 0;
+    std::size_t                                      stringStart = 0; // the opening quote
+    uint32_t                                         depth       = 0;
+    bool                                             inString    = false;
+    bool                                             failed      = false;
+    std::vector<std::pair<std::size_t, std::size_t>> ready; // offset and size of complete values
 
-    std::deque<char>         dataQueue;
-    std::vector<std::string> parsedValuesQueue;
-    uint32_t                 charCount    = 0;
-    int32_t                  bracketLevel = 0;
-    inline void                     parseAndAppendJson(const std::string& jsonStr);
-    inline void                     parseAndAppendJson(std::string&& jsonStr);
+    // the first '{', '}', '[', ']' or '"' in [p, end), or end
+    static inline const char* FindStructural(const char* p, const char* end);
+    inline void               scan();
+    inline void               fail(const std::string& message);
 
 public:
-    inline void                     pushData(const std::string& data);
+    explicit JsonStringQueue(std::size_t MaxValueSize = DEFAULT_MAX_VALUE_SIZE)
+        : maxValueSize(MaxValueSize)
+    {
+    }
+
+    /**
+     * Returns room for at least size more bytes of the stream, to be filled (e.g., by a socket read)
+     * before commit(); drops the values that were already pulled
+     */
+    inline char* prepare(std::size_t size);
+    // scans the first size bytes written to the room given by prepare(); throws std::runtime_error
+    // on bytes that aren't json values, or a value larger than the maximum size
+    inline void commit(std::size_t size);
+    // prepare() and commit() with a copy of data
+    inline void pushData(boost::string_view data);
+
+    // the values completed since the last pull, in order of the stream
+    inline std::vector<boost::string_view> pullSpans();
+    // pullSpans() with copies of the values
     inline std::vector<std::string> pullDataAndClear();
     inline void                     clear();
 };
 
-void JsonStringQueue::parseAndAppendJson(const std::string& jsonStr)
+const char* JsonStringQueue::FindStructural(const char* p, const char* end)
 {
-    parsedValuesQueue.push_back(jsonStr);
+#ifdef __SSE2__
+    // '[' and '{' (or ']' and '}') differ only in the bit 0x20
+    const __m128i bit   = _mm_set1_epi8(0x20);
+    const __m128i open  = _mm_set1_epi8('{');
+    const __m128i close = _mm_set1_epi8('}');
+    const __m128i quote = _mm_set1_epi8('"');
+    while (end - p >= 16) {
+        const __m128i chunk  = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+        const __m128i folded = _mm_or_si128(chunk, bit);
+        const int     mask   = _mm_movemask_epi8(
+            _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(folded, open), _mm_cmpeq_epi8(folded, close)),
+                         _mm_cmpeq_epi8(chunk, quote)));
+        if (mask != 0) {
+            return p + __builtin_ctz(static_cast<unsigned>(mask));
+        }
+        p += 16;
+    }
+#endif
+    for (; p < end; p++) {
+        const char folded = static_cast<char>(*p | 0x20);
+        if (folded == '{' || folded == '}' || *p == '"') {
+            break;
+        }
+    }
+    return p;
 }
 
-void JsonStringQueue::parseAndAppendJson(std::string&& jsonStr)
+void JsonStringQueue::fail(const std::string& message)
 {
-    parsedValuesQueue.push_back(std::move(jsonStr));
+    failed = true;
+    throw std::runtime_error(message);
 }
 
-void JsonStringQueue::pushData(const std::string& data)
+void JsonStringQueue::scan()
 {
-    dataQueue.insert(dataQueue.end(), data.cbegin(), data.cend());
-    while (charCount < dataQueue.size()) {
-        if (charCount > LARGEST_EXPECTED_JSON) {
-            throw std::runtime_error("Huge unparsed json data");
-        }
-        if (dataQueue[charCount] == _openChar) {
-            bracketLevel++;
-            charCount++;
-            continue;
-        } else if (dataQueue[charCount] == _closeChar) {
-            bracketLevel--;
-            if (bracketLevel < 0) {
-                throw std::runtime_error("Invalid bracket appeared in string: " +
-                                         std::string(dataQueue.cbegin(), dataQueue.cend()));
+    const char* data = buffer.data();
+    std::size_t pos  = scanned;
+    while (pos < filled) {
+        if (inString) {
+            // a quote ends the string unless an odd number of backslashes comes before it
+            const void* q = std::memchr(data + pos, '"', filled - pos);
+            if (q == nullptr) {
+                pos = filled;
+                break;
             }
-            charCount++;
-            if (bracketLevel == 0) {
-                parseAndAppendJson(std::string(dataQueue.begin(), dataQueue.begin() + charCount));
-                dataQueue.erase(dataQueue.begin(), dataQueue.begin() + charCount);
-                charCount -= std::distance(dataQueue.begin(), dataQueue.begin() + charCount);
-                assert(charCount >= 0);
+            const std::size_t quotePos = static_cast<const char*>(q) - data;
+            std::size_t       before   = quotePos - 1;
+            while (before > stringStart && data[before] == '\\') {
+                before--;
             }
-            continue;
+            pos      = quotePos + 1;
+            inString = (quotePos - 1 - before) % 2 == 1;
+        } else if (depth == 0) {
+            const char c = data[pos];
+            if (c == '{' || c == '[') {
+                valueStart = pos;
+                depth      = 1;
+            } else if (c != ' ' && c != '\n' && c != '\r' && c != '\t') {
+                scanned = pos;
+                fail(std::string("Invalid json stream: unexpected '") + c + "' between values");
+            }
+            pos++;
         } else {
-            charCount++;
+            pos = FindStructural(data + pos, data + filled) - data;
+            if (pos == filled) {
+                break;
+            }
+            const char c = data[pos++];
+            if (c == '"') {
+                inString    = true;
+                stringStart = pos - 1;
+            } else if (c == '{' || c == '[') {
+                depth++;
+            } else if (--depth == 0) {
+                if (pos - valueStart > maxValueSize) {
+                    fail("Json value larger than " + std::to_string(maxValueSize) + " bytes");
+                }
+                ready.emplace_back(valueStart, pos - valueStart);
+            }
         }
     }
+    scanned = pos;
+    if (depth > 0 && filled - valueStart > maxValueSize) {
+        fail("Json value larger than " + std::to_string(maxValueSize) + " bytes");
+    }
+}
+
+char* JsonStringQueue::prepare(std::size_t size)
+{
+    // keep the value in progress only; whatever came before it was pulled or is whitespace
+    if (ready.empty()) {
+        const std::size_t keep = depth > 0 ? valueStart : scanned;
+        if (keep > 0) {
+            std::memmove(&buffer[0], buffer.data() + keep, filled - keep);
+            filled      -= keep;
+            scanned     -= keep;
+            valueStart  = depth > 0 ? valueStart - keep : 0;
+            stringStart = inString ? stringStart - keep : 0;
+        }
+    }
+    if (buffer.size() < filled + size) {
+        buffer.resize(std::max(filled + size, buffer.size() * 2));
+    }
+    return &buffer[filled];
+}
+
+void JsonStringQueue::commit(std::size_t size)
+{
+    filled += size;
+    if (!failed) {
+        scan();
+    }
+}
+
+void JsonStringQueue::pushData(boost::string_view data)
+{
+    std::memcpy(prepare(data.size()), data.data(), data.size());
+    commit(data.size());
+}
+
+std::vector<boost::string_view> JsonStringQueue::pullSpans()
+{
+    std::vector<boost::string_view> spans;
+    spans.reserve(ready.size());
+    for (const auto& value : ready) {
+        spans.emplace_back(buffer.data() + value.first, value.second);
+    }
+    ready.clear();
+    return spans;
 }
 
 std::vector<std::string> JsonStringQueue::pullDataAndClear()
 {
-    std::vector<std::string> res = std::move(parsedValuesQueue);
+    std::vector<std::string> res;
+    for (const boost::string_view& span : pullSpans()) {
+        res.emplace_back(span.data(), span.size());
+    }
     return res;
 }
 
 void JsonStringQueue::clear()
 {
-    dataQueue.clear();
-    parsedValuesQueue.clear();
-    charCount    = 0;
-    bracketLevel = 0;
+    buffer.clear();
+    ready.clear();
+    filled      = 0;
+    scanned     = 0;
+    valueStart  = 0;
+    stringStart = 0;
+    depth       = 0;
+    inString    = false;
+    failed      = false;
 }
 
 #endif // JSONSTRINGQUEUE_H
@@ -0,0 +1,396 @@
+#include "ParamsRules.h"
+
+#include <cmath>
+#include <cstdlib>
+#include <stdexcept>
+
+class ParamsRuleCompiler
+{
+    const std::string& text;
+    std::size_t        pos  = 0;
+    uint32_t           line = 1;
+    ParamsRuleSet&     set;
+
+    [[noreturn]] void fail(const std::string& why) const
+    {
+        throw std::runtime_error("Invalid params rules, line " + std::to_string(line) + ": " + why);
+    }
+
+    bool atEnd() const { return pos >= text.size(); }
+    char peek() const { return atEnd() ? '\0' : text[pos]; }
+
+    // skips blanks and comments; newlines are skipped only inside a rule
+    void skipSpace(bool newlines)
+    {
+        while (!atEnd()) {
+            const char c = text[pos];
+            if (c == ' ' || c == '\t' || c == '\r') {
+                pos++;
+            } else if (c == '\n' && newlines) {
+                line++;
+                pos++;
+            } else if (c == '#') {
+                while (!atEnd() && text[pos] != '\n') {
+                    pos++;
+                }
+            } else {
+                break;
+            }
+        }
+    }
+
+    bool accept(char c)
+    {
+        skipSpace(true);
+        if (peek() == c) {
+            pos++;
+            return true;
+        }
+        return false;
+    }
+
+    void expect(char c)
+    {
+        if (!accept(c)) {
+            fail(std::string("expected '") + c + "'");
+        }
+    }
+
+    static bool IsIdentifierChar(char c)
+    {
+        return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '_' ||
+               c == '.' || c == '-';
+    }
+
+    std::string identifier()
+    {
+        skipSpace(true);
+        const std::size_t start = pos;
+        while (!atEnd() && IsIdentifierChar(text[pos])) {
+            pos++;
+        }
+        return text.substr(start, pos - start);
+    }
+
+    // accepts the keyword only if it's a whole word
+    bool acceptKeyword(const char* keyword)
+    {
+        skipSpace(true);
+        const std::size_t saved = pos;
+        if (identifier() == keyword) {
+            return true;
+        }
+        pos = saved;
+        return false;
+    }
+
+    bool atNumber()
+    {
+        skipSpace(true);
+        const char c = peek();
+        return (c >= '0' && c <= '9') || c == '-';
+    }
+
+    // a number literal; a '.' is only part of it if a digit follows, so that "0..1" is a range
+    double number()
+    {
+        skipSpace(true);
+        auto isDigit = [this](std::size_t i) {
+            return i < text.size() && text[i] >= '0' && text[i] <= '9';
+        };
+
+        const std::size_t start = pos;
+        if (peek() == '-') {
+            pos++;
+        }
+        if (!isDigit(pos)) {
+            fail("expected a number");
+        }
+        while (isDigit(pos)) {
+            pos++;
+        }
+        if (peek() == '.' && isDigit(pos + 1)) {
+            pos++;
+            while (isDigit(pos)) {
+                pos++;
+            }
+        }
+        if ((peek() == 'e' || peek() == 'E') &&
+            (isDigit(pos + 1) || ((text[pos + 1] == '+' || text[pos + 1] == '-') && isDigit(pos + 2)))) {
+            pos += 2;
+            while (isDigit(pos)) {
+                pos++;
+            }
+        }
+        return std::strtod(text.substr(start, pos - start).c_str(), nullptr);
+    }
+
+    bool atRange()
+    {
+        skipSpace(true);
+        return atNumber() || text.compare(pos, 2, "..") == 0;
+    }
+
+    // lo..hi, lo.., ..hi or a single value
+    void range(double& lo, double& hi)
+    {
+        lo = -HUGE_VAL;
+        hi = HUGE_VAL;
+        if (atNumber()) {
+            lo = number();
+        }
+        skipSpace(true);
+        if (text.compare(pos, 2, "..") == 0) {
+            pos += 2;
+            if (atNumber()) {
+                hi = number();
+            }
+        } else {
+            hi = lo;
+        }
+        if (lo > hi) {
+            fail("empty range");
+        }
+    }
+
+    void countRange(uint32_t& lo, uint32_t& hi)
+    {
+        double l, h;
+        range(l, h);
+        if (l != -HUGE_VAL && l < 0) {
+            fail("negative length");
+        }
+        lo = l == -HUGE_VAL ? 0 : static_cast<uint32_t>(l);
+        hi = h == HUGE_VAL || h > UINT32_MAX ? UINT32_MAX : static_cast<uint32_t>(h);
+    }
+
+    void charset(ParamCheck& check)
+    {
+        expect('[');
+        bool negate = false;
+        if (peek() == '^') {
+            negate = true;
+            pos++;
+        }
+        auto next = [this]() -> unsigned char {
+            if (atEnd() || text[pos] == '\n') {
+                fail("unterminated character class");
+            }
+            if (text[pos] == '\\') {
+                pos++;
+                if (atEnd()) {
+                    fail("unterminated character class");
+                }
+            }
+            const unsigned char c = static_cast<unsigned char>(text[pos++]);
+            if (c >= 128) {
+                fail("character classes can only contain ascii characters");
+            }
+            return c;
+        };
+        std::array<uint64_t, 2> bits = {{0, 0}};
+        while (peek() != ']') {
+            const unsigned char first = next();
+            unsigned char       last  = first;
+            if (peek() == '-' && pos + 1 < text.size() && text[pos + 1] != ']') {
+                pos++;
+                last = next();
+                if (last < first) {
+                    fail("invalid range in character class");
+                }
+            }
+            for (unsigned c = first; c <= last; c++) {
+                bits[c >> 6] |= uint64_t(1) << (c & 63);
+            }
+        }
+        pos++; // ']'
+        if (negate) {
+            bits[0] = ~bits[0];
+            bits[1] = ~bits[1];
+        }
+        check.hasCharset = true;
+        check.charset    = bits;
+    }
+
+    uint32_t addCheck(const ParamCheck& check)
+    {
+        set.checks.push_back(check);
+        return static_cast<uint32_t>(set.checks.size() - 1);
+    }
+
+    // one alternative of a type, or a parenthesized type
+    ParamCheck alternative()
+    {
+        if (accept('(')) {
+            const uint32_t index = type();
+            expect(')');
+            return set.checks[index];
+        }
+
+        const std::string keyword = identifier();
+        ParamCheck        check;
+        if (keyword == "any") {
+            check.kinds = ParamsKind::Any;
+        } else if (keyword == "null") {
+            check.kinds = ParamsKind::Null;
+        } else if (keyword == "bool") {
+            check.kinds = ParamsKind::Bool;
+        } else if (keyword == "object") {
+            check.kinds = ParamsKind::Object;
+        } else if (keyword == "int" || keyword == "num") {
+            check.kinds       = ParamsKind::Number;
+            check.integerOnly = keyword == "int";
+            if (atRange()) {
+                check.hasRange = true;
+                range(check.minValue, check.maxValue);
+            }
+        } else if (keyword == "str") {
+            check.kinds = ParamsKind::String;
+            skipSpace(true);
+            if (peek() == '[') {
+                charset(check);
+            }
+            if (acceptKeyword("len")) {
+                countRange(check.minLength, check.maxLength);
+            }
+        } else if (keyword == "array") {
+            check.kinds = ParamsKind::Array;
+            if (acceptKeyword("len")) {
+                countRange(check.minItems, check.maxItems);
+            }
+            if (acceptKeyword("of")) {
+                check.element = static_cast<int32_t>(addCheck(alternative()));
+            }
+        } else if (keyword.empty()) {
+            fail("expected a type");
+        } else {
+            fail("unknown type '" + keyword + "'");
+        }
+        return check;
+    }
+
+    // alternatives merged into one check, whose index is returned
+    uint32_t type()
+    {
+        ParamCheck merged = alternative();
+        while (accept('|')) {
+            ParamCheck alt = alternative();
+            if (merged.kinds & alt.kinds) {
+                fail("the alternatives of a param must be of different kinds");
+            }
+            merged.kinds |= alt.kinds;
+            if (alt.kinds & ParamsKind::Number) {
+                merged.integerOnly = alt.integerOnly;
+                merged.hasRange    = alt.hasRange;
+                merged.minValue    = alt.minValue;
+                merged.maxValue    = alt.maxValue;
+            }
+            if (alt.kinds & ParamsKind::String) {
+                merged.hasCharset = alt.hasCharset;
+                merged.charset    = alt.charset;
+                merged.minLength  = alt.minLength;
+                merged.maxLength  = alt.maxLength;
+            }
+            if (alt.kinds & ParamsKind::Array) {
+                merged.minItems = alt.minItems;
+                merged.maxItems = alt.maxItems;
+                merged.element  = alt.element;
+            }
+        }
+        return addCheck(merged);
+    }
+
+    ParamSlot param()
+    {
+        ParamSlot slot;
+
+        // an optional name, followed by ':'
+        const std::size_t saved     = pos;
+        const uint32_t    savedLine = line;
+        std::string       name      = identifier();
+        if (!name.empty() && accept(':')) {
+            slot.name = std::move(name);
+        } else {
+            pos  = saved;
+            line = savedLine;
+        }
+
+        slot.check    = type();
+        slot.optional = accept('?');
+        if (slot.optional) {
+            set.checks[slot.check].kinds |= ParamsKind::Null;
+        }
+        return slot;
+    }
+
+    void rule()
+    {
+        const std::string method = identifier();
+        if (method.empty()) {
+            fail("expected a method name");
+        }
+        if (set.rules.find(method) != set.rules.cend()) {
+            fail("duplicate rule for method '" + method + "'");
+        }
+
+        MethodParamsRule rule;
+        expect('(');
+        if (!accept(')')) {
+            do {
+                rule.params.push_back(param());
+            } while (accept(','));
+            expect(')');
+        }
+
+        rule.requiredCount = rule.params.size();
+        rule.allNamed      = true;
+        for (std::size_t i = 0; i < rule.params.size(); i++) {
+            const ParamSlot& p = rule.params[i];
+            if (p.optional && rule.requiredCount == rule.params.size()) {
+                rule.requiredCount = i;
+            }
+            if (!p.optional && rule.requiredCount != rule.params.size()) {
+                fail("only trailing params can be optional in '" + method + "'");
+            }
+            if (p.name.empty()) {
+                rule.allNamed = false;
+            }
+            for (std::size_t j = 0; j < i; j++) {
+                if (!p.name.empty() && rule.params[j].name == p.name) {
+                    fail("duplicate param name '" + p.name + "' in '" + method + "'");
+                }
+            }
+        }
+        if (rule.params.size() > 64) {
+            fail("too many params in '" + method + "'");
+        }
+        set.rules.emplace(method, std::move(rule));
+    }
+
+public:
+    ParamsRuleCompiler(const std::string& Text, ParamsRuleSet& Set) : text(Text), set(Set) {}
+
+    void compile()
+    {
+        while (true) {
+            skipSpace(true);
+            while (accept(';')) {
+            }
+            if (atEnd()) {
+                break;
+            }
+            rule();
+            skipSpace(false);
+            if (!atEnd() && peek() != '\n' && peek() != ';') {
+                fail("unexpected text after rule");
+            }
+        }
+    }
+};
+
+ParamsRuleSet ParamsRuleSet::Compile(const std::string& text)
+{
+    ParamsRuleSet set;
+    ParamsRuleCompiler(text, set).compile();
+    return set;
+}
@@ -0,0 +1,124 @@
+#ifndef PARAMSRULES_H
+#define PARAMSRULES_H
+
+#include <array>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/**
+ * Constraints on the params of json-rpc methods, written in a small rule language and compiled once
+ * into flat tables, which JsonRpcScanner checks while it scans a request. One rule per line (or
+ * separated by ';'), '#' starts a comment:
+ *
+ *     getblock(blockhash: str [0-9a-fA-F] len 64, verbosity: int 0..1?)
+ *     getblockhash(int 0..900000)
+ *     getrawtransaction(str [0-9a-fA-F] len 64, bool | int 0..1?, str?)
+ *     getblockcount()
+ *
+ * Each param is `[name:] type ['|' type]... ['?']`; a trailing '?' makes it optional (optional params
+ * may also be null), and only trailing params can be optional. Types:
+ *
+ *     any                         anything
+ *     null, bool, object          a value of that kind (objects are not looked into)
+ *     int [range]                 an integer literal (no fraction or exponent), e.g., int 0..2, int ..10
+ *     num [range]                 any number
+ *     str [charset] [len range]   a string; [charset] is like a regex class, e.g., [0-9a-f] or [^"\\]
+ *                                 (ascii only); len counts bytes, escapes count as one byte
+ *     array [len range] [of type] an array; `of` constrains every element (use parentheses for
+ *                                 alternatives, e.g., array of (int | str))
+ *
+ * where a range is `lo..hi`, `lo..`, `..hi` or a single value. The alternatives of a param must be of
+ * different kinds (e.g., `int | str`, but not `int 0..1 | int 5..6`), so a value is checked by
+ * looking at its first character only.
+ *
+ * Params can be positional (an array) or named (an object); named params require every param of the
+ * rule to have a name. Methods without a rule are not checked.
+ */
+
+namespace ParamsKind {
+enum : uint8_t
+{
+    Null   = 1 << 0,
+    Bool   = 1 << 1,
+    Number = 1 << 2,
+    String = 1 << 3,
+    Array  = 1 << 4,
+    Object = 1 << 5,
+    Any    = Null | Bool | Number | String | Array | Object
+};
+}
+
+/**
+ * One compiled check of a json value. The fields of a kind only apply to values of that kind.
+ */
+struct ParamCheck
+{
+    uint8_t kinds = ParamsKind::Any;
+
+    // Number
+    bool   integerOnly = false;
+    bool   hasRange    = false;
+    double minValue    = 0;
+    double maxValue    = 0;
+
+    // String; the charset is a bitmap of the allowed ascii characters
+    bool                    hasCharset = false;
+    std::array<uint64_t, 2> charset    = {{0, 0}};
+    uint32_t                minLength  = 0;
+    uint32_t                maxLength  = UINT32_MAX;
+
+    // Array; element is the index of the check of the elements, or -1
+    uint32_t minItems = 0;
+    uint32_t maxItems = UINT32_MAX;
+    int32_t  element  = -1;
+
+    bool allowsChar(unsigned char c) const
+    {
+        return !hasCharset || (c < 128 && ((charset[c >> 6] >> (c & 63)) & 1));
+    }
+};
+
+struct ParamSlot
+{
+    std::string name; // empty for positional-only params
+    uint32_t    check;
+    bool        optional;
+};
+
+struct MethodParamsRule
+{
+    std::vector<ParamSlot> params;
+    std::size_t            requiredCount = 0; // params before the first optional one
+    bool                   allNamed      = false;
+};
+
+class ParamsRuleSet
+{
+    std::vector<ParamCheck>                           checks;
+    std::unordered_map<std::string, MethodParamsRule> rules;
+
+    friend class ParamsRuleCompiler;
+
+public:
+    /**
+     * Compiles rules written in the language above; throws std::runtime_error with the line and
+     * the reason if the text is invalid
+     */
+    static ParamsRuleSet Compile(const std::string& text);
+
+    // nullptr if the method has no rule
+    const MethodParamsRule* find(const std::string& method) const
+    {
+        auto it = rules.find(method);
+        return it == rules.cend() ? nullptr : &it->second;
+    }
+
+    const ParamCheck& getCheck(uint32_t index) const { return checks[index]; }
+
+    bool        empty() const { return rules.empty(); }
+    std::size_t size() const { return rules.size(); }
+};
+
+#endif // PARAMSRULES_H
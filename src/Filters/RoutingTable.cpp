@@ -0,0 +1,162 @@
+#include "RoutingTable.h"
+
+#include "JsonRpcScanner.h"
+#include <algorithm>
+#include <boost/algorithm/string.hpp>
+#include <fnmatch.h>
+#include <stdexcept>
+
+namespace {
+
+bool IsInteger(boost::string_view text)
+{
+    const std::size_t digits = !text.empty() && text[0] == '-' ? 1 : 0;
+    return text.size() > digits && text.size() - digits <= 18 &&
+           text.find_first_not_of("0123456789", digits) == boost::string_view::npos;
+}
+
+} // namespace
+
+void RoutingTable::addRoute(const std::string& text)
+{
+    // the = of the pool is the last one, after the predicates (which have == and the like)
+    const std::size_t open   = text.find('(');
+    const std::size_t close  = text.rfind(')');
+    const std::size_t assign = text.rfind('=');
+    if (assign == std::string::npos || (open != std::string::npos) != (close != std::string::npos) ||
+        (open != std::string::npos && (close < open || assign < close))) {
+        throw std::runtime_error("Invalid route (expected pattern[(predicates)]=pool): " + text);
+    }
+
+    Route route;
+    route.pattern = boost::trim_copy(text.substr(0, std::min(open, assign)));
+    route.glob    = route.pattern.find_first_of("*?[") != std::string::npos;
+    route.pool    = boost::trim_copy(text.substr(assign + 1));
+    if (route.pattern.empty() || route.pool.empty()) {
+        throw std::runtime_error("Invalid route (a pattern or a pool is missing): " + text);
+    }
+    if (open != std::string::npos &&
+        !boost::trim_copy(text.substr(close + 1, assign - close - 1)).empty()) {
+        throw std::runtime_error("Invalid route (expected = after the predicates): " + text);
+    }
+
+    if (open != std::string::npos) {
+        const std::string predicates = text.substr(open + 1, close - open - 1);
+        std::size_t       start      = 0;
+        while (start <= predicates.size()) {
+            const std::size_t end  = std::min(predicates.find("&&", start), predicates.size());
+            const std::string item = boost::trim_copy(predicates.substr(start, end - start));
+            start                  = end + 2;
+
+            const std::size_t digits = item.find_first_not_of("0123456789", 1);
+            if (item.size() < 2 || item[0] != '$' || digits == 1) {
+                throw std::runtime_error("Invalid route predicate (expected $N[op value]): " + item);
+            }
+            Predicate predicate;
+            predicate.index = std::stoul(item.substr(1, digits - 1));
+            if (digits != std::string::npos) {
+                static const std::pair<const char*, Predicate::Op> ops[] = {
+                    {"<=", Predicate::Op::LessEqual}, {">=", Predicate::Op::GreaterEqual},
+                    {"==", Predicate::Op::Equal},     {"!=", Predicate::Op::NotEqual},
+                    {"<", Predicate::Op::Less},       {">", Predicate::Op::Greater}};
+                const std::string rest = boost::trim_left_copy(item.substr(digits));
+                std::size_t       size = 0;
+                for (const auto& op : ops) {
+                    if (boost::starts_with(rest, op.first)) {
+                        predicate.op = op.second;
+                        size         = std::char_traits<char>::length(op.first);
+                        break;
+                    }
+                }
+                predicate.value = boost::trim_copy(rest.substr(size));
+                if (size == 0 || predicate.value.empty()) {
+                    throw std::runtime_error("Invalid route predicate (expected $N[op value]): " + item);
+                }
+                if (predicate.op != Predicate::Op::Equal && predicate.op != Predicate::Op::NotEqual) {
+                    if (!IsInteger(predicate.value)) {
+                        throw std::runtime_error("Invalid route predicate (expected an integer): " + item);
+                    }
+                    predicate.number = std::stoll(predicate.value);
+                }
+            }
+            route.predicates.push_back(std::move(predicate));
+        }
+    }
+    routes.push_back(std::move(route));
+}
+
+std::set<std::string> RoutingTable::getPools() const
+{
+    std::set<std::string> pools;
+    for (const Route& route : routes) {
+        pools.insert(route.pool);
+    }
+    if (!fallbackPool.empty()) {
+        pools.insert(fallbackPool);
+    }
+    return pools;
+}
+
+bool RoutingTable::Matches(const Predicate& predicate, const std::vector<boost::string_view>& params)
+{
+    if (predicate.index >= params.size()) {
+        return false;
+    }
+    const boost::string_view param = params[predicate.index];
+    switch (predicate.op) {
+    case Predicate::Op::Present:
+        return param != "null";
+    case Predicate::Op::Equal:
+        return param == predicate.value;
+    case Predicate::Op::NotEqual:
+        return param != predicate.value;
+    default:
+        break;
+    }
+    if (!IsInteger(param)) {
+        return false;
+    }
+    const int64_t number = std::stoll(param.to_string());
+    switch (predicate.op) {
+    case Predicate::Op::Less:
+        return number < predicate.number;
+    case Predicate::Op::LessEqual:
+        return number <= predicate.number;
+    case Predicate::Op::Greater:
+        return number > predicate.number;
+    default:
+        return number >= predicate.number;
+    }
+}
+
+const std::string* RoutingTable::route(const std::string& method, boost::string_view params) const
+{
+    // split once, and only for the routes with predicates
+    std::vector<boost::string_view> elements;
+    bool                            split = false;
+
+    for (const Route& route : routes) {
+        const bool named = route.glob ? fnmatch(route.pattern.c_str(), method.c_str(), 0) == 0
+                                      : route.pattern == method;
+        if (!named) {
+            continue;
+        }
+        if (!route.predicates.empty() && !split) {
+            std::vector<JsonSpan> spans;
+            if (!params.empty() && JsonRpcScanner::SplitArray(params, spans)) {
+                for (const JsonSpan& span : spans) {
+                    elements.push_back(params.substr(span.offset, span.size));
+                }
+            }
+            split = true;
+        }
+        bool matches = true;
+        for (const Predicate& predicate : route.predicates) {
+            matches = matches && Matches(predicate, elements);
+        }
+        if (matches) {
+            return &route.pool;
+        }
+    }
+    return fallbackPool.empty() ? nullptr : &fallbackPool;
+}
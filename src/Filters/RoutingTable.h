@@ -0,0 +1,76 @@
+#ifndef ROUTINGTABLE_H
+#define ROUTINGTABLE_H
+
+#include <boost/utility/string_view.hpp>
+#include <cstdint>
+#include <set>
+#include <string>
+#include <vector>
+
+/**
+ * Routes json-rpc calls to named upstream pools (see Relay::addUpstreamPool) by their method and
+ * params, e.g., historical queries to archive nodes and cheap tip queries to pruned ones. A route is
+ * written as pattern[(predicates)]=pool:
+ *
+ *     getrawtransaction=archive             one method
+ *     getblock*=archive                     a glob pattern (*, ? and [...])
+ *     getblockstats($0<700000)=archive      only if the integer param 0 is less than 700000
+ *     getblock($1==0 && $0!="")=raw         json values compared as they're written
+ *
+ * Predicates compare a positional param ($N) with an integer (<, <=, >, >=) or with a json value (==,
+ * !=); $N alone requires the param to be there and not null. The first route that matches a call
+ * applies; calls that match none go to the fallback pool, or to the default upstream without one.
+ */
+class RoutingTable
+{
+    struct Predicate
+    {
+        enum class Op
+        {
+            Present,
+            Less,
+            LessEqual,
+            Greater,
+            GreaterEqual,
+            Equal,
+            NotEqual
+        };
+        std::size_t index = 0;
+        Op          op    = Op::Present;
+        std::string value;      // the json of Equal and NotEqual
+        int64_t     number = 0; // of the other comparisons
+    };
+
+    struct Route
+    {
+        std::string            pattern;
+        bool                   glob = false;
+        std::vector<Predicate> predicates;
+        std::string            pool;
+    };
+
+    std::vector<Route> routes;
+    std::string        fallbackPool;
+
+    static bool Matches(const Predicate& predicate, const std::vector<boost::string_view>& params);
+
+public:
+    bool empty() const { return routes.empty() && fallbackPool.empty(); }
+
+    // adds a route after the ones already there; throws std::runtime_error if text is not a route
+    void addRoute(const std::string& text);
+
+    // the pool of the calls that no route matches; empty for the default upstream
+    void setFallbackPool(std::string pool) { fallbackPool = std::move(pool); }
+
+    // the names of all the pools that calls may be routed to
+    std::set<std::string> getPools() const;
+
+    /**
+     * The pool of a call of the method with the params (their raw json, or empty); null if the call
+     * goes to the default upstream
+     */
+    const std::string* route(const std::string& method, boost::string_view params) const;
+};
+
+#endif // ROUTINGTABLE_H
@@ -0,0 +1,271 @@
+#include "SharedMetrics.h"
+
+#include <cerrno>
+#include <cstring>
+#include <dirent.h>
+#include <fcntl.h>
+#include <new>
+#include <signal.h>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace SharedMetricsLayout;
+
+static_assert(ATOMIC_LLONG_LOCK_FREE == 2 && ATOMIC_INT_LOCK_FREE == 2,
+              "shared metrics need lock-free atomics");
+
+const char* const SharedMetrics::DEFAULT_PREFIX = "http_rpc_relay";
+
+namespace {
+
+const std::size_t OTHER_METHODS = METHOD_SLOTS - 1;
+
+uint64_t Load(const std::atomic<uint64_t>& counter) { return counter.load(std::memory_order_relaxed); }
+
+void Increment(std::atomic<uint64_t>& counter) { counter.fetch_add(1, std::memory_order_relaxed); }
+
+uint64_t HashName(boost::string_view name)
+{
+    // FNV-1a
+    uint64_t hash = 14695981039346656037ull;
+    for (char c : name) {
+        hash ^= static_cast<unsigned char>(c);
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+MetricsSnapshot ReadSegment(const Segment& segment)
+{
+    MetricsSnapshot s;
+    s.pids.push_back(segment.pid);
+    s.requests        = Load(segment.requests);
+    s.denied          = Load(segment.denied);
+    s.servedFromCache = Load(segment.servedFromCache);
+    s.failed          = Load(segment.failed);
+    s.upstreamErrors  = Load(segment.upstreamErrors);
+    for (std::size_t i = 0; i < LATENCY_BUCKETS; i++) {
+        s.latencyBuckets[i] = Load(segment.latencyBuckets[i]);
+    }
+    s.latencySumUs = Load(segment.latencySumUs);
+
+    for (const MethodCounters& m : segment.methods) {
+        if (m.state.load(std::memory_order_acquire) != 2) {
+            continue;
+        }
+        MethodMetrics& metrics = s.methods[std::string(m.name, strnlen(m.name, METHOD_NAME_SIZE))];
+        metrics.requests += Load(m.requests);
+        metrics.denied += Load(m.denied);
+        metrics.failed += Load(m.failed);
+    }
+    return s;
+}
+
+bool ProcessExists(int64_t pid) { return kill(static_cast<pid_t>(pid), 0) == 0 || errno == EPERM; }
+
+} // namespace
+
+void MetricsSnapshot::add(const MetricsSnapshot& other)
+{
+    pids.insert(pids.end(), other.pids.begin(), other.pids.end());
+    requests += other.requests;
+    denied += other.denied;
+    servedFromCache += other.servedFromCache;
+    failed += other.failed;
+    upstreamErrors += other.upstreamErrors;
+    for (std::size_t i = 0; i < LATENCY_BUCKETS; i++) {
+        latencyBuckets[i] += other.latencyBuckets[i];
+    }
+    latencySumUs += other.latencySumUs;
+    for (const auto& m : other.methods) {
+        MethodMetrics& metrics = methods[m.first];
+        metrics.requests += m.second.requests;
+        metrics.denied += m.second.denied;
+        metrics.failed += m.second.failed;
+    }
+}
+
+uint64_t MetricsSnapshot::getLatencyQuantileUs(double quantile) const
+{
+    uint64_t total = 0;
+    for (uint64_t count : latencyBuckets) {
+        total += count;
+    }
+    if (total == 0) {
+        return 0;
+    }
+    const double rank = quantile * static_cast<double>(total);
+    uint64_t     seen = 0;
+    for (std::size_t i = 0; i < LATENCY_BUCKETS; i++) {
+        seen += latencyBuckets[i];
+        if (static_cast<double>(seen) >= rank) {
+            return uint64_t(1) << i;
+        }
+    }
+    return uint64_t(1) << (LATENCY_BUCKETS - 1);
+}
+
+SharedMetrics::SharedMetrics(const std::string& prefix)
+    : name("/" + prefix + "." + std::to_string(getpid()))
+{
+    const int fd = shm_open(name.c_str(), O_CREAT | O_RDWR | O_TRUNC, 0644);
+    if (fd < 0) {
+        throw std::runtime_error("Failed to create the metrics segment " + name + ": " +
+                                 std::strerror(errno));
+    }
+    void* memory = MAP_FAILED;
+    if (ftruncate(fd, sizeof(Segment)) == 0) {
+        memory = mmap(nullptr, sizeof(Segment), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+    const int error = errno;
+    close(fd);
+    if (memory == MAP_FAILED) {
+        shm_unlink(name.c_str());
+        throw std::runtime_error("Failed to map the metrics segment " + name + ": " +
+                                 std::strerror(error));
+    }
+
+    // the new segment is all zeroes, which is the initial value of every counter
+    segment            = new (memory) Segment();
+    segment->version   = VERSION;
+    segment->size      = sizeof(Segment);
+    segment->pid       = getpid();
+    segment->startedAt = std::chrono::duration_cast<std::chrono::seconds>(
+                             std::chrono::system_clock::now().time_since_epoch())
+                             .count();
+    MethodCounters& other = segment->methods[OTHER_METHODS];
+    std::strncpy(other.name, "(other)", METHOD_NAME_SIZE);
+    other.state.store(2, std::memory_order_release);
+    segment->magic.store(MAGIC, std::memory_order_release);
+}
+
+SharedMetrics::~SharedMetrics()
+{
+    munmap(segment, sizeof(Segment));
+    shm_unlink(name.c_str());
+}
+
+MethodCounters* SharedMetrics::findMethod(boost::string_view method)
+{
+    if (method.size() >= METHOD_NAME_SIZE) {
+        return &segment->methods[OTHER_METHODS];
+    }
+    // open addressing; slots are never freed, so a method keeps its slot
+    const uint64_t hash = HashName(method);
+    for (std::size_t probe = 0; probe < OTHER_METHODS; probe++) {
+        MethodCounters& slot  = segment->methods[(hash + probe) % OTHER_METHODS];
+        uint32_t        state = slot.state.load(std::memory_order_acquire);
+        if (state == 0 && slot.state.compare_exchange_strong(state, 1, std::memory_order_acquire)) {
+            std::memcpy(slot.name, method.data(), method.size());
+            slot.name[method.size()] = '\0';
+            slot.state.store(2, std::memory_order_release);
+            return &slot;
+        }
+        while (state == 1) {
+            // another thread is naming the slot
+            sched_yield();
+            state = slot.state.load(std::memory_order_acquire);
+        }
+        if (std::strncmp(slot.name, method.data(), method.size()) == 0 &&
+            slot.name[method.size()] == '\0') {
+            return &slot;
+        }
+    }
+    return &segment->methods[OTHER_METHODS];
+}
+
+void SharedMetrics::recordRequest(boost::string_view        method,
+                                  Outcome                   outcome,
+                                  bool                      failed,
+                                  std::chrono::microseconds latency)
+{
+    Increment(segment->requests);
+    switch (outcome) {
+    case Outcome::Denied:
+        Increment(segment->denied);
+        break;
+    case Outcome::ServedFromCache:
+        Increment(segment->servedFromCache);
+        break;
+    case Outcome::Forwarded:
+        break;
+    }
+    if (failed) {
+        Increment(segment->failed);
+    }
+
+    const uint64_t us     = latency.count() > 0 ? static_cast<uint64_t>(latency.count()) : 0;
+    std::size_t    bucket = 0;
+    while (bucket < LATENCY_BUCKETS - 1 && (uint64_t(1) << bucket) <= us) {
+        bucket++;
+    }
+    Increment(segment->latencyBuckets[bucket]);
+    segment->latencySumUs.fetch_add(us, std::memory_order_relaxed);
+
+    if (!method.empty()) {
+        MethodCounters* m = findMethod(method);
+        Increment(m->requests);
+        if (outcome == Outcome::Denied) {
+            Increment(m->denied);
+        }
+        if (failed) {
+            Increment(m->failed);
+        }
+    }
+}
+
+void SharedMetrics::recordUpstreamError() { Increment(segment->upstreamErrors); }
+
+MetricsSnapshot SharedMetrics::snapshot() const { return ReadSegment(*segment); }
+
+std::vector<MetricsSnapshot> SharedMetrics::ReadAll(const std::string& prefix, bool removeStale)
+{
+    std::vector<MetricsSnapshot> snapshots;
+
+    DIR* dir = opendir("/dev/shm");
+    if (!dir) {
+        return snapshots;
+    }
+    const std::string namePrefix = prefix + ".";
+    while (dirent* entry = readdir(dir)) {
+        const std::string file = entry->d_name;
+        if (file.compare(0, namePrefix.size(), namePrefix) != 0) {
+            continue;
+        }
+        const std::string pid = file.substr(namePrefix.size());
+        if (pid.empty() || pid.find_first_not_of("0123456789") != std::string::npos || pid.size() > 9) {
+            continue;
+        }
+        const std::string name = "/" + file;
+        if (!ProcessExists(std::stoll(pid))) {
+            if (removeStale) {
+                shm_unlink(name.c_str());
+            }
+            continue;
+        }
+
+        const int fd = shm_open(name.c_str(), O_RDONLY, 0);
+        if (fd < 0) {
+            continue;
+        }
+        struct stat st;
+        void*       memory = MAP_FAILED;
+        if (fstat(fd, &st) == 0 && static_cast<uint64_t>(st.st_size) == sizeof(Segment)) {
+            memory = mmap(nullptr, sizeof(Segment), PROT_READ, MAP_SHARED, fd, 0);
+        }
+        close(fd);
+        if (memory == MAP_FAILED) {
+            continue; // another version of the layout, or not a segment of a relay
+        }
+        const Segment& segment = *static_cast<const Segment*>(memory);
+        if (segment.magic.load(std::memory_order_acquire) == MAGIC && segment.version == VERSION &&
+            segment.size == sizeof(Segment)) {
+            snapshots.push_back(ReadSegment(segment));
+        }
+        munmap(memory, sizeof(Segment));
+    }
+    closedir(dir);
+    return snapshots;
+}
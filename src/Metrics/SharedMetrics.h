@@ -0,0 +1,146 @@
+#ifndef SHAREDMETRICS_H
+#define SHAREDMETRICS_H
+
+#include <array>
+#include <atomic>
+#include <boost/utility/string_view.hpp>
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+
+/**
+ * The layout of a metrics segment; a reader must check the magic, the version and the size before it
+ * looks at anything else. Version 1:
+ *
+ * - a header with the pid of the relay and its start time;
+ * - the totals and a latency histogram, whose bucket i counts responses that took less than 2^i
+ *   microseconds (and at least 2^(i-1));
+ * - a table of per-method counters, claimed by the first request of every method. Methods that
+ *   don't fit in the table (or whose name is too long) are counted in the last slot, "(other)".
+ *
+ * All counters are 64-bit atomics, which are lock-free (and thus usable across processes) on the
+ * platforms the relay runs on.
+ */
+namespace SharedMetricsLayout {
+
+constexpr uint32_t    MAGIC            = 0x314d5248; // "HRM1"
+constexpr uint32_t    VERSION          = 1;
+constexpr std::size_t LATENCY_BUCKETS  = 32;
+constexpr std::size_t METHOD_SLOTS     = 256;
+constexpr std::size_t METHOD_NAME_SIZE = 64;
+
+struct MethodCounters
+{
+    std::atomic<uint32_t> state; // 0: free, 1: being claimed, 2: named
+    char                  name[METHOD_NAME_SIZE];
+    std::atomic<uint64_t> requests;
+    std::atomic<uint64_t> denied;
+    std::atomic<uint64_t> failed;
+};
+
+struct Segment
+{
+    std::atomic<uint32_t> magic; // written last, when the segment is ready
+    uint32_t              version;
+    uint64_t              size;
+    int64_t               pid;
+    int64_t               startedAt; // seconds since epoch
+
+    std::atomic<uint64_t> requests;
+    std::atomic<uint64_t> denied;
+    std::atomic<uint64_t> servedFromCache;
+    std::atomic<uint64_t> failed; // answered with a 5xx status
+    std::atomic<uint64_t> upstreamErrors;
+
+    std::atomic<uint64_t> latencyBuckets[LATENCY_BUCKETS];
+    std::atomic<uint64_t> latencySumUs;
+
+    MethodCounters methods[METHOD_SLOTS];
+};
+
+} // namespace SharedMetricsLayout
+
+struct MethodMetrics
+{
+    uint64_t requests = 0;
+    uint64_t denied   = 0;
+    uint64_t failed   = 0;
+};
+
+/**
+ * A copy of the counters of one relay process, or the sum of several
+ */
+struct MetricsSnapshot
+{
+    std::vector<int64_t> pids;
+
+    uint64_t requests        = 0;
+    uint64_t denied          = 0;
+    uint64_t servedFromCache = 0;
+    uint64_t failed          = 0;
+    uint64_t upstreamErrors  = 0;
+
+    std::array<uint64_t, SharedMetricsLayout::LATENCY_BUCKETS> latencyBuckets{};
+    uint64_t                                                   latencySumUs = 0;
+
+    std::map<std::string, MethodMetrics> methods;
+
+    void add(const MetricsSnapshot& other);
+
+    // an upper bound of the given quantile (e.g., 0.99) of the latency, from the histogram
+    uint64_t getLatencyQuantileUs(double quantile) const;
+};
+
+/**
+ * The counters and latency histograms of a relay process, kept in a shared memory segment named
+ * /<prefix>.<pid>, so that a reader (relay_metrics) can aggregate all the relays of a host without
+ * asking any of them. Updates are lock-free; the segment is removed when the object is destroyed.
+ */
+class SharedMetrics
+{
+    std::string                   name;
+    SharedMetricsLayout::Segment* segment = nullptr;
+
+    SharedMetricsLayout::MethodCounters* findMethod(boost::string_view method);
+
+public:
+    enum class Outcome
+    {
+        Forwarded,
+        Denied,
+        ServedFromCache
+    };
+
+    static const char* const DEFAULT_PREFIX;
+
+    // creates the segment of this process; throws std::runtime_error on failure
+    explicit SharedMetrics(const std::string& prefix = DEFAULT_PREFIX);
+    ~SharedMetrics();
+
+    SharedMetrics(const SharedMetrics&) = delete;
+    SharedMetrics& operator=(const SharedMetrics&) = delete;
+
+    // a response to a request for method (empty if unknown); failed if its status is 5xx
+    void recordRequest(boost::string_view        method,
+                       Outcome                   outcome,
+                       bool                      failed,
+                       std::chrono::microseconds latency);
+
+    // a request that couldn't be sent to the upstream, or got no response
+    void recordUpstreamError();
+
+    MetricsSnapshot snapshot() const;
+
+    const std::string& getName() const { return name; }
+
+    /**
+     * Snapshots of the segments of all relays with the prefix on this host. Segments of processes that
+     * no longer exist are skipped, and removed if removeStale.
+     */
+    static std::vector<MetricsSnapshot> ReadAll(const std::string& prefix      = DEFAULT_PREFIX,
+                                                bool               removeStale = false);
+};
+
+#endif // SHAREDMETRICS_H
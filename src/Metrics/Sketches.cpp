@@ -0,0 +1,225 @@
+#include "Sketches.h"
+
+#include <algorithm>
+#include <cmath>
+
+SpaceSaving::SpaceSaving(std::size_t Capacity) : capacity(Capacity >= 1 ? Capacity : 1)
+{
+    heap.reserve(capacity);
+}
+
+void SpaceSaving::swapEntries(std::size_t a, std::size_t b)
+{
+    std::swap(heap[a], heap[b]);
+    positions[heap[a].key] = a;
+    positions[heap[b].key] = b;
+}
+
+void SpaceSaving::siftUp(std::size_t i)
+{
+    while (i > 0) {
+        const std::size_t parent = (i - 1) / 2;
+        if (heap[parent].count <= heap[i].count) {
+            break;
+        }
+        swapEntries(i, parent);
+        i = parent;
+    }
+}
+
+void SpaceSaving::siftDown(std::size_t i)
+{
+    for (;;) {
+        const std::size_t left     = 2 * i + 1;
+        const std::size_t right    = left + 1;
+        std::size_t       smallest = i;
+        if (left < heap.size() && heap[left].count < heap[smallest].count) {
+            smallest = left;
+        }
+        if (right < heap.size() && heap[right].count < heap[smallest].count) {
+            smallest = right;
+        }
+        if (smallest == i) {
+            break;
+        }
+        swapEntries(i, smallest);
+        i = smallest;
+    }
+}
+
+void SpaceSaving::add(const std::string& key, uint64_t weight)
+{
+    total += weight;
+
+    auto it = positions.find(key);
+    if (it != positions.end()) {
+        heap[it->second].count += weight;
+        siftDown(it->second);
+        return;
+    }
+    if (heap.size() < capacity) {
+        heap.push_back(Entry{key, weight, 0});
+        positions.emplace(key, heap.size() - 1);
+        siftUp(heap.size() - 1);
+        return;
+    }
+    // the key takes the place of the lightest one, which may have been this key before
+    Entry& lightest = heap.front();
+    positions.erase(lightest.key);
+    lightest.error = lightest.count;
+    lightest.count += weight;
+    lightest.key = key;
+    positions.emplace(key, 0);
+    siftDown(0);
+}
+
+void SpaceSaving::merge(const SpaceSaving& other)
+{
+    // a key missing from a full summary may have had up to its minimum count there
+    const uint64_t missingHere  = getMinCount();
+    const uint64_t missingThere = other.getMinCount();
+
+    std::vector<Entry> merged;
+    merged.reserve(heap.size() + other.heap.size());
+    for (const Entry& e : heap) {
+        auto it = other.positions.find(e.key);
+        if (it == other.positions.cend()) {
+            merged.push_back(Entry{e.key, e.count + missingThere, e.error + missingThere});
+        } else {
+            const Entry& o = other.heap[it->second];
+            merged.push_back(Entry{e.key, e.count + o.count, e.error + o.error});
+        }
+    }
+    for (const Entry& o : other.heap) {
+        if (positions.find(o.key) == positions.cend()) {
+            merged.push_back(Entry{o.key, o.count + missingHere, o.error + missingHere});
+        }
+    }
+
+    if (merged.size() > capacity) {
+        std::nth_element(merged.begin(),
+                         merged.begin() + static_cast<std::ptrdiff_t>(capacity),
+                         merged.end(),
+                         [](const Entry& a, const Entry& b) { return a.count > b.count; });
+        merged.resize(capacity);
+    }
+    heap = std::move(merged);
+    std::make_heap(heap.begin(), heap.end(), [](const Entry& a, const Entry& b) {
+        return a.count > b.count;
+    });
+    positions.clear();
+    for (std::size_t i = 0; i < heap.size(); i++) {
+        positions[heap[i].key] = i;
+    }
+    total += other.total;
+}
+
+std::vector<SpaceSaving::Entry> SpaceSaving::top(std::size_t k) const
+{
+    std::vector<Entry> entries = heap;
+    std::sort(entries.begin(), entries.end(), [](const Entry& a, const Entry& b) {
+        return a.count > b.count || (a.count == b.count && a.key < b.key);
+    });
+    if (entries.size() > k) {
+        entries.resize(k);
+    }
+    return entries;
+}
+
+uint64_t SpaceSaving::getMinCount() const { return heap.size() < capacity ? 0 : heap.front().count; }
+
+DDSketch::DDSketch(double Accuracy, std::size_t MaxBuckets)
+    : gamma((1 + Accuracy) / (1 - Accuracy)), logGamma(std::log(gamma)),
+      maxBuckets(MaxBuckets >= 1 ? MaxBuckets : 1)
+{
+}
+
+int32_t DDSketch::bucketIndex(double value) const
+{
+    return static_cast<int32_t>(std::ceil(std::log(value) / logGamma));
+}
+
+std::size_t DDSketch::reserve(int32_t index)
+{
+    if (buckets.empty()) {
+        minIndex = index;
+        buckets.assign(1, 0);
+        return 0;
+    }
+    if (index < minIndex) {
+        const std::size_t missing = static_cast<std::size_t>(minIndex - index);
+        if (buckets.size() + missing > maxBuckets) {
+            // the lowest bucket already holds the collapsed values below it
+            return 0;
+        }
+        buckets.insert(buckets.begin(), missing, 0);
+        minIndex = index;
+        return 0;
+    }
+
+    const int64_t lowestKept = static_cast<int64_t>(index) - static_cast<int64_t>(maxBuckets) + 1;
+    if (lowestKept > minIndex) {
+        // collapse the buckets below lowestKept into it
+        const std::size_t shift     = static_cast<std::size_t>(lowestKept - minIndex);
+        uint64_t          collapsed = 0;
+        for (std::size_t i = 0; i < std::min(shift, buckets.size()); i++) {
+            collapsed += buckets[i];
+        }
+        buckets.erase(buckets.begin(),
+                      buckets.begin() + static_cast<std::ptrdiff_t>(std::min(shift, buckets.size())));
+        if (buckets.empty()) {
+            buckets.push_back(0);
+        }
+        buckets.front() += collapsed;
+        minIndex = static_cast<int32_t>(lowestKept);
+    }
+    const std::size_t position = static_cast<std::size_t>(index - minIndex);
+    if (position >= buckets.size()) {
+        buckets.resize(position + 1, 0);
+    }
+    return position;
+}
+
+void DDSketch::add(double value, uint64_t n)
+{
+    count += n;
+    sum += value * static_cast<double>(n);
+    if (value < 1) {
+        zeroCount += n;
+        return;
+    }
+    buckets[reserve(bucketIndex(value))] += n;
+}
+
+void DDSketch::merge(const DDSketch& other)
+{
+    count += other.count;
+    sum += other.sum;
+    zeroCount += other.zeroCount;
+    for (std::size_t i = 0; i < other.buckets.size(); i++) {
+        if (other.buckets[i] > 0) {
+            buckets[reserve(other.minIndex + static_cast<int32_t>(i))] += other.buckets[i];
+        }
+    }
+}
+
+double DDSketch::getQuantile(double q) const
+{
+    if (count == 0) {
+        return 0;
+    }
+    q                   = std::min(std::max(q, 0.0), 1.0);
+    const uint64_t rank = static_cast<uint64_t>(q * static_cast<double>(count - 1));
+    if (rank < zeroCount) {
+        return 0;
+    }
+    uint64_t seen = zeroCount;
+    for (std::size_t i = 0; i < buckets.size(); i++) {
+        seen += buckets[i];
+        if (seen > rank) {
+            // the middle of the bucket (gamma^(index-1), gamma^index], by relative error
+            return 2 * std::pow(gamma, minIndex + static_cast<int32_t>(i)) / (gamma + 1);
+        }
+    }
+    return 2 * std::pow(gamma, minIndex + static_cast<int32_t>(buckets.size()) - 1) / (gamma + 1);
+}
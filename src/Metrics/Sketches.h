@@ -0,0 +1,95 @@
+#ifndef SKETCHES_H
+#define SKETCHES_H
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/**
+ * The heaviest keys of a stream (e.g., the methods or clients with the most requests) in a fixed number
+ * of counters, by the Space-Saving algorithm: a new key that finds all counters taken replaces the
+ * smallest one and inherits its count. Any key heavier than total / capacity is in the summary, and
+ * every count is an overestimate by at most its error.
+ *
+ * Not thread-safe.
+ */
+class SpaceSaving
+{
+public:
+    struct Entry
+    {
+        std::string key;
+        uint64_t    count = 0;
+        uint64_t    error = 0; // the count inherited from the key it replaced
+    };
+
+private:
+    std::size_t                                  capacity;
+    std::vector<Entry>                           heap; // a min-heap by count
+    std::unordered_map<std::string, std::size_t> positions;
+    uint64_t                                     total = 0;
+
+    void swapEntries(std::size_t a, std::size_t b);
+    void siftUp(std::size_t i);
+    void siftDown(std::size_t i);
+
+public:
+    explicit SpaceSaving(std::size_t Capacity = 64);
+
+    void add(const std::string& key, uint64_t weight = 1);
+
+    // adds the counts of another summary, keeping the capacity of this one
+    void merge(const SpaceSaving& other);
+
+    // the k heaviest entries, heaviest first
+    std::vector<Entry> top(std::size_t k) const;
+
+    // the sum of all weights added
+    uint64_t getTotal() const { return total; }
+    // the count of a key that isn't in the summary is at most this
+    uint64_t getMinCount() const;
+
+    std::size_t getCapacity() const { return capacity; }
+};
+
+/**
+ * Quantiles of a stream of positive values within a relative error, in bounded memory (DDSketch):
+ * values fall into logarithmic buckets whose bounds grow by gamma = (1 + accuracy) / (1 - accuracy), so
+ * any quantile is known to within `accuracy` of its value. The buckets only cover the range of values
+ * seen; beyond maxBuckets, the lowest buckets are collapsed into one, which loses accuracy only for the
+ * lowest quantiles.
+ *
+ * Not thread-safe.
+ */
+class DDSketch
+{
+    double                gamma;
+    double                logGamma;
+    std::size_t           maxBuckets;
+    std::vector<uint64_t> buckets; // buckets[i] counts values of bucket index minIndex + i
+    int32_t               minIndex  = 0;
+    uint64_t              zeroCount = 0; // values below 1
+    uint64_t              count     = 0;
+    double                sum       = 0;
+
+    int32_t bucketIndex(double value) const;
+    // makes room for the bucket index, collapsing the lowest buckets if needed; returns its position
+    std::size_t reserve(int32_t index);
+
+public:
+    explicit DDSketch(double Accuracy = 0.01, std::size_t MaxBuckets = 1024);
+
+    void add(double value, uint64_t n = 1);
+
+    // adds the values of another sketch, which must have the same accuracy
+    void merge(const DDSketch& other);
+
+    // the value of the quantile (0 <= q <= 1), within the accuracy; 0 if empty
+    double getQuantile(double q) const;
+
+    uint64_t getCount() const { return count; }
+    double   getSum() const { return sum; }
+};
+
+#endif // SKETCHES_H
@@ -0,0 +1,163 @@
+#include "UsageTracker.h"
+
+#include <algorithm>
+#include <atomic>
+#include <jsoncpp/json/json.h>
+
+namespace {
+
+std::atomic<uint64_t> g_UsageTrackerInstanceCounter{0};
+
+const char* const UNKNOWN_KEY   = "(unknown)";
+const char* const OTHER_METHODS = "(other)";
+
+Json::Value ToJson(const std::vector<SpaceSaving::Entry>& entries)
+{
+    Json::Value list(Json::arrayValue);
+    for (const SpaceSaving::Entry& e : entries) {
+        Json::Value entry;
+        entry["key"]   = e.key;
+        entry["count"] = Json::UInt64(e.count);
+        entry["error"] = Json::UInt64(e.error);
+        list.append(entry);
+    }
+    return list;
+}
+
+} // namespace
+
+UsageTracker::Shard::Shard(const UsageOptions& options)
+    : methodRequests(options.topCapacity), methodTime(options.topCapacity),
+      clientRequests(options.topCapacity), clientTime(options.topCapacity)
+{
+}
+
+UsageTracker::UsageTracker(UsageOptions Options)
+    : instanceId(++g_UsageTrackerInstanceCounter), options(Options)
+{
+}
+
+UsageTracker::Shard& UsageTracker::localShard()
+{
+    // the pair (instance id, shard) is cached per thread, so registration happens once per thread
+    struct LocalCache
+    {
+        uint64_t               owner = 0;
+        std::shared_ptr<Shard> shard;
+    };
+    thread_local LocalCache cache;
+
+    if (cache.owner != instanceId) {
+        auto shard = std::make_shared<Shard>(options);
+        {
+            std::lock_guard<std::mutex> lg(shardsMutex);
+            shards.push_back(shard);
+        }
+        cache.owner = instanceId;
+        cache.shard = std::move(shard);
+    }
+    return *cache.shard;
+}
+
+void UsageTracker::record(const std::string&        method,
+                          const std::string&        client,
+                          std::chrono::microseconds latency)
+{
+    const std::string& methodKey = method.empty() ? UNKNOWN_KEY : method;
+    const std::string& clientKey = client.empty() ? UNKNOWN_KEY : client;
+    const uint64_t     us        = static_cast<uint64_t>(std::max<int64_t>(latency.count(), 1));
+
+    Shard& shard = localShard();
+
+    std::lock_guard<std::mutex> lg(shard.mtx); // only contended while report() merges
+    shard.methodRequests.add(methodKey);
+    shard.methodTime.add(methodKey, us);
+    shard.clientRequests.add(clientKey);
+    shard.clientTime.add(clientKey, us);
+
+    auto it = shard.latencies.find(methodKey);
+    if (it == shard.latencies.end()) {
+        const std::string& key =
+            shard.latencies.size() + 1 < options.maxTrackedMethods ? methodKey : OTHER_METHODS;
+        it = shard.latencies.find(key);
+        if (it == shard.latencies.end()) {
+            it = shard.latencies
+                     .emplace(key, DDSketch(options.latencyAccuracy, options.maxLatencyBuckets))
+                     .first;
+        }
+    }
+    it->second.add(static_cast<double>(us));
+}
+
+UsageReport UsageTracker::report(std::size_t topK) const
+{
+    Shard                                     merged(options);
+    std::unordered_map<std::string, DDSketch> latencies;
+    {
+        std::lock_guard<std::mutex> lg(shardsMutex);
+        for (const std::shared_ptr<Shard>& shard : shards) {
+            std::lock_guard<std::mutex> shardLock(shard->mtx);
+            merged.methodRequests.merge(shard->methodRequests);
+            merged.methodTime.merge(shard->methodTime);
+            merged.clientRequests.merge(shard->clientRequests);
+            merged.clientTime.merge(shard->clientTime);
+            for (const auto& sketch : shard->latencies) {
+                auto it = latencies.find(sketch.first);
+                if (it == latencies.end()) {
+                    latencies.emplace(sketch.first, sketch.second);
+                } else {
+                    it->second.merge(sketch.second);
+                }
+            }
+        }
+    }
+
+    UsageReport report;
+    report.requests          = merged.methodRequests.getTotal();
+    report.methodsByRequests = merged.methodRequests.top(topK);
+    report.methodsByTimeUs   = merged.methodTime.top(topK);
+    report.clientsByRequests = merged.clientRequests.top(topK);
+    report.clientsByTimeUs   = merged.clientTime.top(topK);
+    for (const auto& sketch : latencies) {
+        MethodLatency l;
+        l.method = sketch.first;
+        l.count  = sketch.second.getCount();
+        l.sumUs  = sketch.second.getSum();
+        l.p50Us  = sketch.second.getQuantile(0.5);
+        l.p90Us  = sketch.second.getQuantile(0.9);
+        l.p99Us  = sketch.second.getQuantile(0.99);
+        l.p999Us = sketch.second.getQuantile(0.999);
+        report.latencies.push_back(std::move(l));
+    }
+    std::sort(report.latencies.begin(),
+              report.latencies.end(),
+              [](const MethodLatency& a, const MethodLatency& b) { return a.sumUs > b.sumUs; });
+    return report;
+}
+
+std::string UsageReport::toJson() const
+{
+    Json::Value root;
+    root["requests"]            = Json::UInt64(requests);
+    root["methods_by_requests"] = ToJson(methodsByRequests);
+    root["methods_by_time_us"]  = ToJson(methodsByTimeUs);
+    root["clients_by_requests"] = ToJson(clientsByRequests);
+    root["clients_by_time_us"]  = ToJson(clientsByTimeUs);
+
+    Json::Value list(Json::arrayValue);
+    for (const MethodLatency& l : latencies) {
+        Json::Value entry;
+        entry["method"]  = l.method;
+        entry["count"]   = Json::UInt64(l.count);
+        entry["mean_us"] = l.count > 0 ? l.sumUs / static_cast<double>(l.count) : 0.0;
+        entry["p50_us"]  = l.p50Us;
+        entry["p90_us"]  = l.p90Us;
+        entry["p99_us"]  = l.p99Us;
+        entry["p999_us"] = l.p999Us;
+        list.append(entry);
+    }
+    root["latencies"] = list;
+
+    Json::StyledWriter writer;
+    return writer.write(root);
+}
@@ -0,0 +1,93 @@
+#ifndef USAGETRACKER_H
+#define USAGETRACKER_H
+
+#include "Sketches.h"
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+struct UsageOptions
+{
+    // keys kept by every heavy hitter summary; a key with more than 1/topCapacity of the total is never
+    // lost
+    std::size_t topCapacity = 64;
+    // relative error of the latency quantiles
+    double      latencyAccuracy   = 0.01;
+    std::size_t maxLatencyBuckets = 1024;
+    // methods with their own latency sketch; the others share one, "(other)"
+    std::size_t maxTrackedMethods = 128;
+};
+
+struct MethodLatency
+{
+    std::string method;
+    uint64_t    count  = 0;
+    double      sumUs  = 0;
+    double      p50Us  = 0;
+    double      p90Us  = 0;
+    double      p99Us  = 0;
+    double      p999Us = 0;
+};
+
+/**
+ * What the relay spent its time on, as merged from all threads by UsageTracker::report()
+ */
+struct UsageReport
+{
+    uint64_t requests = 0;
+
+    std::vector<SpaceSaving::Entry> methodsByRequests;
+    std::vector<SpaceSaving::Entry> methodsByTimeUs; // by the sum of their response times
+    std::vector<SpaceSaving::Entry> clientsByRequests;
+    std::vector<SpaceSaving::Entry> clientsByTimeUs;
+
+    // the latency of every tracked method, the ones that took the most time first
+    std::vector<MethodLatency> latencies;
+
+    std::string toJson() const;
+};
+
+/**
+ * Heavy hitters by method and by client, by request count and by response time, and per-method
+ * latency quantiles, in fixed memory (see SpaceSaving and DDSketch). Every thread updates its own
+ * summaries, behind a lock that is only contended while report() merges them.
+ */
+class UsageTracker
+{
+    struct Shard
+    {
+        std::mutex                                mtx;
+        SpaceSaving                               methodRequests;
+        SpaceSaving                               methodTime;
+        SpaceSaving                               clientRequests;
+        SpaceSaving                               clientTime;
+        std::unordered_map<std::string, DDSketch> latencies;
+
+        explicit Shard(const UsageOptions& options);
+    };
+
+    const uint64_t     instanceId;
+    const UsageOptions options;
+
+    mutable std::mutex                  shardsMutex; // only for registration and merging
+    std::vector<std::shared_ptr<Shard>> shards;
+
+    Shard& localShard();
+
+public:
+    explicit UsageTracker(UsageOptions Options = UsageOptions());
+
+    UsageTracker(const UsageTracker&) = delete;
+    UsageTracker& operator=(const UsageTracker&) = delete;
+
+    // a response to a request of the client for the method; either may be empty if unknown
+    void record(const std::string& method, const std::string& client, std::chrono::microseconds latency);
+
+    // the topK heaviest methods and clients of each summary, merged over all threads
+    UsageReport report(std::size_t topK = 20) const;
+};
+
+#endif // USAGETRACKER_H
@@ -0,0 +1,52 @@
+#ifndef FILTERCHAINRELAY_H
+#define FILTERCHAINRELAY_H
+
+#include "Relay.h"
+
+#include "Filters/FilterChain.h"
+
+/**
+ * Holds the chain in a base that's constructed before Relay, because Relay starts serving in its
+ * constructor and sessions may call filterRequest() right away
+ */
+template <typename Chain>
+struct FilterChainHolder
+{
+    Chain chain;
+
+    explicit FilterChainHolder(Chain&& Chain_) : chain(std::move(Chain_)) {}
+};
+
+/**
+ * A relay whose requests are filtered by a FilterChain, e.g.,
+ *
+ *     using MyChain = FilterChain<BodySizePolicy, MethodAllowlistPolicy, MethodRoutingPolicy>;
+ *     FilterChainRelay<MyChain> relay(std::move(chain), "0.0.0.0", 8332, "127.0.0.1", 18332);
+ *
+ * The chain is immutable once the relay is constructed, so no locking is needed to apply it.
+ */
+template <typename Chain>
+class FilterChainRelay : private FilterChainHolder<Chain>, public Relay<FilterChainRelay<Chain>>
+{
+public:
+    FilterChainRelay(Chain&&             Chain_,
+                     std::string         ServerBindAddress,
+                     uint16_t            ServerBindPort,
+                     std::string         ClientTargetAddress,
+                     uint16_t            ClientTargetPort,
+                     uint32_t            ThreadCount     = std::thread::hardware_concurrency(),
+                     RelayExecutionModel ExecutionModel  = RelayExecutionModel::SeparatePools,
+                     int                 ListeningSocket = -1)
+        : FilterChainHolder<Chain>(std::move(Chain_)),
+          Relay<FilterChainRelay<Chain>>(std::move(ServerBindAddress), ServerBindPort,
+                                         std::move(ClientTargetAddress), ClientTargetPort, ThreadCount,
+                                         ExecutionModel, ListeningSocket)
+    {
+    }
+
+    FilterDecision filterRequest(const RequestType& request) const { return this->chain(request); }
+
+    bool validateRequest(const RequestType& request) const { return filterRequest(request).isAllowed(); }
+};
+
+#endif // FILTERCHAINRELAY_H
@@ -1,9 +1,19 @@
 #include "JsonRpcRelay.h"
 
 JsonRpcRelay::JsonRpcRelay(JsonRPCFilter&& Filter, std::string ServerBindAddress, uint16_t ServerBindPort,
-                           std::string ClientTargetAddress, uint16_t ClientTargetPort, uint32_t ThreadCount)
-    : Relay(ServerBindAddress, ServerBindPort, ClientTargetAddress, ClientTargetPort, ThreadCount), filter(Filter)
+                           std::string ClientTargetAddress, uint16_t ClientTargetPort, uint32_t ThreadCount,
+                           RelayExecutionModel ExecutionModel, int ListeningSocket)
+    : Relay(ServerBindAddress, ServerBindPort, ClientTargetAddress, ClientTargetPort, ThreadCount,
+            ExecutionModel, ListeningSocket),
+      filter(Filter)
 {
 }
 
 bool JsonRpcRelay::validateRequest(const RequestType& request) { return filter(request); }
+
+FilterDecision JsonRpcRelay::filterRequest(const RequestType& request) { return filter.decide(request); }
+
+bool JsonRpcRelay::isMethodAllowed(const std::string& method) const
+{
+    return filter.allowedMethodExists(method);
+}
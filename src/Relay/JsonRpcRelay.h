@@ -12,9 +12,17 @@ class JsonRpcRelay : public Relay<JsonRpcRelay>
 public:
     JsonRpcRelay(JsonRPCFilter&& Filter, std::string ServerBindAddress, uint16_t ServerBindPort,
                  std::string ClientTargetAddress, uint16_t ClientTargetPort,
-                 uint32_t ThreadCount = std::thread::hardware_concurrency());
+                 uint32_t            ThreadCount     = std::thread::hardware_concurrency(),
+                 RelayExecutionModel ExecutionModel  = RelayExecutionModel::SeparatePools,
+                 int                 ListeningSocket = -1);
 
     bool validateRequest(const RequestType& request);
+
+    // like validateRequest(), with the priority class of the method
+    FilterDecision filterRequest(const RequestType& request);
+
+    // whether the filter allows the method; see Relay::enableEarlyRejection
+    bool isMethodAllowed(const std::string& method) const;
 };
 
 #endif // JSONRPCRELAY_H
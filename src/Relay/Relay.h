@@ -1,19 +1,49 @@
 #ifndef RELAY_H
 #define RELAY_H
 
+#include "Cache/ImmutableResultCache.h"
+#include "Cache/PrefetchEngine.h"
+#include "Client/AsyncClient.h"
 #include "Client/ClientSession.h"
+#include "Client/HealthProbe.h"
+#include "Client/LongPollCollapser.h"
+#include "Client/TrafficMirror.h"
+#include "Client/MicroBatcher.h"
+#include "Client/PriorityScheduler.h"
+#include "Client/UpstreamPool.h"
+#include "Filters/FilterDecision.h"
 #include "Filters/JsonRPCFilter.h"
+#include "Metrics/SharedMetrics.h"
+#include "Metrics/UsageTracker.h"
 #include "Server/RelayServer.h"
 #include "Server/RelaySession.h"
+#include "Server/StreamServer.h"
+#include <boost/algorithm/string/trim.hpp>
+#include <map>
+#include <mutex>
+
+/**
+ * How the relay distributes work over threads
+ */
+enum class RelayExecutionModel
+{
+    // server sessions and upstream clients run on two separate io_contexts with ThreadCount threads
+    // each; every response is handed over from a client thread to a server thread
+    SeparatePools,
+    // a single io_context with ThreadCount threads; the upstream client of a request runs on the strand
+    // of the server session that received it, so a request never switches threads
+    Unified
+};
 
 template <typename Derived>
 class Relay
 {
-    std::string serverBindAddress;
-    uint16_t    serverBindPort;
-    std::string clientTargetAddress;
-    uint16_t    clientTargetPort;
-    uint32_t    threadCount;
+    std::string         serverBindAddress;
+    uint16_t            serverBindPort;
+    std::string         clientTargetAddress;
+    uint16_t            clientTargetPort;
+    uint32_t            threadCount;
+    RelayExecutionModel executionModel;
 
     std::unique_ptr<net::io_context>       ioc_client;
     std::unique_ptr<net::io_context::work> ioc_client_work;
@@ -40,18 +70,298 @@ class Relay
 
     void startThreadsAndIoContext();
 
-    std::shared_ptr<RelayServer> server;
+    // the handler of the server sessions; calls relayRequest() directly, without type erasure
+    struct RequestHandler
+    {
+        Relay* relay;
+
+        void
+        operator()(const RequestType& req, const SessionExecutor& executor, ResponseCallback done) const
+        {
+            relay->relayRequest(req, executor, std::move(done));
+        }
+
+        bool acceptsWebSocket() const { return std::atomic_load(&relay->webSocketPool) != nullptr; }
+
+        void handleWebSocketMessage(const RequestType&     upgrade,
+                                    std::string            message,
+                                    const SessionExecutor& executor,
+                                    WebSocketCallback      done) const
+        {
+            relay->relayWebSocketMessage(upgrade, std::move(message), executor, std::move(done));
+        }
+
+        void handleStreamMessage(std::string            message,
+                                 const SessionExecutor& executor,
+                                 StreamMessageCallback  done) const
+        {
+            relay->relayStreamMessage(std::move(message), executor, std::move(done));
+        }
+    };
+
+    std::shared_ptr<BasicRelayServer<RequestHandler>> server;
+
+    // serves json-rpc calls over raw TCP; null if disabled
+    std::shared_ptr<BasicStreamServer<RequestHandler>> streamServer;
+    std::shared_ptr<const StreamListenerOptions>       streamOptions;
+
+    struct UpstreamTarget
+    {
+        std::string                     address;
+        std::string                     port;
+        std::shared_ptr<UpstreamPool>   pool;    // shared connections, for websocket calls
+        std::shared_ptr<CircuitBreaker> breaker; // null if health checks are disabled
+        std::shared_ptr<AsyncClient>    client;  // keep-alive connections; null to connect per request
+        // options of the keep-alive connections of this upstream alone; null for keepAliveOptions
+        std::shared_ptr<const AsyncClientOptions> clientOptions;
+    };
+    using UpstreamPoolMap = std::map<std::string, UpstreamTarget>;
+    using UpstreamList    = std::vector<UpstreamTarget>;
+
+    // replaced as a whole when a pool is added, so readers never lock
+    std::shared_ptr<const UpstreamPoolMap> upstreamPools = std::make_shared<const UpstreamPoolMap>();
+
+    // serializes the writers (copy and swap) of upstreamPools and defaultUpstreams
+    std::mutex upstreamsWriteMutex;
+
+    // the target of allowed requests, then its failovers in order of preference; replaced as a whole
+    std::shared_ptr<const UpstreamList> defaultUpstreams;
+
+    // health checking of all upstreams; options are null while it's disabled
+    std::mutex                                healthMutex;
+    std::shared_ptr<const HealthCheckOptions> healthChecks;
+    std::vector<std::shared_ptr<HealthProbe>> healthProbes;
+
+    // gives the target a breaker and starts probing it, if health checks are enabled
+    void monitorUpstream(UpstreamTarget& target);
+
+    // options of the keep-alive connections to every upstream; null to connect per request
+    std::shared_ptr<const AsyncClientOptions> keepAliveOptions;
+
+    // gives the target its pool of keep-alive connections, if they're enabled
+    void connectUpstream(UpstreamTarget& target);
+
+    void addUpstreamPool(const std::string&                        name,
+                         const std::string&                        address,
+                         uint16_t                                  port,
+                         std::shared_ptr<const AsyncClientOptions> options);
+
+    // connections to the default upstream shared by websocket clients; null if websockets are disabled
+    std::shared_ptr<UpstreamPool> webSocketPool;
+    std::size_t                   webSocketConnectionCount = 2;
+
+    // combines calls to the default upstream into batches; null if batching is disabled
+    std::shared_ptr<MicroBatcher> microBatcher;
+
+    // admits upstream calls by priority class; null if priority classes are disabled
+    std::shared_ptr<PriorityScheduler> priorityScheduler;
+
+    // counters of the relay, readable by other processes; null if disabled
+    std::shared_ptr<SharedMetrics> sharedMetrics;
+
+    // heavy hitters and latency quantiles by method and client; null if disabled
+    std::shared_ptr<UsageTracker> usageTracker;
+
+    // results of calls that never change, kept on disk; null if disabled
+    std::shared_ptr<ImmutableResultCache> immutableCache;
+
+    // prefetches the calls that usually come next, and keeps their results; null if disabled
+    std::shared_ptr<PrefetchEngine> prefetchEngine;
+
+    // sends one upstream call per wait condition of long-poll methods; null if disabled
+    std::shared_ptr<LongPollCollapser> longPollCollapser;
+
+    // copies a sample of the allowed requests to a shadow upstream; null if disabled
+    std::shared_ptr<TrafficMirror> trafficMirror;
+
+    // where upstream connections run
+    net::io_context& clientContext()
+    {
+        return executionModel == RelayExecutionModel::Unified ? *ioc_server : *ioc_client;
+    }
 
     Derived& derived() { return static_cast<Derived&>(*this); }
 
+    void relayRequest(const RequestType& req, const SessionExecutor& executor, ResponseCallback done);
+    // queues an allowed or routed request by its priority class, if they're enabled, then sends it
+    void scheduleRequest(const RequestType&     req,
+                         const SessionExecutor& executor,
+                         const FilterDecision&  decision,
+                         RequestTrace*          trace,
+                         ResponseCallback       done);
+    // sends an allowed or routed request upstream, once it's admitted by the priority scheduler
+    void sendRequest(const RequestType&     req,
+                     const SessionExecutor& executor,
+                     const FilterDecision&  decision,
+                     RequestTrace*          trace,
+                     ResponseCallback       done);
+    void forwardRequest(const RequestType&     req,
+                        const SessionExecutor& executor,
+                        const UpstreamTarget&  target,
+                        RequestTrace*          trace,
+                        ResponseCallback       done);
+    // sends the prefetches that the engine plans after a call of the method returned the result
+    void prefetchAfter(const std::shared_ptr<PrefetchEngine>& prefetch,
+                       const std::string&                     method,
+                       boost::string_view                     params,
+                       boost::string_view                     result,
+                       uint32_t                               level,
+                       const SessionExecutor&                 executor,
+                       const std::string&                     authorization);
+    // sends the request in a batch if its method is batched; false if it isn't
+    bool batchRequest(const RequestType&    req,
+                      const FilterDecision& decision,
+                      RequestTrace*         trace,
+                      ResponseCallback&     done);
+    void relayWebSocketMessage(const RequestType&     upgrade,
+                               std::string            message,
+                               const SessionExecutor& executor,
+                               WebSocketCallback      done);
+    // relays a call read from a raw TCP stream like an http request
+    void relayStreamMessage(std::string            message,
+                            const SessionExecutor& executor,
+                            StreamMessageCallback  done);
+
 public:
-    Relay(std::string ServerBindAddress,
-          uint16_t    ServerBindPort,
-          std::string ClientTargetAddress,
-          uint16_t    ClientTargetPort,
-          uint32_t    ThreadCount = std::thread::hardware_concurrency());
+    Relay(std::string         ServerBindAddress,
+          uint16_t            ServerBindPort,
+          std::string         ClientTargetAddress,
+          uint16_t            ClientTargetPort,
+          uint32_t            ThreadCount     = std::thread::hardware_concurrency(),
+          RelayExecutionModel ExecutionModel  = RelayExecutionModel::SeparatePools,
+          int                 ListeningSocket = -1);
 
     void stop();
+
+    /**
+     * Stop accepting connections, close idle keep-alive connections at once and the others after their
+     * current response; the relay keeps running until stop() so that requests in flight are answered.
+     * Drained (if any) is called, on any thread, once no http, websocket or raw TCP connection is left;
+     * it must only signal (see SessionTracker), and it's forgotten by stop().
+     */
+    void drain(std::function<void()> drained = nullptr);
+
+    // the number of http (and raw TCP) connections that are still open
+    std::size_t getActiveSessionCount() const;
+
+    // the native handle of the listening socket, to hand it over to a new process (see ListenerHandoff)
+    int getListeningSocket() { return server->getListeningSocket(); }
+
+    // record all requests received by the relay into the capture (nullptr to stop recording)
+    void setTrafficCapture(std::shared_ptr<TrafficCapture> capture);
+
+    // record the timeline of sampled requests into the tracer (nullptr to stop tracing)
+    void setRequestTracer(std::shared_ptr<RequestTracer> tracer);
+
+    // serve downstream connections over TLS with the context (nullptr to serve plain http)
+    void setTlsContext(std::shared_ptr<boost::asio::ssl::context> tls);
+
+    /**
+     * Check http requests while they're read (see RequestScreen): their header as soon as it's read,
+     * and the method of the call while the body arrives, if Derived has isMethodAllowed(); requests
+     * that fail are answered and their connection closed without reading the rest of them
+     */
+    void enableEarlyRejection(RequestScreenOptions options);
+
+    // relays whose filter can tell a method it denies from its name alone hide this
+    bool isMethodAllowed(const std::string&) const { return true; }
+
+    // count requests, denials and upstream errors, and time the responses (nullptr to stop)
+    void setSharedMetrics(std::shared_ptr<SharedMetrics> metrics);
+
+    // track the methods and clients that take the most requests and time (nullptr to stop)
+    void setUsageTracker(std::shared_ptr<UsageTracker> tracker);
+
+    /**
+     * Answer allowed calls of the methods cached by the cache from it, and store the results of the
+     * calls it doesn't have (nullptr to stop)
+     */
+    void setImmutableCache(std::shared_ptr<ImmutableResultCache> cache);
+
+    /**
+     * Prefetch the calls that the rules of the engine expect after allowed calls, and answer calls
+     * with the prefetched results (nullptr to stop)
+     */
+    void setPrefetchEngine(std::shared_ptr<PrefetchEngine> engine);
+
+    /**
+     * Send one call upstream for the allowed calls of the long-poll methods of the collapser that wait
+     * for the same condition, and give its response to all of them (nullptr to stop)
+     */
+    void setLongPollCollapser(std::shared_ptr<LongPollCollapser> collapser);
+
+    /**
+     * Copy a sample of the allowed requests to the shadow upstream of the mirror once they're answered,
+     * and compare its responses with the real ones (nullptr to stop)
+     */
+    void setTrafficMirror(std::shared_ptr<TrafficMirror> mirror);
+
+    // add (or replace) an upstream that requests can be routed to by name with FilterDecision::Route
+    void addUpstreamPool(const std::string& name, const std::string& address, uint16_t port);
+
+    /**
+     * Add (or replace) an upstream pool with keep-alive connections of its own options, e.g., a lower
+     * maxConnections for slow archive nodes, whether or not enableUpstreamKeepAlive() was called
+     */
+    void addUpstreamPool(const std::string& name,
+                         const std::string& address,
+                         uint16_t           port,
+                         AsyncClientOptions options);
+
+    /**
+     * Add an upstream for allowed requests while the target (and the failovers added before this one)
+     * is unhealthy; needs health checks to be enabled to take effect
+     */
+    void addFailoverUpstream(const std::string& address, uint16_t port);
+
+    /**
+     * Probe every upstream in the background, track the failures of real requests, and give every
+     * upstream a circuit breaker: requests to an upstream whose breaker is open fail at once with 503,
+     * or go to the next healthy failover
+     */
+    void enableHealthChecks(HealthCheckOptions options);
+
+    /**
+     * Accept websocket upgrades; every message is a json-rpc call that goes through the same filter as
+     * http requests, and is sent upstream over one of UpstreamConnections connections shared by all
+     * websocket clients (per upstream pool added after this call)
+     */
+    void enableWebSocket(std::size_t UpstreamConnections = 2);
+
+    /**
+     * Combine allowed calls of the methods of options into json-rpc batches to the default upstream,
+     * sent over UpstreamConnections connections; calls of other methods are relayed as usual
+     */
+    void enableMicroBatching(MicroBatchOptions options, std::size_t UpstreamConnections = 2);
+
+    /**
+     * Queue the upstream calls of allowed and routed requests by the priority class the filter gives
+     * them (see PriorityScheduler), so that heavy calls can't take all upstream slots, and within a
+     * class by client if options.clientIdentity is set, so that every client gets its share; calls
+     * that find their queue full are answered with 503
+     */
+    void enablePriorityClasses(PriorityOptions options);
+
+    /**
+     * Send allowed and routed requests over pools of keep-alive connections (one pool per upstream),
+     * instead of over a new connection per request
+     */
+    void enableUpstreamKeepAlive(AsyncClientOptions options);
+
+    /**
+     * Also accept raw TCP connections on the address and port, whose json-rpc calls (a stream of json
+     * objects, e.g., one per line) go through the same path as http requests, and are answered in order
+     * with one line each (see StreamSession); call it once
+     */
+    void enableStreamListener(const std::string&    address,
+                              uint16_t              port,
+                              StreamListenerOptions options = StreamListenerOptions());
+
+    /**
+     * Decides what to do with a request. The default accepts or rejects with Derived::validateRequest();
+     * derived classes can hide this to return richer decisions (see FilterChainRelay)
+     */
+    FilterDecision filterRequest(const RequestType& req);
 };
 
 template <typename Derived>
@@ -69,15 +379,20 @@ void Relay<Derived>::startThreadsAndIoContext()
     ioc_server      = std::make_unique<net::io_context>(threadCount);
     ioc_server_work = std::make_unique<net::io_context::work>(*ioc_server);
 
-    ioc_client      = std::make_unique<net::io_context>(threadCount);
-    ioc_client_work = std::make_unique<net::io_context::work>(*ioc_client);
-
     serverThreadsVector.reserve(threadCount);
     for (auto i = threadCount; i > 0; --i) {
         serverThreadsVector.emplace_back(std::unique_ptr<std::thread, decltype(serverThreadDestructor)>(
             new std::thread([this] { ioc_server->run(); }), serverThreadDestructor));
     }
 
+    if (executionModel == RelayExecutionModel::Unified) {
+        // clients run on the executors of the server sessions
+        return;
+    }
+
+    ioc_client      = std::make_unique<net::io_context>(threadCount);
+    ioc_client_work = std::make_unique<net::io_context::work>(*ioc_client);
+
     clientThreadsVector.reserve(threadCount);
     for (auto i = threadCount; i > 0; --i) {
         clientThreadsVector.emplace_back(std::unique_ptr<std::thread, decltype(clientThreadDestructor)>(
@@ -86,42 +401,884 @@ void Relay<Derived>::startThreadsAndIoContext()
 }
 
 template <typename Derived>
-Relay<Derived>::Relay(std::string ServerBindAddress,
-                      uint16_t    ServerBindPort,
-                      std::string ClientTargetAddress,
-                      uint16_t    ClientTargetPort,
-                      uint32_t    ThreadCount)
+Relay<Derived>::Relay(std::string         ServerBindAddress,
+                      uint16_t            ServerBindPort,
+                      std::string         ClientTargetAddress,
+                      uint16_t            ClientTargetPort,
+                      uint32_t            ThreadCount,
+                      RelayExecutionModel ExecutionModel,
+                      int                 ListeningSocket)
     : serverBindAddress(std::move(ServerBindAddress)), serverBindPort(ServerBindPort),
       clientTargetAddress(std::move(ClientTargetAddress)), clientTargetPort(ClientTargetPort),
-      threadCount(ThreadCount)
+      threadCount(ThreadCount >= 1 ? ThreadCount : 1), executionModel(ExecutionModel)
 {
     auto const address = net::ip::make_address(serverBindAddress);
     uint16_t   port    = serverBindPort;
 
     startThreadsAndIoContext();
 
-    server = std::make_shared<RelayServer>(*ioc_server, net::ip::tcp::endpoint{address, port});
-    server->setRequestPassingFunctor([this](const RequestType& req) -> ResponseType {
-        if (derived().validateRequest(req)) {
-            std::shared_ptr<ClientSession> client = std::make_shared<ClientSession>(*ioc_client);
-            client->run(clientTargetAddress, std::to_string(clientTargetPort), req);
-            try {
-                return client->getResponse().get();
-            } catch (std::exception& ex) {
-                return make_response_server_error(req, ex.what());
+    defaultUpstreams = std::make_shared<const UpstreamList>(UpstreamList{
+        UpstreamTarget{clientTargetAddress, std::to_string(clientTargetPort), nullptr, nullptr}});
+
+    auto handler = std::make_shared<const RequestHandler>(RequestHandler{this});
+    if (ListeningSocket >= 0) {
+        // e.g., handed over by the process this one replaces; the bind address and port are unused
+        server =
+            std::make_shared<BasicRelayServer<RequestHandler>>(*ioc_server, ListeningSocket, handler);
+    } else {
+        server = std::make_shared<BasicRelayServer<RequestHandler>>(
+            *ioc_server, net::ip::tcp::endpoint{address, port}, handler);
+    }
+    server->run();
+}
+
+/**
+ * The client of a request as the scheduler tells clients apart, for fair queueing
+ */
+inline std::string ClientKey(const PriorityScheduler& scheduler, const RequestType& req)
+{
+    switch (scheduler.getClientIdentity()) {
+    case ClientIdentity::None:
+        return std::string();
+    case ClientIdentity::Header: {
+        auto it = req.find(scheduler.getIdentityHeader());
+        if (it != req.end() && !it->value().empty()) {
+            return it->value().to_string();
+        }
+        break;
+    }
+    case ClientIdentity::SourceAddress:
+        break;
+    }
+    const net::ip::address* peer = CurrentPeerScope::Current();
+    return peer ? peer->to_string() : std::string();
+}
+
+template <typename Derived>
+void Relay<Derived>::relayRequest(const RequestType&     req,
+                                  const SessionExecutor& executor,
+                                  ResponseCallback       done)
+{
+    std::shared_ptr<SharedMetrics>              metrics = std::atomic_load(&sharedMetrics);
+    std::shared_ptr<UsageTracker>               usage   = std::atomic_load(&usageTracker);
+    const std::chrono::steady_clock::time_point start   = metrics || usage
+                                                              ? std::chrono::steady_clock::now()
+                                                              : std::chrono::steady_clock::time_point();
+
+    RequestTrace*  trace         = RequestTracer::Current();
+    const uint64_t filterStartNs = trace ? RequestTrace::Now() : 0;
+    FilterDecision decision      = derived().filterRequest(req);
+    if (trace) {
+        trace->addSpan("filter", filterStartNs, RequestTrace::Now());
+    }
+
+    // allowed calls are scanned once for the caches and the long-poll collapser
+    std::shared_ptr<ImmutableResultCache> cache     = std::atomic_load(&immutableCache);
+    std::shared_ptr<PrefetchEngine>       prefetch  = std::atomic_load(&prefetchEngine);
+    std::shared_ptr<LongPollCollapser>    collapser = std::atomic_load(&longPollCollapser);
+    std::string                           cacheKey;
+    std::string                           prefetchKey;
+    JsonRpcCall                           call;
+    bool                                  isCall = false;
+    if ((cache || prefetch || collapser) && decision.isAllowed()) {
+        isCall = JsonRpcScanner::Scan(req.body(), nullptr, call) && !call.id.empty();
+    }
+    const boost::string_view params =
+        boost::string_view(req.body()).substr(call.params.offset, call.params.size);
+
+    // an allowed call whose result never changes is answered from the disk cache, if it's there
+    if (isCall && cache && cache->isCached(call.method)) {
+        const uint64_t lookupStartNs = trace ? RequestTrace::Now() : 0;
+        cacheKey                     = ImmutableResultCache::MakeKey(call.method, params);
+
+        std::string response = R"({"result":)";
+        if (cache->lookup(cacheKey, response)) {
+            response += R"(,"error":null,"id":)" + req.body().substr(call.id.offset, call.id.size) + "}";
+            std::string method = std::move(decision.method);
+            decision           = FilterDecision::ServeFromCache(std::move(response));
+            decision.method    = method.empty() ? call.method : std::move(method);
+            cacheKey.clear();
+        }
+        if (trace) {
+            trace->addSpan("immutable cache lookup", lookupStartNs, RequestTrace::Now());
+        }
+    }
+
+    // a call that the prefetch rules expect is answered with its prefetched result, if it's there
+    if (isCall && prefetch && decision.isAllowed() && prefetch->isPrefetched(call.method)) {
+        prefetchKey          = ImmutableResultCache::MakeKey(call.method, params);
+        std::string response = R"({"result":)";
+        if (prefetch->lookup(prefetchKey, response)) {
+            response += R"(,"error":null,"id":)" + req.body().substr(call.id.offset, call.id.size) + "}";
+            std::string method = std::move(decision.method);
+            decision           = FilterDecision::ServeFromCache(std::move(response));
+            decision.method    = method.empty() ? call.method : std::move(method);
+            prefetchKey.clear();
+        }
+    }
+
+    if (metrics) {
+        SharedMetrics::Outcome outcome = SharedMetrics::Outcome::Forwarded;
+        if (decision.verdict == FilterDecision::Verdict::Deny) {
+            outcome = SharedMetrics::Outcome::Denied;
+        } else if (decision.verdict == FilterDecision::Verdict::ServeFromCache) {
+            outcome = SharedMetrics::Outcome::ServedFromCache;
+        }
+        ResponseCallback measured = [metrics, start, outcome, method = decision.method, done](
+                                        ResponseType&& res) {
+            metrics->recordRequest(method,
+                                   outcome,
+                                   res.result_int() >= 500,
+                                   std::chrono::duration_cast<std::chrono::microseconds>(
+                                       std::chrono::steady_clock::now() - start));
+            done(std::move(res));
+        };
+        done = std::move(measured);
+    }
+    if (usage) {
+        const net::ip::address* peer     = CurrentPeerScope::Current();
+        ResponseCallback        measured = [usage,
+                                     start,
+                                     method = decision.method,
+                                     client = peer ? peer->to_string() : std::string(),
+                                     done](ResponseType&& res) {
+            usage->record(method,
+                          client,
+                          std::chrono::duration_cast<std::chrono::microseconds>(
+                              std::chrono::steady_clock::now() - start));
+            done(std::move(res));
+        };
+        done = std::move(measured);
+    }
+    if (!cacheKey.empty()) {
+        ResponseCallback stored = [cache, method = call.method, cacheKey, done](ResponseType&& res) {
+            if (res.result() == http::status::ok) {
+                cache->store(method, cacheKey, res.body());
+            }
+            done(std::move(res));
+        };
+        done = std::move(stored);
+    }
+    if (isCall && prefetch && prefetch->isTrigger(call.method)) {
+        // the calls that usually come next are prefetched as soon as this one succeeds
+        ResponseCallback triggered = [this,
+                                      prefetch,
+                                      executor,
+                                      method        = call.method,
+                                      params        = params.to_string(),
+                                      authorization = req[http::field::authorization].to_string(),
+                                      done](ResponseType&& res) {
+            boost::string_view result;
+            if (res.result() == http::status::ok && PrefetchEngine::FindResult(res.body(), result)) {
+                prefetchAfter(prefetch, method, params, result, 0, executor, authorization);
             }
+            done(std::move(res));
+        };
+        done = std::move(triggered);
+    }
+
+    switch (decision.verdict) {
+    case FilterDecision::Verdict::Deny:
+        return done(make_response_bad_request(req, decision.reason));
+    case FilterDecision::Verdict::ServeFromCache:
+        return done(make_response_json(req, std::move(decision.body)));
+    case FilterDecision::Verdict::Route:
+    case FilterDecision::Verdict::Allow:
+        break;
+    }
+
+    std::shared_ptr<TrafficMirror> mirror = std::atomic_load(&trafficMirror);
+    if (mirror && mirror->admit()) {
+        // the copy for the shadow is made before the response is handed over, and sent after it
+        const RequestType* reqPtr      = &req;
+        const auto         mirrorStart = std::chrono::steady_clock::now();
+        ResponseCallback   mirrored    = [mirror, reqPtr, mirrorStart, done](ResponseType&& res) {
+            TrafficMirror::Job job = mirror->capture(
+                *reqPtr,
+                res,
+                std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() -
+                                                                      mirrorStart));
+            done(std::move(res));
+            mirror->submit(std::move(job));
+        };
+        done = std::move(mirrored);
+    }
+
+    if (isCall && collapser && collapser->isCollapsed(call.method)) {
+        // a long poll that waits for the same condition as one upstream is parked on it
+        const std::string key =
+            LongPollCollapser::MakeKey(call.method, params, req[http::field::authorization]);
+
+        const RequestType* reqPtr = &req;
+        auto               parked = [reqPtr, done](http::status status, std::string&& body) {
+            ResponseType res = make_response_json(*reqPtr, std::move(body));
+            res.result(status);
+            done(std::move(res));
+        };
+        if (collapser->join(key, req.body().substr(call.id.offset, call.id.size), std::move(parked))) {
+            return;
+        }
+        ResponseCallback collapsed = [collapser, key, done](ResponseType&& res) {
+            collapser->complete(key, res.result(), res.body());
+            done(std::move(res));
+        };
+        done = std::move(collapsed);
+    }
+    if (!prefetchKey.empty()) {
+        // a call whose prefetch is in flight waits for it, and is only sent itself if the prefetch fails
+        const RequestType*             reqPtr = &req;
+        const std::string              id     = req.body().substr(call.id.offset, call.id.size);
+        PrefetchEngine::ResultCallback ready  = [this, reqPtr, executor, decision, trace, id, done](
+                                                   const std::string* result) {
+            if (result) {
+                return done(make_response_json(
+                    *reqPtr, R"({"result":)" + *result + R"(,"error":null,"id":)" + id + "}"));
+            }
+            net::dispatch(executor, [this, reqPtr, executor, decision, trace, done]() {
+                scheduleRequest(*reqPtr, executor, decision, trace, done);
+            });
+        };
+        if (prefetch->wait(prefetchKey, std::move(ready))) {
+            return;
+        }
+    }
+    scheduleRequest(req, executor, decision, trace, std::move(done));
+}
+
+template <typename Derived>
+void Relay<Derived>::scheduleRequest(const RequestType&     req,
+                                     const SessionExecutor& executor,
+                                     const FilterDecision&  decision,
+                                     RequestTrace*          trace,
+                                     ResponseCallback       done)
+{
+    std::shared_ptr<PriorityScheduler> scheduler = std::atomic_load(&priorityScheduler);
+    if (!scheduler) {
+        return sendRequest(req, executor, decision, trace, std::move(done));
+    }
+
+    // the slot of the request is freed as soon as it's answered
+    const std::size_t priority = scheduler->getClassIndex(decision.priorityClass);
+    ResponseCallback  release  = [scheduler, priority, done](ResponseType&& res) {
+        scheduler->release(priority);
+        done(std::move(res));
+    };
+    const RequestType* reqPtr   = &req;
+    const uint64_t     queuedNs = trace ? RequestTrace::Now() : 0;
+    auto               admitted = [this, reqPtr, executor, decision, trace, queuedNs, release, done](
+                         bool isAdmitted) {
+        if (!isAdmitted) {
+            return done(make_response_server_error(*reqPtr, "Relay is stopping\n"));
+        }
+        // a queued request is admitted on the thread of the request that frees its slot
+        net::dispatch(executor, [this, reqPtr, executor, decision, trace, queuedNs, release]() {
+            if (trace) {
+                trace->addSpan("priority queue", queuedNs, RequestTrace::Now());
+            }
+            sendRequest(*reqPtr, executor, decision, trace, release);
+        });
+    };
+    if (!scheduler->submit(priority, ClientKey(*scheduler, req), std::move(admitted))) {
+        done(make_response_server_error(req, "Too many queued requests\n"));
+    }
+}
+
+template <typename Derived>
+void Relay<Derived>::sendRequest(const RequestType&     req,
+                                 const SessionExecutor& executor,
+                                 const FilterDecision&  decision,
+                                 RequestTrace*          trace,
+                                 ResponseCallback       done)
+{
+    if (decision.verdict == FilterDecision::Verdict::Route) {
+        std::shared_ptr<const UpstreamPoolMap> pools = std::atomic_load(&upstreamPools);
+        auto                                   it    = pools->find(decision.pool);
+        if (it == pools->cend()) {
+            LogWrite("Request routed to unknown upstream pool: " + decision.pool, b_sev::err);
+            return done(make_response_server_error(req, "Unknown upstream pool\n"));
+        }
+        if (it->second.breaker && !it->second.breaker->allowRequest()) {
+            return done(make_response_server_error(req, "Upstream is unavailable\n"));
+        }
+        return forwardRequest(req, executor, it->second, trace, std::move(done));
+    }
+    if (batchRequest(req, decision, trace, done)) {
+        return;
+    }
+
+    // the first upstream whose breaker lets the request through
+    std::shared_ptr<const UpstreamList> upstreams = std::atomic_load(&defaultUpstreams);
+    for (const UpstreamTarget& target : *upstreams) {
+        if (!target.breaker || target.breaker->allowRequest()) {
+            return forwardRequest(req, executor, target, trace, std::move(done));
+        }
+    }
+    done(make_response_server_error(req, "No upstream is available\n"));
+}
+
+template <typename Derived>
+void Relay<Derived>::forwardRequest(const RequestType&     req,
+                                    const SessionExecutor& executor,
+                                    const UpstreamTarget&  target,
+                                    RequestTrace*          trace,
+                                    ResponseCallback       done)
+{
+    // the request outlives the client session, as the session that owns it waits for the callback
+    const RequestType*              reqPtr     = &req;
+    std::shared_ptr<CircuitBreaker> breaker    = target.breaker;
+    std::shared_ptr<SharedMetrics>  metrics    = std::atomic_load(&sharedMetrics);
+    ClientSession::CompletionHandler onResponse = [reqPtr, breaker, metrics, done](
+                                                      beast::error_code                   ec,
+                                                      http::response<http::string_body>&& res) {
+        if (breaker) {
+            // an upstream that's still starting up answers with 503 (e.g., while loading blocks)
+            if (ec || res.result() == http::status::service_unavailable) {
+                breaker->recordFailure();
+            } else {
+                breaker->recordSuccess();
+            }
+        }
+        if (ec && metrics) {
+            metrics->recordUpstreamError();
+        }
+        if (ec) {
+            done(make_response_server_error(*reqPtr, boost::system::system_error(ec).what()));
         } else {
-            return make_response_bad_request(req, "Failed to validate request\n");
+            done(std::move(res));
+        }
+    };
+
+    if (target.client) {
+        return target.client->send(req, std::move(onResponse), std::chrono::milliseconds::zero(), trace);
+    }
+
+    std::shared_ptr<ClientSession> client = executionModel == RelayExecutionModel::Unified
+                                                ? std::make_shared<ClientSession>(executor)
+                                                : std::make_shared<ClientSession>(*ioc_client);
+    client->setTrace(trace);
+    client->setCompletionHandler(std::move(onResponse));
+    client->run(target.address, target.port, req);
+}
+
+template <typename Derived>
+void Relay<Derived>::prefetchAfter(const std::shared_ptr<PrefetchEngine>& prefetch,
+                                   const std::string&                     method,
+                                   boost::string_view                     params,
+                                   boost::string_view                     result,
+                                   uint32_t                               level,
+                                   const SessionExecutor&                 executor,
+                                   const std::string&                     authorization)
+{
+    for (PrefetchEngine::Call& planned : prefetch->plan(method, params, result, level)) {
+        // the request outlives sendRequest(), which needs it until it calls back
+        auto req = std::make_shared<RequestType>(http::verb::post, "/", 11);
+        req->set(http::field::host, clientTargetAddress);
+        req->set(http::field::content_type, "application/json");
+        if (!authorization.empty()) {
+            req->set(http::field::authorization, authorization);
+        }
+        req->body() = R"({"jsonrpc":"1.0","id":"prefetch","method":")" + planned.method +
+                      R"(","params":)" + planned.params + "}";
+        req->prepare_payload();
+        auto next = std::make_shared<const PrefetchEngine::Call>(std::move(planned));
+
+        // prefetches are filtered like calls, but skip the priority queues: they have their own budget
+        const FilterDecision decision = derived().filterRequest(*req);
+        if (!decision.isAllowed()) {
+            prefetch->complete(*next, nullptr);
+            continue;
+        }
+        sendRequest(*req,
+                    executor,
+                    decision,
+                    nullptr,
+                    [this, prefetch, req, next, executor, authorization](ResponseType&& res) {
+                        boost::string_view found;
+                        if (res.result() != http::status::ok ||
+                            !PrefetchEngine::FindResult(res.body(), found)) {
+                            return prefetch->complete(*next, nullptr);
+                        }
+                        const std::string value = found.to_string();
+                        prefetch->complete(*next, &value);
+                        prefetchAfter(prefetch,
+                                      next->method,
+                                      next->params,
+                                      value,
+                                      next->level,
+                                      executor,
+                                      authorization);
+                    });
+    }
+}
+
+template <typename Derived>
+bool Relay<Derived>::batchRequest(const RequestType&    req,
+                                  const FilterDecision& decision,
+                                  RequestTrace*         trace,
+                                  ResponseCallback&     done)
+{
+    std::shared_ptr<MicroBatcher> batcher = std::atomic_load(&microBatcher);
+    if (!batcher) {
+        return false;
+    }
+    // the filter usually scanned the call already
+    JsonRpcCall call;
+    if (!decision.scanned && !JsonRpcScanner::Scan(req.body(), nullptr, call)) {
+        return false;
+    }
+    const std::string& method = decision.scanned ? decision.method : call.method;
+    const JsonSpan     id     = decision.scanned ? decision.id : call.id;
+    if (id.empty()) {
+        return false; // notifications get no response, so they can't be told apart in a batch
+    }
+    const std::chrono::microseconds budget = batcher->getBudget(method);
+    if (budget <= std::chrono::microseconds::zero()) {
+        return false;
+    }
+
+    const RequestType* reqPtr  = &req;
+    const uint64_t     startNs = trace ? RequestTrace::Now() : 0;
+    auto onResponse = [reqPtr, trace, startNs, done](boost::system::error_code ec, std::string&& body) {
+        if (trace) {
+            trace->addSpan("batched upstream call", startNs, RequestTrace::Now());
+        }
+        if (ec) {
+            return done(make_response_server_error(*reqPtr, boost::system::system_error(ec).what()));
         }
+        done(make_response_json(*reqPtr, std::move(body)));
+    };
+    batcher->submit(
+        req.body(), id, budget, req[http::field::authorization].to_string(), std::move(onResponse));
+    return true;
+}
+
+/**
+ * A json-rpc error response for a call with the given id (raw json, or empty for null)
+ */
+inline std::string MakeJsonRpcErrorResponse(const std::string& id, int code, const std::string& message)
+{
+    std::string escaped;
+    for (char c : message) {
+        if (c == '"' || c == '\\') {
+            escaped += '\\';
+            escaped += c;
+        } else if (static_cast<unsigned char>(c) >= 0x20) {
+            escaped += c;
+        }
+    }
+    return R"({"result":null,"error":{"code":)" + std::to_string(code) + R"(,"message":")" + escaped +
+           R"("},"id":)" + (id.empty() ? std::string("null") : id) + "}";
+}
+
+template <typename Derived>
+void Relay<Derived>::relayWebSocketMessage(const RequestType&     upgrade,
+                                           std::string            message,
+                                           const SessionExecutor& executor,
+                                           WebSocketCallback      done)
+{
+    boost::ignore_unused(executor);
+
+    // the same filter as http requests
+    RequestType req{http::verb::post, "/", 11};
+    req.body()                    = std::move(message);
+    const FilterDecision decision = derived().filterRequest(req);
+
+    // the filter found the id while it scanned the call, unless it didn't scan it
+    JsonSpan idSpan = decision.id;
+    if (!decision.scanned && !JsonRpcScanner::FindMember(req.body(), "id", idSpan)) {
+        idSpan = JsonSpan();
+    }
+    std::string id = req.body().substr(idSpan.offset, idSpan.size);
+
+    std::shared_ptr<UpstreamPool> pool;
+    switch (decision.verdict) {
+    case FilterDecision::Verdict::Deny:
+        return done(MakeJsonRpcErrorResponse(id, -32600, boost::trim_right_copy(decision.reason)));
+    case FilterDecision::Verdict::ServeFromCache:
+        return done(std::string(decision.body));
+    case FilterDecision::Verdict::Route: {
+        std::shared_ptr<const UpstreamPoolMap> pools = std::atomic_load(&upstreamPools);
+        auto                                   it    = pools->find(decision.pool);
+        if (it == pools->cend()) {
+            LogWrite("Request routed to unknown upstream pool: " + decision.pool, b_sev::err);
+            return done(MakeJsonRpcErrorResponse(id, -32603, "Unknown upstream pool"));
+        }
+        pool = it->second.pool;
+        break;
+    }
+    case FilterDecision::Verdict::Allow:
+        pool = std::atomic_load(&webSocketPool);
+        break;
+    }
+
+    const std::string authorization = upgrade[http::field::authorization].to_string();
+    pool->call(std::move(req.body()),
+               idSpan,
+               authorization,
+               [id, done](boost::system::error_code ec, std::string&& response) {
+                   if (ec) {
+                       done(MakeJsonRpcErrorResponse(id, -32603, ec.message()));
+                   } else if (response.empty()) {
+                       done(MakeJsonRpcErrorResponse(id, -32603, "Empty response from upstream"));
+                   } else {
+                       done(std::move(response));
+                   }
+               });
+}
+
+template <typename Derived>
+void Relay<Derived>::relayStreamMessage(std::string            message,
+                                        const SessionExecutor& executor,
+                                        StreamMessageCallback  done)
+{
+    // the request outlives relayRequest(), which needs it until it calls back
+    auto req = std::make_shared<RequestType>(http::verb::post, "/", 11);
+    req->set(http::field::host, clientTargetAddress);
+    req->set(http::field::content_type, "application/json");
+    std::shared_ptr<const StreamListenerOptions> options = std::atomic_load(&streamOptions);
+    if (options && !options->authorization.empty()) {
+        req->set(http::field::authorization, options->authorization);
+    }
+    req->body() = std::move(message);
+    req->prepare_payload();
+
+    relayRequest(*req, executor, [req, done](ResponseType&& res) {
+        // the relay's own errors are plain text, which stream clients get as json-rpc errors
+        const std::size_t start = res.body().find_first_not_of(" \t\r\n");
+        if (res.result() == http::status::ok ||
+            (start != std::string::npos && (res.body()[start] == '{' || res.body()[start] == '['))) {
+            return done(std::move(res.body()));
+        }
+        JsonSpan idSpan;
+        if (!JsonRpcScanner::FindMember(req->body(), "id", idSpan)) {
+            idSpan = JsonSpan();
+        }
+        done(MakeJsonRpcErrorResponse(req->body().substr(idSpan.offset, idSpan.size),
+                                      res.result_int() < 500 ? -32600 : -32603,
+                                      boost::trim_copy(res.body())));
     });
-    server->run();
 }
 
 template <typename Derived>
 void Relay<Derived>::stop()
 {
+    server->forgetDrained();
+    std::shared_ptr<BasicStreamServer<RequestHandler>> streams = std::atomic_load(&streamServer);
+    if (streams) {
+        streams->forgetDrained();
+    }
+
     ioc_server_work.reset();
     ioc_client_work.reset();
+
+    std::shared_ptr<UpstreamPool> pool = std::atomic_load(&webSocketPool);
+    if (pool) {
+        pool->stop();
+    }
+    for (const auto& p : *std::atomic_load(&upstreamPools)) {
+        p.second.pool->stop();
+        if (p.second.client) {
+            p.second.client->stop();
+        }
+    }
+    for (const UpstreamTarget& target : *std::atomic_load(&defaultUpstreams)) {
+        if (target.client) {
+            target.client->stop();
+        }
+    }
+    {
+        std::lock_guard<std::mutex> lock(healthMutex);
+        for (const auto& probe : healthProbes) {
+            probe->stop();
+        }
+        healthProbes.clear();
+    }
+    std::shared_ptr<MicroBatcher> batcher = std::atomic_load(&microBatcher);
+    if (batcher) {
+        batcher->stop();
+    }
+    std::shared_ptr<PriorityScheduler> scheduler = std::atomic_load(&priorityScheduler);
+    if (scheduler) {
+        scheduler->stop();
+    }
+}
+
+template <typename Derived>
+void Relay<Derived>::drain(std::function<void()> drained)
+{
+    std::shared_ptr<BasicStreamServer<RequestHandler>> streams = std::atomic_load(&streamServer);
+    if (!streams) {
+        return server->drain(std::move(drained));
+    }
+    // both servers have to drain
+    std::function<void()> each;
+    if (drained) {
+        auto pending = std::make_shared<std::atomic<int>>(2);
+        each         = [pending, drained]() {
+            if (--*pending == 0) {
+                drained();
+            }
+        };
+    }
+    server->drain(each);
+    streams->drain(each);
+}
+
+template <typename Derived>
+std::size_t Relay<Derived>::getActiveSessionCount() const
+{
+    std::shared_ptr<BasicStreamServer<RequestHandler>> streams = std::atomic_load(&streamServer);
+    return server->getActiveSessionCount() + (streams ? streams->getActiveSessionCount() : 0);
+}
+
+template <typename Derived>
+void Relay<Derived>::setTrafficCapture(std::shared_ptr<TrafficCapture> capture)
+{
+    std::shared_ptr<BasicStreamServer<RequestHandler>> streams = std::atomic_load(&streamServer);
+    if (streams) {
+        streams->setTrafficCapture(capture);
+    }
+    server->setTrafficCapture(std::move(capture));
+}
+
+template <typename Derived>
+void Relay<Derived>::setRequestTracer(std::shared_ptr<RequestTracer> tracer)
+{
+    server->setRequestTracer(std::move(tracer));
+}
+
+template <typename Derived>
+void Relay<Derived>::setTlsContext(std::shared_ptr<boost::asio::ssl::context> tls)
+{
+    server->setTlsContext(std::move(tls));
+}
+
+template <typename Derived>
+void Relay<Derived>::enableEarlyRejection(RequestScreenOptions options)
+{
+    const Derived*                 self      = &derived();
+    RequestScreen::MethodPredicate isAllowed = [self](const std::string& method) {
+        return self->isMethodAllowed(method);
+    };
+    server->setRequestScreen(
+        std::make_shared<const RequestScreen>(std::move(options), std::move(isAllowed)));
+}
+
+template <typename Derived>
+void Relay<Derived>::setSharedMetrics(std::shared_ptr<SharedMetrics> metrics)
+{
+    std::atomic_store(&sharedMetrics, std::move(metrics));
+}
+
+template <typename Derived>
+void Relay<Derived>::setUsageTracker(std::shared_ptr<UsageTracker> tracker)
+{
+    std::atomic_store(&usageTracker, std::move(tracker));
+}
+
+template <typename Derived>
+void Relay<Derived>::setImmutableCache(std::shared_ptr<ImmutableResultCache> cache)
+{
+    std::atomic_store(&immutableCache, std::move(cache));
+}
+
+template <typename Derived>
+void Relay<Derived>::setPrefetchEngine(std::shared_ptr<PrefetchEngine> engine)
+{
+    std::atomic_store(&prefetchEngine, std::move(engine));
+}
+
+template <typename Derived>
+void Relay<Derived>::setLongPollCollapser(std::shared_ptr<LongPollCollapser> collapser)
+{
+    std::atomic_store(&longPollCollapser, std::move(collapser));
+}
+
+template <typename Derived>
+void Relay<Derived>::setTrafficMirror(std::shared_ptr<TrafficMirror> mirror)
+{
+    std::atomic_store(&trafficMirror, std::move(mirror));
+}
+
+template <typename Derived>
+void Relay<Derived>::addUpstreamPool(const std::string& name, const std::string& address, uint16_t port)
+{
+    addUpstreamPool(name, address, port, std::shared_ptr<const AsyncClientOptions>());
+}
+
+template <typename Derived>
+void Relay<Derived>::addUpstreamPool(const std::string& name,
+                                     const std::string& address,
+                                     uint16_t           port,
+                                     AsyncClientOptions options)
+{
+    addUpstreamPool(name, address, port, std::make_shared<const AsyncClientOptions>(std::move(options)));
+}
+
+template <typename Derived>
+void Relay<Derived>::addUpstreamPool(const std::string&                        name,
+                                     const std::string&                        address,
+                                     uint16_t                                  port,
+                                     std::shared_ptr<const AsyncClientOptions> options)
+{
+    std::lock_guard<std::mutex> lock(upstreamsWriteMutex);
+
+    UpstreamTarget target{address,
+                          std::to_string(port),
+                          std::make_shared<UpstreamPool>(
+                              clientContext(), address, std::to_string(port), webSocketConnectionCount),
+                          nullptr,
+                          nullptr,
+                          std::move(options)};
+    monitorUpstream(target);
+    connectUpstream(target);
+
+    std::shared_ptr<const UpstreamPoolMap> current = std::atomic_load(&upstreamPools);
+    std::shared_ptr<UpstreamPoolMap>       updated = std::make_shared<UpstreamPoolMap>(*current);
+    (*updated)[name]                               = std::move(target);
+    std::atomic_store(&upstreamPools, std::shared_ptr<const UpstreamPoolMap>(std::move(updated)));
+}
+
+template <typename Derived>
+void Relay<Derived>::addFailoverUpstream(const std::string& address, uint16_t port)
+{
+    std::lock_guard<std::mutex> lock(upstreamsWriteMutex);
+
+    UpstreamTarget target{address, std::to_string(port), nullptr, nullptr};
+    monitorUpstream(target);
+    connectUpstream(target);
+
+    std::shared_ptr<const UpstreamList> current = std::atomic_load(&defaultUpstreams);
+    std::shared_ptr<UpstreamList>       updated = std::make_shared<UpstreamList>(*current);
+    updated->push_back(std::move(target));
+    std::atomic_store(&defaultUpstreams, std::shared_ptr<const UpstreamList>(std::move(updated)));
+}
+
+template <typename Derived>
+void Relay<Derived>::monitorUpstream(UpstreamTarget& target)
+{
+    std::lock_guard<std::mutex> lock(healthMutex);
+    if (!healthChecks || target.breaker) {
+        return;
+    }
+    target.breaker = std::make_shared<CircuitBreaker>(healthChecks->breaker);
+    auto probe     = std::make_shared<HealthProbe>(
+        clientContext(), target.address, target.port, *healthChecks, target.breaker);
+    probe->run();
+    healthProbes.push_back(std::move(probe));
+}
+
+template <typename Derived>
+void Relay<Derived>::connectUpstream(UpstreamTarget& target)
+{
+    std::shared_ptr<const AsyncClientOptions> options =
+        target.clientOptions ? target.clientOptions : std::atomic_load(&keepAliveOptions);
+    if (!options || target.client) {
+        return;
+    }
+    target.client =
+        std::make_shared<AsyncClient>(clientContext(), target.address, target.port, *options);
+}
+
+template <typename Derived>
+void Relay<Derived>::enableHealthChecks(HealthCheckOptions options)
+{
+    {
+        std::lock_guard<std::mutex> lock(healthMutex);
+        healthChecks = std::make_shared<const HealthCheckOptions>(std::move(options));
+    }
+
+    // the upstreams that were added before get their breakers and probes now
+    std::lock_guard<std::mutex> lock(upstreamsWriteMutex);
+
+    auto upstreams = std::make_shared<UpstreamList>(*std::atomic_load(&defaultUpstreams));
+    for (UpstreamTarget& target : *upstreams) {
+        monitorUpstream(target);
+    }
+    std::atomic_store(&defaultUpstreams, std::shared_ptr<const UpstreamList>(std::move(upstreams)));
+
+    auto pools = std::make_shared<UpstreamPoolMap>(*std::atomic_load(&upstreamPools));
+    for (auto& p : *pools) {
+        monitorUpstream(p.second);
+    }
+    std::atomic_store(&upstreamPools, std::shared_ptr<const UpstreamPoolMap>(std::move(pools)));
+}
+
+template <typename Derived>
+void Relay<Derived>::enableWebSocket(std::size_t UpstreamConnections)
+{
+    webSocketConnectionCount = UpstreamConnections >= 1 ? UpstreamConnections : 1;
+    std::atomic_store(&webSocketPool,
+                      std::make_shared<UpstreamPool>(clientContext(),
+                                                     clientTargetAddress,
+                                                     std::to_string(clientTargetPort),
+                                                     webSocketConnectionCount));
+}
+
+template <typename Derived>
+void Relay<Derived>::enableMicroBatching(MicroBatchOptions options, std::size_t UpstreamConnections)
+{
+    std::atomic_store(&microBatcher,
+                      std::make_shared<MicroBatcher>(clientContext(),
+                                                     clientTargetAddress,
+                                                     std::to_string(clientTargetPort),
+                                                     UpstreamConnections,
+                                                     std::move(options)));
+}
+
+template <typename Derived>
+void Relay<Derived>::enablePriorityClasses(PriorityOptions options)
+{
+    std::atomic_store(&priorityScheduler, std::make_shared<PriorityScheduler>(std::move(options)));
+}
+
+template <typename Derived>
+void Relay<Derived>::enableUpstreamKeepAlive(AsyncClientOptions options)
+{
+    std::atomic_store(&keepAliveOptions,
+                      std::shared_ptr<const AsyncClientOptions>(
+                          std::make_shared<const AsyncClientOptions>(std::move(options))));
+
+    // the upstreams that were added before get their connection pools now
+    std::lock_guard<std::mutex> lock(upstreamsWriteMutex);
+
+    auto upstreams = std::make_shared<UpstreamList>(*std::atomic_load(&defaultUpstreams));
+    for (UpstreamTarget& target : *upstreams) {
+        connectUpstream(target);
+    }
+    std::atomic_store(&defaultUpstreams, std::shared_ptr<const UpstreamList>(std::move(upstreams)));
+
+    auto pools = std::make_shared<UpstreamPoolMap>(*std::atomic_load(&upstreamPools));
+    for (auto& p : *pools) {
+        connectUpstream(p.second);
+    }
+    std::atomic_store(&upstreamPools, std::shared_ptr<const UpstreamPoolMap>(std::move(pools)));
+}
+
+template <typename Derived>
+void Relay<Derived>::enableStreamListener(const std::string&    address,
+                                          uint16_t              port,
+                                          StreamListenerOptions options)
+{
+    std::atomic_store(&streamOptions,
+                      std::shared_ptr<const StreamListenerOptions>(
+                          std::make_shared<const StreamListenerOptions>(options)));
+    auto streams = std::make_shared<BasicStreamServer<RequestHandler>>(
+        *ioc_server,
+        net::ip::tcp::endpoint{net::ip::make_address(address), port},
+        std::make_shared<const RequestHandler>(RequestHandler{this}),
+        std::move(options));
+    streams->run();
+    std::atomic_store(&streamServer, std::move(streams));
+}
+
+template <typename Derived>
+FilterDecision Relay<Derived>::filterRequest(const RequestType& req)
+{
+    if (derived().validateRequest(req)) {
+        return FilterDecision::Allow();
+    }
+    return FilterDecision::Deny("Failed to validate request\n");
 }
 
 #endif // RELAY_H
@@ -0,0 +1,47 @@
+#include "AdminEndpoint.h"
+
+namespace {
+
+ResponseType MakeNotFound(const RequestType& req)
+{
+    ResponseType res{boost::beast::http::status::not_found, req.version()};
+    res.set(boost::beast::http::field::server, BOOST_BEAST_VERSION_STRING);
+    res.set(boost::beast::http::field::content_type, "text/plain");
+    res.keep_alive(req.keep_alive());
+    res.body() = "Not found\n";
+    res.prepare_payload();
+    return res;
+}
+
+} // namespace
+
+ResponseType AdminEndpoint::operator()(const RequestType& req) const
+{
+    const boost::string_view target = req.target();
+    const std::size_t        query  = target.find('?');
+    const boost::string_view path   = target.substr(0, query);
+
+    if (req.method() == boost::beast::http::verb::get && path == "/prefetch" && prefetch) {
+        return make_response_json(req, prefetch->getStats().toJson());
+    }
+    if (req.method() == boost::beast::http::verb::get && path == "/mirror" && mirror) {
+        return make_response_json(req, mirror->getStats().toJson());
+    }
+    if (req.method() != boost::beast::http::verb::get || path != "/usage" || !usage) {
+        return MakeNotFound(req);
+    }
+
+    std::size_t top = 20;
+    if (query != boost::string_view::npos) {
+        const boost::string_view params = target.substr(query + 1);
+        if (params.starts_with("top=")) {
+            const std::string value = params.substr(4).to_string();
+            if (value.empty() || value.size() > 6 ||
+                value.find_first_not_of("0123456789") != std::string::npos) {
+                return make_response_bad_request(req, "Invalid top\n");
+            }
+            top = std::stoul(value);
+        }
+    }
+    return make_response_json(req, usage->report(top).toJson());
+}
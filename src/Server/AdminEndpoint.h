@@ -0,0 +1,36 @@
+#ifndef ADMINENDPOINT_H
+#define ADMINENDPOINT_H
+
+#include "Cache/PrefetchEngine.h"
+#include "Client/TrafficMirror.h"
+#include "Metrics/UsageTracker.h"
+#include "RelaySession.h"
+#include <memory>
+
+/**
+ * The http handler of the admin port of the relay (see EasyServer), kept apart from the relayed port so
+ * that it's never exposed to the clients of the relay. Paths:
+ *
+ * - GET /usage[?top=N]: the UsageReport of the tracker as json, with the N heaviest keys of every list
+ *   (20 by default)
+ * - GET /prefetch: the stats of the prefetch engine as json, if there's one
+ * - GET /mirror: the comparison of the shadow upstream with the real ones as json, if there's a mirror
+ */
+class AdminEndpoint
+{
+    std::shared_ptr<UsageTracker>         usage;
+    std::shared_ptr<const PrefetchEngine> prefetch;
+    std::shared_ptr<const TrafficMirror>  mirror;
+
+public:
+    explicit AdminEndpoint(std::shared_ptr<UsageTracker>         Usage,
+                           std::shared_ptr<const PrefetchEngine> Prefetch = nullptr,
+                           std::shared_ptr<const TrafficMirror>  Mirror   = nullptr)
+        : usage(std::move(Usage)), prefetch(std::move(Prefetch)), mirror(std::move(Mirror))
+    {
+    }
+
+    ResponseType operator()(const RequestType& req) const;
+};
+
+#endif // ADMINENDPOINT_H
@@ -0,0 +1,180 @@
+#include "ListenerHandoff.h"
+
+#include "Logging/DefaultLogger.h"
+#include <boost/beast/core/bind_handler.hpp>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+namespace net = boost::asio;
+
+namespace {
+
+const char HANDOFF_MESSAGE = 'L';
+const char HANDOFF_ACK     = 'A';
+
+void SetTimeout(int fd, std::chrono::milliseconds timeout)
+{
+    timeval tv{};
+    tv.tv_sec  = static_cast<time_t>(timeout.count() / 1000);
+    tv.tv_usec = static_cast<suseconds_t>((timeout.count() % 1000) * 1000);
+    ::setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    ::setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+}
+
+bool SendSocket(int channel, int fd)
+{
+    char  message = HANDOFF_MESSAGE;
+    iovec iov{&message, 1};
+
+    union
+    {
+        cmsghdr align;
+        char    buffer[CMSG_SPACE(sizeof(int))];
+    } control;
+    std::memset(&control, 0, sizeof(control));
+
+    msghdr msg{};
+    msg.msg_iov        = &iov;
+    msg.msg_iovlen     = 1;
+    msg.msg_control    = control.buffer;
+    msg.msg_controllen = sizeof(control.buffer);
+
+    cmsghdr* cmsg    = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type  = SCM_RIGHTS;
+    cmsg->cmsg_len   = CMSG_LEN(sizeof(int));
+    std::memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+
+    return ::sendmsg(channel, &msg, MSG_NOSIGNAL) == 1;
+}
+
+int ReceiveSocket(int channel)
+{
+    char  message = 0;
+    iovec iov{&message, 1};
+
+    union
+    {
+        cmsghdr align;
+        char    buffer[CMSG_SPACE(sizeof(int))];
+    } control;
+    std::memset(&control, 0, sizeof(control));
+
+    msghdr msg{};
+    msg.msg_iov        = &iov;
+    msg.msg_iovlen     = 1;
+    msg.msg_control    = control.buffer;
+    msg.msg_controllen = sizeof(control.buffer);
+
+    if (::recvmsg(channel, &msg, MSG_CMSG_CLOEXEC) != 1 || message != HANDOFF_MESSAGE) {
+        return -1;
+    }
+    cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+    if (cmsg == nullptr || cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS ||
+        cmsg->cmsg_len != CMSG_LEN(sizeof(int))) {
+        return -1;
+    }
+    int fd = -1;
+    std::memcpy(&fd, CMSG_DATA(cmsg), sizeof(int));
+    return fd;
+}
+
+} // namespace
+
+ListenerHandoff::ListenerHandoff(net::io_context&      ioc,
+                                 std::string           Path,
+                                 int                   ListeningSocket,
+                                 std::function<void()> OnHandedOff)
+    : acceptor(ioc), path(std::move(Path)), listeningSocket(ListeningSocket),
+      onHandedOff(std::move(OnHandedOff))
+{
+}
+
+void ListenerHandoff::run()
+{
+    // the file of a previous process (that may still be draining) is replaced
+    ::unlink(path.c_str());
+
+    boost::system::error_code ec;
+    acceptor.open(net::local::stream_protocol(), ec);
+    if (!ec) {
+        acceptor.bind(net::local::stream_protocol::endpoint(path), ec);
+    }
+    if (!ec) {
+        acceptor.listen(1, ec);
+    }
+    if (ec) {
+        throw std::runtime_error("Failed to serve the handoff socket " + path + ": " + ec.message());
+    }
+    do_accept();
+}
+
+void ListenerHandoff::stop()
+{
+    boost::system::error_code ec;
+    acceptor.close(ec);
+}
+
+void ListenerHandoff::do_accept()
+{
+    acceptor.async_accept(
+        boost::beast::bind_front_handler(&ListenerHandoff::on_accept, shared_from_this()));
+}
+
+void ListenerHandoff::on_accept(boost::system::error_code           ec,
+                                net::local::stream_protocol::socket channel)
+{
+    if (ec == net::error::operation_aborted || !acceptor.is_open()) {
+        return;
+    }
+    if (ec) {
+        LogWrite("Failed to accept a handoff connection: " + ec.message(), b_sev::err);
+        return do_accept();
+    }
+
+    // the exchange is two bytes long, so it's done synchronously
+    SetTimeout(channel.native_handle(), std::chrono::milliseconds(5000));
+    char ack = 0;
+    if (!SendSocket(channel.native_handle(), listeningSocket) ||
+        ::recv(channel.native_handle(), &ack, 1, 0) != 1 || ack != HANDOFF_ACK) {
+        LogWrite("Handoff of the listening socket failed; still serving", b_sev::err);
+        return do_accept();
+    }
+
+    LogWrite("Listening socket handed over to a new process", b_sev::info);
+    stop();
+    onHandedOff();
+}
+
+int ListenerHandoff::Receive(const std::string& path, std::chrono::milliseconds timeout)
+{
+    sockaddr_un address{};
+    if (path.size() >= sizeof(address.sun_path)) {
+        throw std::runtime_error("Handoff socket path is too long: " + path);
+    }
+    address.sun_family = AF_UNIX;
+    std::memcpy(address.sun_path, path.c_str(), path.size() + 1);
+
+    const int channel = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (channel < 0) {
+        throw std::runtime_error("Failed to create a unix socket: " + std::string(strerror(errno)));
+    }
+    if (::connect(channel, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) != 0) {
+        // nobody serves the path; the caller binds a listening socket of its own
+        ::close(channel);
+        return -1;
+    }
+
+    SetTimeout(channel, timeout);
+    const int fd = ReceiveSocket(channel);
+    if (fd >= 0 && ::send(channel, &HANDOFF_ACK, 1, MSG_NOSIGNAL) != 1) {
+        // without the ack, the old process keeps serving; both processes share the socket then
+        LogWrite("Failed to acknowledge the listening socket handoff", b_sev::warn);
+    }
+    ::close(channel);
+    return fd;
+}
@@ -0,0 +1,53 @@
+#ifndef LISTENERHANDOFF_H
+#define LISTENERHANDOFF_H
+
+#include <boost/asio/io_context.hpp>
+#include <boost/asio/local/stream_protocol.hpp>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <string>
+
+/**
+ * Hands the listening socket of a running relay over to the process that replaces it, so that a
+ * restart doesn't refuse or reset any connection:
+ *
+ * 1. the running process serves a unix socket at a known path with a ListenerHandoff;
+ * 2. the new process calls Receive() with the same path before it starts its relay, gets a duplicate
+ *    of the listening socket (with SCM_RIGHTS), and serves on it; connections waiting in the backlog
+ *    are accepted by whichever process gets to them first;
+ * 3. once the new process has acknowledged the socket, the old one is told through OnHandedOff, and
+ *    it stops accepting and drains its sessions.
+ *
+ * The new process then serves the path itself for the next restart.
+ */
+class ListenerHandoff : public std::enable_shared_from_this<ListenerHandoff>
+{
+    boost::asio::local::stream_protocol::acceptor acceptor;
+    std::string                                   path;
+    int                                           listeningSocket;
+    std::function<void()>                         onHandedOff;
+
+    void do_accept();
+    void on_accept(boost::system::error_code ec, boost::asio::local::stream_protocol::socket channel);
+
+public:
+    ListenerHandoff(boost::asio::io_context& ioc,
+                    std::string              Path,
+                    int                      ListeningSocket,
+                    std::function<void()>    OnHandedOff);
+
+    // starts serving the path (replacing any stale socket file); throws if it can't be served
+    void run();
+
+    void stop();
+
+    /**
+     * Takes over the listening socket of the process that serves path. Returns the new file
+     * descriptor, or -1 if no process serves the path (e.g., on the first start).
+     */
+    static int Receive(const std::string&        path,
+                       std::chrono::milliseconds timeout = std::chrono::milliseconds(5000));
+};
+
+#endif // LISTENERHANDOFF_H
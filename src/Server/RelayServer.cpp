@@ -1,64 +1,91 @@
 #include "RelayServer.h"
 
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <sys/socket.h>
+#include <unistd.h>
+
 namespace net = boost::asio; // from <boost/asio.hpp>
 
-RelayServer::RelayServer(boost::asio::io_context& ioc, boost::asio::ip::tcp::endpoint endpoint)
-    : ioc_(ioc), acceptor_(net::make_strand(ioc))
+void OpenAcceptor(boost::asio::ip::tcp::acceptor&       acceptor,
+                  const boost::asio::ip::tcp::endpoint& endpoint)
 {
     boost::beast::error_code ec;
 
     // Open the acceptor
-    acceptor_.open(endpoint.protocol(), ec);
+    acceptor.open(endpoint.protocol(), ec);
     if (ec) {
         LogWrite("Failed to open acceptor: " + ec.message(), b_sev::err);
         return;
     }
 
     // Allow address reuse
-    acceptor_.set_option(net::socket_base::reuse_address(true), ec);
+    acceptor.set_option(net::socket_base::reuse_address(true), ec);
     if (ec) {
         LogWrite("Failed to set_option: " + ec.message(), b_sev::err);
         return;
     }
 
     // Bind to the server address
-    acceptor_.bind(endpoint, ec);
+    acceptor.bind(endpoint, ec);
     if (ec) {
         LogWrite("Failed to bind: " + ec.message(), b_sev::err);
         return;
     }
 
     // Start listening for connections
-    acceptor_.listen(net::socket_base::max_listen_connections, ec);
+    acceptor.listen(net::socket_base::max_listen_connections, ec);
     if (ec) {
         LogWrite("Failed to listen: " + ec.message(), b_sev::err);
         return;
     }
 }
 
-void RelayServer::run() { do_accept(); }
-
-void RelayServer::setRequestPassingFunctor(const std::function<ResponseType(const RequestType&)>& func)
+void AdoptAcceptor(boost::asio::ip::tcp::acceptor& acceptor, int listeningSocket)
 {
-    requestPassingFunctor = func;
+    sockaddr_storage address{};
+    socklen_t        length = sizeof(address);
+    if (::getsockname(listeningSocket, reinterpret_cast<sockaddr*>(&address), &length) != 0) {
+        const std::string error = strerror(errno);
+        ::close(listeningSocket);
+        throw std::runtime_error("Failed to get the address of the listening socket: " + error);
+    }
+
+    boost::beast::error_code ec;
+    acceptor.assign(address.ss_family == AF_INET6 ? net::ip::tcp::v6() : net::ip::tcp::v4(),
+                    listeningSocket,
+                    ec);
+    if (ec) {
+        ::close(listeningSocket);
+        throw std::runtime_error("Failed to adopt the listening socket: " + ec.message());
+    }
 }
 
-void RelayServer::do_accept()
+RelayServer::RelayServer(boost::asio::io_context& ioc, boost::asio::ip::tcp::endpoint endpoint)
+    : BasicRelayServer<AsyncRequestPassingFunctor>(
+          ioc,
+          endpoint,
+          std::make_shared<const AsyncRequestPassingFunctor>(
+              [](const RequestType& req, const SessionExecutor&, ResponseCallback done) {
+                  LogWrite("No validation function set; returning false by default, i.e., all requests "
+                           "are rejected",
+                           b_sev::warn);
+                  done(make_response_bad_request(req, "Handler not set"));
+              }))
 {
-    // The new connection gets its own strand
-    acceptor_.async_accept(net::make_strand(ioc_),
-                           boost::beast::bind_front_handler(&RelayServer::on_accept, shared_from_this()));
 }
 
-void RelayServer::on_accept(boost::beast::error_code ec, boost::asio::ip::tcp::socket socket)
+void RelayServer::setRequestPassingFunctor(const std::function<ResponseType(const RequestType&)>& func)
 {
-    if (ec) {
-        LogWrite("Failed to accept connection: " + ec.message(), b_sev::err);
-    } else {
-        // Create the session and run it
-        std::make_shared<RelaySession>(std::move(socket), requestPassingFunctor)->run();
-    }
+    setHandler(std::make_shared<const AsyncRequestPassingFunctor>(
+        [func](const RequestType& req, const SessionExecutor& executor, ResponseCallback done) {
+            boost::ignore_unused(executor);
+            done(func(req));
+        }));
+}
 
-    // Accept another connection
-    do_accept();
+void RelayServer::setAsyncRequestPassingFunctor(const AsyncRequestPassingFunctor& func)
+{
+    setHandler(std::make_shared<const AsyncRequestPassingFunctor>(func));
 }
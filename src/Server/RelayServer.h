@@ -12,23 +12,104 @@
 
 #include "RelaySession.h"
 
-class RelayServer : public std::enable_shared_from_this<RelayServer>
+// opens, binds and starts listening on the acceptor; failures are logged
+void OpenAcceptor(boost::asio::ip::tcp::acceptor&       acceptor,
+                  const boost::asio::ip::tcp::endpoint& endpoint);
+
+// makes the acceptor own an already listening socket; throws std::runtime_error if it can't
+void AdoptAcceptor(boost::asio::ip::tcp::acceptor& acceptor, int listeningSocket);
+
+/**
+ * Accepts connections and runs a BasicRelaySession<Handler> for each. All sessions share one immutable
+ * SessionContext (the handler and the instrumentation); see SessionContext for the Handler requirements.
+ * With a TLS context, connections are served over TLS instead of plain http.
+ */
+template <typename Handler>
+class BasicRelayServer : public std::enable_shared_from_this<BasicRelayServer<Handler>>
 {
     boost::asio::io_context&       ioc_;
     boost::asio::ip::tcp::acceptor acceptor_;
 
-    std::function<ResponseType(const RequestType&)> requestPassingFunctor = [](const RequestType& req) -> ResponseType {
-        LogWrite("No validation function set; returning false by default, i.e., all requests are rejected",
-                 b_sev::warn);
-        return make_response_bad_request(req, "Handler not set");
-    };
+    std::shared_ptr<const SessionContext<Handler>> context_;
+    std::shared_ptr<SessionTracker>                sessions_ = std::make_shared<SessionTracker>();
+
+    void initContext(std::shared_ptr<const Handler> H);
+
+    // replaces the context; only connections accepted after the call are affected
+    void updateContext(const std::function<void(SessionContext<Handler>&)>& update);
 
 public:
-    RelayServer(net::io_context& ioc, net::ip::tcp::endpoint endpoint);
+    BasicRelayServer(net::io_context&               ioc,
+                     net::ip::tcp::endpoint         endpoint,
+                     std::shared_ptr<const Handler> H);
+
+    /**
+     * Serves on an already listening socket (e.g., one handed over by another process), and owns it.
+     * Throws std::runtime_error if the socket isn't usable.
+     */
+    BasicRelayServer(net::io_context& ioc, int listeningSocket, std::shared_ptr<const Handler> H);
 
     // Start accepting incoming connections
     void run();
 
+    /**
+     * Stop accepting connections, close the keep-alive connections that are waiting for a request, and
+     * every other one after its current response (websockets once their calls in flight are answered).
+     * Drained (if any) is called, on any thread, once no connection is left (see SessionTracker).
+     */
+    void drain(std::function<void()> drained = nullptr);
+
+    // forgets the drained callback of drain()
+    void forgetDrained() { sessions_->forgetDrained(); }
+
+    std::size_t getActiveSessionCount() const { return sessions_->getActiveCount(); }
+
+    // the native handle of the listening socket, e.g., to hand it over to another process
+    int getListeningSocket() { return acceptor_.native_handle(); }
+
+    /**
+     * Replace the handler. Only connections accepted after the call are affected.
+     */
+    void setHandler(std::shared_ptr<const Handler> H);
+
+    /**
+     * Record every request read by the sessions of this server to the given capture; nullptr disables
+     * capturing. Only connections accepted after the call are affected.
+     */
+    void setTrafficCapture(std::shared_ptr<TrafficCapture> Capture);
+
+    /**
+     * Record the timeline of sampled requests with the given tracer; nullptr disables tracing.
+     * Only connections accepted after the call are affected.
+     */
+    void setRequestTracer(std::shared_ptr<RequestTracer> Tracer);
+
+    /**
+     * Serve new connections over TLS with the given context (see MakeTlsServerContext()); nullptr
+     * switches back to plain http. Only connections accepted after the call are affected.
+     */
+    void setTlsContext(std::shared_ptr<boost::asio::ssl::context> Tls);
+
+    /**
+     * Check the header and the method of requests with the screen while they're read, and reject them
+     * before they're read whole if they fail; nullptr reads requests whole. Only connections accepted
+     * after the call are affected.
+     */
+    void setRequestScreen(std::shared_ptr<const RequestScreen> Screen);
+
+private:
+    void do_accept();
+    void on_accept(boost::beast::error_code ec, net::ip::tcp::socket socket);
+};
+
+/**
+ * A server with a type-erased handler that can be set after construction
+ */
+class RelayServer : public BasicRelayServer<AsyncRequestPassingFunctor>
+{
+public:
+    RelayServer(net::io_context& ioc, net::ip::tcp::endpoint endpoint);
+
     /**
      * set the function that validates whether the request should be passed further to the
      * @brief SetReqValidatorFunctor
@@ -36,9 +117,139 @@ public:
      */
     void setRequestPassingFunctor(const std::function<ResponseType(const RequestType&)>& func);
 
-private:
-    void do_accept();
-    void on_accept(boost::beast::error_code ec, net::ip::tcp::socket socket);
+    /**
+     * set the function that handles requests asynchronously; it's called on the thread of the session
+     * that received the request, and must call the callback it's given exactly once
+     */
+    void setAsyncRequestPassingFunctor(const AsyncRequestPassingFunctor& func);
 };
 
+template <typename Handler>
+BasicRelayServer<Handler>::BasicRelayServer(net::io_context&               ioc,
+                                            net::ip::tcp::endpoint         endpoint,
+                                            std::shared_ptr<const Handler> H)
+    : ioc_(ioc), acceptor_(net::make_strand(ioc))
+{
+    initContext(std::move(H));
+    OpenAcceptor(acceptor_, endpoint);
+}
+
+template <typename Handler>
+BasicRelayServer<Handler>::BasicRelayServer(net::io_context&               ioc,
+                                            int                            listeningSocket,
+                                            std::shared_ptr<const Handler> H)
+    : ioc_(ioc), acceptor_(net::make_strand(ioc))
+{
+    initContext(std::move(H));
+    AdoptAcceptor(acceptor_, listeningSocket);
+}
+
+template <typename Handler>
+void BasicRelayServer<Handler>::initContext(std::shared_ptr<const Handler> H)
+{
+    auto context      = std::make_shared<SessionContext<Handler>>();
+    context->handler  = std::move(H);
+    context->sessions = sessions_;
+    context_          = std::move(context);
+}
+
+template <typename Handler>
+void BasicRelayServer<Handler>::run()
+{
+    do_accept();
+}
+
+template <typename Handler>
+void BasicRelayServer<Handler>::drain(std::function<void()> drained)
+{
+    sessions_->drain(std::move(drained));
+    auto self = this->shared_from_this();
+    net::dispatch(acceptor_.get_executor(), [self]() {
+        boost::beast::error_code ec;
+        self->acceptor_.close(ec);
+    });
+}
+
+template <typename Handler>
+void BasicRelayServer<Handler>::updateContext(
+    const std::function<void(SessionContext<Handler>&)>& update)
+{
+    // setters are rare, so the context is copied on update and accepting only needs one atomic load
+    auto updated = std::make_shared<SessionContext<Handler>>(*std::atomic_load(&context_));
+    update(*updated);
+    std::atomic_store(&context_, std::shared_ptr<const SessionContext<Handler>>(std::move(updated)));
+}
+
+template <typename Handler>
+void BasicRelayServer<Handler>::setHandler(std::shared_ptr<const Handler> H)
+{
+    updateContext([&H](SessionContext<Handler>& c) { c.handler = std::move(H); });
+}
+
+template <typename Handler>
+void BasicRelayServer<Handler>::setTrafficCapture(std::shared_ptr<TrafficCapture> Capture)
+{
+    updateContext(
+        [&Capture](SessionContext<Handler>& c) { c.instrumentation.capture = std::move(Capture); });
+}
+
+template <typename Handler>
+void BasicRelayServer<Handler>::setRequestTracer(std::shared_ptr<RequestTracer> Tracer)
+{
+    updateContext(
+        [&Tracer](SessionContext<Handler>& c) { c.instrumentation.tracer = std::move(Tracer); });
+}
+
+template <typename Handler>
+void BasicRelayServer<Handler>::setTlsContext(std::shared_ptr<boost::asio::ssl::context> Tls)
+{
+    updateContext([&Tls](SessionContext<Handler>& c) { c.tls = std::move(Tls); });
+}
+
+template <typename Handler>
+void BasicRelayServer<Handler>::setRequestScreen(std::shared_ptr<const RequestScreen> Screen)
+{
+    updateContext([&Screen](SessionContext<Handler>& c) { c.screen = std::move(Screen); });
+}
+
+template <typename Handler>
+void BasicRelayServer<Handler>::do_accept()
+{
+    // The new connection gets its own strand
+    acceptor_.async_accept(
+        net::make_strand(ioc_),
+        boost::beast::bind_front_handler(&BasicRelayServer::on_accept, this->shared_from_this()));
+}
+
+template <typename Handler>
+void BasicRelayServer<Handler>::on_accept(boost::beast::error_code     ec,
+                                          boost::asio::ip::tcp::socket socket)
+{
+    if (!acceptor_.is_open()) {
+        return; // draining
+    }
+    if (ec) {
+        LogWrite("Failed to accept connection: " + ec.message(), b_sev::err);
+    } else {
+        std::shared_ptr<const SessionContext<Handler>> context = std::atomic_load(&context_);
+
+        const uint64_t acceptedNs = context->instrumentation.tracer ? RequestTrace::Now() : 0;
+
+        // Create the session and run it
+        if (context->tls) {
+            boost::asio::ssl::context& tls = *context->tls;
+            std::make_shared<BasicRelaySession<Handler, TlsStream>>(
+                std::move(socket), tls, std::move(context), acceptedNs)
+                ->run();
+        } else {
+            std::make_shared<BasicRelaySession<Handler>>(
+                std::move(socket), std::move(context), acceptedNs)
+                ->run();
+        }
+    }
+
+    // Accept another connection
+    do_accept();
+}
+
 #endif // RELAYSERVER_H
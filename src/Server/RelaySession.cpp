@@ -2,6 +2,12 @@
 
 #include "Logging/DefaultLogger.h"
 
+const net::ip::address*& CurrentPeerScope::Peer()
+{
+    thread_local const net::ip::address* peer = nullptr;
+    return peer;
+}
+
 boost::beast::http::response<boost::beast::http::string_body>
 make_response_bad_request(const RequestType& req, const boost::string_view why)
 {
@@ -15,6 +21,19 @@ make_response_bad_request(const RequestType& req, const boost::string_view why)
     return res;
 }
 
+boost::beast::http::response<boost::beast::http::string_body>
+make_response_json(const RequestType& req, std::string&& body)
+{
+    boost::beast::http::response<boost::beast::http::string_body> res{boost::beast::http::status::ok,
+                                                                      req.version()};
+    res.set(boost::beast::http::field::server, BOOST_BEAST_VERSION_STRING);
+    res.set(boost::beast::http::field::content_type, "application/json");
+    res.keep_alive(req.keep_alive());
+    res.body() = std::move(body);
+    res.prepare_payload();
+    return res;
+}
+
 boost::beast::http::response<boost::beast::http::string_body>
 make_response_server_error(const RequestType& req, const boost::string_view why)
 {
@@ -28,70 +47,73 @@ make_response_server_error(const RequestType& req, const boost::string_view why)
     return res;
 }
 
-void RelaySession::run() { do_read(); }
-
-void RelaySession::do_read()
+uint64_t SessionTracker::enter()
 {
-    // Make the request empty before reading,
-    // otherwise the operation behavior is undefined.
-    req_ = {};
-
-    // Set the timeout.
-    stream_.expires_after(std::chrono::seconds(60));
-
-    // Read a request
-    boost::beast::http::async_read(
-        stream_,
-        buffer_,
-        req_,
-        boost::beast::bind_front_handler(&RelaySession::on_read, shared_from_this()));
+    std::lock_guard<std::mutex> lock(mtx);
+    active++;
+    return nextId++;
 }
 
-void RelaySession::on_read(boost::beast::error_code ec, std::size_t bytes_transferred)
+void SessionTracker::leave(uint64_t id)
 {
-    boost::ignore_unused(bytes_transferred);
-
-    // This means they closed the connection
-    if (ec == boost::beast::http::error::end_of_stream) {
-        return do_close();
+    std::function<void()>       closer; // destroyed after the lock is released
+    std::lock_guard<std::mutex> lock(mtx);
+    auto                        it = closers.find(id);
+    if (it != closers.end()) {
+        closer = std::move(it->second);
+        closers.erase(it);
     }
-
-    if (ec) {
-        LogWrite("Failed to read: " + ec.message(), b_sev::err);
-        return;
+    active--;
+    if (active == 0 && draining && drained) {
+        drained();
+        drained = nullptr;
     }
-
-    // Send the response
-    handle_request(std::move(req_), lambda_);
 }
 
-void RelaySession::on_write(bool close, boost::beast::error_code ec, std::size_t bytes_transferred)
+void SessionTracker::watch(uint64_t id, std::function<void()> closeIfIdle)
 {
-    boost::ignore_unused(bytes_transferred);
-
-    if (ec) {
-        LogWrite("Failed to write: " + ec.message(), b_sev::err);
-        return;
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        if (!draining) {
+            closers[id] = std::move(closeIfIdle);
+            return;
+        }
     }
+    closeIfIdle();
+}
 
-    if (close) {
-        // This means we should close the connection, usually because
-        // the response indicated the "Connection: close" semantic.
-        return do_close();
+void SessionTracker::drain(std::function<void()> Drained)
+{
+    std::vector<std::function<void()>> idle;
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        draining = true;
+        if (active == 0) {
+            if (Drained) {
+                Drained();
+            }
+        } else {
+            drained = std::move(Drained);
+        }
+        for (auto& closer : closers) {
+            idle.push_back(std::move(closer.second));
+        }
+        closers.clear();
+    }
+    // outside of the lock: a session that is gone by now may be destroyed by the closer
+    for (const std::function<void()>& closeIfIdle : idle) {
+        closeIfIdle();
     }
-
-    // We're done with the response so delete it
-    res_ = nullptr;
-
-    // Read another request
-    do_read();
 }
 
-void RelaySession::do_close()
+void SessionTracker::forgetDrained()
 {
-    // Send a TCP shutdown
-    boost::beast::error_code ec;
-    stream_.socket().shutdown(net::ip::tcp::socket::shutdown_send, ec);
+    std::lock_guard<std::mutex> lock(mtx);
+    drained = nullptr;
+}
 
-    // At this point the connection is closed gracefully
+std::size_t SessionTracker::getActiveCount() const
+{
+    std::lock_guard<std::mutex> lock(mtx);
+    return active;
 }
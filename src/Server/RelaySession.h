@@ -1,33 +1,194 @@
 #ifndef RELAYSESSION_H
 #define RELAYSESSION_H
 
+#include <atomic>
 #include <boost/asio/strand.hpp>
 #include <boost/beast/core.hpp>
 #include <boost/beast/http.hpp>
+#include <boost/beast/ssl.hpp>
 #include <boost/beast/version.hpp>
+#include <boost/beast/websocket/rfc6455.hpp>
 #include <boost/config.hpp>
+#include <boost/optional.hpp>
 #include <iostream>
+#include <map>
 #include <memory>
+#include <mutex>
+
+#include "Capture/TrafficCapture.h"
+#include "Logging/DefaultLogger.h"
+#include "RequestScreen.h"
+#include "Tracing/RequestTracer.h"
 
 namespace net = boost::asio; // from <boost/asio.hpp>
 
 using RequestType  = boost::beast::http::request<boost::beast::http::string_body>;
 using ResponseType = boost::beast::http::response<boost::beast::http::string_body>;
 
+// The executor (strand) on which a session runs its handlers
+using SessionExecutor = boost::beast::tcp_stream::executor_type;
+// Completes a request with its response; can be called from any thread, but only once
+using ResponseCallback = std::function<void(ResponseType&&)>;
+/**
+ * Handles a request asynchronously. The request stays valid until the callback is called.
+ * The executor is the one of the session that received the request, so work that is scheduled on it
+ * runs without switching threads.
+ */
+using AsyncRequestPassingFunctor =
+    std::function<void(const RequestType&, const SessionExecutor&, ResponseCallback)>;
+
 boost::beast::http::response<boost::beast::http::string_body>
 make_response_bad_request(const RequestType& req, const boost::string_view why);
 boost::beast::http::response<boost::beast::http::string_body>
 make_response_server_error(const RequestType& req, const boost::string_view why);
+boost::beast::http::response<boost::beast::http::string_body>
+make_response_json(const RequestType& req, std::string&& body);
+
+/**
+ * Makes the remote address of a session's connection the current peer of the calling thread for the
+ * lifetime of the object; sessions set it while they call their handler, so that handlers can tell
+ * clients apart without a change of their signature
+ */
+class CurrentPeerScope
+{
+    const net::ip::address* previous;
+
+    static const net::ip::address*& Peer();
+
+public:
+    explicit CurrentPeerScope(const net::ip::address& peer) : previous(Peer()) { Peer() = &peer; }
+    ~CurrentPeerScope() { Peer() = previous; }
+
+    CurrentPeerScope(const CurrentPeerScope&) = delete;
+    CurrentPeerScope& operator=(const CurrentPeerScope&) = delete;
+
+    // the remote address of the connection whose request is being handled; null outside of handlers
+    static const net::ip::address* Current() { return Peer(); }
+};
+
+/**
+ * Optional observers of the requests handled by sessions; null members are disabled
+ */
+struct SessionInstrumentation
+{
+    std::shared_ptr<TrafficCapture> capture;
+    std::shared_ptr<RequestTracer>  tracer;
+};
+
+/**
+ * Counts the live sessions of a server, and tells them when the server is draining: a draining session
+ * closes its connection after its current response instead of waiting for another request, and the
+ * sessions that are waiting for a request when the drain starts are closed at once. The end of the
+ * drain is signaled when the last session is gone.
+ *
+ * Thread-safe.
+ */
+class SessionTracker
+{
+    std::atomic<bool> draining{false};
+
+    mutable std::mutex                        mtx;
+    std::size_t                               active = 0;
+    uint64_t                                  nextId = 0;
+    std::map<uint64_t, std::function<void()>> closers;  // by session, once they run
+    std::function<void()>                     drained; // called once, when the drain ends
+
+public:
+    // counts a new session; returns its id, for the other calls
+    uint64_t enter();
+
+    // uncounts a session; the last one to leave a draining server ends the drain
+    void leave(uint64_t id);
+
+    /**
+     * Registers the function that closes a running session if it's idle when the drain starts (called
+     * at once if it already started). It's called on any thread, so it has to get to the session's
+     * strand, and it must not keep the session alive.
+     */
+    void watch(uint64_t id, std::function<void()> closeIfIdle);
 
-class RelaySession : public std::enable_shared_from_this<RelaySession>
+    /**
+     * Starts the drain, and closes the idle sessions. Drained is called once no session is left,
+     * possibly at once; it's called on any thread, under a lock, so it must only signal, e.g., post.
+     */
+    void drain(std::function<void()> Drained);
+
+    // forgets the drained callback, e.g., before what it signals is destroyed
+    void forgetDrained();
+
+    bool isDraining() const { return draining; }
+
+    std::size_t getActiveCount() const;
+};
+
+/**
+ * What the sessions of a server share: the handler and the instrumentation. It's immutable; the server
+ * replaces it as a whole when it's reconfigured, so accepting a connection only copies one pointer.
+ *
+ * A Handler is a function object with
+ *
+ *     void operator()(const RequestType&     req,
+ *                     const SessionExecutor& executor,
+ *                     ResponseCallback       done) const;
+ *
+ * with the same contract as AsyncRequestPassingFunctor. It's called directly, so with a concrete
+ * Handler type there's no type-erased call per request.
+ *
+ * Handlers that also have
+ *
+ *     bool acceptsWebSocket() const;
+ *     void handleWebSocketMessage(const RequestType&     upgrade,
+ *                                 std::string            message,
+ *                                 const SessionExecutor& executor,
+ *                                 WebSocketCallback      done) const;
+ *
+ * get websocket upgrade requests (while acceptsWebSocket() returns true) turned into a
+ * WebSocketSession, which calls handleWebSocketMessage() for every message.
+ */
+template <typename Handler>
+struct SessionContext
+{
+    std::shared_ptr<const Handler>             handler;
+    SessionInstrumentation                     instrumentation;
+    std::shared_ptr<SessionTracker>            sessions; // may be null
+    std::shared_ptr<boost::asio::ssl::context> tls;      // null for plain http
+    std::shared_ptr<const RequestScreen>       screen;   // null to read requests whole before checks
+};
+
+// Completes a websocket message with its response; can be called from any thread, but only once
+using WebSocketCallback = std::function<void(std::string&&)>;
+
+template <typename Handler, typename = void>
+struct AcceptsWebSocket : std::false_type
+{
+};
+
+template <typename Handler>
+struct AcceptsWebSocket<Handler, decltype(std::declval<const Handler&>().acceptsWebSocket(), void())>
+    : std::true_type
+{
+};
+
+template <typename Handler>
+class WebSocketSession;
+
+// A session over TLS, which terminates the encryption of the downstream connection
+using TlsStream = boost::beast::ssl_stream<boost::beast::tcp_stream>;
+
+/**
+ * Serves the http requests of one connection. Stream is either a plain boost::beast::tcp_stream or a
+ * TlsStream; websocket upgrades are only supported on plain connections.
+ */
+template <typename Handler, typename Stream = boost::beast::tcp_stream>
+class BasicRelaySession : public std::enable_shared_from_this<BasicRelaySession<Handler, Stream>>
 {
     // This is the C++11 equivalent of a generic lambda.
     // The function object is used to send an HTTP message.
     struct send_lambda
     {
-        RelaySession& self_;
+        BasicRelaySession& self_;
 
-        explicit send_lambda(RelaySession& self) : self_(self) {}
+        explicit send_lambda(BasicRelaySession& self) : self_(self) {}
 
         template <bool isRequest, typename Body, typename Fields>
         void operator()(boost::beast::http::message<isRequest, Body, Fields>&& msg) const
@@ -42,29 +203,112 @@ class RelaySession : public std::enable_shared_from_this<RelaySession>
             // pointer in the class to keep it alive.
             self_.res_ = sp;
 
+            if (self_.trace_) {
+                self_.writeStartNs_ = RequestTrace::Now();
+            }
+
             // Write the response
-            boost::beast::http::async_write(self_.stream_,
-                                            *sp,
-                                            boost::beast::bind_front_handler(&RelaySession::on_write,
-                                                                             self_.shared_from_this(),
-                                                                             sp->need_eof()));
+            boost::beast::http::async_write(
+                self_.stream_,
+                *sp,
+                boost::beast::bind_front_handler(
+                    &BasicRelaySession::on_write, self_.shared_from_this(), sp->need_eof()));
         }
     };
 
-    boost::beast::tcp_stream                                     stream_;
+    using RequestParser = boost::beast::http::request_parser<boost::beast::http::string_body>;
+
+    Stream                                                       stream_;
     boost::beast::flat_buffer                                    buffer_;
     boost::beast::http::request<boost::beast::http::string_body> req_;
     std::shared_ptr<void>                                        res_;
     send_lambda                                                  lambda_;
-    std::function<ResponseType(const RequestType&)>              requestPassingFunctor;
+    std::shared_ptr<const SessionContext<Handler>>               context_;
+
+    // with a request screen, requests are read in steps, and checked as soon as possible
+    boost::optional<RequestParser> parser_;
+    MethodSniffer                  sniffer_;
+
+    // the remote address of the connection
+    net::ip::address peer_;
+
+    // the id of the session in the tracker, and whether it's waiting for the next request
+    uint64_t sessionId_ = 0;
+    bool     idle_      = false;
+
+    // arrival of the request in progress, for the traffic capture
+    std::chrono::system_clock::time_point requestArrival_;
+    std::chrono::steady_clock::time_point requestStart_;
+
+    // tracing of the request in progress; acceptedNs_ is cleared after the first request
+    std::unique_ptr<RequestTrace> trace_;
+    uint64_t                      acceptedNs_   = 0;
+    uint64_t                      readStartNs_  = 0;
+    uint64_t                      writeStartNs_ = 0;
+
+    void on_response(ResponseType&& res, uint64_t completedNs);
+
+    bool isDraining() const { return context_->sessions && context_->sessions->isDraining(); }
+
+    // closes the connection if it's waiting for a request and nothing of it arrived yet
+    void close_if_idle();
+
+    // hands the connection over to a WebSocketSession if the handler supports it
+    bool upgradeToWebSocket(std::true_type);
+    bool upgradeToWebSocket(std::false_type) { return false; }
+
+    using WebSocketSupport =
+        std::integral_constant<bool,
+                               AcceptsWebSocket<Handler>::value &&
+                                   std::is_same<Stream, boost::beast::tcp_stream>::value>;
+
+    // reads the first request right away, or after the TLS handshake
+    void start(boost::beast::tcp_stream&) { do_read(); }
+    void start(TlsStream&);
+    void on_handshake(boost::beast::error_code ec);
+
+    void shutdown(boost::beast::tcp_stream&);
+    void shutdown(TlsStream&);
+
+    // the steps of a screened read: the header, then the body, some of it at a time while it's sniffed
+    void do_read_header();
+    void on_header(boost::beast::error_code ec, std::size_t bytes_transferred);
+    void do_read_body();
+    void on_body(boost::beast::error_code ec, std::size_t bytes_transferred);
+    // answers a request that failed the screen before it's read whole, and closes the connection
+    void reject(const RequestScreen::Rejection& rejection);
 
 public:
     // Take ownership of the stream
-    RelaySession(net::ip::tcp::socket&&                          socket,
-                 std::function<ResponseType(const RequestType&)> RequestPassingFunctor)
-        : stream_(std::move(socket)), lambda_(*this),
-          requestPassingFunctor(std::move(RequestPassingFunctor))
+    BasicRelaySession(net::ip::tcp::socket&&                         socket,
+                      std::shared_ptr<const SessionContext<Handler>> Context,
+                      uint64_t                                       AcceptedNs = 0)
+        : stream_(std::move(socket)), lambda_(*this), context_(std::move(Context)),
+          acceptedNs_(AcceptedNs)
     {
+        if (context_->sessions) {
+            sessionId_ = context_->sessions->enter();
+        }
+    }
+
+    // Take ownership of the stream, which is encrypted with Tls
+    BasicRelaySession(net::ip::tcp::socket&&                         socket,
+                      boost::asio::ssl::context&                     Tls,
+                      std::shared_ptr<const SessionContext<Handler>> Context,
+                      uint64_t                                       AcceptedNs = 0)
+        : stream_(std::move(socket), Tls), lambda_(*this), context_(std::move(Context)),
+          acceptedNs_(AcceptedNs)
+    {
+        if (context_->sessions) {
+            sessionId_ = context_->sessions->enter();
+        }
+    }
+
+    ~BasicRelaySession()
+    {
+        if (context_->sessions) {
+            context_->sessions->leave(sessionId_);
+        }
     }
 
     // Start the asynchronous operation
@@ -78,13 +322,350 @@ public:
 
     void do_close();
 
-    template <typename Body, typename Allocator, typename Send>
-    static void
-    handle_request(boost::beast::http::request<Body, boost::beast::http::basic_fields<Allocator>>&& req,
-                   Send&&                                                                           send)
-    {
-        return send(std::move(send.self_.requestPassingFunctor(req)));
-    }
+    void handle_request();
 };
 
+// A session with a type-erased handler
+using RelaySession = BasicRelaySession<AsyncRequestPassingFunctor>;
+
+template <typename Handler, typename Stream>
+void BasicRelaySession<Handler, Stream>::run()
+{
+    boost::beast::error_code ec;
+    peer_ = boost::beast::get_lowest_layer(stream_).socket().remote_endpoint(ec).address();
+
+    if (context_->sessions) {
+        std::weak_ptr<BasicRelaySession> weak = this->shared_from_this();
+        context_->sessions->watch(sessionId_, [weak]() {
+            if (auto self = weak.lock()) {
+                net::dispatch(boost::beast::get_lowest_layer(self->stream_).get_executor(),
+                              [self]() { self->close_if_idle(); });
+            }
+        });
+    }
+
+    start(stream_);
+}
+
+template <typename Handler, typename Stream>
+void BasicRelaySession<Handler, Stream>::close_if_idle()
+{
+    if (idle_ && buffer_.size() == 0) {
+        // the read completes with operation_aborted, and on_read() closes the connection
+        boost::beast::get_lowest_layer(stream_).cancel();
+    }
+}
+
+template <typename Handler, typename Stream>
+void BasicRelaySession<Handler, Stream>::start(TlsStream&)
+{
+    boost::beast::get_lowest_layer(stream_).expires_after(std::chrono::seconds(30));
+
+    stream_.async_handshake(
+        boost::asio::ssl::stream_base::server,
+        boost::beast::bind_front_handler(&BasicRelaySession::on_handshake, this->shared_from_this()));
+}
+
+template <typename Handler, typename Stream>
+void BasicRelaySession<Handler, Stream>::on_handshake(boost::beast::error_code ec)
+{
+    if (ec) {
+        LogWrite("Failed the TLS handshake: " + ec.message(), b_sev::err);
+        return;
+    }
+
+    do_read();
+}
+
+template <typename Handler, typename Stream>
+void BasicRelaySession<Handler, Stream>::do_read()
+{
+    if (isDraining()) {
+        return do_close();
+    }
+
+    // Make the request empty before reading,
+    // otherwise the operation behavior is undefined.
+    req_ = {};
+
+    // Set the timeout.
+    boost::beast::get_lowest_layer(stream_).expires_after(std::chrono::seconds(60));
+
+    if (context_->instrumentation.tracer) {
+        readStartNs_ = RequestTrace::Now();
+    }
+
+    idle_ = true;
+    if (context_->screen) {
+        return do_read_header();
+    }
+
+    // Read a request
+    boost::beast::http::async_read(
+        stream_,
+        buffer_,
+        req_,
+        boost::beast::bind_front_handler(&BasicRelaySession::on_read, this->shared_from_this()));
+}
+
+template <typename Handler, typename Stream>
+void BasicRelaySession<Handler, Stream>::do_read_header()
+{
+    parser_.emplace();
+    parser_->body_limit(context_->screen->getOptions().maxBodySize);
+    sniffer_ = MethodSniffer();
+
+    boost::beast::http::async_read_header(
+        stream_,
+        buffer_,
+        *parser_,
+        boost::beast::bind_front_handler(&BasicRelaySession::on_header, this->shared_from_this()));
+}
+
+template <typename Handler, typename Stream>
+void BasicRelaySession<Handler, Stream>::on_header(boost::beast::error_code ec,
+                                                   std::size_t              bytes_transferred)
+{
+    idle_ = false;
+
+    // the parser checks a Content-Length beyond the limit as soon as it has the header
+    if (ec == boost::beast::http::error::body_limit) {
+        return reject(context_->screen->rejectOversized());
+    }
+    if (ec) {
+        return on_read(ec, bytes_transferred);
+    }
+
+    const RequestScreen::Rejection rejection =
+        context_->screen->checkHeader(parser_->get(), parser_->content_length());
+    if (rejection.rejected()) {
+        return reject(rejection);
+    }
+    if (parser_->is_done()) {
+        return on_body(ec, 0);
+    }
+    do_read_body();
+}
+
+template <typename Handler, typename Stream>
+void BasicRelaySession<Handler, Stream>::do_read_body()
+{
+    boost::beast::http::async_read_some(
+        stream_,
+        buffer_,
+        *parser_,
+        boost::beast::bind_front_handler(&BasicRelaySession::on_body, this->shared_from_this()));
+}
+
+template <typename Handler, typename Stream>
+void BasicRelaySession<Handler, Stream>::on_body(boost::beast::error_code ec,
+                                                 std::size_t              bytes_transferred)
+{
+    if (ec == boost::beast::http::error::body_limit) {
+        return reject(context_->screen->rejectOversized());
+    }
+    if (ec) {
+        return on_read(ec, bytes_transferred);
+    }
+
+    if (!parser_->is_done()) {
+        // the method usually comes first, so a denied call is rejected after its first bytes
+        const std::string&          body   = parser_->get().body();
+        const MethodSniffer::Result result = sniffer_.feed(body);
+        if (result == MethodSniffer::Result::Found) {
+            const RequestScreen::Rejection rejection =
+                context_->screen->checkMethod(sniffer_.getMethod());
+            if (rejection.rejected()) {
+                return reject(rejection);
+            }
+        }
+        if (result == MethodSniffer::Result::NeedMore &&
+            body.size() < context_->screen->getOptions().sniffLimit) {
+            return do_read_body();
+        }
+
+        // decided, or left to the filter: the rest is read at once
+        return boost::beast::http::async_read(
+            stream_,
+            buffer_,
+            *parser_,
+            boost::beast::bind_front_handler(&BasicRelaySession::on_body, this->shared_from_this()));
+    }
+
+    req_ = parser_->release();
+    parser_.reset();
+    on_read(ec, bytes_transferred);
+}
+
+template <typename Handler, typename Stream>
+void BasicRelaySession<Handler, Stream>::reject(const RequestScreen::Rejection& rejection)
+{
+    ResponseType res = make_response_bad_request(parser_->get(), rejection.reason);
+    res.result(rejection.status);
+    res.keep_alive(false);
+    parser_.reset();
+
+    // the rest of the request is never read; the connection is closed after the response
+    lambda_(std::move(res));
+}
+
+template <typename Handler, typename Stream>
+void BasicRelaySession<Handler, Stream>::on_read(boost::beast::error_code ec,
+                                                 std::size_t              bytes_transferred)
+{
+    boost::ignore_unused(bytes_transferred);
+    idle_ = false;
+
+    // This means they closed the connection
+    if (ec == boost::beast::http::error::end_of_stream) {
+        return do_close();
+    }
+
+    // the server started draining while the connection was idle
+    if (ec == net::error::operation_aborted && isDraining()) {
+        return do_close();
+    }
+
+    // a TLS client closed the connection without a close_notify, which is common between requests
+    if (ec == boost::asio::ssl::error::stream_truncated) {
+        return;
+    }
+
+    if (ec) {
+        LogWrite("Failed to read: " + ec.message(), b_sev::err);
+        return;
+    }
+
+    const SessionInstrumentation& instrumentation = context_->instrumentation;
+    if (instrumentation.tracer) {
+        trace_ = instrumentation.tracer->begin();
+        if (trace_) {
+            if (acceptedNs_ != 0) {
+                trace_->addSpan("accept", acceptedNs_, readStartNs_);
+            }
+            // on keep-alive connections, this includes the wait for the client's next request
+            trace_->markRequestStart();
+            trace_->addSpan("read", readStartNs_, trace_->getRequestStartNs());
+        }
+        acceptedNs_ = 0;
+    }
+
+    if (boost::beast::websocket::is_upgrade(req_) &&
+        upgradeToWebSocket(WebSocketSupport())) {
+        return;
+    }
+
+    handle_request();
+}
+
+template <typename Handler, typename Stream>
+bool BasicRelaySession<Handler, Stream>::upgradeToWebSocket(std::true_type)
+{
+    if (!context_->handler->acceptsWebSocket()) {
+        return false;
+    }
+    trace_.reset();
+    auto ws = std::make_shared<WebSocketSession<Handler>>(stream_.release_socket(), context_);
+    ws->run(std::move(req_));
+    return true;
+}
+
+template <typename Handler, typename Stream>
+void BasicRelaySession<Handler, Stream>::handle_request()
+{
+    if (context_->instrumentation.capture) {
+        requestArrival_ = std::chrono::system_clock::now();
+        requestStart_   = std::chrono::steady_clock::now();
+    }
+
+    auto self = this->shared_from_this();
+
+    CurrentTraceScope traceScope(trace_.get());
+    CurrentPeerScope  peerScope(peer_);
+    (*context_->handler)(req_, stream_.get_executor(), [self](ResponseType&& res) {
+        const uint64_t completedNs = self->trace_ ? RequestTrace::Now() : 0;
+        // the handler may complete on another thread; get back to the session's strand
+        auto sp = std::make_shared<ResponseType>(std::move(res));
+        net::dispatch(self->stream_.get_executor(),
+                      [self, sp, completedNs]() { self->on_response(std::move(*sp), completedNs); });
+    });
+}
+
+template <typename Handler, typename Stream>
+void BasicRelaySession<Handler, Stream>::on_response(ResponseType&& res, uint64_t completedNs)
+{
+    if (trace_) {
+        trace_->addSpan("response handoff", completedNs, RequestTrace::Now());
+    }
+
+    if (context_->instrumentation.capture) {
+        context_->instrumentation.capture->record(
+            requestArrival_, std::chrono::steady_clock::now() - requestStart_, req_.body());
+    }
+
+    if (isDraining()) {
+        res.keep_alive(false);
+    }
+
+    // Send the response
+    lambda_(std::move(res));
+}
+
+template <typename Handler, typename Stream>
+void BasicRelaySession<Handler, Stream>::on_write(bool                     close,
+                                                  boost::beast::error_code ec,
+                                                  std::size_t              bytes_transferred)
+{
+    boost::ignore_unused(bytes_transferred);
+
+    if (trace_) {
+        trace_->addSpan("downstream write", writeStartNs_, RequestTrace::Now());
+        context_->instrumentation.tracer->finish(std::move(trace_));
+    }
+
+    if (ec) {
+        LogWrite("Failed to write: " + ec.message(), b_sev::err);
+        return;
+    }
+
+    if (close) {
+        // This means we should close the connection, usually because
+        // the response indicated the "Connection: close" semantic.
+        return do_close();
+    }
+
+    // We're done with the response so delete it
+    res_ = nullptr;
+
+    // Read another request
+    do_read();
+}
+
+template <typename Handler, typename Stream>
+void BasicRelaySession<Handler, Stream>::do_close()
+{
+    shutdown(stream_);
+}
+
+template <typename Handler, typename Stream>
+void BasicRelaySession<Handler, Stream>::shutdown(boost::beast::tcp_stream&)
+{
+    // Send a TCP shutdown
+    boost::beast::error_code ec;
+    stream_.socket().shutdown(net::ip::tcp::socket::shutdown_send, ec);
+
+    // At this point the connection is closed gracefully
+}
+
+template <typename Handler, typename Stream>
+void BasicRelaySession<Handler, Stream>::shutdown(TlsStream&)
+{
+    boost::beast::get_lowest_layer(stream_).expires_after(std::chrono::seconds(30));
+
+    // Send a TLS close_notify; the connection is closed when the session is destroyed
+    stream_.async_shutdown([self = this->shared_from_this()](boost::beast::error_code) {});
+}
+
+#include "WebSocketSession.h"
+
 #endif // RELAYSESSION_H
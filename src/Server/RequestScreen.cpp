@@ -0,0 +1,159 @@
+#include "RequestScreen.h"
+
+#include "Logging/DefaultLogger.h"
+#include <boost/algorithm/string.hpp>
+#include <boost/beast/websocket/rfc6455.hpp>
+
+namespace http = boost::beast::http;
+
+MethodSniffer::Result MethodSniffer::feed(boost::string_view body)
+{
+    for (; offset < body.size() && result == Result::NeedMore; offset++) {
+        const char c = body[offset];
+        if (inString) {
+            if (escaped) {
+                escaped = false;
+            } else if (c == '\\') {
+                escaped = true;
+                if (methodValue || (isKey && depth == 1)) {
+                    result = Result::Unknown; // escaped names are left to the filter
+                }
+            } else if (c == '"') {
+                inString = false;
+                if (methodValue) {
+                    method.assign(body.data() + stringStart, offset - stringStart);
+                    result = Result::Found;
+                } else if (isKey) {
+                    methodKey = body.substr(stringStart, offset - stringStart) == "method";
+                }
+            }
+            continue;
+        }
+        switch (c) {
+        case ' ':
+        case '\t':
+        case '\r':
+        case '\n':
+            break;
+        case '"':
+            inString    = true;
+            isKey       = depth == 1 && expectKey;
+            expectKey   = false;
+            stringStart = offset + 1;
+            break;
+        case ':':
+            methodValue = depth == 1 && methodKey;
+            methodKey   = false;
+            break;
+        case '{':
+        case '[':
+            if ((depth == 0 && c == '[') || methodValue) {
+                result = Result::Unknown; // a batch, or a method that isn't a string
+            }
+            depth++;
+            expectKey = depth == 1;
+            break;
+        case '}':
+        case ']':
+            depth--;
+            if (depth <= 0) {
+                result = Result::Unknown; // the object ended without a method
+            }
+            break;
+        case ',':
+            expectKey = depth == 1;
+            break;
+        default:
+            if (methodValue || depth == 0) {
+                result = Result::Unknown;
+            }
+            break;
+        }
+    }
+    return result;
+}
+
+RequestScreen::RequestScreen(RequestScreenOptions Options, MethodPredicate IsAllowed)
+    : options(std::move(Options)), isAllowed(std::move(IsAllowed))
+{
+}
+
+RequestScreen::Rejection RequestScreen::checkHeader(const http::request_header<>& header,
+                                                    boost::optional<uint64_t>     contentLength) const
+{
+    Rejection rejection;
+    if (boost::beast::websocket::is_upgrade(header)) {
+        // upgrades have no body; their messages go through the filter one by one
+    } else if (header.method() != http::verb::post) {
+        rejection.status = http::status::method_not_allowed;
+        rejection.reason = "Only POST requests are accepted\n";
+    } else if (contentLength && *contentLength > options.maxBodySize) {
+        sizeRejections++;
+        rejection.status = http::status::payload_too_large;
+        rejection.reason = "Request body is too large\n";
+        LogWrite("Rejected a request of " + std::to_string(*contentLength) + " bytes before its body",
+                 b_sev::warn);
+        return rejection;
+    } else if (options.requireJsonContentType) {
+        const boost::string_view type = header[http::field::content_type];
+        if (!boost::istarts_with(type, "application/json") && !boost::istarts_with(type, "text/plain")) {
+            rejection.status = http::status::unsupported_media_type;
+            rejection.reason = "Content-Type must be application/json\n";
+        }
+    }
+
+    if (!rejection.rejected() && !options.paths.empty()) {
+        boost::string_view path = header.target();
+        path                    = path.substr(0, path.find('?'));
+        bool allowed            = false;
+        for (const std::string& pattern : options.paths) {
+            allowed = !pattern.empty() && pattern.back() == '*'
+                          ? path.starts_with(boost::string_view(pattern).substr(0, pattern.size() - 1))
+                          : path == pattern;
+            if (allowed) {
+                break;
+            }
+        }
+        if (!allowed) {
+            rejection.status = http::status::not_found;
+            rejection.reason = "Unknown path\n";
+        }
+    }
+
+    if (rejection.rejected()) {
+        headerRejections++;
+        LogWrite("Rejected a request by its header (" + boost::trim_copy(rejection.reason) + "): " +
+                     std::string(header.method_string()) + " " + std::string(header.target()),
+                 b_sev::warn);
+    }
+    return rejection;
+}
+
+RequestScreen::Rejection RequestScreen::rejectOversized() const
+{
+    sizeRejections++;
+    LogWrite("Rejected a request whose body is larger than " + std::to_string(options.maxBodySize) +
+                 " bytes",
+             b_sev::warn);
+    return Rejection{http::status::payload_too_large, "Request body is too large\n"};
+}
+
+RequestScreen::Rejection RequestScreen::checkMethod(const std::string& method) const
+{
+    if (!isAllowed || isAllowed(method)) {
+        return Rejection();
+    }
+    methodRejections++;
+    LogWrite("Rejected a call of a method that is not allowed before its body was read: " + method,
+             b_sev::warn);
+    return Rejection{http::status::bad_request, "Failed to validate request\n"};
+}
+
+RequestScreen::Stats RequestScreen::getStats() const
+{
+    Stats stats;
+    stats.headers   = headerRejections.load();
+    stats.oversized = sizeRejections.load();
+    stats.methods   = methodRejections.load();
+    return stats;
+}
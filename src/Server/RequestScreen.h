@@ -0,0 +1,117 @@
+#ifndef REQUESTSCREEN_H
+#define REQUESTSCREEN_H
+
+#include <atomic>
+#include <boost/beast/http/message.hpp>
+#include <boost/beast/http/status.hpp>
+#include <boost/optional.hpp>
+#include <boost/utility/string_view.hpp>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+struct RequestScreenOptions
+{
+    // a larger body is rejected with 413, by its Content-Length before it's read if it has one
+    std::size_t maxBodySize = 1 << 20;
+    // the targets that requests may have, exact or as a prefix* (e.g., / and /wallet/*); empty for any
+    std::vector<std::string> paths;
+    // reject requests without a json (or text/plain, as bitcoin-cli sends) Content-Type with 415
+    bool requireJsonContentType = false;
+    // how much of a body is searched for the method while it arrives; the rest is read at once
+    std::size_t sniffLimit = 4096;
+};
+
+/**
+ * Finds the "method" of a json-rpc call in a body while it arrives, without waiting for the rest of
+ * it: feed() is given the body read so far, which only grows, and resumes where the last call stopped.
+ * Only the "method" member of the top level object counts; a body that isn't an object (e.g., a batch),
+ * or whose method isn't a plain string, is left to the filter, which reads it whole.
+ */
+class MethodSniffer
+{
+public:
+    enum class Result
+    {
+        NeedMore,
+        Found,
+        Unknown // the filter has to decide
+    };
+
+private:
+    std::size_t offset      = 0;
+    int         depth       = 0;
+    bool        inString    = false;
+    bool        escaped     = false;
+    bool        expectKey   = false; // the next string at depth 1 is a key
+    bool        isKey       = false; // the current string is a key
+    bool        methodKey   = false; // the last key at depth 1 was "method"
+    bool        methodValue = false; // the next value is the method
+    std::size_t stringStart = 0;
+    Result      result      = Result::NeedMore;
+    std::string method;
+
+public:
+    Result feed(boost::string_view body);
+
+    const std::string& getMethod() const { return method; }
+};
+
+/**
+ * Checks what it can of an http request before it's read whole (see BasicRelaySession): the header
+ * (verb, target, Content-Type and Content-Length) as soon as it's read, then the json-rpc method while
+ * the body arrives. A request that fails is answered at once and its connection is closed, so that
+ * oversized or disallowed requests don't cost their transfer and a buffer for their body. Requests
+ * that pass still go through the filter of the relay.
+ *
+ * Thread-safe.
+ */
+class RequestScreen
+{
+public:
+    using MethodPredicate = std::function<bool(const std::string& method)>;
+
+    struct Rejection
+    {
+        boost::beast::http::status status = boost::beast::http::status::ok;
+        std::string                reason;
+
+        bool rejected() const { return status != boost::beast::http::status::ok; }
+    };
+
+    struct Stats
+    {
+        uint64_t headers   = 0; // requests rejected by their header
+        uint64_t oversized = 0; // requests rejected by the size of their body
+        uint64_t methods   = 0; // requests rejected by their method, before their body was read whole
+    };
+
+private:
+    const RequestScreenOptions options;
+    const MethodPredicate      isAllowed;
+
+    mutable std::atomic<uint64_t> headerRejections{0};
+    mutable std::atomic<uint64_t> sizeRejections{0};
+    mutable std::atomic<uint64_t> methodRejections{0};
+
+public:
+    // a null predicate allows every method
+    RequestScreen(RequestScreenOptions Options, MethodPredicate IsAllowed);
+
+    const RequestScreenOptions& getOptions() const { return options; }
+
+    // checks the header of a request, with the length of its body if it's known
+    Rejection checkHeader(const boost::beast::http::request_header<>& header,
+                          boost::optional<uint64_t>                  contentLength) const;
+
+    // the rejection of a request whose body turned out larger than maxBodySize
+    Rejection rejectOversized() const;
+
+    // checks the method found in a body
+    Rejection checkMethod(const std::string& method) const;
+
+    Stats getStats() const;
+};
+
+#endif // REQUESTSCREEN_H
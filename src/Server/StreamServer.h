@@ -0,0 +1,119 @@
+#ifndef STREAMSERVER_H
+#define STREAMSERVER_H
+
+#include "RelayServer.h"
+#include "StreamSession.h"
+
+/**
+ * Accepts raw TCP connections and runs a StreamSession<Handler> for each, for clients that send
+ * json-rpc calls without http. The Handler is the one of BasicRelayServer, which must also have
+ *
+ *     void handleStreamMessage(std::string            message,
+ *                              const SessionExecutor& executor,
+ *                              StreamMessageCallback  done) const;
+ */
+template <typename Handler>
+class BasicStreamServer : public std::enable_shared_from_this<BasicStreamServer<Handler>>
+{
+    boost::asio::io_context&       ioc_;
+    boost::asio::ip::tcp::acceptor acceptor_;
+    const StreamListenerOptions    options_;
+
+    std::shared_ptr<const SessionContext<Handler>> context_;
+    std::shared_ptr<SessionTracker>                sessions_ = std::make_shared<SessionTracker>();
+
+    void do_accept();
+    void on_accept(boost::beast::error_code ec, net::ip::tcp::socket socket);
+
+public:
+    BasicStreamServer(net::io_context&               ioc,
+                      net::ip::tcp::endpoint         endpoint,
+                      std::shared_ptr<const Handler> H,
+                      StreamListenerOptions          Options);
+
+    // Start accepting incoming connections
+    void run();
+
+    /**
+     * Stop accepting connections; every connection is closed once its calls in flight are answered.
+     * Drained (if any) is called, on any thread, once no connection is left (see SessionTracker).
+     */
+    void drain(std::function<void()> drained = nullptr);
+
+    // forgets the drained callback of drain()
+    void forgetDrained() { sessions_->forgetDrained(); }
+
+    std::size_t getActiveSessionCount() const { return sessions_->getActiveCount(); }
+
+    /**
+     * Record every call read by the sessions of this server to the given capture; nullptr disables
+     * capturing. Only connections accepted after the call are affected.
+     */
+    void setTrafficCapture(std::shared_ptr<TrafficCapture> Capture);
+};
+
+template <typename Handler>
+BasicStreamServer<Handler>::BasicStreamServer(net::io_context&               ioc,
+                                              net::ip::tcp::endpoint         endpoint,
+                                              std::shared_ptr<const Handler> H,
+                                              StreamListenerOptions          Options)
+    : ioc_(ioc), acceptor_(net::make_strand(ioc)), options_(std::move(Options))
+{
+    auto context      = std::make_shared<SessionContext<Handler>>();
+    context->handler  = std::move(H);
+    context->sessions = sessions_;
+    context_          = std::move(context);
+    OpenAcceptor(acceptor_, endpoint);
+}
+
+template <typename Handler>
+void BasicStreamServer<Handler>::run()
+{
+    do_accept();
+}
+
+template <typename Handler>
+void BasicStreamServer<Handler>::drain(std::function<void()> drained)
+{
+    sessions_->drain(std::move(drained));
+    auto self = this->shared_from_this();
+    net::dispatch(acceptor_.get_executor(), [self]() {
+        boost::beast::error_code ec;
+        self->acceptor_.close(ec);
+    });
+}
+
+template <typename Handler>
+void BasicStreamServer<Handler>::setTrafficCapture(std::shared_ptr<TrafficCapture> Capture)
+{
+    auto updated = std::make_shared<SessionContext<Handler>>(*std::atomic_load(&context_));
+    updated->instrumentation.capture = std::move(Capture);
+    std::atomic_store(&context_, std::shared_ptr<const SessionContext<Handler>>(std::move(updated)));
+}
+
+template <typename Handler>
+void BasicStreamServer<Handler>::do_accept()
+{
+    acceptor_.async_accept(
+        net::make_strand(ioc_),
+        boost::beast::bind_front_handler(&BasicStreamServer::on_accept, this->shared_from_this()));
+}
+
+template <typename Handler>
+void BasicStreamServer<Handler>::on_accept(boost::beast::error_code ec, net::ip::tcp::socket socket)
+{
+    if (!acceptor_.is_open()) {
+        return; // draining
+    }
+    if (ec) {
+        LogWrite("Failed to accept stream connection: " + ec.message(), b_sev::err);
+    } else {
+        socket.set_option(net::ip::tcp::no_delay(true), ec);
+        std::make_shared<StreamSession<Handler>>(
+            std::move(socket), std::atomic_load(&context_), options_)
+            ->run();
+    }
+    do_accept();
+}
+
+#endif // STREAMSERVER_H
@@ -0,0 +1,280 @@
+#ifndef STREAMSESSION_H
+#define STREAMSESSION_H
+
+#include "Filters/JsonStringQueue.h"
+#include "RelaySession.h"
+#include <deque>
+
+// Completes a stream message with its response; can be called from any thread, but only once
+using StreamMessageCallback = std::function<void(std::string&&)>;
+
+struct StreamListenerOptions
+{
+    // calls read ahead of their responses; reading stops while this many are in flight
+    std::size_t maxCallsInFlight = 64;
+    // a connection without a call in flight is closed once it has sent nothing for this long; it's
+    // also the time a client has to take a response
+    std::chrono::milliseconds idleTimeout{30000};
+    // a call larger than this gets a parse error, and its connection is closed
+    std::size_t maxMessageSize = JsonStringQueue::DEFAULT_MAX_VALUE_SIZE;
+    // the Authorization header of the upstream requests of stream calls, which have no headers
+    std::string authorization;
+};
+
+/**
+ * A raw TCP connection that carries json-rpc calls as a stream of json objects (typically one per line)
+ * and gets one response line per call, without any http framing. The socket is read straight into a
+ * JsonStringQueue, which splits the calls; they're handled concurrently by
+ * Handler::handleStreamMessage(), and answered in the order they came in; consecutive ready responses
+ * are written together.
+ *
+ * A stream that can't be split (e.g., an unbalanced bracket, or a call larger than maxMessageSize)
+ * gets a json-rpc parse error, and is closed once the calls before it are answered.
+ */
+template <typename Handler>
+class StreamSession : public std::enable_shared_from_this<StreamSession<Handler>>
+{
+    static const std::size_t READ_SIZE = 1 << 16;
+
+    struct Slot
+    {
+        std::string response;
+        bool        ready = false;
+    };
+
+    boost::beast::tcp_stream                       stream_;
+    net::steady_timer                              idleTimer_;
+    std::shared_ptr<const SessionContext<Handler>> context_;
+    const StreamListenerOptions                    options_;
+    net::ip::address                               peer_;
+    JsonStringQueue                                splitter_;
+    std::deque<Slot>                               slots_;        // by call, the oldest first
+    uint64_t                                       firstSlot_ = 0; // the number of the oldest call
+    std::string                                    outbox_;       // ready responses, in order
+    std::string                                    writing_;      // the responses being written
+    uint64_t                                       sessionId_ = 0; // in the tracker
+    bool                                           reading_   = false;
+    bool                                           closing_   = false; // no more calls are read
+    bool                                           closed_    = false;
+
+    bool isDraining() const { return context_->sessions && context_->sessions->isDraining(); }
+    bool isIdle() const { return slots_.empty() && writing_.empty() && outbox_.empty(); }
+
+    void do_read();
+    void on_read(boost::beast::error_code ec, std::size_t bytes_transferred);
+    void handle_message(std::string&& message);
+    void on_response(uint64_t slot, std::string&& response);
+    void do_write();
+    void on_write(boost::beast::error_code ec, std::size_t bytes_transferred);
+    // closes the connection unless a call comes in within the idle timeout
+    void wait_idle();
+    void close();
+
+public:
+    StreamSession(net::ip::tcp::socket&&                         socket,
+                  std::shared_ptr<const SessionContext<Handler>> Context,
+                  StreamListenerOptions                          Options)
+        : stream_(std::move(socket)), idleTimer_(stream_.get_executor()), context_(std::move(Context)),
+          options_(std::move(Options)), splitter_(options_.maxMessageSize)
+    {
+        if (context_->sessions) {
+            sessionId_ = context_->sessions->enter();
+        }
+    }
+
+    ~StreamSession()
+    {
+        if (context_->sessions) {
+            context_->sessions->leave(sessionId_);
+        }
+    }
+
+    void run();
+};
+
+template <typename Handler>
+void StreamSession<Handler>::run()
+{
+    boost::beast::error_code ec;
+    peer_ = stream_.socket().remote_endpoint(ec).address();
+    auto self = this->shared_from_this();
+    net::dispatch(stream_.get_executor(), [self]() {
+        self->wait_idle();
+        self->do_read();
+    });
+}
+
+template <typename Handler>
+void StreamSession<Handler>::do_read()
+{
+    if (reading_ || closing_ || slots_.size() >= options_.maxCallsInFlight) {
+        return;
+    }
+    if (isDraining()) {
+        closing_ = true;
+        if (isIdle()) {
+            close();
+        }
+        return;
+    }
+    reading_ = true;
+    // reads wait for as long as calls are in flight; the idle timer closes idle connections
+    stream_.expires_never();
+    stream_.async_read_some(
+        net::buffer(splitter_.prepare(READ_SIZE), READ_SIZE),
+        boost::beast::bind_front_handler(&StreamSession::on_read, this->shared_from_this()));
+}
+
+template <typename Handler>
+void StreamSession<Handler>::on_read(boost::beast::error_code ec, std::size_t bytes_transferred)
+{
+    reading_ = false;
+    if (ec) {
+        // the client is done (or gone); the calls it sent are still answered
+        closing_ = true;
+        if (isIdle()) {
+            close();
+        }
+        return;
+    }
+    if (closing_) {
+        return; // e.g., after a parse error; the rest of the stream is ignored
+    }
+    idleTimer_.cancel();
+
+    bool invalid = false;
+    try {
+        splitter_.commit(bytes_transferred);
+    } catch (std::exception& ex) {
+        LogWrite(std::string("Invalid json stream: ") + ex.what(), b_sev::err);
+        invalid = true;
+    }
+    // the calls completed before an error are still handled
+    for (const boost::string_view& message : splitter_.pullSpans()) {
+        handle_message(message.to_string());
+    }
+    if (invalid) {
+        closing_ = true;
+        slots_.push_back(Slot());
+        on_response(firstSlot_ + slots_.size() - 1,
+                    R"({"result":null,"error":{"code":-32700,"message":"Parse error"},"id":null})");
+        return;
+    }
+    if (isIdle()) {
+        wait_idle(); // e.g., only whitespace, or the start of a call
+    }
+    do_read();
+}
+
+template <typename Handler>
+void StreamSession<Handler>::handle_message(std::string&& message)
+{
+    const SessionInstrumentation& instrumentation = context_->instrumentation;
+    const auto arrival = instrumentation.capture ? std::chrono::system_clock::now()
+                                                 : std::chrono::system_clock::time_point();
+    const auto begin   = instrumentation.capture ? std::chrono::steady_clock::now()
+                                                 : std::chrono::steady_clock::time_point();
+    std::shared_ptr<TrafficCapture> capture = instrumentation.capture;
+    std::shared_ptr<std::string>    call    = capture ? std::make_shared<std::string>(message) : nullptr;
+
+    slots_.push_back(Slot());
+    const uint64_t slot = firstSlot_ + slots_.size() - 1;
+    auto           self = this->shared_from_this();
+
+    CurrentPeerScope peerScope(peer_);
+    context_->handler->handleStreamMessage(
+        std::move(message),
+        stream_.get_executor(),
+        [self, slot, capture, call, arrival, begin](std::string&& response) {
+            if (capture) {
+                capture->record(arrival, std::chrono::steady_clock::now() - begin, *call);
+            }
+            // the handler may complete on another thread; get back to the session's strand
+            auto sp = std::make_shared<std::string>(std::move(response));
+            net::dispatch(self->stream_.get_executor(),
+                          [self, slot, sp]() { self->on_response(slot, std::move(*sp)); });
+        });
+}
+
+template <typename Handler>
+void StreamSession<Handler>::on_response(uint64_t slot, std::string&& response)
+{
+    if (closed_) {
+        return;
+    }
+    Slot& s    = slots_[slot - firstSlot_];
+    s.response = std::move(response);
+    s.ready    = true;
+
+    // responses go out in the order of the calls
+    while (!slots_.empty() && slots_.front().ready) {
+        std::string& r = slots_.front().response;
+        while (!r.empty() && (r.back() == '\n' || r.back() == '\r' || r.back() == ' ')) {
+            r.pop_back();
+        }
+        outbox_ += r;
+        outbox_ += '\n';
+        slots_.pop_front();
+        firstSlot_++;
+    }
+    if (writing_.empty() && !outbox_.empty()) {
+        do_write();
+    }
+    do_read();
+}
+
+template <typename Handler>
+void StreamSession<Handler>::do_write()
+{
+    writing_.swap(outbox_);
+    stream_.expires_after(options_.idleTimeout);
+    net::async_write(
+        stream_,
+        net::buffer(writing_),
+        boost::beast::bind_front_handler(&StreamSession::on_write, this->shared_from_this()));
+}
+
+template <typename Handler>
+void StreamSession<Handler>::on_write(boost::beast::error_code ec, std::size_t bytes_transferred)
+{
+    boost::ignore_unused(bytes_transferred);
+    writing_.clear();
+    if (ec) {
+        return close(); // the responses that are still to come are dropped
+    }
+    if (!outbox_.empty()) {
+        return do_write();
+    }
+    if (isIdle()) {
+        if (closing_) {
+            return close();
+        }
+        wait_idle();
+    }
+    do_read();
+}
+
+template <typename Handler>
+void StreamSession<Handler>::wait_idle()
+{
+    auto self = this->shared_from_this();
+    idleTimer_.expires_after(options_.idleTimeout);
+    idleTimer_.async_wait([self](boost::beast::error_code ec) {
+        if (!ec && self->isIdle()) {
+            self->close();
+        }
+    });
+}
+
+template <typename Handler>
+void StreamSession<Handler>::close()
+{
+    closed_  = true;
+    closing_ = true;
+    idleTimer_.cancel();
+    boost::beast::error_code ec;
+    stream_.socket().shutdown(net::ip::tcp::socket::shutdown_both, ec);
+    stream_.socket().close(ec);
+}
+
+#endif // STREAMSESSION_H
@@ -0,0 +1,121 @@
+#include "TlsContext.h"
+
+#include <boost/asio/buffer.hpp>
+#include <openssl/evp.h>
+#include <openssl/pem.h>
+#include <openssl/ssl.h>
+#include <openssl/x509.h>
+#include <stdexcept>
+
+namespace net = boost::asio;
+
+namespace {
+
+// the session id context of the relay; sessions are only resumed by the service that created them
+const unsigned char SESSION_ID_CONTEXT[] = "HttpRpcRelay";
+
+template <typename T, void (*Free)(T*)>
+struct OpenSslDeleter
+{
+    void operator()(T* p) const { Free(p); }
+};
+
+using PKeyPtr    = std::unique_ptr<EVP_PKEY, OpenSslDeleter<EVP_PKEY, EVP_PKEY_free>>;
+using PKeyCtxPtr = std::unique_ptr<EVP_PKEY_CTX, OpenSslDeleter<EVP_PKEY_CTX, EVP_PKEY_CTX_free>>;
+using X509Ptr    = std::unique_ptr<X509, OpenSslDeleter<X509, X509_free>>;
+using BioPtr     = std::unique_ptr<BIO, OpenSslDeleter<BIO, BIO_free_all>>;
+
+std::string BioToString(BIO* bio)
+{
+    char*      data = nullptr;
+    const long size = BIO_get_mem_data(bio, &data);
+    return std::string(data, static_cast<std::size_t>(size));
+}
+
+} // namespace
+
+std::shared_ptr<net::ssl::context> MakeTlsServerContext(const TlsOptions& options)
+{
+    auto context = std::make_shared<net::ssl::context>(net::ssl::context::tls_server);
+    context->set_options(net::ssl::context::default_workarounds | net::ssl::context::no_sslv2 |
+                         net::ssl::context::no_sslv3 | net::ssl::context::no_tlsv1 |
+                         net::ssl::context::no_tlsv1_1 | net::ssl::context::single_dh_use);
+
+    boost::system::error_code ec;
+    context->use_certificate_chain(net::buffer(options.certificateChain), ec);
+    if (ec) {
+        throw std::runtime_error("Invalid TLS certificate chain: " + ec.message());
+    }
+    context->use_private_key(net::buffer(options.privateKey), net::ssl::context::pem, ec);
+    if (ec) {
+        throw std::runtime_error("Invalid TLS private key: " + ec.message());
+    }
+
+    SSL_CTX* ctx = context->native_handle();
+    if (SSL_CTX_check_private_key(ctx) != 1) {
+        throw std::runtime_error("The TLS private key doesn't match the certificate");
+    }
+
+    // resumption by session id (TLS 1.2)
+    SSL_CTX_set_session_id_context(ctx, SESSION_ID_CONTEXT, sizeof(SESSION_ID_CONTEXT) - 1);
+    if (options.sessionCacheSize > 0) {
+        SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_SERVER);
+        SSL_CTX_sess_set_cache_size(ctx, options.sessionCacheSize);
+    } else {
+        SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_OFF);
+    }
+
+    // resumption by session tickets, whose keys OpenSSL generates for the context
+    SSL_CTX_clear_options(ctx, SSL_OP_NO_TICKET);
+#ifdef TLS1_3_VERSION
+    SSL_CTX_set_num_tickets(ctx, options.ticketCount);
+#endif
+
+    // idle keep-alive connections don't need to keep their read and write buffers
+    SSL_CTX_set_mode(ctx, SSL_MODE_RELEASE_BUFFERS);
+
+    return context;
+}
+
+TlsCredentials MakeSelfSignedCredentials(const std::string& commonName)
+{
+    PKeyCtxPtr keyContext(EVP_PKEY_CTX_new_id(EVP_PKEY_EC, nullptr));
+    EVP_PKEY*  rawKey = nullptr;
+    if (!keyContext || EVP_PKEY_keygen_init(keyContext.get()) != 1 ||
+        EVP_PKEY_CTX_set_ec_paramgen_curve_nid(keyContext.get(), NID_X9_62_prime256v1) != 1 ||
+        EVP_PKEY_keygen(keyContext.get(), &rawKey) != 1) {
+        throw std::runtime_error("Failed to generate a key");
+    }
+    PKeyPtr key(rawKey);
+
+    X509Ptr certificate(X509_new());
+    if (!certificate) {
+        throw std::runtime_error("Failed to create a certificate");
+    }
+    X509_set_version(certificate.get(), 2);
+    ASN1_INTEGER_set(X509_get_serialNumber(certificate.get()), 1);
+    X509_gmtime_adj(X509_getm_notBefore(certificate.get()), -60);
+    X509_gmtime_adj(X509_getm_notAfter(certificate.get()), 24 * 60 * 60);
+    X509_set_pubkey(certificate.get(), key.get());
+
+    X509_NAME* name = X509_get_subject_name(certificate.get());
+    X509_NAME_add_entry_by_txt(name,
+                               "CN",
+                               MBSTRING_ASC,
+                               reinterpret_cast<const unsigned char*>(commonName.c_str()),
+                               -1,
+                               -1,
+                               0);
+    X509_set_issuer_name(certificate.get(), name);
+    if (X509_sign(certificate.get(), key.get(), EVP_sha256()) == 0) {
+        throw std::runtime_error("Failed to sign the certificate");
+    }
+
+    BioPtr certificateBio(BIO_new(BIO_s_mem()));
+    BioPtr keyBio(BIO_new(BIO_s_mem()));
+    if (!certificateBio || !keyBio || PEM_write_bio_X509(certificateBio.get(), certificate.get()) != 1 ||
+        PEM_write_bio_PrivateKey(keyBio.get(), key.get(), nullptr, nullptr, 0, nullptr, nullptr) != 1) {
+        throw std::runtime_error("Failed to write the credentials");
+    }
+    return TlsCredentials{BioToString(certificateBio.get()), BioToString(keyBio.get())};
+}
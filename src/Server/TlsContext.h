@@ -0,0 +1,39 @@
+#ifndef TLSCONTEXT_H
+#define TLSCONTEXT_H
+
+#include <boost/asio/ssl/context.hpp>
+#include <memory>
+#include <string>
+
+struct TlsOptions
+{
+    // PEM of the certificate, followed by its intermediates
+    std::string certificateChain;
+    // PEM of the private key of the certificate
+    std::string privateKey;
+    // sessions kept by the server for resumption by session id (TLS 1.2); 0 disables the cache
+    long sessionCacheSize = 20480;
+    // tickets sent to every client after a TLS 1.3 handshake, to resume without any server state
+    std::size_t ticketCount = 2;
+};
+
+/**
+ * A server context for TLS 1.2 and 1.3, with session resumption: through the session cache and
+ * session tickets, returning clients skip the key exchange and certificate verification of a full
+ * handshake. Throws std::runtime_error if the certificate or the key can't be used.
+ */
+std::shared_ptr<boost::asio::ssl::context> MakeTlsServerContext(const TlsOptions& options);
+
+struct TlsCredentials
+{
+    std::string certificateChain;
+    std::string privateKey;
+};
+
+/**
+ * A new key (EC P-256) and a self-signed certificate for commonName, valid for a day; for tests and
+ * benchmarks. Throws std::runtime_error on failure.
+ */
+TlsCredentials MakeSelfSignedCredentials(const std::string& commonName);
+
+#endif // TLSCONTEXT_H
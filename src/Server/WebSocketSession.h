@@ -0,0 +1,208 @@
+#ifndef WEBSOCKETSESSION_H
+#define WEBSOCKETSESSION_H
+
+#include "RelaySession.h"
+#include <boost/beast/websocket.hpp>
+#include <deque>
+
+/**
+ * A websocket connection upgraded from a BasicRelaySession. Every text message is a json-rpc call that
+ * is given to Handler::handleWebSocketMessage(), and every response is sent back as a text message.
+ * Calls are handled concurrently, so responses may come back in a different order than the calls (as
+ * usual with json-rpc over websockets, clients match them by id); reading stops while too many calls
+ * are in flight.
+ *
+ * The session counts in the tracker of its server: when the server drains, it stops reading calls, and
+ * closes the websocket once the calls in flight are answered.
+ */
+template <typename Handler>
+class WebSocketSession : public std::enable_shared_from_this<WebSocketSession<Handler>>
+{
+    static const std::size_t MAX_CALLS_IN_FLIGHT = 64;
+
+    boost::beast::websocket::stream<boost::beast::tcp_stream> ws_;
+    boost::beast::flat_buffer                                 buffer_;
+    std::shared_ptr<const SessionContext<Handler>>            context_;
+    RequestType                                               upgrade_;
+    std::deque<std::string>                                   outbox_;
+    std::size_t                                               callsInFlight_ = 0;
+    uint64_t                                                  sessionId_     = 0;
+    bool                                                      reading_       = false;
+    bool                                                      closed_        = false;
+    bool                                                      draining_      = false;
+
+    void on_accept(boost::beast::error_code ec);
+    void do_read();
+    void on_read(boost::beast::error_code ec, std::size_t bytes_transferred);
+    void on_response(std::string&& response);
+    void do_write();
+    void on_write(boost::beast::error_code ec, std::size_t bytes_transferred);
+    // starts the drain of the session, and closes it if no call is in flight
+    void drain();
+    void close_if_done();
+
+public:
+    WebSocketSession(net::ip::tcp::socket&&                         socket,
+                     std::shared_ptr<const SessionContext<Handler>> Context)
+        : ws_(std::move(socket)), context_(std::move(Context))
+    {
+        if (context_->sessions) {
+            sessionId_ = context_->sessions->enter();
+        }
+    }
+
+    ~WebSocketSession()
+    {
+        if (context_->sessions) {
+            context_->sessions->leave(sessionId_);
+        }
+    }
+
+    // Accept the upgrade request, and start reading messages
+    void run(RequestType&& upgrade);
+};
+
+template <typename Handler>
+void WebSocketSession<Handler>::run(RequestType&& upgrade)
+{
+    upgrade_ = std::move(upgrade);
+    ws_.set_option(
+        boost::beast::websocket::stream_base::timeout::suggested(boost::beast::role_type::server));
+    ws_.async_accept(
+        upgrade_,
+        boost::beast::bind_front_handler(&WebSocketSession::on_accept, this->shared_from_this()));
+}
+
+template <typename Handler>
+void WebSocketSession<Handler>::on_accept(boost::beast::error_code ec)
+{
+    if (ec) {
+        LogWrite("Failed to accept websocket: " + ec.message(), b_sev::err);
+        return;
+    }
+    if (context_->sessions) {
+        std::weak_ptr<WebSocketSession> weak = this->shared_from_this();
+        context_->sessions->watch(sessionId_, [weak]() {
+            if (auto self = weak.lock()) {
+                net::dispatch(self->ws_.get_executor(), [self]() { self->drain(); });
+            }
+        });
+    }
+    do_read();
+}
+
+template <typename Handler>
+void WebSocketSession<Handler>::do_read()
+{
+    if (reading_ || closed_ || draining_ || callsInFlight_ >= MAX_CALLS_IN_FLIGHT) {
+        return;
+    }
+    reading_ = true;
+    ws_.async_read(
+        buffer_, boost::beast::bind_front_handler(&WebSocketSession::on_read, this->shared_from_this()));
+}
+
+template <typename Handler>
+void WebSocketSession<Handler>::on_read(boost::beast::error_code ec, std::size_t bytes_transferred)
+{
+    boost::ignore_unused(bytes_transferred);
+    reading_ = false;
+
+    if (ec) {
+        closed_ = true;
+        if (ec != boost::beast::websocket::error::closed) {
+            LogWrite("Failed to read from websocket: " + ec.message(), b_sev::err);
+        }
+        return;
+    }
+
+    std::string message = boost::beast::buffers_to_string(buffer_.data());
+    buffer_.consume(buffer_.size());
+
+    const SessionInstrumentation& instrumentation = context_->instrumentation;
+    const auto arrival = instrumentation.capture ? std::chrono::system_clock::now()
+                                                 : std::chrono::system_clock::time_point();
+    const auto start   = instrumentation.capture ? std::chrono::steady_clock::now()
+                                                 : std::chrono::steady_clock::time_point();
+    std::shared_ptr<TrafficCapture> capture = instrumentation.capture;
+    std::shared_ptr<std::string>    call    = capture ? std::make_shared<std::string>(message) : nullptr;
+
+    callsInFlight_++;
+    auto self = this->shared_from_this();
+    context_->handler->handleWebSocketMessage(
+        upgrade_,
+        std::move(message),
+        ws_.get_executor(),
+        [self, capture, call, arrival, start](std::string&& response) {
+            if (capture) {
+                capture->record(arrival, std::chrono::steady_clock::now() - start, *call);
+            }
+            // the handler may complete on another thread; get back to the session's strand
+            auto sp = std::make_shared<std::string>(std::move(response));
+            net::dispatch(self->ws_.get_executor(), [self, sp]() { self->on_response(std::move(*sp)); });
+        });
+
+    do_read();
+}
+
+template <typename Handler>
+void WebSocketSession<Handler>::on_response(std::string&& response)
+{
+    callsInFlight_--;
+    if (closed_) {
+        return;
+    }
+    outbox_.push_back(std::move(response));
+    if (outbox_.size() == 1) {
+        do_write();
+    }
+    do_read();
+}
+
+template <typename Handler>
+void WebSocketSession<Handler>::do_write()
+{
+    ws_.text(true);
+    ws_.async_write(
+        net::buffer(outbox_.front()),
+        boost::beast::bind_front_handler(&WebSocketSession::on_write, this->shared_from_this()));
+}
+
+template <typename Handler>
+void WebSocketSession<Handler>::on_write(boost::beast::error_code ec, std::size_t bytes_transferred)
+{
+    boost::ignore_unused(bytes_transferred);
+
+    if (ec) {
+        closed_ = true;
+        LogWrite("Failed to write to websocket: " + ec.message(), b_sev::err);
+        return;
+    }
+
+    outbox_.pop_front();
+    if (!outbox_.empty()) {
+        do_write();
+    }
+    close_if_done();
+}
+
+template <typename Handler>
+void WebSocketSession<Handler>::drain()
+{
+    draining_ = true;
+    close_if_done();
+}
+
+template <typename Handler>
+void WebSocketSession<Handler>::close_if_done()
+{
+    if (!draining_ || closed_ || callsInFlight_ > 0 || !outbox_.empty()) {
+        return;
+    }
+    // the pending read completes with websocket::error::closed
+    closed_ = true;
+    ws_.async_close(boost::beast::websocket::close_code::going_away,
+                    [self = this->shared_from_this()](boost::beast::error_code) {});
+}
+
+#endif // WEBSOCKETSESSION_H
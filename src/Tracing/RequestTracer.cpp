@@ -0,0 +1,249 @@
+#include "RequestTracer.h"
+
+#include "Logging/DefaultLogger.h"
+#include <cstdio>
+#include <deque>
+#include <fstream>
+#include <sstream>
+
+#ifdef __linux__
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace {
+// discarded traces a thread keeps for reuse
+const std::size_t MAX_SPARE_TRACES = 64;
+} // namespace
+
+RequestTrace::RequestTrace(uint64_t Id, bool Sampled) : id(Id), sampled(Sampled) { spans.reserve(16); }
+
+void RequestTrace::addSpan(const char* name, uint64_t beginNs, uint64_t endNs)
+{
+    spans.push_back(Span{name, beginNs, endNs, CurrentThreadId()});
+}
+
+void RequestTrace::reset(uint64_t Id, bool Sampled)
+{
+    id             = Id;
+    sampled        = Sampled;
+    requestStartNs = 0;
+    spans.clear();
+}
+
+void RequestTrace::markRequestStart() { requestStartNs = Now(); }
+
+uint64_t RequestTrace::Now()
+{
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                                     std::chrono::steady_clock::now().time_since_epoch())
+                                     .count());
+}
+
+uint32_t RequestTrace::CurrentThreadId()
+{
+#ifdef __linux__
+    thread_local uint32_t tid = static_cast<uint32_t>(::syscall(SYS_gettid));
+#else
+    thread_local uint32_t tid =
+        static_cast<uint32_t>(std::hash<std::thread::id>()(std::this_thread::get_id()));
+#endif
+    return tid;
+}
+
+RequestTracer::TraceRing::TraceRing(std::size_t capacity) : slots(capacity + 1, nullptr) {}
+
+RequestTracer::TraceRing::~TraceRing()
+{
+    while (RequestTrace* t = pop()) {
+        delete t;
+    }
+}
+
+bool RequestTracer::TraceRing::push(std::unique_ptr<RequestTrace>&& trace)
+{
+    const std::size_t t    = tail.load(std::memory_order_relaxed);
+    const std::size_t next = (t + 1) % slots.size();
+    if (next == head.load(std::memory_order_acquire)) {
+        return false; // full
+    }
+    slots[t] = trace.release();
+    tail.store(next, std::memory_order_release);
+    return true;
+}
+
+RequestTrace* RequestTracer::TraceRing::pop()
+{
+    const std::size_t h = head.load(std::memory_order_relaxed);
+    if (h == tail.load(std::memory_order_acquire)) {
+        return nullptr; // empty
+    }
+    RequestTrace* result = slots[h];
+    head.store((h + 1) % slots.size(), std::memory_order_release);
+    return result;
+}
+
+RequestTracer::RequestTracer(uint32_t                 SampleEveryN,
+                             std::chrono::nanoseconds LatencyThreshold,
+                             std::size_t              PerThreadCapacity)
+    : sampleEveryN(SampleEveryN),
+      latencyThreshold(LatencyThreshold),
+      perThreadCapacity(PerThreadCapacity >= 1 ? PerThreadCapacity : 1)
+{
+}
+
+RequestTracer::~RequestTracer()
+{
+    if (rollingThread.joinable()) {
+        {
+            std::lock_guard<std::mutex> lg(rollingMutex);
+            stopRolling = true;
+        }
+        rollingCondition.notify_all();
+        rollingThread.join();
+    }
+}
+
+RequestTracer::ThreadSlot& RequestTracer::localSlot()
+{
+    return slots.local([this] { return std::make_shared<ThreadSlot>(perThreadCapacity); });
+}
+
+std::unique_ptr<RequestTrace> RequestTracer::begin()
+{
+    const uint64_t n       = requestCounter.fetch_add(1, std::memory_order_relaxed);
+    const bool     sampled = sampleEveryN > 0 && n % sampleEveryN == 0;
+    if (!sampled && latencyThreshold.count() <= 0) {
+        return nullptr;
+    }
+    std::vector<std::unique_ptr<RequestTrace>>& spare = localSlot().spare;
+    if (spare.empty()) {
+        return std::unique_ptr<RequestTrace>(new RequestTrace(n, sampled));
+    }
+    std::unique_ptr<RequestTrace> trace = std::move(spare.back());
+    spare.pop_back();
+    trace->reset(n, sampled);
+    return trace;
+}
+
+void RequestTracer::finish(std::unique_ptr<RequestTrace> trace)
+{
+    if (!trace) {
+        return;
+    }
+    ThreadSlot& slot = localSlot();
+    if (!trace->isSampled()) {
+        const uint64_t start     = trace->getRequestStartNs();
+        const uint64_t threshold = static_cast<uint64_t>(latencyThreshold.count());
+        if (start == 0 || RequestTrace::Now() - start < threshold) {
+            if (slot.spare.size() < MAX_SPARE_TRACES) {
+                slot.spare.push_back(std::move(trace));
+            }
+            return;
+        }
+    }
+    if (slot.ring.push(std::move(trace))) {
+        tracesKept++;
+    } else {
+        tracesDropped++;
+    }
+}
+
+std::vector<std::unique_ptr<RequestTrace>> RequestTracer::drain()
+{
+    std::vector<std::unique_ptr<RequestTrace>> result;
+
+    // the lock makes this the only consumer of the rings
+    std::lock_guard<std::mutex> lg(drainMutex);
+    for (const auto& slot : slots.snapshot()) {
+        while (RequestTrace* t = slot->ring.pop()) {
+            result.emplace_back(t);
+        }
+    }
+    return result;
+}
+
+std::string RequestTracer::ToChromeTrace(const std::vector<std::unique_ptr<RequestTrace>>& traces)
+{
+    const auto us = [](uint64_t ns) {
+        char buf[32];
+        std::snprintf(buf, sizeof(buf), "%llu.%03u", static_cast<unsigned long long>(ns / 1000),
+                      static_cast<unsigned>(ns % 1000));
+        return std::string(buf);
+    };
+
+#ifdef __linux__
+    const int pid = static_cast<int>(::getpid());
+#else
+    const int pid = 1;
+#endif
+
+    std::ostringstream os;
+    os << R"({"displayTimeUnit":"ns","traceEvents":[)";
+    bool first = true;
+    for (const auto& trace : traces) {
+        for (const RequestTrace::Span& s : trace->getSpans()) {
+            os << (first ? "" : ",") << R"({"name":")" << s.name << R"(","cat":"relay","ph":"X","ts":)"
+               << us(s.beginNs) << R"(,"dur":)" << us(s.endNs >= s.beginNs ? s.endNs - s.beginNs : 0)
+               << R"(,"pid":)" << pid << R"(,"tid":)" << s.tid << R"(,"args":{"request":)"
+               << trace->getId() << R"(,"sampled":)" << (trace->isSampled() ? "true" : "false") << "}}";
+            first = false;
+        }
+    }
+    os << "]}";
+    return os.str();
+}
+
+std::string RequestTracer::exportChromeTrace() { return ToChromeTrace(drain()); }
+
+bool RequestTracer::exportChromeTraceToFile(const std::string& filename)
+{
+    return WriteFile(filename, exportChromeTrace());
+}
+
+bool RequestTracer::WriteFile(const std::string& filename, const std::string& contents)
+{
+    std::ofstream file(filename, std::ios::trunc);
+    if (!file.is_open()) {
+        LogWrite("Failed to open trace file: " + filename, b_sev::err);
+        return false;
+    }
+    file << contents;
+    return static_cast<bool>(file);
+}
+
+void RequestTracer::startRollingExport(const std::string&        prefix,
+                                       std::chrono::milliseconds interval,
+                                       uint32_t                  maxFiles)
+{
+    if (rollingThread.joinable()) {
+        throw std::runtime_error("Rolling trace export was already started");
+    }
+    rollingThread = std::thread([this, prefix, interval, maxFiles] {
+        std::deque<std::string>      written;
+        uint64_t                     sequence = 0;
+        std::unique_lock<std::mutex> lock(rollingMutex);
+        while (!stopRolling) {
+            rollingCondition.wait_for(lock, interval);
+            lock.unlock();
+            std::vector<std::unique_ptr<RequestTrace>> pending = drain();
+            if (!pending.empty()) {
+                const std::string filename = prefix + "." + std::to_string(sequence++) + ".json";
+                if (WriteFile(filename, ToChromeTrace(pending))) {
+                    written.push_back(filename);
+                }
+                while (maxFiles > 0 && written.size() > maxFiles) {
+                    std::remove(written.front().c_str());
+                    written.pop_front();
+                }
+            }
+            lock.lock();
+        }
+    });
+}
+
+RequestTrace*& RequestTracer::Current()
+{
+    thread_local RequestTrace* current = nullptr;
+    return current;
+}
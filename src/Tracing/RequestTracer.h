@@ -0,0 +1,175 @@
+#ifndef REQUESTTRACER_H
+#define REQUESTTRACER_H
+
+#include "Capture/PerThread.h"
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+/**
+ * The timeline of a single relayed request: a list of named spans, each tagged with the thread it
+ * ran on. The stages of a request run one after the other (even when they hop between threads), so
+ * spans are appended without synchronization.
+ */
+class RequestTrace
+{
+public:
+    struct Span
+    {
+        const char* name; // must be a string literal
+        uint64_t    beginNs;
+        uint64_t    endNs;
+        uint32_t    tid;
+    };
+
+private:
+    uint64_t          id;
+    bool              sampled;
+    uint64_t          requestStartNs = 0;
+    std::vector<Span> spans;
+
+public:
+    RequestTrace(uint64_t Id, bool Sampled);
+
+    void addSpan(const char* name, uint64_t beginNs, uint64_t endNs);
+
+    // makes a finished trace a new one, keeping the capacity of its spans
+    void reset(uint64_t Id, bool Sampled);
+
+    // marks the moment the request was fully read; latency thresholds are measured from here
+    void markRequestStart();
+
+    uint64_t                 getId() const { return id; }
+    bool                     isSampled() const { return sampled; }
+    uint64_t                 getRequestStartNs() const { return requestStartNs; }
+    const std::vector<Span>& getSpans() const { return spans; }
+
+    // steady clock, in nanoseconds
+    static uint64_t Now();
+    // the OS thread id of the calling thread (as shown by perf/top)
+    static uint32_t CurrentThreadId();
+};
+
+/**
+ * Records the timeline of sampled requests and exports them as Chrome trace json (loadable in Perfetto
+ * and chrome://tracing).
+ *
+ * A request is kept when it's one of every `sampleEveryN` requests, or when handling it took at least
+ * `latencyThreshold`. With a threshold, every request must be recorded until its end is known, otherwise
+ * only the sampled ones are; the traces of the requests that turn out fast are kept by their thread for
+ * the next requests, so recording them doesn't allocate.
+ *
+ * Finished traces go to a single-producer/single-consumer ring buffer owned by the finishing thread;
+ * the exporter drains all rings, so the request path never takes a lock. When a ring is full, the trace
+ * is dropped.
+ */
+class RequestTracer
+{
+    class TraceRing
+    {
+        std::vector<RequestTrace*> slots;
+        std::atomic<std::size_t>   head{0}; // next slot to read (consumer)
+        std::atomic<std::size_t>   tail{0}; // next slot to write (producer)
+
+    public:
+        explicit TraceRing(std::size_t capacity);
+        ~TraceRing();
+        bool          push(std::unique_ptr<RequestTrace>&& trace);
+        RequestTrace* pop();
+    };
+
+    // the ring of a thread, and the discarded traces it reuses
+    struct ThreadSlot
+    {
+        TraceRing                                  ring;
+        std::vector<std::unique_ptr<RequestTrace>> spare;
+
+        explicit ThreadSlot(std::size_t capacity) : ring(capacity) {}
+    };
+
+    const uint32_t                 sampleEveryN;
+    const std::chrono::nanoseconds latencyThreshold;
+    const std::size_t              perThreadCapacity;
+
+    std::atomic<uint64_t> requestCounter{0};
+    std::atomic<uint64_t> tracesKept{0};
+    std::atomic<uint64_t> tracesDropped{0};
+
+    PerThread<ThreadSlot> slots;
+    std::mutex            drainMutex; // makes a single exporter the consumer of the rings
+
+    std::mutex              rollingMutex;
+    std::condition_variable rollingCondition;
+    bool                    stopRolling = false;
+    std::thread             rollingThread;
+
+    ThreadSlot&                                localSlot();
+    std::vector<std::unique_ptr<RequestTrace>> drain();
+
+    static std::string ToChromeTrace(const std::vector<std::unique_ptr<RequestTrace>>& traces);
+    static bool        WriteFile(const std::string& filename, const std::string& contents);
+
+public:
+    /**
+     * @param SampleEveryN keep one of every N requests (0 to disable counting-based sampling)
+     * @param LatencyThreshold keep all requests that took at least this long (0 to disable)
+     * @param PerThreadCapacity number of finished traces a thread can buffer before they're exported
+     */
+    RequestTracer(uint32_t                 SampleEveryN,
+                  std::chrono::nanoseconds LatencyThreshold,
+                  std::size_t              PerThreadCapacity = 4096);
+    ~RequestTracer();
+
+    RequestTracer(const RequestTracer&) = delete;
+    RequestTracer& operator=(const RequestTracer&) = delete;
+
+    // returns nullptr when the request doesn't need to be recorded
+    std::unique_ptr<RequestTrace> begin();
+
+    // decides whether the trace is kept, and if so, queues it for export
+    void finish(std::unique_ptr<RequestTrace> trace);
+
+    // drains all traces finished so far into a Chrome trace json document
+    std::string exportChromeTrace();
+    bool        exportChromeTraceToFile(const std::string& filename);
+
+    /**
+     * Periodically export to files named <prefix>.<sequence>.json, keeping at most maxFiles of them
+     * (0 keeps all). Nothing is written for intervals without traces.
+     */
+    void startRollingExport(const std::string&        prefix,
+                            std::chrono::milliseconds interval,
+                            uint32_t                  maxFiles = 0);
+
+    // traces queued for export so far, and traces dropped as the ring of their thread was full
+    uint64_t getTracesKept() const { return tracesKept.load(); }
+    uint64_t getTracesDropped() const { return tracesDropped.load(); }
+
+    // the trace of the request being handled by the calling thread, if any
+    static RequestTrace*& Current();
+};
+
+/**
+ * Makes a trace the current one of the calling thread for the lifetime of the object
+ */
+class CurrentTraceScope
+{
+    RequestTrace* previous;
+
+public:
+    explicit CurrentTraceScope(RequestTrace* trace) : previous(RequestTracer::Current())
+    {
+        RequestTracer::Current() = trace;
+    }
+    ~CurrentTraceScope() { RequestTracer::Current() = previous; }
+
+    CurrentTraceScope(const CurrentTraceScope&) = delete;
+    CurrentTraceScope& operator=(const CurrentTraceScope&) = delete;
+};
+
+#endif // REQUESTTRACER_H
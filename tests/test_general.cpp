@@ -1,14 +1,40 @@
 #include "gtest/gtest.h"
 
+#include "Cache/ImmutableResultCache.h"
+#include "Cache/PrefetchEngine.h"
+#include "Capture/TrafficCapture.h"
+#include "Client/AsyncClient.h"
+#include "Client/CircuitBreaker.h"
 #include "Client/ClientSession.h"
 #include "Client/EasyClient.h"
+#include "Client/FairQueue.h"
+#include "Client/PriorityScheduler.h"
+#include "Client/TrafficMirror.h"
+#include "Filters/FilterPolicies.h"
 #include "Filters/JsonRPCFilter.h"
+#include "Filters/JsonRpcScanner.h"
+#include "Filters/JsonStringQueue.h"
+#include "Metrics/SharedMetrics.h"
+#include "Metrics/UsageTracker.h"
+#include "Relay/FilterChainRelay.h"
 #include "Relay/JsonRpcRelay.h"
+#include "Server/AdminEndpoint.h"
 #include "Server/EasyServer.h"
+#include "Server/ListenerHandoff.h"
 #include "Server/RelayServer.h"
+#include "Server/TlsContext.h"
+#include "Tracing/RequestTracer.h"
+#include "tools/BlockingHttpClient.h"
+#include "tools/CaptureReplay.h"
+#include "tools/UpstreamSimulator.h"
 #include <boost/algorithm/string.hpp>
+#include <boost/beast/websocket.hpp>
+#include <dirent.h>
 #include <future>
+#include <jsoncpp/json/json.h>
+#include <set>
 #include <string>
+#include <unistd.h>
 
 #include <boost/asio/io_context.hpp>
 
@@ -376,3 +402,2048 @@ TEST(Relay, EasyServerAndClient)
     EXPECT_EQ(response.result_int(), (unsigned)boost::beast::http::status::ok);
     EXPECT_EQ(response.body(), "Success!");
 }
+
+TEST(Capture, WriteAndReadBack)
+{
+    const std::string filename = "test_capture_" + GenerateRandomString__test(10) + ".bin";
+
+    const std::string body1 = R"({"jsonrpc": "2.0", "method": "method1", "params": [42, 23], "id": 1})";
+    const std::string body2 = "not json";
+
+    const auto arrival = std::chrono::system_clock::now();
+    {
+        TrafficCapture capture(filename);
+        capture.record(arrival, std::chrono::microseconds(150), body1);
+        std::thread([&] { capture.record(arrival, std::chrono::microseconds(7), body2); }).join();
+        capture.flush();
+        EXPECT_EQ(capture.getRecordsWritten(), 2u);
+        EXPECT_EQ(capture.getRecordsDropped(), 0u);
+    }
+
+    std::vector<CaptureRecord> records = CaptureReader::ReadAll(filename);
+    std::remove(filename.c_str());
+
+    ASSERT_EQ(records.size(), 2u);
+    std::sort(records.begin(), records.end(), [](const CaptureRecord& a, const CaptureRecord& b) {
+        return a.latencyNs > b.latencyNs;
+    });
+    EXPECT_EQ(records[0].method, "method1");
+    EXPECT_EQ(records[0].body, body1);
+    EXPECT_EQ(records[0].latencyNs, 150000u);
+    EXPECT_EQ(records[0].arrivalNs,
+              static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                                        arrival.time_since_epoch())
+                                        .count()));
+    EXPECT_EQ(records[1].method, "");
+    EXPECT_EQ(records[1].body, body2);
+}
+
+TEST(Capture, CapturedTrafficReplaysThroughARelay)
+{
+    const std::string filename = "test_capture_" + GenerateRandomString__test(10) + ".bin";
+
+    auto stub = StartStubUpstream(3062, 1, R"({"result": 800000, "error": null, "id": 1})");
+
+    JsonRPCFilter filter;
+    filter.applyOptions("getblockcount,getbestblockhash");
+    JsonRpcRelay relay(std::move(filter), "127.0.0.1", 3061, "127.0.0.1", 3062, 2);
+    auto         capture = std::make_shared<TrafficCapture>(filename);
+    relay.setTrafficCapture(capture);
+
+    BlockingHttpClient client("127.0.0.1", 3061);
+    for (int i = 0; i < 6; i++) {
+        const char* method = i % 2 == 0 ? "getblockcount" : "getbestblockhash";
+        auto        req    = BlockingHttpClient::MakeJsonRequest(
+            "127.0.0.1", std::string(R"({"method": ")") + method + R"(", "id": 1})");
+        EXPECT_EQ(client.send(req).result(), http::status::ok);
+    }
+    relay.setTrafficCapture(nullptr);
+    capture->flush();
+
+    std::vector<CaptureRecord> records = CaptureReader::ReadAll(filename);
+    std::remove(filename.c_str());
+    ASSERT_EQ(records.size(), 6u);
+    EXPECT_EQ(std::count_if(records.cbegin(),
+                            records.cend(),
+                            [](const CaptureRecord& r) { return r.method == "getblockcount"; }),
+              3);
+
+    // the capture drives the same relay again, at ten times its pace
+    ReplayOptions options;
+    options.speed       = 10;
+    options.concurrency = 2;
+    LoadReport report;
+    ReplayCapture(records, "127.0.0.1", 3061, options, report);
+
+    std::ostringstream printed;
+    report.print("replay", std::chrono::seconds(1), printed);
+    EXPECT_NE(printed.str().find("requests:   6 ok, 0 failed"), std::string::npos) << printed.str();
+
+    relay.stop();
+}
+
+TEST(Tracing, RelayedRequestTimeline)
+{
+    uint16_t relayPort  = 3010;
+    uint16_t targetPort = 3011;
+
+    EasyServer server("127.0.0.1", targetPort, 1);
+    server.setRequestResponseFunctor([](const RequestType& req) -> ResponseType {
+        boost::beast::http::response<boost::beast::http::string_body> res{boost::beast::http::status::ok,
+                                                                          req.version()};
+        res.keep_alive(req.keep_alive());
+        res.body() = req.body();
+        res.prepare_payload();
+        return res;
+    });
+    server.run();
+
+    JsonRPCFilter filter;
+    filter.applyOptions("method1");
+
+    JsonRpcRelay relay(std::move(filter), "127.0.0.1", relayPort, "127.0.0.1", targetPort, 1);
+
+    // one of every two requests is sampled
+    auto tracer = std::make_shared<RequestTracer>(2, std::chrono::nanoseconds(0));
+    relay.setRequestTracer(tracer);
+
+    for (int i = 0; i < 4; i++) {
+        EasyClient client;
+        client.run(boost::beast::http::verb::post,
+                   "127.0.0.1",
+                   std::to_string(relayPort),
+                   "/",
+                   R"({"jsonrpc": "2.0", "method": "method1", "id": 1})",
+                   11);
+        EXPECT_EQ(client.getResponse().get().result_int(), (unsigned)boost::beast::http::status::ok);
+    }
+    // the response is received before the session finishes the trace
+    const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+    while (tracer->getTracesKept() < 2 && std::chrono::steady_clock::now() < deadline) {
+        std::this_thread::yield();
+    }
+    EXPECT_EQ(tracer->getTracesKept(), 2u);
+
+    Json::Reader reader;
+    Json::Value  root;
+    ASSERT_TRUE(reader.parse(tracer->exportChromeTrace(), root, false));
+    ASSERT_TRUE(root["traceEvents"].isArray());
+
+    std::map<std::string, int> spanCounts;
+    std::set<int64_t>          requests;
+    for (const Json::Value& event : root["traceEvents"]) {
+        EXPECT_EQ(event["ph"].asString(), "X");
+        EXPECT_GE(event["dur"].asDouble(), 0.);
+        spanCounts[event["name"].asString()]++;
+        requests.insert(event["args"]["request"].asInt64());
+    }
+    EXPECT_EQ(requests.size(), 2u);
+    for (const char* name : {"read",
+                             "filter",
+                             "queue wait",
+                             "upstream resolve",
+                             "upstream connect",
+                             "upstream write",
+                             "upstream read",
+                             "response handoff",
+                             "downstream write",
+                             "accept"}) {
+        EXPECT_EQ(spanCounts[name], 2) << name;
+    }
+
+    // everything was drained by the first export
+    ASSERT_TRUE(reader.parse(tracer->exportChromeTrace(), root, false));
+    EXPECT_EQ(root["traceEvents"].size(), 0u);
+
+    // with a latency threshold, the traces of fast requests are reused by their thread
+    RequestTracer                 slowOnly(0, std::chrono::seconds(10));
+    std::unique_ptr<RequestTrace> fast  = slowOnly.begin();
+    const RequestTrace*           first = fast.get();
+    ASSERT_NE(first, nullptr);
+    fast->markRequestStart();
+    fast->addSpan("read", 0, 1);
+    slowOnly.finish(std::move(fast));
+    std::unique_ptr<RequestTrace> next = slowOnly.begin();
+    EXPECT_EQ(next.get(), first);
+    EXPECT_TRUE(next->getSpans().empty());
+    EXPECT_EQ(slowOnly.getTracesKept(), 0u);
+}
+
+TEST(Relay, RelayClass_unifiedExecutionModel)
+{
+    EasyServer server("127.0.0.1", 3013, 1);
+    server.setRequestResponseFunctor([](const RequestType& req) -> ResponseType {
+        boost::beast::http::response<boost::beast::http::string_body> res{boost::beast::http::status::ok,
+                                                                          req.version()};
+        res.keep_alive(req.keep_alive());
+        res.body() = std::string("Success!") + req.body();
+        res.prepare_payload();
+        return res;
+    });
+    server.run();
+
+    JsonRPCFilter filter;
+    filter.applyOptions("method1,method2");
+
+    JsonRpcRelay relay(
+        std::move(filter), "127.0.0.1", 3012, "127.0.0.1", 3013, 2, RelayExecutionModel::Unified);
+
+    // several concurrent requests, so that sessions share the threads
+    const std::string body = R"({"jsonrpc": "2.0", "method": "method2", "params": [], "id": 1})";
+    std::vector<std::unique_ptr<EasyClient>>                    clients;
+    std::vector<std::future<http::response<http::string_body>>> futures;
+    for (int i = 0; i < 8; i++) {
+        clients.emplace_back(new EasyClient);
+        clients.back()->run(boost::beast::http::verb::post, "127.0.0.1", "3012", "/", body, 11);
+        futures.push_back(clients.back()->getResponse());
+    }
+    for (auto& f : futures) {
+        auto response = f.get();
+        EXPECT_EQ(response.result_int(), (unsigned)boost::beast::http::status::ok);
+        EXPECT_EQ(response.body(), "Success!" + body);
+    }
+
+    {
+        EasyClient client;
+        client.run(boost::beast::http::verb::post,
+                   "127.0.0.1",
+                   "3012",
+                   "/",
+                   R"({"jsonrpc": "2.0", "method": "methodx", "id": 1})",
+                   11);
+        EXPECT_EQ(client.getResponse().get().result_int(),
+                  (unsigned)boost::beast::http::status::bad_request);
+    }
+}
+
+using TestFilterChain = FilterChain<BodySizePolicy,
+                                    MethodAllowlistPolicy,
+                                    ParamsShapePolicy,
+                                    StaticResultPolicy,
+                                    MethodRoutingPolicy>;
+
+static TestFilterChain MakeTestFilterChain()
+{
+    TestFilterChain chain;
+    chain.get<BodySizePolicy>().setMaxBodySize(200);
+    for (const char* m : {"getblockcount", "getblockhash", "getchaintips", "getnetworkinfo"}) {
+        chain.get<MethodAllowlistPolicy>().addAllowedMethod(m);
+    }
+    ParamsShapePolicy::Shape shape;
+    shape.kind     = ParamsShapePolicy::Shape::Kind::Array;
+    shape.minCount = 1;
+    shape.maxCount = 1;
+    chain.get<ParamsShapePolicy>().setShape("getblockhash", shape);
+    shape.kind = ParamsShapePolicy::Shape::Kind::None;
+    chain.get<ParamsShapePolicy>().setShape("getblockcount", shape);
+    chain.get<StaticResultPolicy>().setResult("getnetworkinfo", R"({"version":1})");
+    chain.get<MethodRoutingPolicy>().setRoute("getchaintips", "archive");
+    return chain;
+}
+
+TEST(Filters, FilterChainDecisions)
+{
+    TestFilterChain chain = MakeTestFilterChain();
+
+    auto decide = [&chain](const std::string& body) {
+        RequestType req{http::verb::post, "/", 11};
+        req.body() = body;
+        req.prepare_payload();
+        return chain(req);
+    };
+
+    EXPECT_EQ(decide(R"({"method": "getblockcount", "params": [], "id": 1})").verdict,
+              FilterDecision::Verdict::Allow);
+    EXPECT_EQ(decide(R"({"method": "getblockcount", "params": [5], "id": 1})").verdict,
+              FilterDecision::Verdict::Deny);
+    EXPECT_EQ(decide(R"({"method": "getblockcount", "params": 5, "id": 1})").verdict,
+              FilterDecision::Verdict::Deny);
+    EXPECT_EQ(decide(R"({"method": "getblockcount", "params": null, "id": 1})").verdict,
+              FilterDecision::Verdict::Allow);
+    EXPECT_EQ(decide(R"({"method": "getblockhash", "params": [5], "id": 1})").verdict,
+              FilterDecision::Verdict::Allow);
+    EXPECT_EQ(decide(R"({"method": "getblockhash", "params": {"height": 5}, "id": 1})").verdict,
+              FilterDecision::Verdict::Deny);
+    EXPECT_EQ(decide(R"({"method": "stop", "id": 1})").verdict, FilterDecision::Verdict::Deny);
+    EXPECT_EQ(decide(R"({"method": )").verdict, FilterDecision::Verdict::Deny);
+    EXPECT_EQ(decide(R"({"method": "getblockcount", "id": ")" + std::string(200, 'x') + "\"}").reason,
+              "Request body is too large\n");
+
+    FilterDecision routed = decide(R"({"method": "getchaintips", "id": 1})");
+    EXPECT_EQ(routed.verdict, FilterDecision::Verdict::Route);
+    EXPECT_EQ(routed.pool, "archive");
+
+    FilterDecision cached = decide(R"({"method": "getnetworkinfo", "id": "abc"})");
+    EXPECT_EQ(cached.verdict, FilterDecision::Verdict::ServeFromCache);
+    EXPECT_EQ(cached.body, R"({"result":{"version":1},"error":null,"id":"abc"})");
+}
+
+TEST(Relay, FilterChainRelay_routesAndServesFromCache)
+{
+    auto makeServer = [](uint16_t port, const std::string& name) {
+        std::unique_ptr<EasyServer> server(new EasyServer("127.0.0.1", port, 1));
+        server->setRequestResponseFunctor([name](const RequestType& req) -> ResponseType {
+            ResponseType res{boost::beast::http::status::ok, req.version()};
+            res.keep_alive(req.keep_alive());
+            res.body() = name;
+            res.prepare_payload();
+            return res;
+        });
+        server->run();
+        return server;
+    };
+    auto defaultUpstream = makeServer(3015, "default");
+    auto archiveUpstream = makeServer(3016, "archive");
+
+    FilterChainRelay<TestFilterChain> relay(
+        MakeTestFilterChain(), "127.0.0.1", 3014, "127.0.0.1", 3015, 2);
+    relay.addUpstreamPool("archive", "127.0.0.1", 3016);
+
+    auto send = [](const std::string& body) {
+        EasyClient client;
+        client.run(boost::beast::http::verb::post, "127.0.0.1", "3014", "/", body, 11);
+        return client.getResponse().get();
+    };
+
+    auto res = send(R"({"method": "getblockcount", "params": [], "id": 1})");
+    EXPECT_EQ(res.result_int(), (unsigned)boost::beast::http::status::ok);
+    EXPECT_EQ(res.body(), "default");
+
+    res = send(R"({"method": "getchaintips", "id": 1})");
+    EXPECT_EQ(res.result_int(), (unsigned)boost::beast::http::status::ok);
+    EXPECT_EQ(res.body(), "archive");
+
+    res = send(R"({"method": "getnetworkinfo", "id": 7})");
+    EXPECT_EQ(res.result_int(), (unsigned)boost::beast::http::status::ok);
+    EXPECT_EQ(res.body(), R"({"result":{"version":1},"error":null,"id":7})");
+
+    res = send(R"({"method": "getblockhash", "params": [], "id": 1})");
+    EXPECT_EQ(res.result_int(), (unsigned)boost::beast::http::status::bad_request);
+    EXPECT_EQ(res.body(), "Invalid number of params\n");
+}
+
+// a concrete handler type, called by the sessions without type erasure
+struct CountingEchoHandler
+{
+    std::shared_ptr<std::atomic<int>> calls = std::make_shared<std::atomic<int>>(0);
+
+    void operator()(const RequestType& req, const SessionExecutor&, ResponseCallback done) const
+    {
+        (*calls)++;
+        ResponseType res{http::status::ok, req.version()};
+        res.keep_alive(req.keep_alive());
+        res.body() = "echo " + req.body();
+        res.prepare_payload();
+        done(std::move(res));
+    }
+};
+
+TEST(Relay, BasicRelayServerWithACustomHandlerType)
+{
+    auto handler = std::make_shared<const CountingEchoHandler>();
+
+    net::io_context ioc(1);
+    auto            server = std::make_shared<BasicRelayServer<CountingEchoHandler>>(
+        ioc, net::ip::tcp::endpoint{net::ip::make_address("127.0.0.1"), 3063}, handler);
+    server->run();
+    std::thread thread([&ioc] { ioc.run(); });
+
+    BlockingHttpClient client("127.0.0.1", 3063);
+    for (int i = 0; i < 3; i++) {
+        auto req = BlockingHttpClient::MakeJsonRequest("127.0.0.1", std::to_string(i));
+        auto res = client.send(req);
+        EXPECT_EQ(res.result(), http::status::ok);
+        EXPECT_EQ(res.body(), "echo " + std::to_string(i));
+    }
+    EXPECT_EQ(handler->calls->load(), 3);
+
+    // a replaced handler serves the connections accepted after it
+    auto other = std::make_shared<const CountingEchoHandler>();
+    server->setHandler(other);
+    BlockingHttpClient second("127.0.0.1", 3063);
+    auto               req = BlockingHttpClient::MakeJsonRequest("127.0.0.1", "x");
+    EXPECT_EQ(second.send(req).body(), "echo x");
+    EXPECT_EQ(other->calls->load(), 1);
+    EXPECT_EQ(handler->calls->load(), 3);
+
+    ioc.stop();
+    thread.join();
+}
+
+static RequestType MakeJsonRpcRequest(const std::string& body)
+{
+    RequestType req{http::verb::post, "/", 11};
+    req.body() = body;
+    req.prepare_payload();
+    return req;
+}
+
+TEST(Filters, ParamsRules)
+{
+    JsonRPCFilter filter;
+    filter.applyOptions("getblock,getblockhash,getblockcount,getrawtransaction,getblockstats");
+    filter.applyParamsRules(R"(
+        # heavy calls
+        getblock(blockhash: str [0-9a-fA-F] len 64, verbosity: int 0..1?)
+        getblockhash(int 0..900000); getblockcount()
+        getrawtransaction(str [0-9a-f] len 64, bool | int 0..1?, str?)
+        getblockstats(int | str, array len ..3 of str [a-z_]?)
+    )");
+
+    const std::string hash(64, 'a');
+    auto allowed = [&filter](const std::string& body) { return filter(MakeJsonRpcRequest(body)); };
+
+    EXPECT_TRUE(allowed(R"({"method": "getblock", "params": [")" + hash + R"("], "id": 1})"));
+    EXPECT_TRUE(allowed(R"({"method": "getblock", "params": [")" + hash + R"(", 1], "id": 1})"));
+    EXPECT_TRUE(allowed(R"({"method": "getblock", "params": [")" + hash + R"(", null], "id": 1})"));
+    EXPECT_FALSE(allowed(R"({"method": "getblock", "params": [")" + hash + R"(", 2], "id": 1})"));
+    EXPECT_FALSE(allowed(R"({"method": "getblock", "params": [")" + hash + R"(", 1.0], "id": 1})"));
+    EXPECT_FALSE(allowed(R"({"method": "getblock", "params": ["xyz", 1], "id": 1})"));
+    EXPECT_FALSE(allowed(R"({"method": "getblock", "params": [], "id": 1})"));
+    EXPECT_FALSE(allowed(R"({"method": "getblock", "id": 1})"));
+    EXPECT_FALSE(allowed(R"({"method": "getblock", "params": [")" + hash + R"(", 1, 1], "id": 1})"));
+
+    // named params, and params before the method
+    EXPECT_TRUE(allowed(R"({"method": "getblock", "params": {"verbosity": 0, "blockhash": ")" + hash +
+                        R"("}, "id": 1})"));
+    EXPECT_FALSE(allowed(R"({"method": "getblock", "params": {"verbosity": 0}, "id": 1})"));
+    EXPECT_FALSE(allowed(R"({"method": "getblock", "params": {"blockhash": ")" + hash +
+                         R"(", "x": 1}, "id": 1})"));
+    EXPECT_TRUE(allowed(R"({"params": [")" + hash + R"(", 0], "method": "getblock", "id": 1})"));
+    EXPECT_FALSE(allowed(R"({"params": [")" + hash + R"(", 5], "method": "getblock", "id": 1})"));
+
+    EXPECT_TRUE(allowed(R"({"method": "getblockhash", "params": [900000], "id": 1})"));
+    EXPECT_FALSE(allowed(R"({"method": "getblockhash", "params": [900001], "id": 1})"));
+    EXPECT_FALSE(allowed(R"({"method": "getblockhash", "params": ["1"], "id": 1})"));
+    EXPECT_TRUE(allowed(R"({"method": "getblockcount", "params": [], "id": 1})"));
+    EXPECT_FALSE(allowed(R"({"method": "getblockcount", "params": [1], "id": 1})"));
+
+    const std::string rawtx = R"({"method": "getrawtransaction", "params": [")" + hash;
+    EXPECT_TRUE(allowed(rawtx + R"(", true], "id": 1})"));
+    EXPECT_TRUE(allowed(rawtx + R"(", 1], "id": 1})"));
+    EXPECT_FALSE(allowed(rawtx + R"(", "1"], "id": 1})"));
+
+    EXPECT_TRUE(allowed(R"({"method": "getblockstats", "params": [5, ["height", "txs"]], "id": 1})"));
+    EXPECT_FALSE(allowed(R"({"method": "getblockstats", "params": [5, ["a", "b", "c", "d"]]})"));
+    EXPECT_FALSE(allowed(R"({"method": "getblockstats", "params": [5, ["Height"]], "id": 1})"));
+
+    // the json itself must be valid, and unambiguous
+    EXPECT_FALSE(allowed(R"({"method": "getblockcount", "method": "stop", "id": 1})"));
+    EXPECT_FALSE(allowed(R"({"method": "getblockcount", "id": 1} {"method": "stop"})"));
+    EXPECT_FALSE(allowed(R"({"method": "getblockcount", "id": 01})"));
+    EXPECT_FALSE(allowed(R"([{"method": "getblockcount", "id": 1}])"));
+    EXPECT_TRUE(allowed(R"({"method": "getblockcount", "id": "\"x\""})"));
+
+    EXPECT_THROW(ParamsRuleSet::Compile("getblock(int 5..1)"), std::runtime_error);
+    EXPECT_THROW(ParamsRuleSet::Compile("getblock(int | num)"), std::runtime_error);
+    EXPECT_THROW(ParamsRuleSet::Compile("getblock(int?, int)"), std::runtime_error);
+    EXPECT_THROW(ParamsRuleSet::Compile("getblock(integer)"), std::runtime_error);
+    EXPECT_THROW(ParamsRuleSet::Compile("getblock(int) getblockhash()"), std::runtime_error);
+    EXPECT_THROW(ParamsRuleSet::Compile("getblock(int)\ngetblock(str)"), std::runtime_error);
+}
+
+TEST(Filters, JsonRpcScannerSpans)
+{
+    const std::string body = R"( {"id": {"a": [1, 2]}, "method": "x", "params": [true, null]} )";
+    JsonRpcCall       call;
+    ASSERT_TRUE(JsonRpcScanner::Scan(body, nullptr, call));
+    EXPECT_EQ(call.method, "x");
+    EXPECT_EQ(body.substr(call.id.offset, call.id.size), R"({"a": [1, 2]})");
+    EXPECT_EQ(body.substr(call.params.offset, call.params.size), "[true, null]");
+
+    // the filter hands its spans to the relay, which doesn't scan the call again
+    JsonRPCFilter filter;
+    filter.applyOptions("x");
+    RequestType req{http::verb::post, "/", 11};
+    req.body()              = body;
+    FilterDecision decision = filter.decide(req);
+    EXPECT_TRUE(decision.scanned);
+    EXPECT_EQ(body.substr(decision.id.offset, decision.id.size), R"({"a": [1, 2]})");
+    EXPECT_EQ(body.substr(decision.params.offset, decision.params.size), "[true, null]");
+
+    const std::string deep =
+        R"({"method": "x", "params": )" + std::string(100, '[') + std::string(100, ']') + "}";
+    EXPECT_FALSE(JsonRpcScanner::Scan(deep, nullptr, call));
+    EXPECT_FALSE(JsonRpcScanner::Scan(R"({"method": "x", "params": [1,]})", nullptr, call));
+    EXPECT_FALSE(call.error.empty());
+}
+
+TEST(Filters, JsonStringQueueSplitsStreams)
+{
+    // brackets and escaped quotes in strings, a batch, and a value larger than 16 KiB
+    const std::string first  = R"({"method": "x", "params": ["}", "\"{", "\\", "a\\\"]"], "id": 1})";
+    const std::string second = R"([{"method": "y", "id": 2}, {"method": "z", "id": 3}])";
+    const std::string third  = R"({"params": [")" + std::string(100000, 'f') + R"("], "id": {}})";
+    const std::string stream = " " + first + "\n" + second + "\r\n" + third + "\n";
+
+    // one push, then a byte at a time
+    JsonStringQueue queue;
+    queue.pushData(stream);
+    EXPECT_EQ(queue.pullDataAndClear(), std::vector<std::string>({first, second, third}));
+    std::vector<std::string> values;
+    for (char c : stream) {
+        queue.pushData(std::string(1, c));
+        for (const boost::string_view& span : queue.pullSpans()) {
+            values.push_back(span.to_string());
+        }
+    }
+    EXPECT_EQ(values, std::vector<std::string>({first, second, third}));
+
+    // the values before an error still come out
+    EXPECT_THROW(queue.pushData(first + "\n}"), std::runtime_error);
+    EXPECT_EQ(queue.pullDataAndClear(), std::vector<std::string>({first}));
+    queue.clear();
+    EXPECT_THROW(queue.pushData("x"), std::runtime_error);
+
+    // the size limit applies to values in progress too
+    JsonStringQueue small(1000);
+    small.pushData(first);
+    EXPECT_EQ(small.pullDataAndClear().size(), 1u);
+    EXPECT_THROW(small.pushData(third.substr(0, 2000)), std::runtime_error);
+}
+
+TEST(Relay, WebSocketCallsShareUpstreamConnections)
+{
+    // an upstream that echoes the first param as result, and remembers the ids it saw
+    std::mutex            idsMutex;
+    std::set<std::string> upstreamIds;
+    EasyServer            server("127.0.0.1", 3021, 1);
+    server.setRequestResponseFunctor([&](const RequestType& req) -> ResponseType {
+        Json::Value  call;
+        Json::Reader reader;
+        reader.parse(req.body(), call, false);
+        {
+            std::lock_guard<std::mutex> lock(idsMutex);
+            upstreamIds.insert(Json::FastWriter().write(call["id"]));
+        }
+        Json::Value response;
+        response["result"] = call["params"][0];
+        response["error"]  = Json::Value();
+        // a param of -1 gets a response with the wrong id
+        response["id"] = call["params"][0].asInt() == -1 ? Json::Value("bogus") : call["id"];
+        ResponseType res{boost::beast::http::status::ok, req.version()};
+        res.keep_alive(req.keep_alive());
+        res.body() = Json::FastWriter().write(response);
+        res.prepare_payload();
+        return res;
+    });
+    server.run();
+
+    JsonRPCFilter filter;
+    filter.applyOptions("echo");
+    JsonRpcRelay relay(std::move(filter), "127.0.0.1", 3020, "127.0.0.1", 3021, 2);
+    relay.enableWebSocket(1);
+
+    net::io_context                                                   ioc;
+    std::vector<std::unique_ptr<beast::websocket::stream<tcp::socket>>> clients;
+    for (int c = 0; c < 3; c++) {
+        clients.emplace_back(new beast::websocket::stream<tcp::socket>(ioc));
+        clients.back()->next_layer().connect(tcp::endpoint(net::ip::make_address("127.0.0.1"), 3020));
+        clients.back()->handshake("127.0.0.1", "/");
+    }
+
+    // every client uses the same ids, and sends all its calls before reading any response
+    for (int c = 0; c < 3; c++) {
+        for (int i = 1; i <= 5; i++) {
+            const std::string call = R"({"jsonrpc": "2.0", "method": "echo", "params": [)" +
+                                     std::to_string(c * 100 + i) + R"(], "id": )" + std::to_string(i) + "}";
+            clients[c]->write(net::buffer(call));
+        }
+    }
+    for (int c = 0; c < 3; c++) {
+        std::map<int, int> results; // id -> result
+        for (int i = 1; i <= 5; i++) {
+            beast::flat_buffer buffer;
+            clients[c]->read(buffer);
+            Json::Value  response;
+            Json::Reader reader;
+            ASSERT_TRUE(reader.parse(beast::buffers_to_string(buffer.data()), response, false));
+            results[response["id"].asInt()] = response["result"].asInt();
+        }
+        for (int i = 1; i <= 5; i++) {
+            EXPECT_EQ(results[i], c * 100 + i);
+        }
+    }
+    {
+        std::lock_guard<std::mutex> lock(idsMutex);
+        EXPECT_EQ(upstreamIds.size(), 15u);
+    }
+
+    // denied calls are answered with a json-rpc error
+    clients[0]->write(net::buffer(std::string(R"({"jsonrpc": "2.0", "method": "stop", "id": "x"})")));
+    beast::flat_buffer buffer;
+    clients[0]->read(buffer);
+    Json::Value  response;
+    Json::Reader reader;
+    ASSERT_TRUE(reader.parse(beast::buffers_to_string(buffer.data()), response, false));
+    EXPECT_EQ(response["id"].asString(), "x");
+    EXPECT_EQ(response["error"]["code"].asInt(), -32600);
+
+    // a response that doesn't match its call fails it, and the next call gets a new connection
+    auto roundTrip = [&](const std::string& call) {
+        clients[0]->write(net::buffer(call));
+        beast::flat_buffer reply;
+        clients[0]->read(reply);
+        Json::Value result;
+        EXPECT_TRUE(reader.parse(beast::buffers_to_string(reply.data()), result, false));
+        return result;
+    };
+    response = roundTrip(R"({"jsonrpc": "2.0", "method": "echo", "params": [-1], "id": 8})");
+    EXPECT_EQ(response["id"].asInt(), 8);
+    EXPECT_EQ(response["error"]["code"].asInt(), -32603);
+    response = roundTrip(R"({"jsonrpc": "2.0", "method": "echo", "params": [9], "id": 9})");
+    EXPECT_EQ(response["result"].asInt(), 9);
+
+    for (auto& client : clients) {
+        client->close(beast::websocket::close_code::normal);
+    }
+    relay.stop();
+}
+
+TEST(Relay, MicroBatchingCombinesCalls)
+{
+    // an upstream that answers batches in reverse order, and remembers the size of every request
+    std::mutex       sizesMutex;
+    std::vector<int> requestSizes; // number of calls per upstream request; 0 for a single call
+    EasyServer       server("127.0.0.1", 3023, 1);
+    server.setRequestResponseFunctor([&](const RequestType& req) -> ResponseType {
+        Json::Value  body;
+        Json::Reader reader;
+        reader.parse(req.body(), body, false);
+        auto answer = [](const Json::Value& call) {
+            Json::Value response;
+            response["result"] = call["params"].isArray() ? call["params"][0] : Json::Value("info");
+            response["error"]  = Json::Value();
+            response["id"]     = call["id"];
+            return response;
+        };
+        Json::Value response;
+        if (body.isArray()) {
+            response = Json::Value(Json::arrayValue);
+            for (int i = static_cast<int>(body.size()) - 1; i >= 0; i--) {
+                response.append(answer(body[i]));
+            }
+        } else {
+            response = answer(body);
+        }
+        {
+            std::lock_guard<std::mutex> lock(sizesMutex);
+            requestSizes.push_back(body.isArray() ? static_cast<int>(body.size()) : 0);
+        }
+        ResponseType res{boost::beast::http::status::ok, req.version()};
+        res.keep_alive(req.keep_alive());
+        res.body() = Json::FastWriter().write(response);
+        res.prepare_payload();
+        return res;
+    });
+    server.run();
+
+    EXPECT_EQ(MicroBatchOptions::ParseMethods(" echo:500000, getblockhash:0 ").size(), 2u);
+    EXPECT_EQ(MicroBatchOptions::ParseMethods("echo:500000").at("echo"), std::chrono::milliseconds(500));
+    EXPECT_THROW(MicroBatchOptions::ParseMethods("echo"), std::runtime_error);
+    EXPECT_THROW(MicroBatchOptions::ParseMethods("echo:-1"), std::runtime_error);
+
+    JsonRPCFilter filter;
+    filter.applyOptions("echo,getinfo,getblockhash");
+    JsonRpcRelay relay(std::move(filter), "127.0.0.1", 3022, "127.0.0.1", 3023, 2);
+
+    // echo calls only leave in full batches, as their budget is longer than the test
+    MicroBatchOptions options;
+    options.methods      = MicroBatchOptions::ParseMethods("echo:60000000,getblockhash:1000");
+    options.maxBatchSize = 4;
+    relay.enableMicroBatching(options, 1);
+
+    auto post = [](EasyClient& client, const std::string& body) {
+        client.run(boost::beast::http::verb::post, "127.0.0.1", "3022", "/", body, 11);
+    };
+    auto result = [](EasyClient& client) {
+        auto         res = client.getResponse().get();
+        Json::Value  response;
+        Json::Reader reader;
+        EXPECT_EQ(res.result_int(), (unsigned)boost::beast::http::status::ok);
+        EXPECT_TRUE(reader.parse(res.body(), response, false));
+        EXPECT_EQ(response["id"].asString(), "a");
+        return response["result"];
+    };
+
+    // a full batch leaves at once; every client gets its own result with its own id
+    {
+        std::vector<std::unique_ptr<EasyClient>> clients;
+        for (int c = 0; c < 4; c++) {
+            clients.emplace_back(new EasyClient);
+            post(*clients.back(),
+                 R"({"jsonrpc": "2.0", "method": "echo", "params": [)" + std::to_string(c) +
+                     R"(], "id": "a"})");
+        }
+        for (int c = 0; c < 4; c++) {
+            EXPECT_EQ(result(*clients[c]).asInt(), c);
+        }
+        std::lock_guard<std::mutex> lock(sizesMutex);
+        EXPECT_EQ(requestSizes, std::vector<int>({4}));
+    }
+
+    // methods that aren't batched don't wait for the batch in progress
+    {
+        std::vector<std::unique_ptr<EasyClient>> batched;
+        batched.emplace_back(new EasyClient);
+        post(*batched.back(), R"({"jsonrpc": "2.0", "method": "echo", "params": [7], "id": "a"})");
+        EasyClient direct;
+        post(direct, R"({"jsonrpc": "2.0", "method": "getinfo", "id": "a"})");
+        EXPECT_EQ(result(direct).asString(), "info");
+        for (int c = 1; c < 4; c++) {
+            batched.emplace_back(new EasyClient);
+            post(*batched.back(), R"({"jsonrpc": "2.0", "method": "echo", "params": [7], "id": "a"})");
+        }
+        for (auto& client : batched) {
+            EXPECT_EQ(result(*client).asInt(), 7);
+        }
+        std::lock_guard<std::mutex> lock(sizesMutex);
+        EXPECT_EQ(requestSizes, std::vector<int>({4, 0, 4}));
+    }
+
+    // a lone batched call leaves after its budget, unwrapped
+    {
+        EasyClient lone;
+        post(lone, R"({"jsonrpc": "2.0", "method": "getblockhash", "params": [5], "id": "a"})");
+        EXPECT_EQ(result(lone).asInt(), 5);
+        std::lock_guard<std::mutex> lock(sizesMutex);
+        EXPECT_EQ(requestSizes, std::vector<int>({4, 0, 4, 0}));
+    }
+
+    relay.stop();
+}
+
+TEST(Relay, ListeningSocketHandoffAndDrain)
+{
+    // a held call waits in the upstream until the test releases it
+    std::promise<void>       held;
+    std::promise<void>       release;
+    std::shared_future<void> released = release.get_future().share();
+
+    EasyServer server("127.0.0.1", 3025, 1);
+    server.setRequestResponseFunctor([&held, released](const RequestType& req) -> ResponseType {
+        if (req.body().find("hold") != std::string::npos) {
+            held.set_value();
+            released.wait();
+        }
+        ResponseType res{boost::beast::http::status::ok, req.version()};
+        res.keep_alive(req.keep_alive());
+        res.body() = "Success!";
+        res.prepare_payload();
+        return res;
+    });
+    server.run();
+
+    const std::string path = "/tmp/httprpcrelay_test_handoff.sock";
+    EXPECT_EQ(ListenerHandoff::Receive(path + ".missing"), -1);
+
+    // the old relay only allows method1, the new one only method2
+    JsonRPCFilter oldFilter;
+    oldFilter.applyOptions("method1");
+    JsonRpcRelay oldRelay(std::move(oldFilter), "127.0.0.1", 3024, "127.0.0.1", 3025, 1);
+
+    net::io_context ioc;
+    auto            work = net::make_work_guard(ioc);
+    std::thread     handoffThread([&ioc]() { ioc.run(); });
+
+    std::promise<void> handedOff;
+    std::promise<void> drained;
+    auto               handoff = std::make_shared<ListenerHandoff>(
+        ioc, path, oldRelay.getListeningSocket(), [&handedOff, &drained, &oldRelay]() {
+            oldRelay.drain([&drained]() { drained.set_value(); });
+            handedOff.set_value();
+        });
+    handoff->run();
+
+    auto request = [](const std::string& method, const std::string& params) {
+        RequestType req{http::verb::post, "/", 11};
+        req.set(http::field::host, "127.0.0.1");
+        req.body() = R"({"jsonrpc": "2.0", "method": ")" + method + R"(", "params": [)" + params +
+                     R"(], "id": 1})";
+        req.keep_alive(true);
+        req.prepare_payload();
+        return req;
+    };
+
+    // two keep-alive connections to the old relay, open across the handoff: an idle one, and one with
+    // a call in progress
+    net::io_context                   clientIoc;
+    beast::tcp_stream                 idleConnection(clientIoc);
+    beast::tcp_stream                 busyConnection(clientIoc);
+    beast::flat_buffer                buffer;
+    http::response<http::string_body> res;
+    idleConnection.connect(tcp::endpoint(net::ip::make_address("127.0.0.1"), 3024));
+    http::write(idleConnection, request("method1", ""));
+    http::read(idleConnection, buffer, res);
+    EXPECT_EQ(res.result(), http::status::ok);
+    EXPECT_TRUE(res.keep_alive());
+
+    busyConnection.connect(tcp::endpoint(net::ip::make_address("127.0.0.1"), 3024));
+    http::write(busyConnection, request("method1", R"("hold")"));
+    EXPECT_EQ(held.get_future().wait_for(std::chrono::seconds(5)), std::future_status::ready);
+
+    const int listeningSocket = ListenerHandoff::Receive(path);
+    ASSERT_GE(listeningSocket, 0);
+    EXPECT_EQ(handedOff.get_future().wait_for(std::chrono::seconds(5)), std::future_status::ready);
+
+    JsonRPCFilter newFilter;
+    newFilter.applyOptions("method2");
+    JsonRpcRelay newRelay(std::move(newFilter),
+                          "127.0.0.1",
+                          3024,
+                          "127.0.0.1",
+                          3025,
+                          1,
+                          RelayExecutionModel::SeparatePools,
+                          listeningSocket);
+
+    // the old relay closes the idle connection at once
+    beast::error_code ec;
+    buffer.clear();
+    res = {};
+    http::read(idleConnection, buffer, res, ec);
+    EXPECT_EQ(ec, http::error::end_of_stream);
+
+    // and answers the call in progress before it closes that connection, which ends the drain
+    release.set_value();
+    buffer.clear();
+    res = {};
+    http::read(busyConnection, buffer, res);
+    EXPECT_EQ(res.result(), http::status::ok);
+    EXPECT_FALSE(res.keep_alive());
+    EXPECT_EQ(drained.get_future().wait_for(std::chrono::seconds(5)), std::future_status::ready);
+    EXPECT_EQ(oldRelay.getActiveSessionCount(), 0u);
+
+    // new connections are served by the new relay
+    for (int i = 0; i < 3; i++) {
+        EasyClient client;
+        client.run(http::verb::post, "127.0.0.1", "3024", "/", request("method2", "").body(), 11);
+        EXPECT_EQ(client.getResponse().get().result(), http::status::ok);
+    }
+
+    work.reset();
+    handoffThread.join();
+    oldRelay.stop();
+    newRelay.stop();
+}
+
+TEST(Relay, CircuitBreakerStates)
+{
+    CircuitBreakerOptions options;
+    options.failureThreshold = 3;
+    options.openDuration     = std::chrono::milliseconds(50);
+    options.halfOpenTrials   = 1;
+    CircuitBreaker breaker(options);
+
+    // failures must be consecutive to open the breaker
+    breaker.recordFailure();
+    breaker.recordFailure();
+    breaker.recordSuccess();
+    breaker.recordFailure();
+    breaker.recordFailure();
+    EXPECT_EQ(breaker.getState(), CircuitBreaker::State::Closed);
+    EXPECT_TRUE(breaker.allowRequest());
+    breaker.recordFailure();
+    EXPECT_EQ(breaker.getState(), CircuitBreaker::State::Open);
+    EXPECT_FALSE(breaker.allowRequest());
+
+    // a late success of a request sent before it opened doesn't close it
+    breaker.recordSuccess();
+    EXPECT_EQ(breaker.getState(), CircuitBreaker::State::Open);
+    EXPECT_FALSE(breaker.allowRequest());
+
+    // after the open period, one trial passes; its failure opens the breaker again
+    std::this_thread::sleep_for(std::chrono::milliseconds(60));
+    EXPECT_TRUE(breaker.allowRequest());
+    EXPECT_EQ(breaker.getState(), CircuitBreaker::State::HalfOpen);
+    EXPECT_FALSE(breaker.allowRequest());
+    breaker.recordFailure();
+    EXPECT_EQ(breaker.getState(), CircuitBreaker::State::Open);
+    EXPECT_FALSE(breaker.allowRequest());
+
+    // a successful probe lets a trial through at once, and the trial's success closes the breaker
+    breaker.recordProbe(true);
+    EXPECT_TRUE(breaker.allowRequest());
+    breaker.recordSuccess();
+    EXPECT_EQ(breaker.getState(), CircuitBreaker::State::Closed);
+
+    // a failed probe opens it right away
+    breaker.recordProbe(false);
+    EXPECT_FALSE(breaker.allowRequest());
+}
+
+TEST(Relay, HealthChecksFailOverAndFailFast)
+{
+    // the target (3028) is down; the failover answers json-rpc calls
+    EasyServer server("127.0.0.1", 3027, 1);
+    server.setRequestResponseFunctor([](const RequestType& req) -> ResponseType {
+        ResponseType res{boost::beast::http::status::ok, req.version()};
+        res.keep_alive(req.keep_alive());
+        res.body() = R"({"result": "failover", "error": null, "id": 1})";
+        res.prepare_payload();
+        return res;
+    });
+    server.run();
+
+    // method2 is routed to a pool that is down too (3029), and has no failover
+    RoutingTable routes;
+    routes.addRoute("method2=archive");
+    JsonRPCFilter filter;
+    filter.applyOptions("method1,method2");
+    filter.setRoutingTable(std::move(routes));
+    JsonRpcRelay relay(std::move(filter), "127.0.0.1", 3026, "127.0.0.1", 3028, 1);
+    relay.addUpstreamPool("archive", "127.0.0.1", 3029);
+
+    HealthCheckOptions options;
+    options.interval                 = std::chrono::milliseconds(20);
+    options.timeout                  = std::chrono::milliseconds(200);
+    options.method                   = "getblockchaininfo";
+    options.breaker.failureThreshold = 2;
+    options.breaker.openDuration     = std::chrono::seconds(10);
+    relay.enableHealthChecks(options);
+    relay.addFailoverUpstream("127.0.0.1", 3027);
+
+    // the first probes mark the target down
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+
+    auto post = [](const std::string& body) {
+        EasyClient client;
+        client.run(http::verb::post, "127.0.0.1", "3026", "/", body, 11);
+        return client.getResponse().get();
+    };
+    for (int i = 0; i < 3; i++) {
+        const auto start = std::chrono::steady_clock::now();
+        auto       res   = post(R"({"jsonrpc": "2.0", "method": "method1", "id": 1})");
+        EXPECT_EQ(res.result(), http::status::ok);
+        EXPECT_NE(res.body().find("failover"), std::string::npos);
+        EXPECT_LT(std::chrono::steady_clock::now() - start, std::chrono::milliseconds(500));
+    }
+
+    // a routed call to the pool fails fast with 503 while its breaker is open
+    for (int i = 0; i < 3; i++) {
+        const auto start = std::chrono::steady_clock::now();
+        auto       res   = post(R"({"jsonrpc": "2.0", "method": "method2", "id": 1})");
+        EXPECT_EQ(res.result(), http::status::service_unavailable);
+        EXPECT_EQ(res.body(), "Upstream is unavailable\n");
+        EXPECT_LT(std::chrono::steady_clock::now() - start, std::chrono::milliseconds(500));
+    }
+
+    relay.stop();
+}
+
+TEST(Relay, TlsTerminationResumesSessions)
+{
+    EasyServer server("127.0.0.1", 3031, 1);
+    server.setRequestResponseFunctor([](const RequestType& req) -> ResponseType {
+        ResponseType res{boost::beast::http::status::ok, req.version()};
+        res.keep_alive(req.keep_alive());
+        res.body() = R"({"result": 1, "error": null, "id": 1})";
+        res.prepare_payload();
+        return res;
+    });
+    server.run();
+
+    JsonRPCFilter filter;
+    filter.applyOptions("method1");
+    JsonRpcRelay relay(std::move(filter), "127.0.0.1", 3030, "127.0.0.1", 3031, 1);
+
+    const TlsCredentials credentials = MakeSelfSignedCredentials("127.0.0.1");
+    TlsOptions           options;
+    options.certificateChain = credentials.certificateChain;
+    options.privateKey       = credentials.privateKey;
+    relay.setTlsContext(MakeTlsServerContext(options));
+
+    // TLS 1.3 resumes with session tickets, TLS 1.2 with the session cache of the server
+    for (int maxVersion : {TLS1_3_VERSION, TLS1_2_VERSION}) {
+        boost::asio::ssl::context clientTls(boost::asio::ssl::context::tls_client);
+        clientTls.set_verify_mode(boost::asio::ssl::verify_none);
+        SSL_CTX_set_max_proto_version(clientTls.native_handle(), maxVersion);
+
+        BlockingHttpClient client("127.0.0.1", 3030, clientTls, true);
+        auto req = BlockingHttpClient::MakeJsonRequest(
+            "127.0.0.1", R"({"jsonrpc": "2.0", "method": "method1", "id": 1})", false);
+        for (int i = 0; i < 3; i++) {
+            auto res = client.send(req);
+            EXPECT_EQ(res.result(), http::status::ok);
+            EXPECT_NE(res.body().find(R"("result": 1)"), std::string::npos);
+        }
+        EXPECT_EQ(client.getHandshakeCount(), 3u);
+        EXPECT_EQ(client.getResumedHandshakeCount(), 2u);
+    }
+
+    // plain http isn't served anymore
+    BlockingHttpClient plain("127.0.0.1", 3030);
+    auto req = BlockingHttpClient::MakeJsonRequest("127.0.0.1", R"({"method": "method1"})");
+    EXPECT_THROW(plain.send(req), boost::system::system_error);
+
+    relay.stop();
+}
+
+TEST(Relay, PrioritySchedulerWeightsClasses)
+{
+    PriorityOptions options;
+    options.classes        = PriorityOptions::ParseClasses("interactive:3, bulk:1:0:2");
+    options.maxConcurrency = 1;
+    PriorityScheduler scheduler(options);
+
+    const std::size_t interactive = scheduler.getClassIndex("interactive");
+    const std::size_t bulk        = scheduler.getClassIndex("bulk");
+    EXPECT_EQ(scheduler.getClassName(scheduler.getClassIndex("unknown")), "default");
+
+    // admitted jobs add their letter, and the ones dropped by stop() add a '-'
+    std::string order;
+    auto        job = [&order](char letter) {
+        return [&order, letter](bool admitted) { order += admitted ? letter : '-'; };
+    };
+    EXPECT_TRUE(scheduler.submit(bulk, "", job('B'))); // takes the only slot
+    for (int i = 0; i < 4; i++) {
+        EXPECT_TRUE(scheduler.submit(interactive, "", job('i')));
+    }
+    EXPECT_TRUE(scheduler.submit(bulk, "", job('b')));
+    EXPECT_TRUE(scheduler.submit(bulk, "", job('b')));
+    // the queue of bulk is full
+    EXPECT_FALSE(scheduler.submit(bulk, "", job('x')));
+    EXPECT_EQ(scheduler.getQueueLength(interactive), 4u);
+
+    // every completion admits the next job, three interactive ones for every bulk one
+    std::size_t previous = bulk;
+    for (int i = 0; i < 6; i++) {
+        const std::size_t before = order.size();
+        scheduler.release(previous);
+        ASSERT_EQ(order.size(), before + 1);
+        previous = order.back() == 'i' ? interactive : bulk;
+    }
+    EXPECT_EQ(order, "Biibiib");
+    EXPECT_EQ(scheduler.getRunningCount(bulk), 1u);
+
+    // stopping completes the jobs still queued, and later jobs are rejected
+    EXPECT_TRUE(scheduler.submit(interactive, "", job('i')));
+    EXPECT_TRUE(scheduler.submit(interactive, "", job('i')));
+    scheduler.stop();
+    EXPECT_EQ(order, "Biibiib--");
+    EXPECT_EQ(scheduler.getQueueLength(interactive), 0u);
+    EXPECT_FALSE(scheduler.submit(interactive, "", job('i')));
+
+    EXPECT_THROW(PriorityOptions::ParseClasses("bulk:0"), std::runtime_error);
+    EXPECT_THROW(PriorityOptions::ParseClasses("bulk"), std::runtime_error);
+}
+
+TEST(Relay, PriorityClassesLimitHeavyCalls)
+{
+    // the upstream takes 200ms for heavy calls, and has enough threads for all of them
+    EasyServer server("127.0.0.1", 3033, 4);
+    server.setRequestResponseFunctor([](const RequestType& req) -> ResponseType {
+        if (req.body().find("heavy") != std::string::npos) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(200));
+        }
+        ResponseType res{boost::beast::http::status::ok, req.version()};
+        res.keep_alive(req.keep_alive());
+        res.body() = R"({"result": 1, "error": null, "id": 1})";
+        res.prepare_payload();
+        return res;
+    });
+    server.run();
+
+    JsonRPCFilter filter;
+    filter.applyOptions("cheap, heavy:bulk");
+    JsonRpcRelay relay(std::move(filter), "127.0.0.1", 3032, "127.0.0.1", 3033, 2);
+
+    PriorityOptions options;
+    options.classes = PriorityOptions::ParseClasses("interactive:8,bulk:1:1");
+    relay.enablePriorityClasses(options);
+
+    auto post = [](const std::string& method) {
+        EasyClient client;
+        client.run(http::verb::post,
+                   "127.0.0.1",
+                   "3032",
+                   "/",
+                   R"({"jsonrpc": "2.0", "method": ")" + method + R"(", "id": 1})",
+                   11);
+        return client.getResponse().get();
+    };
+
+    // bulk calls go upstream one at a time, without delaying cheap calls
+    const auto start = std::chrono::steady_clock::now();
+
+    std::vector<std::future<http::response<http::string_body>>> heavy;
+    for (int i = 0; i < 3; i++) {
+        heavy.push_back(std::async(std::launch::async, post, "heavy"));
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    const auto cheapStart = std::chrono::steady_clock::now();
+    EXPECT_EQ(post("cheap").result(), http::status::ok);
+    EXPECT_LT(std::chrono::steady_clock::now() - cheapStart, std::chrono::milliseconds(150));
+
+    for (auto& f : heavy) {
+        EXPECT_EQ(f.get().result(), http::status::ok);
+    }
+    EXPECT_GE(std::chrono::steady_clock::now() - start, std::chrono::milliseconds(600));
+
+    relay.stop();
+}
+
+TEST(Relay, FairQueueTakesTurnsBetweenFlows)
+{
+    FairQueue<int> queue;
+    for (int i = 0; i < 4; i++) {
+        EXPECT_TRUE(queue.push("noisy", i, 4));
+    }
+    EXPECT_FALSE(queue.push("noisy", 4, 4));
+    EXPECT_TRUE(queue.push("quiet", 10, 4));
+    EXPECT_TRUE(queue.push("other", 20, 4));
+    EXPECT_EQ(queue.size(), 6u);
+    EXPECT_EQ(queue.getFlowCount(), 3u);
+
+    std::vector<int> order;
+    while (!queue.empty()) {
+        order.push_back(queue.pop());
+    }
+    EXPECT_EQ(order, (std::vector<int>{0, 10, 20, 1, 2, 3}));
+    EXPECT_EQ(queue.getFlowCount(), 0u);
+
+    // empty flows are kept for reuse, up to the limit, the least recently used ones dropped first
+    FairQueue<int> bounded(2);
+    for (const std::string flow : {"a", "b", "c"}) {
+        EXPECT_TRUE(bounded.push(flow, 1));
+        bounded.pop();
+    }
+    EXPECT_EQ(bounded.getIdleFlowCount(), 2u);
+    EXPECT_TRUE(bounded.push("b", 2));
+    EXPECT_TRUE(bounded.push("a", 3));
+    EXPECT_EQ(bounded.getFlowCount(), 2u);
+    EXPECT_EQ(bounded.getIdleFlowCount(), 1u);
+    EXPECT_EQ(bounded.pop(), 2);
+    EXPECT_EQ(bounded.pop(), 3);
+}
+
+TEST(Relay, FairQueueingSharesTheUpstreamBetweenClients)
+{
+    // the upstream records which client's call arrives, and holds the calls until the test releases
+    // them; the relay sends it one call at a time
+    std::mutex               arrivalsMutex;
+    std::string              arrivals;
+    std::promise<void>       firstArrived;
+    std::promise<void>       release;
+    std::shared_future<void> released = release.get_future().share();
+
+    EasyServer server("127.0.0.1", 3035, 1);
+    server.setRequestResponseFunctor(
+        [&arrivalsMutex, &arrivals, &firstArrived, released](const RequestType& req) -> ResponseType {
+            {
+                std::lock_guard<std::mutex> lock(arrivalsMutex);
+                arrivals += req.body().find("quiet") != std::string::npos ? 'q' : 'n';
+                if (arrivals.size() == 1) {
+                    firstArrived.set_value();
+                }
+            }
+            released.wait();
+            ResponseType res{boost::beast::http::status::ok, req.version()};
+            res.keep_alive(req.keep_alive());
+            res.body() = R"({"result": 1, "error": null, "id": 1})";
+            res.prepare_payload();
+            return res;
+        });
+    server.run();
+
+    JsonRPCFilter filter;
+    filter.applyOptions("method1");
+    JsonRpcRelay relay(std::move(filter), "127.0.0.1", 3034, "127.0.0.1", 3035, 2);
+
+    PriorityOptions options;
+    options.maxConcurrency    = 1;
+    options.clientIdentity    = ClientIdentity::Header;
+    options.identityHeader    = "X-Api-Key";
+    options.maxQueuePerClient = 4;
+    relay.enablePriorityClasses(options);
+
+    auto post = [](const std::string& key) {
+        BlockingHttpClient client("127.0.0.1", 3034);
+        auto               req = BlockingHttpClient::MakeJsonRequest(
+            "127.0.0.1", R"({"jsonrpc": "2.0", "method": "method1", "id": ")" + key + R"("})");
+        req.set("X-Api-Key", key);
+        return client.send(req).result();
+    };
+
+    // the first call of the noisy client takes the only upstream slot
+    auto first = std::async(std::launch::async, post, "noisy");
+    ASSERT_EQ(firstArrived.get_future().wait_for(std::chrono::seconds(5)), std::future_status::ready);
+
+    // then every client sends one call more than fits in its queue; the one that doesn't fit is
+    // rejected at once, so the others are queued by then
+    using Calls = std::vector<std::future<http::status>>;
+    auto flood  = [&post](const std::string& key, Calls& calls) {
+        auto rejected = std::make_shared<std::promise<void>>();
+        auto once     = std::make_shared<std::atomic<bool>>(false);
+        for (int i = 0; i < 5; i++) {
+            calls.push_back(std::async(std::launch::async, [post, key, rejected, once]() {
+                const http::status status = post(key);
+                if (status == http::status::service_unavailable && !once->exchange(true)) {
+                    rejected->set_value();
+                }
+                return status;
+            }));
+        }
+        return rejected->get_future().wait_for(std::chrono::seconds(5));
+    };
+    Calls noisy;
+    Calls quiet;
+    EXPECT_EQ(flood("noisy", noisy), std::future_status::ready);
+    EXPECT_EQ(flood("quiet", quiet), std::future_status::ready);
+
+    // the clients take turns, instead of the quiet one waiting for all the calls of the noisy one
+    release.set_value();
+    EXPECT_EQ(first.get(), http::status::ok);
+    for (Calls* calls : {&noisy, &quiet}) {
+        int ok = 0;
+        for (auto& f : *calls) {
+            ok += f.get() == http::status::ok ? 1 : 0;
+        }
+        EXPECT_EQ(ok, 4);
+    }
+    std::lock_guard<std::mutex> lock(arrivalsMutex);
+    EXPECT_EQ(arrivals, "nnqnqnqnq");
+
+    relay.stop();
+}
+
+TEST(Relay, SharedMetricsAggregateOverProcesses)
+{
+    EasyServer server("127.0.0.1", 3037, 1);
+    server.setRequestResponseFunctor([](const RequestType& req) -> ResponseType {
+        ResponseType res{boost::beast::http::status::ok, req.version()};
+        res.keep_alive(req.keep_alive());
+        res.body() = R"({"result": 1, "error": null, "id": 1})";
+        res.prepare_payload();
+        return res;
+    });
+    server.run();
+
+    const std::string prefix  = "http_rpc_relay_test_" + std::to_string(getpid());
+    auto              metrics = std::make_shared<SharedMetrics>(prefix);
+    // another relay of the host, which published its counters too
+    SharedMetrics other(prefix + "_other");
+
+    JsonRPCFilter filter;
+    filter.applyOptions("method1");
+    JsonRpcRelay relay(std::move(filter), "127.0.0.1", 3036, "127.0.0.1", 3037, 2);
+    relay.setSharedMetrics(metrics);
+
+    BlockingHttpClient client("127.0.0.1", 3036);
+    auto               allowed = BlockingHttpClient::MakeJsonRequest(
+        "127.0.0.1", R"({"jsonrpc": "2.0", "method": "method1", "id": 1})");
+    for (int i = 0; i < 3; i++) {
+        EXPECT_EQ(client.send(allowed).result(), http::status::ok);
+    }
+    auto denied = BlockingHttpClient::MakeJsonRequest(
+        "127.0.0.1", R"({"jsonrpc": "2.0", "method": "method2", "id": 1})");
+    EXPECT_EQ(client.send(denied).result(), http::status::bad_request);
+    relay.stop();
+
+    // the segment of this process is found by its prefix, and nothing else is
+    std::vector<MetricsSnapshot> snapshots = SharedMetrics::ReadAll(prefix);
+    ASSERT_EQ(snapshots.size(), 1u);
+    const MetricsSnapshot& s = snapshots.front();
+    EXPECT_EQ(s.pids, std::vector<int64_t>{getpid()});
+    EXPECT_EQ(s.requests, 4u);
+    EXPECT_EQ(s.denied, 1u);
+    EXPECT_EQ(s.failed, 0u);
+    EXPECT_EQ(s.methods.at("method1").requests, 3u);
+    EXPECT_EQ(s.methods.at("method2").denied, 1u);
+    EXPECT_GT(s.getLatencyQuantileUs(0.99), 0u);
+
+    other.recordRequest(
+        "method1", SharedMetrics::Outcome::Forwarded, true, std::chrono::microseconds(5));
+    other.recordUpstreamError();
+    MetricsSnapshot total = s;
+    total.add(SharedMetrics::ReadAll(prefix + "_other").front());
+    EXPECT_EQ(total.requests, 5u);
+    EXPECT_EQ(total.failed, 1u);
+    EXPECT_EQ(total.upstreamErrors, 1u);
+    EXPECT_EQ(total.methods.at("method1").requests, 4u);
+
+    // the segment goes away with the object, once the last request done with it lets go of it
+    relay.setSharedMetrics(nullptr);
+    metrics.reset();
+    for (int i = 0; i < 100 && !SharedMetrics::ReadAll(prefix).empty(); i++) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    EXPECT_TRUE(SharedMetrics::ReadAll(prefix).empty());
+}
+
+TEST(Metrics, SketchesFindHeavyHittersAndQuantiles)
+{
+    // two heavy keys in a stream of 1000 distinct light ones, split over two summaries
+    SpaceSaving first(16);
+    SpaceSaving second(16);
+    for (int i = 0; i < 1000; i++) {
+        SpaceSaving& s = i % 2 == 0 ? first : second;
+        s.add("light" + std::to_string(i));
+        s.add("heavy", 3);
+        if (i % 4 == 0) {
+            s.add("medium", 2);
+        }
+    }
+    first.merge(second);
+    EXPECT_EQ(first.getTotal(), 1000u + 3000u + 500u);
+    std::vector<SpaceSaving::Entry> top = first.top(2);
+    ASSERT_EQ(top.size(), 2u);
+    EXPECT_EQ(top[0].key, "heavy");
+    EXPECT_EQ(top[1].key, "medium");
+    // counts are overestimates by at most their error
+    EXPECT_GE(top[0].count, 3000u);
+    EXPECT_LE(top[0].count - top[0].error, 3000u);
+
+    // quantiles of 1..100000 within 1%, even merged from two sketches
+    DDSketch low(0.01);
+    DDSketch high(0.01);
+    for (int v = 1; v <= 100000; v++) {
+        (v % 3 == 0 ? low : high).add(v);
+    }
+    low.merge(high);
+    EXPECT_EQ(low.getCount(), 100000u);
+    for (double q : {0.5, 0.9, 0.99}) {
+        EXPECT_NEAR(low.getQuantile(q), q * 100000, q * 100000 * 0.011);
+    }
+
+    // beyond its buckets, a sketch collapses its lowest values and keeps the high quantiles
+    DDSketch bounded(0.01, 64);
+    for (int v = 1; v <= 100000; v++) {
+        bounded.add(v);
+    }
+    EXPECT_NEAR(bounded.getQuantile(0.99), 99000, 99000 * 0.011);
+    EXPECT_GT(bounded.getQuantile(0.01), 1000);
+}
+
+TEST(Relay, AdminEndpointReportsUsage)
+{
+    EasyServer server("127.0.0.1", 3039, 1);
+    server.setRequestResponseFunctor([](const RequestType& req) -> ResponseType {
+        if (req.body().find("slow") != std::string::npos) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        }
+        ResponseType res{boost::beast::http::status::ok, req.version()};
+        res.keep_alive(req.keep_alive());
+        res.body() = R"({"result": 1, "error": null, "id": 1})";
+        res.prepare_payload();
+        return res;
+    });
+    server.run();
+
+    JsonRPCFilter filter;
+    filter.applyOptions("fast,slow");
+    JsonRpcRelay relay(std::move(filter), "127.0.0.1", 3038, "127.0.0.1", 3039, 2);
+    auto         usage = std::make_shared<UsageTracker>();
+    relay.setUsageTracker(usage);
+
+    EasyServer admin("127.0.0.1", 3040, 1);
+    admin.setRequestResponseFunctor(AdminEndpoint(usage));
+    admin.run();
+
+    // many fast calls, and a few slow ones that take more time in total
+    BlockingHttpClient client("127.0.0.1", 3038);
+    auto fast = BlockingHttpClient::MakeJsonRequest("127.0.0.1", R"({"method": "fast", "id": 1})");
+    auto slow = BlockingHttpClient::MakeJsonRequest("127.0.0.1", R"({"method": "slow", "id": 1})");
+    for (int i = 0; i < 20; i++) {
+        EXPECT_EQ(client.send(fast).result(), http::status::ok);
+    }
+    for (int i = 0; i < 5; i++) {
+        EXPECT_EQ(client.send(slow).result(), http::status::ok);
+    }
+
+    BlockingHttpClient                                           adminClient("127.0.0.1", 3040);
+    boost::beast::http::request<boost::beast::http::string_body> get{
+        boost::beast::http::verb::get, "/usage?top=5", 11};
+    get.set(boost::beast::http::field::host, "127.0.0.1");
+    auto res = adminClient.send(get);
+    ASSERT_EQ(res.result(), http::status::ok);
+
+    Json::Value  report;
+    Json::Reader reader;
+    ASSERT_TRUE(reader.parse(res.body(), report));
+    EXPECT_EQ(report["requests"].asUInt64(), 25u);
+    EXPECT_EQ(report["methods_by_requests"][0]["key"].asString(), "fast");
+    EXPECT_EQ(report["methods_by_requests"][0]["count"].asUInt64(), 20u);
+    EXPECT_EQ(report["methods_by_time_us"][0]["key"].asString(), "slow");
+    EXPECT_EQ(report["clients_by_requests"][0]["key"].asString(), "127.0.0.1");
+    EXPECT_EQ(report["latencies"][0]["method"].asString(), "slow");
+    EXPECT_GE(report["latencies"][0]["p50_us"].asDouble(), 19000);
+
+    get.target("/other");
+    EXPECT_EQ(adminClient.send(get).result(), http::status::not_found);
+
+    relay.stop();
+}
+
+TEST(Client, AsyncClientPoolsConnections)
+{
+    EasyServer server("127.0.0.1", 3041, 2);
+    server.setRequestResponseFunctor([](const RequestType& req) -> ResponseType {
+        if (req.body().find("slow") != std::string::npos) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(200));
+        }
+        ResponseType res{boost::beast::http::status::ok, req.version()};
+        res.keep_alive(req.keep_alive());
+        res.body() = R"({"result": 1, "error": null, "id": 1})";
+        res.prepare_payload();
+        return res;
+    });
+    server.run();
+
+    net::io_context    ioc;
+    auto               work = std::make_unique<net::io_context::work>(ioc);
+    std::thread        thread([&ioc]() { ioc.run(); });
+    AsyncClientOptions options;
+    options.maxConnections = 4;
+    auto client = std::make_shared<AsyncClient>(ioc, "127.0.0.1", "3041", options);
+
+    // many requests in flight at once share the connections of the pool
+    const auto req = BlockingHttpClient::MakeJsonRequest("127.0.0.1", R"({"method": "fast"})");
+    std::atomic<int>   succeeded{0};
+    std::atomic<int>   remaining{50};
+    std::promise<void> allDone;
+    for (int i = 0; i < 50; i++) {
+        client->send(req, [&](boost::beast::error_code ec, AsyncClient::Response&& res) {
+            if (!ec && res.result() == http::status::ok) {
+                succeeded++;
+            }
+            if (--remaining == 0) {
+                allDone.set_value();
+            }
+        });
+    }
+    allDone.get_future().wait();
+    EXPECT_EQ(succeeded.load(), 50);
+    EXPECT_LE(client->getConnectionsOpened(), 4u);
+    EXPECT_EQ(client->getQueueLength(), 0u);
+
+    // later requests reuse the idle connections; futures work through the completion token
+    const uint64_t opened = client->getConnectionsOpened();
+    for (int i = 0; i < 5; i++) {
+        auto res = client->asyncSend(req, net::use_future).get();
+        EXPECT_EQ(res.result(), http::status::ok);
+    }
+    EXPECT_EQ(client->getConnectionsOpened(), opened);
+
+    // a request that takes longer than its timeout fails with timeout, and the pool recovers
+    std::promise<boost::beast::error_code> timedOut;
+    client->send(BlockingHttpClient::MakeJsonRequest("127.0.0.1", R"({"method": "slow"})"),
+                 [&](boost::beast::error_code ec, AsyncClient::Response&&) { timedOut.set_value(ec); },
+                 std::chrono::milliseconds(50));
+    EXPECT_EQ(timedOut.get_future().get(), boost::beast::error::timeout);
+    EXPECT_EQ(client->asyncSend(req, net::use_future).get().result(), http::status::ok);
+
+    // the relay reuses its upstream connections too
+    JsonRPCFilter filter;
+    filter.applyOptions("fast");
+    JsonRpcRelay relay(std::move(filter), "127.0.0.1", 3042, "127.0.0.1", 3041, 2);
+    AsyncClientOptions upstreamOptions;
+    upstreamOptions.maxConnections = 2;
+    relay.enableUpstreamKeepAlive(upstreamOptions);
+    for (int i = 0; i < 10; i++) {
+        auto relayed = req;
+        relayed.keep_alive(false); // a new downstream connection every time
+        BlockingHttpClient once("127.0.0.1", 3042);
+        EXPECT_EQ(once.send(relayed).result(), http::status::ok);
+    }
+    relay.stop();
+
+    client->stop();
+    EXPECT_THROW(client->asyncSend(req, net::use_future).get(), boost::system::system_error);
+    work.reset();
+    thread.join();
+}
+
+TEST(Tools, UpstreamSimulatorQueuesAndFails)
+{
+    const LatencyDistribution bimodal = LatencyDistribution::Parse("bimodal:1:50:0.25");
+    EXPECT_EQ(bimodal.kind, LatencyDistribution::Kind::Bimodal);
+    EXPECT_DOUBLE_EQ(bimodal.slowMs, 50);
+    EXPECT_THROW(LatencyDistribution::Parse("uniform:1:2"), std::runtime_error);
+    EXPECT_THROW(MethodProfile::Parse("fixed:1,colour=red"), std::runtime_error);
+
+    SimulatorOptions options;
+    options.workers           = 1;
+    options.queueDepth        = 1;
+    options.defaultProfile    = MethodProfile::Parse("fixed:300,size=4");
+    options.methods["broken"] = MethodProfile::Parse("fixed:1,error=1");
+    options.methods["lost"]   = MethodProfile::Parse("fixed:1,drop=1");
+    UpstreamSimulator simulator("127.0.0.1", 3043, options);
+    simulator.run(2);
+
+    // one call takes the only worker, one waits in the queue, and the queue has no room for the third
+    std::vector<std::future<http::status>> calls;
+    for (int i = 0; i < 3; i++) {
+        calls.push_back(std::async(std::launch::async, []() {
+            BlockingHttpClient client("127.0.0.1", 3043);
+            auto               req = BlockingHttpClient::MakeJsonRequest(
+                "127.0.0.1", R"({"method": "getblock", "params": [], "id": 7})");
+            return client.send(req).result();
+        }));
+    }
+    std::multiset<http::status> statuses;
+    for (auto& call : calls) {
+        statuses.insert(call.get());
+    }
+    EXPECT_EQ(statuses.count(http::status::ok), 2u);
+    EXPECT_EQ(statuses.count(http::status::service_unavailable), 1u);
+
+    BlockingHttpClient client("127.0.0.1", 3043);
+    auto req = BlockingHttpClient::MakeJsonRequest("127.0.0.1", R"({"method": "getblock", "id": 7})");
+    auto res = client.send(req);
+    EXPECT_EQ(res.result(), http::status::ok);
+    EXPECT_EQ(res.body(), R"({"result":"xxxx","error":null,"id":7})");
+
+    auto broken = BlockingHttpClient::MakeJsonRequest("127.0.0.1", R"({"method": "broken", "id": 1})");
+    res         = client.send(broken);
+    EXPECT_EQ(res.result(), http::status::internal_server_error);
+    EXPECT_NE(res.body().find("Simulated error"), std::string::npos);
+
+    auto lost = BlockingHttpClient::MakeJsonRequest("127.0.0.1", R"({"method": "lost", "id": 1})");
+    EXPECT_THROW(client.send(lost), boost::system::system_error);
+
+    const UpstreamSimulator::Stats stats = simulator.getStats();
+    EXPECT_EQ(stats.calls, 6);
+    EXPECT_EQ(stats.rejected, 1);
+    EXPECT_EQ(stats.errors, 1);
+    EXPECT_EQ(stats.drops, 1);
+    EXPECT_EQ(stats.maxQueue, 1);
+    simulator.stop();
+}
+
+TEST(Relay, ImmutableCacheServesResultsAcrossRestarts)
+{
+    std::atomic<int> upstreamCalls{0};
+    EasyServer       server("127.0.0.1", 3044, 2);
+    server.setRequestResponseFunctor([&](const RequestType& req) -> ResponseType {
+        upstreamCalls++;
+        ResponseType res{boost::beast::http::status::ok, req.version()};
+        res.keep_alive(req.keep_alive());
+        if (req.body().find("getblock") != std::string::npos) {
+            res.body() = R"({"result": {"hash": "00ab", "tx": ["t1", "t2"]}, "error": null, "id": 1})";
+        } else if (req.body().find("mempooltx") != std::string::npos) {
+            res.body() = R"({"result": {"txid": "mempooltx"}, "error": null, "id": 1})";
+        } else {
+            res.body() = R"({"result": {"txid": "t1", "blockhash": "00ab"}, "error": null, "id": 1})";
+        }
+        res.prepare_payload();
+        return res;
+    });
+    server.run();
+
+    char        pattern[] = "/tmp/httprpcrelay_test_cache.XXXXXX";
+    std::string directory = mkdtemp(pattern);
+
+    ImmutableCacheOptions options;
+    options.directory    = directory;
+    options.methods      = ImmutableCacheOptions::ParseMethods("getblock, getrawtransaction:blockhash");
+    options.segmentBytes = 4096;
+    options.maxBytes     = 3 * 4096;
+    EXPECT_EQ(options.methods["getrawtransaction"], "blockhash");
+
+    auto call = [](uint16_t port, const std::string& body) {
+        BlockingHttpClient client("127.0.0.1", port);
+        auto               req = BlockingHttpClient::MakeJsonRequest("127.0.0.1", body);
+        return client.send(req).body();
+    };
+    {
+        auto cache = ImmutableResultCache::Open(options);
+        ASSERT_NE(cache, nullptr);
+        EXPECT_EQ(ImmutableResultCache::Open(options), nullptr); // the directory is locked
+
+        JsonRPCFilter filter;
+        filter.applyOptions("getblock,getrawtransaction");
+        JsonRpcRelay relay(std::move(filter), "127.0.0.1", 3045, "127.0.0.1", 3044, 2);
+        relay.setImmutableCache(cache);
+
+        // the first call goes upstream; the next ones, with other ids or spacing, are served from disk
+        call(3045, R"({"method": "getblock", "params": ["00ab", 1], "id": 1})");
+        EXPECT_EQ(call(3045, R"({"method": "getblock", "params": [ "00ab",1 ], "id": "x"})"),
+                  R"({"result":{"hash": "00ab", "tx": ["t1", "t2"]},"error":null,"id":"x"})");
+        EXPECT_EQ(upstreamCalls.load(), 1);
+
+        // a transaction is only cached once it's confirmed (its result has a blockhash)
+        call(3045, R"({"method": "getrawtransaction", "params": ["mempooltx", true], "id": 2})");
+        call(3045, R"({"method": "getrawtransaction", "params": ["mempooltx", true], "id": 2})");
+        call(3045, R"({"method": "getrawtransaction", "params": ["t1", true], "id": 2})");
+        call(3045, R"({"method": "getrawtransaction", "params": ["t1", true], "id": 2})");
+        EXPECT_EQ(upstreamCalls.load(), 4);
+
+        const ImmutableResultCache::Stats stats = cache->getStats();
+        EXPECT_EQ(stats.stores, 2u);
+        EXPECT_EQ(stats.hits, 2u);
+        EXPECT_EQ(stats.entries, 2u);
+        relay.setImmutableCache(nullptr);
+        relay.stop();
+    }
+
+    // a restart finds the results in the segment files
+    auto cache = ImmutableResultCache::Open(options);
+    ASSERT_NE(cache, nullptr);
+    EXPECT_EQ(cache->getStats().entries, 2u);
+    std::string result;
+    EXPECT_TRUE(cache->lookup(ImmutableResultCache::MakeKey("getblock", R"(["00ab", 1])"), result));
+    EXPECT_EQ(result, R"({"hash": "00ab", "tx": ["t1", "t2"]})");
+
+    // the oldest segment is dropped once the size cap is reached
+    const std::string big = R"({"result": ")" + std::string(3000, 'x') + R"(", "error": null, "id": 1})";
+    for (int i = 0; i < 4; i++) {
+        const std::string key = ImmutableResultCache::MakeKey("getblock", std::to_string(i));
+        EXPECT_TRUE(cache->store("getblock", key, big));
+    }
+    EXPECT_EQ(cache->getStats().segments, 3u);
+    EXPECT_EQ(cache->getStats().evictedSegments, 1u);
+    result.clear();
+    EXPECT_FALSE(cache->lookup(ImmutableResultCache::MakeKey("getblock", R"(["00ab", 1])"), result));
+    EXPECT_TRUE(cache->lookup(ImmutableResultCache::MakeKey("getblock", "3"), result));
+    cache.reset();
+
+    DIR* dir = opendir(directory.c_str());
+    while (dirent* entry = readdir(dir)) {
+        std::remove((directory + "/" + entry->d_name).c_str());
+    }
+    closedir(dir);
+    rmdir(directory.c_str());
+}
+
+TEST(Relay, PrefetchFollowsSequentialScans)
+{
+    // heights, hashes and blocks of a chain of 5 blocks
+    std::mutex                 callsMutex;
+    std::map<std::string, int> upstreamCalls; // by method
+    EasyServer                 server("127.0.0.1", 3049, 2);
+    server.setRequestResponseFunctor([&](const RequestType& req) -> ResponseType {
+        Json::Value  call;
+        Json::Reader reader;
+        reader.parse(req.body(), call, false);
+        {
+            std::lock_guard<std::mutex> lock(callsMutex);
+            upstreamCalls[call["method"].asString()]++;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+        Json::Value response;
+        response["error"] = Json::Value();
+        response["id"]    = call["id"];
+        if (call["method"] == "getblockhash") {
+            const int height = call["params"][0].asInt();
+            if (height <= 5) {
+                response["result"] = "hash" + std::to_string(height);
+            } else {
+                response["error"]["code"] = -8;
+            }
+        } else {
+            response["result"]["hash"]   = call["params"][0];
+            response["result"]["height"] = std::stoi(call["params"][0].asString().substr(4));
+        }
+        ResponseType res{boost::beast::http::status::ok, req.version()};
+        res.keep_alive(req.keep_alive());
+        res.body() = Json::FastWriter().write(response);
+        res.prepare_payload();
+        return res;
+    });
+    server.run();
+
+    EXPECT_THROW(PrefetchRule::Parse("getblockhash getblock($result)"), std::runtime_error);
+    EXPECT_THROW(PrefetchRule::Parse("getblockhash>getblockhash($x+1)"), std::runtime_error);
+    std::string rendered;
+    EXPECT_TRUE(PrefetchRule::Parse("getblock>getblock($result.next.hash, 1, $1-1)")
+                    .render(R"(["a", 7])", R"({"next": {"hash": "b"}})", rendered));
+    EXPECT_EQ(rendered, R"(["b",1,6])");
+    EXPECT_FALSE(PrefetchRule::Parse("getblock>getblock($result.next)").render("[]", "{}", rendered));
+
+    PrefetchOptions options;
+    options.rules.push_back(PrefetchRule::Parse("getblockhash>getblock($result,1)"));
+    options.rules.push_back(PrefetchRule::Parse("getblockhash>getblockhash($0+1)"));
+    auto prefetch = std::make_shared<PrefetchEngine>(options);
+
+    JsonRPCFilter filter;
+    filter.applyOptions("getblockhash,getblock");
+    JsonRpcRelay relay(std::move(filter), "127.0.0.1", 3050, "127.0.0.1", 3049, 2);
+    relay.setPrefetchEngine(prefetch);
+
+    // only the first call of the scan goes upstream itself
+    BlockingHttpClient client("127.0.0.1", 3050);
+    for (int height = 1; height <= 5; height++) {
+        auto req = BlockingHttpClient::MakeJsonRequest(
+            "127.0.0.1",
+            R"({"id": 1, "method": "getblockhash", "params": [)" + std::to_string(height) + "]}");
+        Json::Value  response;
+        Json::Reader reader;
+        ASSERT_TRUE(reader.parse(client.send(req).body(), response, false));
+        const std::string hash = response["result"].asString();
+        EXPECT_EQ(hash, "hash" + std::to_string(height));
+
+        req = BlockingHttpClient::MakeJsonRequest(
+            "127.0.0.1", R"({"method": "getblock", "params": [")" + hash + R"(", 1], "id": "b"})");
+        ASSERT_TRUE(reader.parse(client.send(req).body(), response, false));
+        EXPECT_EQ(response["id"].asString(), "b");
+        EXPECT_EQ(response["result"]["height"].asInt(), height);
+    }
+
+    // the last prefetch, of a height past the tip, fails
+    for (int i = 0; i < 100 && prefetch->getStats().failed == 0; i++) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    const PrefetchEngine::Stats stats = prefetch->getStats();
+    EXPECT_EQ(stats.issued, 10u);
+    EXPECT_EQ(stats.hits + stats.joined, 9u);
+    EXPECT_EQ(stats.misses, 1u);
+    EXPECT_EQ(stats.failed, 1u);
+    {
+        std::lock_guard<std::mutex> lock(callsMutex);
+        EXPECT_EQ(upstreamCalls["getblockhash"], 6);
+        EXPECT_EQ(upstreamCalls["getblock"], 5);
+    }
+    relay.stop();
+}
+
+TEST(Relay, LongPollCallsShareOneUpstreamCall)
+{
+    // an upstream whose waitfornewblock returns after a while
+    std::atomic<int> upstreamCalls{0};
+    EasyServer       server("127.0.0.1", 3051, 4);
+    server.setRequestResponseFunctor([&](const RequestType& req) -> ResponseType {
+        upstreamCalls++;
+        Json::Value  call;
+        Json::Reader reader;
+        reader.parse(req.body(), call, false);
+        std::this_thread::sleep_for(std::chrono::milliseconds(300));
+        Json::Value response;
+        response["result"]["height"] = call["params"][0];
+        response["error"]            = Json::Value();
+        response["id"]               = call["id"];
+        ResponseType res{boost::beast::http::status::ok, req.version()};
+        res.keep_alive(req.keep_alive());
+        res.body() = Json::FastWriter().write(response);
+        res.prepare_payload();
+        return res;
+    });
+    server.run();
+
+    EXPECT_EQ(LongPollCollapser::ParseMethods("waitfornewblock, waitforblock").size(), 2u);
+    EXPECT_THROW(LongPollCollapser::ParseMethods("waitfornewblock,,waitforblock"), std::runtime_error);
+    auto collapser = std::make_shared<LongPollCollapser>(LongPollCollapser::ParseMethods("waitforblockheight"));
+
+    JsonRPCFilter filter;
+    filter.applyOptions("waitforblockheight");
+    JsonRpcRelay relay(std::move(filter), "127.0.0.1", 3052, "127.0.0.1", 3051, 2);
+    relay.setLongPollCollapser(collapser);
+
+    // 8 clients wait for the same height, 2 for another one
+    std::vector<std::future<std::string>> responses;
+    for (int c = 0; c < 10; c++) {
+        responses.push_back(std::async(std::launch::async, [c]() {
+            BlockingHttpClient client("127.0.0.1", 3052);
+            auto               req = BlockingHttpClient::MakeJsonRequest(
+                "127.0.0.1",
+                R"({"method": "waitforblockheight", "params": [)" + std::string(c < 8 ? "100" : "200") +
+                    R"(], "id": )" + std::to_string(c) + "}");
+            return client.send(req).body();
+        }));
+        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    }
+    for (int c = 0; c < 10; c++) {
+        Json::Value  response;
+        Json::Reader reader;
+        ASSERT_TRUE(reader.parse(responses[c].get(), response, false));
+        EXPECT_EQ(response["id"].asInt(), c);
+        EXPECT_EQ(response["result"]["height"].asInt(), c < 8 ? 100 : 200);
+    }
+    EXPECT_EQ(upstreamCalls.load(), 2);
+
+    const LongPollCollapser::Stats stats = collapser->getStats();
+    EXPECT_EQ(stats.sent, 2u);
+    EXPECT_EQ(stats.joined, 8u);
+    EXPECT_EQ(stats.waiting, 0u);
+    EXPECT_EQ(stats.maxWaiting, 8u);
+
+    // once the wait returned, the next call goes upstream again
+    BlockingHttpClient client("127.0.0.1", 3052);
+    auto               req = BlockingHttpClient::MakeJsonRequest(
+        "127.0.0.1", R"({"method": "waitforblockheight", "params": [100], "id": 1})");
+    client.send(req);
+    EXPECT_EQ(upstreamCalls.load(), 3);
+    relay.stop();
+}
+
+TEST(Relay, RoutesMethodsToUpstreamPools)
+{
+    RoutingTable table;
+    table.addRoute("getblockstats($0<100)=archive");
+    table.addRoute("getrawtransaction=archive");
+    table.addRoute("get*info=tip");
+    table.addRoute("getblock($1==2 && $0!=\"\")=raw");
+    EXPECT_EQ(*table.route("getblockstats", "[50]"), "archive");
+    EXPECT_EQ(table.route("getblockstats", "[150]"), nullptr);
+    EXPECT_EQ(table.route("getblockstats", "[\"50\"]"), nullptr);
+    EXPECT_EQ(*table.route("getrawtransaction", ""), "archive");
+    EXPECT_EQ(*table.route("getblockchaininfo", "[]"), "tip");
+    EXPECT_EQ(*table.route("getblock", "[\"00ab\", 2]"), "raw");
+    EXPECT_EQ(table.route("getblock", "[\"00ab\", 1]"), nullptr);
+    EXPECT_EQ(table.getPools(), (std::set<std::string>{"archive", "raw", "tip"}));
+    table.setFallbackPool("tip");
+    EXPECT_EQ(*table.route("getblock", "[\"00ab\", 1]"), "tip");
+    EXPECT_THROW(table.addRoute("getblock"), std::runtime_error);
+    EXPECT_THROW(table.addRoute("getblock($0<abc)=archive"), std::runtime_error);
+    EXPECT_THROW(table.addRoute("getblock(0<1)=archive"), std::runtime_error);
+    EXPECT_THROW(table.addRoute("=archive"), std::runtime_error);
+
+    // the target and an archive pool answer with their names
+    auto makeUpstream = [](uint16_t port, const std::string& name) {
+        auto server = std::make_unique<EasyServer>("127.0.0.1", port, 2);
+        server->setRequestResponseFunctor([name](const RequestType& req) -> ResponseType {
+            ResponseType res{boost::beast::http::status::ok, req.version()};
+            res.keep_alive(req.keep_alive());
+            res.body() = R"({"result": ")" + name + R"(", "error": null, "id": 1})";
+            res.prepare_payload();
+            return res;
+        });
+        server->run();
+        return server;
+    };
+    auto target  = makeUpstream(3053, "target");
+    auto archive = makeUpstream(3054, "archive");
+
+    RoutingTable routes;
+    routes.addRoute("getblockstats($0<100)=archive");
+    routes.addRoute("getraw*=archive");
+    JsonRPCFilter filter;
+    filter.applyOptions("getblockstats,getrawtransaction,getbestblockhash");
+    filter.setRoutingTable(std::move(routes));
+    JsonRpcRelay relay(std::move(filter), "127.0.0.1", 3055, "127.0.0.1", 3053, 2);
+    AsyncClientOptions archiveOptions;
+    archiveOptions.maxConnections = 1;
+    relay.addUpstreamPool("archive", "127.0.0.1", 3054, archiveOptions);
+
+    auto call = [](const std::string& method, const std::string& params) {
+        BlockingHttpClient client("127.0.0.1", 3055);
+        auto               req = BlockingHttpClient::MakeJsonRequest(
+            "127.0.0.1", R"({"method": ")" + method + R"(", "params": )" + params + R"(, "id": 1})");
+        Json::Value  response;
+        Json::Reader reader;
+        reader.parse(client.send(req).body(), response, false);
+        return response["result"].asString();
+    };
+    EXPECT_EQ(call("getblockstats", "[50]"), "archive");
+    EXPECT_EQ(call("getblockstats", "[150]"), "target");
+    EXPECT_EQ(call("getrawtransaction", R"(["00ab"])"), "archive");
+    EXPECT_EQ(call("getbestblockhash", "[]"), "target");
+    relay.stop();
+}
+
+TEST(Relay, MirrorComparesShadowWithoutDelayingClients)
+{
+    // the real upstream and a slower shadow, which disagrees on two methods
+    auto makeUpstream = [](uint16_t port, bool shadow) {
+        auto server = std::make_unique<EasyServer>("127.0.0.1", port, 2);
+        server->setRequestResponseFunctor([shadow](const RequestType& req) -> ResponseType {
+            Json::Value  call;
+            Json::Reader reader;
+            reader.parse(req.body(), call, false);
+            const std::string method = call["method"].asString();
+            std::string       body   = R"({"result": ")" + method + R"(", "error": null, "id": 1})";
+            if (shadow) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(300));
+                if (method == "getbestblockhash") {
+                    body = R"({"result": "other", "error": null, "id": 1})";
+                } else if (method == "getblockhash") {
+                    body = R"({"result": null, "error": {"code": -8, "message": "x"}, "id": 1})";
+                }
+            }
+            ResponseType res{boost::beast::http::status::ok, req.version()};
+            res.keep_alive(req.keep_alive());
+            res.body() = body;
+            res.prepare_payload();
+            return res;
+        });
+        server->run();
+        return server;
+    };
+    auto target = makeUpstream(3056, false);
+    auto shadow = makeUpstream(3057, true);
+
+    MirrorOptions options;
+    options.address = "127.0.0.1";
+    options.port    = 3057;
+    auto mirror     = std::make_shared<TrafficMirror>(options);
+
+    JsonRPCFilter filter;
+    filter.applyOptions("getblockcount,getbestblockhash,getblockhash");
+    JsonRpcRelay relay(std::move(filter), "127.0.0.1", 3058, "127.0.0.1", 3056, 2);
+    relay.setTrafficMirror(mirror);
+
+    const auto start = std::chrono::steady_clock::now();
+    for (const char* method : {"getblockcount", "getbestblockhash", "getblockhash"}) {
+        BlockingHttpClient client("127.0.0.1", 3058);
+        auto               req = BlockingHttpClient::MakeJsonRequest(
+            "127.0.0.1", std::string(R"({"method": ")") + method + R"(", "params": [], "id": 1})");
+        EXPECT_NE(client.send(req).body().find(method), std::string::npos);
+    }
+    // the clients didn't wait for the shadow
+    EXPECT_LT(std::chrono::steady_clock::now() - start, std::chrono::milliseconds(300));
+
+    for (int i = 0; i < 200 && mirror->getStats().mirrored < 3; i++) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    TrafficMirror::Stats stats = mirror->getStats();
+    EXPECT_EQ(stats.mirrored, 3u);
+    EXPECT_EQ(stats.dropped, 0u);
+    EXPECT_EQ(stats.shadowFailures, 0u);
+    EXPECT_EQ(stats.errorMismatches, 1u);
+    EXPECT_EQ(stats.resultMismatches, 1u);
+    EXPECT_EQ(stats.queued, 0u);
+    EXPECT_GE(stats.shadowLatency.getQuantile(0.5), 250000.0);
+    EXPECT_LT(stats.primaryLatency.getQuantile(0.5), 250000.0);
+    relay.stop();
+
+    // sampled requests beyond the queue are dropped, not mirrored
+    options.sampleEvery    = 2;
+    options.maxQueueLength = 1;
+    TrafficMirror bounded(options);
+    EXPECT_TRUE(bounded.admit());
+    EXPECT_FALSE(bounded.admit());
+    EXPECT_FALSE(bounded.admit());
+    EXPECT_EQ(bounded.getStats().dropped, 1u);
+}
+
+TEST(Relay, StreamListenerAnswersCallsInOrder)
+{
+    // an upstream that echoes the first param as result; smaller params take longer
+    EasyServer server("127.0.0.1", 3047, 4);
+    server.setRequestResponseFunctor([&](const RequestType& req) -> ResponseType {
+        Json::Value  call;
+        Json::Reader reader;
+        reader.parse(req.body(), call, false);
+        std::this_thread::sleep_for(std::chrono::milliseconds(10 * (5 - call["params"][0].asInt())));
+        Json::Value response;
+        response["result"] = call["params"][0];
+        response["error"]  = Json::Value();
+        response["id"]     = call["id"];
+        ResponseType res{boost::beast::http::status::ok, req.version()};
+        res.keep_alive(req.keep_alive());
+        res.body() = Json::FastWriter().write(response);
+        res.prepare_payload();
+        return res;
+    });
+    server.run();
+
+    JsonRPCFilter filter;
+    filter.applyOptions("echo");
+    JsonRpcRelay relay(std::move(filter), "127.0.0.1", 3046, "127.0.0.1", 3047, 2);
+    relay.enableUpstreamKeepAlive(AsyncClientOptions());
+    relay.enableStreamListener("127.0.0.1", 3048);
+
+    net::io_context ioc;
+    tcp::socket     socket(ioc);
+    socket.connect(tcp::endpoint(net::ip::make_address("127.0.0.1"), 3048));
+
+    // all the calls in one write, a denied one among them, and the last one split over two writes
+    std::string calls;
+    for (int i = 1; i <= 4; i++) {
+        calls += R"({"method": "echo", "params": [)" + std::to_string(i) + R"(], "id": )" +
+                 std::to_string(i) + "}\n";
+    }
+    calls += R"({"method": "stop", "id": "x"})"
+             "\n"
+             R"({"method": "echo", "params": [)";
+    net::write(socket, net::buffer(calls));
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    net::write(socket, net::buffer(std::string(R"(5], "id": 5})"
+                                               "\n")));
+
+    std::string      buffer;
+    std::vector<int> ids;
+    for (int i = 0; i < 6; i++) {
+        const std::size_t n = net::read_until(socket, net::dynamic_buffer(buffer), '\n');
+        Json::Value       response;
+        Json::Reader      reader;
+        ASSERT_TRUE(reader.parse(buffer.substr(0, n), response, false));
+        buffer.erase(0, n);
+        if (response["id"].isString()) {
+            EXPECT_EQ(response["id"].asString(), "x");
+            EXPECT_EQ(response["error"]["code"].asInt(), -32600);
+            ids.push_back(0);
+        } else {
+            EXPECT_EQ(response["result"].asInt(), response["id"].asInt());
+            ids.push_back(response["id"].asInt());
+        }
+    }
+    EXPECT_EQ(ids, std::vector<int>({1, 2, 3, 4, 0, 5}));
+
+    // a stream that isn't json gets a parse error, then the connection is closed
+    net::write(socket, net::buffer(std::string("}\n")));
+    const std::size_t n = net::read_until(socket, net::dynamic_buffer(buffer), '\n');
+    EXPECT_NE(buffer.substr(0, n).find("-32700"), std::string::npos);
+    boost::system::error_code ec;
+    net::read(socket, net::dynamic_buffer(buffer), ec);
+    EXPECT_EQ(ec, net::error::eof);
+
+    relay.stop();
+}
+
+TEST(Relay, EarlyRejectionBeforeTheBodyIsRead)
+{
+    // the method is found in the first chunk, however the body goes on
+    MethodSniffer sniffer;
+    EXPECT_EQ(sniffer.feed(R"({"id": 1, "params": {"method": "x"}, "met)"),
+              MethodSniffer::Result::NeedMore);
+    EXPECT_EQ(sniffer.feed(R"({"id": 1, "params": {"method": "x"}, "method" : "stop", "par)"),
+              MethodSniffer::Result::Found);
+    EXPECT_EQ(sniffer.getMethod(), "stop");
+    MethodSniffer batch;
+    EXPECT_EQ(batch.feed(R"([{"method": "stop"}])"), MethodSniffer::Result::Unknown);
+    MethodSniffer number;
+    EXPECT_EQ(number.feed(R"({"params": ["method"], "method": 1})"), MethodSniffer::Result::Unknown);
+
+    std::atomic<int> upstreamCalls{0};
+    EasyServer       server("127.0.0.1", 3059, 2);
+    server.setRequestResponseFunctor([&](const RequestType& req) -> ResponseType {
+        upstreamCalls++;
+        ResponseType res{boost::beast::http::status::ok, req.version()};
+        res.keep_alive(req.keep_alive());
+        res.body() = R"({"result": 1, "error": null, "id": 1})";
+        res.prepare_payload();
+        return res;
+    });
+    server.run();
+
+    JsonRPCFilter filter;
+    filter.applyOptions("getblockcount");
+    JsonRpcRelay         relay(std::move(filter), "127.0.0.1", 3060, "127.0.0.1", 3059, 2);
+    RequestScreenOptions options;
+    options.maxBodySize = 1024;
+    options.paths       = {"/", "/wallet/*"};
+    relay.enableEarlyRejection(options);
+
+    // allowed calls go through as before
+    {
+        BlockingHttpClient client("127.0.0.1", 3060);
+        auto               req = BlockingHttpClient::MakeJsonRequest(
+            "127.0.0.1", R"({"method": "getblockcount", "params": [], "id": 1})");
+        EXPECT_EQ(client.send(req).result(), boost::beast::http::status::ok);
+    }
+
+    // sends a part of a request, and reads the response up to the end of the connection
+    auto partial = [](const std::string& head, const std::string& body) {
+        net::io_context ioc;
+        tcp::socket     socket(ioc);
+        socket.connect(tcp::endpoint(net::ip::make_address("127.0.0.1"), 3060));
+        net::write(socket, net::buffer(head + "\r\n" + body));
+        std::string               response;
+        boost::system::error_code ec;
+        net::read(socket, net::dynamic_buffer(response), ec);
+        EXPECT_EQ(ec, net::error::eof);
+        return response.substr(0, response.find("\r\n"));
+    };
+    const std::string post = "POST / HTTP/1.1\r\nHost: 127.0.0.1\r\nContent-Type: application/json\r\n";
+    // the body is never sent
+    EXPECT_EQ(partial(post + "Content-Length: 100000000\r\n", ""), "HTTP/1.1 413 Payload Too Large");
+    // the body stops right after the method
+    EXPECT_EQ(partial(post + "Content-Length: 500\r\n", R"({"method": "stop", "params": [)"),
+              "HTTP/1.1 400 Bad Request");
+    EXPECT_EQ(partial("GET / HTTP/1.1\r\nHost: 127.0.0.1\r\n", ""), "HTTP/1.1 405 Method Not Allowed");
+    EXPECT_EQ(partial("POST /admin HTTP/1.1\r\nHost: 127.0.0.1\r\nContent-Length: 2\r\n", "{}"),
+              "HTTP/1.1 404 Not Found");
+    EXPECT_EQ(upstreamCalls.load(), 1);
+    relay.stop();
+}
@@ -0,0 +1,146 @@
+#ifndef BLOCKINGHTTPCLIENT_H
+#define BLOCKINGHTTPCLIENT_H
+
+#include <boost/asio.hpp>
+#include <boost/asio/ssl.hpp>
+#include <boost/beast.hpp>
+#include <boost/beast/ssl.hpp>
+#include <memory>
+#include <string>
+
+/**
+ * A minimal synchronous keep-alive HTTP client, one per load-generating thread.
+ * The connection is (re)opened lazily, so a failed request just drops it.
+ *
+ * With a TLS context, it connects over TLS; with resumeSessions, every new connection offers the
+ * session of the previous one, so the server can skip the full handshake.
+ */
+class BlockingHttpClient
+{
+    struct SessionDeleter
+    {
+        void operator()(SSL_SESSION* session) const { SSL_SESSION_free(session); }
+    };
+
+    using TlsStream = boost::beast::ssl_stream<boost::beast::tcp_stream>;
+
+    boost::asio::io_context                      ioc;
+    boost::asio::ip::tcp::endpoint               endpoint;
+    boost::beast::tcp_stream                     stream;
+    boost::beast::flat_buffer                    buffer;
+    bool                                         connected         = false;
+    boost::asio::ssl::context*                   tls               = nullptr;
+    bool                                         resumeSessions    = false;
+    std::unique_ptr<TlsStream>                   tlsStream;
+    std::unique_ptr<SSL_SESSION, SessionDeleter> session;
+    uint64_t                                     handshakes        = 0;
+    uint64_t                                     resumedHandshakes = 0;
+
+    void connect()
+    {
+        if (!tls) {
+            stream.connect(endpoint);
+            return;
+        }
+        tlsStream.reset(new TlsStream(ioc, *tls));
+        boost::beast::get_lowest_layer(*tlsStream).connect(endpoint);
+        if (session) {
+            SSL_set_session(tlsStream->native_handle(), session.get());
+        }
+        tlsStream->handshake(boost::asio::ssl::stream_base::client);
+        handshakes++;
+        if (SSL_session_reused(tlsStream->native_handle())) {
+            resumedHandshakes++;
+        }
+    }
+
+    template <typename Stream>
+    boost::beast::http::response<boost::beast::http::string_body>
+    exchange(Stream& s, boost::beast::http::request<boost::beast::http::string_body>& req)
+    {
+        boost::beast::http::write(s, req);
+        boost::beast::http::response<boost::beast::http::string_body> res;
+        boost::beast::http::read(s, buffer, res);
+        return res;
+    }
+
+public:
+    BlockingHttpClient(const std::string& address, uint16_t port)
+        : endpoint(boost::asio::ip::make_address(address), port), stream(ioc)
+    {
+    }
+
+    BlockingHttpClient(const std::string&         address,
+                       uint16_t                   port,
+                       boost::asio::ssl::context& Tls,
+                       bool                       ResumeSessions)
+        : endpoint(boost::asio::ip::make_address(address), port), stream(ioc), tls(&Tls),
+          resumeSessions(ResumeSessions)
+    {
+    }
+
+    ~BlockingHttpClient() { close(); }
+
+    void close()
+    {
+        boost::beast::error_code ec;
+        if (tlsStream) {
+            // a session is only resumable after a clean TLS shutdown
+            if (connected) {
+                tlsStream->shutdown(ec);
+            }
+            boost::beast::get_lowest_layer(*tlsStream).socket().close(ec);
+            tlsStream.reset();
+        } else {
+            stream.socket().shutdown(boost::asio::ip::tcp::socket::shutdown_both, ec);
+            stream.socket().close(ec);
+        }
+        buffer.consume(buffer.size());
+        connected = false;
+    }
+
+    /**
+     * Sends the request and waits for the response; throws boost::system::system_error on failure
+     */
+    boost::beast::http::response<boost::beast::http::string_body>
+    send(boost::beast::http::request<boost::beast::http::string_body>& req)
+    {
+        try {
+            if (!connected) {
+                connect();
+                connected = true;
+            }
+            auto res = tlsStream ? exchange(*tlsStream, req) : exchange(stream, req);
+            if (tlsStream && resumeSessions && !session) {
+                // with TLS 1.3, the session tickets arrive after the handshake, with the first response
+                session.reset(SSL_get1_session(tlsStream->native_handle()));
+            }
+            if (res.need_eof()) {
+                close();
+            }
+            return res;
+        } catch (...) {
+            close();
+            throw;
+        }
+    }
+
+    // TLS handshakes done by the client, and how many of them resumed a session
+    uint64_t getHandshakeCount() const { return handshakes; }
+    uint64_t getResumedHandshakeCount() const { return resumedHandshakes; }
+
+    static boost::beast::http::request<boost::beast::http::string_body>
+    MakeJsonRequest(const std::string& host, std::string body, bool keepAlive = true)
+    {
+        boost::beast::http::request<boost::beast::http::string_body> req{
+            boost::beast::http::verb::post, "/", 11};
+        req.set(boost::beast::http::field::host, host);
+        req.set(boost::beast::http::field::content_type, "application/json");
+        req.keep_alive(keepAlive);
+        req.body() = std::move(body);
+        req.prepare_payload();
+        return req;
+    }
+};
+
+#endif // BLOCKINGHTTPCLIENT_H
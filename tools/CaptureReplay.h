@@ -0,0 +1,90 @@
+#ifndef CAPTUREREPLAY_H
+#define CAPTUREREPLAY_H
+
+#include "BlockingHttpClient.h"
+#include "Capture/TrafficCapture.h"
+#include "LoadReport.h"
+#include "StubUpstream.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+struct ReplayOptions
+{
+    // the original spacing of the requests is divided by this; 0 sends them as fast as possible
+    double   speed       = 1.;
+    uint32_t concurrency = 8;
+    /**
+     * Ask the stub upstream (see StartStubUpstream) to wait the recorded latency of each request; that
+     * latency is the whole time the relay took, its own share included, so the emulated upstream is
+     * slightly slower than the real one was
+     */
+    bool emulateLatency = false;
+};
+
+/**
+ * Sends the captured requests, in the order of their arrival, to the relay at address:port over
+ * options.concurrency keep-alive connections, and records their latencies in the report.
+ *
+ * At a given speed, the latency of a request counts from the time it was scheduled to be sent, not
+ * from the time a connection got free to send it: a relay that falls behind delays the requests queued
+ * after the slow ones, and that wait is part of what their clients would see (measuring from the send
+ * time hides it, which is known as coordinated omission).
+ */
+inline void ReplayCapture(std::vector<CaptureRecord> records,
+                          const std::string&         address,
+                          uint16_t                   port,
+                          const ReplayOptions&       options,
+                          LoadReport&                report)
+{
+    std::sort(records.begin(), records.end(), [](const CaptureRecord& a, const CaptureRecord& b) {
+        return a.arrivalNs < b.arrivalNs;
+    });
+    if (records.empty()) {
+        return;
+    }
+
+    std::atomic<size_t> nextRecord{0};
+    const uint64_t      firstArrivalNs = records.front().arrivalNs;
+    const auto          start          = std::chrono::steady_clock::now();
+
+    std::vector<std::thread> workers;
+    for (uint32_t i = 0; i < std::max<uint32_t>(1, options.concurrency); i++) {
+        workers.emplace_back([&] {
+            BlockingHttpClient    client(address, port);
+            std::vector<uint64_t> latencies;
+            uint64_t              failures = 0;
+            for (size_t idx = nextRecord++; idx < records.size(); idx = nextRecord++) {
+                const CaptureRecord& r         = records[idx];
+                auto                 scheduled = std::chrono::steady_clock::now();
+                if (options.speed > 0) {
+                    scheduled = start + std::chrono::nanoseconds(static_cast<uint64_t>(
+                                            static_cast<double>(r.arrivalNs - firstArrivalNs) /
+                                            options.speed));
+                    std::this_thread::sleep_until(scheduled);
+                }
+                auto req = BlockingHttpClient::MakeJsonRequest(address, r.body);
+                if (options.emulateLatency) {
+                    req.set(REPLAY_LATENCY_HEADER, std::to_string(r.latencyNs / 1000));
+                }
+                try {
+                    client.send(req);
+                    latencies.push_back(static_cast<uint64_t>(
+                        std::chrono::duration_cast<std::chrono::nanoseconds>(
+                            std::chrono::steady_clock::now() - scheduled)
+                            .count()));
+                } catch (std::exception&) {
+                    failures++;
+                }
+            }
+            report.merge(latencies, failures);
+        });
+    }
+    for (std::thread& t : workers) {
+        t.join();
+    }
+}
+
+#endif // CAPTUREREPLAY_H
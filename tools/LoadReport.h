@@ -0,0 +1,61 @@
+#ifndef LOADREPORT_H
+#define LOADREPORT_H
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <iomanip>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <vector>
+
+/**
+ * Collects request latencies from many load-generating threads and prints throughput and
+ * percentiles. Every thread records into its own vector and merges once when it's done.
+ */
+class LoadReport
+{
+    std::mutex            mtx;
+    std::vector<uint64_t> latenciesNs;
+    uint64_t              failures = 0;
+
+public:
+    void merge(const std::vector<uint64_t>& threadLatenciesNs, uint64_t threadFailures)
+    {
+        std::lock_guard<std::mutex> lg(mtx);
+        latenciesNs.insert(latenciesNs.end(), threadLatenciesNs.cbegin(), threadLatenciesNs.cend());
+        failures += threadFailures;
+    }
+
+    static uint64_t Percentile(const std::vector<uint64_t>& sorted, double p)
+    {
+        if (sorted.empty()) {
+            return 0;
+        }
+        std::size_t idx = static_cast<std::size_t>(p * static_cast<double>(sorted.size() - 1) + 0.5);
+        return sorted[std::min(idx, sorted.size() - 1)];
+    }
+
+    void print(const std::string& title, std::chrono::nanoseconds wallTime, std::ostream& os = std::cout)
+    {
+        std::lock_guard<std::mutex> lg(mtx);
+        std::sort(latenciesNs.begin(), latenciesNs.end());
+
+        const double seconds = std::chrono::duration<double>(wallTime).count();
+        const auto   us      = [](uint64_t ns) { return static_cast<double>(ns) / 1000.; };
+
+        os << std::fixed << std::setprecision(1);
+        os << "== " << title << std::endl;
+        os << "requests:   " << latenciesNs.size() << " ok, " << failures << " failed" << std::endl;
+        os << "wall time:  " << seconds << " s" << std::endl;
+        os << "throughput: " << (seconds > 0 ? static_cast<double>(latenciesNs.size()) / seconds : 0.)
+           << " req/s" << std::endl;
+        os << "latency us: p50 " << us(Percentile(latenciesNs, 0.50)) << ", p90 "
+           << us(Percentile(latenciesNs, 0.90)) << ", p99 " << us(Percentile(latenciesNs, 0.99))
+           << ", p99.9 " << us(Percentile(latenciesNs, 0.999)) << ", max "
+           << us(latenciesNs.empty() ? 0 : latenciesNs.back()) << std::endl;
+    }
+};
+
+#endif // LOADREPORT_H
@@ -0,0 +1,44 @@
+#ifndef STUBUPSTREAM_H
+#define STUBUPSTREAM_H
+
+#include "Server/EasyServer.h"
+#include <chrono>
+#include <memory>
+#include <string>
+#include <thread>
+
+// a request header with the latency, in microseconds, that the stub waits before it answers
+static const char* REPLAY_LATENCY_HEADER = "X-Replay-Latency-Us";
+
+/**
+ * A local upstream that answers every request with the same json body, for the tools and tests that
+ * measure the relay alone. With emulateLatency, it waits the REPLAY_LATENCY_HEADER of each request,
+ * blocking the thread that handles it.
+ */
+inline std::unique_ptr<EasyServer> StartStubUpstream(uint16_t           port,
+                                                     uint32_t           threads,
+                                                     const std::string& body,
+                                                     bool               emulateLatency = false)
+{
+    std::unique_ptr<EasyServer> stub(new EasyServer("127.0.0.1", port, threads));
+    stub->setRequestResponseFunctor([body, emulateLatency](const RequestType& req) -> ResponseType {
+        if (emulateLatency) {
+            auto it = req.find(REPLAY_LATENCY_HEADER);
+            if (it != req.end()) {
+                std::this_thread::sleep_for(
+                    std::chrono::microseconds(std::stoull(it->value().to_string())));
+            }
+        }
+        ResponseType res{boost::beast::http::status::ok, req.version()};
+        res.set(boost::beast::http::field::server, BOOST_BEAST_VERSION_STRING);
+        res.set(boost::beast::http::field::content_type, "application/json");
+        res.keep_alive(req.keep_alive());
+        res.body() = body;
+        res.prepare_payload();
+        return res;
+    });
+    stub->run();
+    return stub;
+}
+
+#endif // STUBUPSTREAM_H
@@ -0,0 +1,439 @@
+#ifndef UPSTREAMSIMULATOR_H
+#define UPSTREAMSIMULATOR_H
+
+#include "Filters/JsonRpcScanner.h"
+#include <atomic>
+#include <boost/algorithm/string.hpp>
+#include <boost/asio.hpp>
+#include <boost/beast.hpp>
+#include <chrono>
+#include <cmath>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+/**
+ * How long a simulated call takes:
+ * - fixed:<ms>
+ * - lognormal:<median_ms>:<sigma>, a long tail that grows with sigma (0.5 is moderate, 1.5 is heavy)
+ * - bimodal:<fast_ms>:<slow_ms>:<slow_fraction>, e.g., cache hits and misses
+ */
+struct LatencyDistribution
+{
+    enum class Kind
+    {
+        Fixed,
+        LogNormal,
+        Bimodal
+    };
+
+    Kind   kind         = Kind::Fixed;
+    double milliseconds = 0; // the fixed value, the median, or the fast mode
+    double sigma        = 0;
+    double slowMs       = 0;
+    double slowFraction = 0;
+
+    // throws std::runtime_error on invalid input
+    static LatencyDistribution Parse(const std::string& text)
+    {
+        std::vector<std::string> fields;
+        boost::split(fields, text, boost::is_any_of(":"));
+        LatencyDistribution d;
+        try {
+            if (fields[0] == "fixed" && fields.size() == 2) {
+                d.milliseconds = std::stod(fields[1]);
+            } else if (fields[0] == "lognormal" && fields.size() == 3) {
+                d.kind         = Kind::LogNormal;
+                d.milliseconds = std::stod(fields[1]);
+                d.sigma        = std::stod(fields[2]);
+            } else if (fields[0] == "bimodal" && fields.size() == 4) {
+                d.kind         = Kind::Bimodal;
+                d.milliseconds = std::stod(fields[1]);
+                d.slowMs       = std::stod(fields[2]);
+                d.slowFraction = std::stod(fields[3]);
+            } else {
+                throw std::invalid_argument(text);
+            }
+        } catch (std::logic_error&) {
+            throw std::runtime_error("Invalid latency distribution (expected fixed:<ms>, "
+                                     "lognormal:<median_ms>:<sigma> or "
+                                     "bimodal:<fast_ms>:<slow_ms>:<slow_fraction>): " +
+                                     text);
+        }
+        if (d.milliseconds < 0 || d.sigma < 0 || d.slowMs < 0 || d.slowFraction < 0 ||
+            d.slowFraction > 1) {
+            throw std::runtime_error("Invalid latency distribution: " + text);
+        }
+        return d;
+    }
+
+    std::chrono::microseconds sample(std::mt19937_64& rng) const
+    {
+        double ms = milliseconds;
+        switch (kind) {
+        case Kind::Fixed:
+            break;
+        case Kind::LogNormal:
+            ms = std::lognormal_distribution<double>(std::log(std::max(milliseconds, 1e-3)),
+                                                     sigma)(rng);
+            break;
+        case Kind::Bimodal:
+            ms = std::uniform_real_distribution<double>(0, 1)(rng) < slowFraction ? slowMs
+                                                                                 : milliseconds;
+            break;
+        }
+        return std::chrono::microseconds(static_cast<int64_t>(ms * 1000));
+    }
+};
+
+/**
+ * The behaviour of one method: <latency>[,size=<bytes>][,error=<rate>][,drop=<rate>], e.g.,
+ * lognormal:20:0.8,size=200000,error=0.01
+ */
+struct MethodProfile
+{
+    LatencyDistribution latency;
+    // the size of the result string
+    std::size_t responseBytes = 16;
+    // calls answered with a json-rpc error (and http status 500, like bitcoind)
+    double errorRate = 0;
+    // calls whose connection is closed without a response
+    double dropRate = 0;
+
+    static MethodProfile Parse(const std::string& text)
+    {
+        std::vector<std::string> fields;
+        boost::split(fields, text, boost::is_any_of(","));
+        MethodProfile p;
+        p.latency = LatencyDistribution::Parse(fields[0]);
+        for (std::size_t i = 1; i < fields.size(); i++) {
+            const std::size_t eq    = fields[i].find('=');
+            const std::string key   = fields[i].substr(0, eq);
+            const std::string value = eq == std::string::npos ? std::string() : fields[i].substr(eq + 1);
+            try {
+                if (key == "size") {
+                    p.responseBytes = static_cast<std::size_t>(std::stoull(value));
+                } else if (key == "error") {
+                    p.errorRate = std::stod(value);
+                } else if (key == "drop") {
+                    p.dropRate = std::stod(value);
+                } else {
+                    throw std::invalid_argument(key);
+                }
+            } catch (std::logic_error&) {
+                throw std::runtime_error(
+                    "Invalid method profile field (expected size=, error= or drop=): " + fields[i]);
+            }
+        }
+        return p;
+    }
+};
+
+struct SimulatorOptions
+{
+    // profiles by method; other methods (and calls that aren't json-rpc) get defaultProfile
+    std::map<std::string, MethodProfile> methods;
+    MethodProfile                        defaultProfile;
+
+    // calls processed at once, like the rpc threads of a node
+    uint32_t workers = 4;
+    // calls waiting for a worker, like the rpc work queue of a node; beyond this, calls get 503
+    std::size_t queueDepth = 16;
+
+    // false closes every connection after its response
+    bool keepAlive = true;
+    // responses per connection before it's closed; 0 is unlimited
+    uint32_t maxRequestsPerConnection = 0;
+    // keep-alive connections without a request for this long are closed
+    std::chrono::milliseconds idleTimeout{30000};
+
+    // of the random choices, which are made in the order the calls arrive
+    uint64_t seed = 1;
+};
+
+/**
+ * A stub json-rpc upstream that behaves like a loaded node: every call takes a worker for a latency
+ * drawn from the distribution of its method, waits in a bounded work queue while all workers are
+ * busy, and may fail or lose its connection at the configured rates. Batches take one worker for the
+ * sum of the latencies of their calls. Workers are timers, so a few threads simulate any number of
+ * them.
+ *
+ * It has its own minimal http session rather than a RelaySession, which can't drop a connection
+ * without answering.
+ */
+class UpstreamSimulator
+{
+public:
+    struct Stats
+    {
+        uint64_t calls    = 0;
+        uint64_t rejected = 0; // work queue full
+        uint64_t errors   = 0;
+        uint64_t drops    = 0;
+        uint64_t maxQueue = 0;
+    };
+
+private:
+    using Request  = boost::beast::http::request<boost::beast::http::string_body>;
+    using Response = boost::beast::http::response<boost::beast::http::string_body>;
+    // called on the session's strand with the response, or with nullptr to drop the connection
+    using Reply = std::function<void(std::shared_ptr<Response>)>;
+
+    class Session : public std::enable_shared_from_this<Session>
+    {
+        UpstreamSimulator&        sim;
+        boost::beast::tcp_stream  stream;
+        boost::beast::flat_buffer buffer;
+        Request                   req;
+        std::shared_ptr<Response> res;
+        uint32_t                  served = 0;
+
+        void doRead()
+        {
+            req = {};
+            stream.expires_after(sim.options.idleTimeout);
+            boost::beast::http::async_read(
+                stream,
+                buffer,
+                req,
+                boost::beast::bind_front_handler(&Session::onRead, shared_from_this()));
+        }
+
+        void onRead(boost::beast::error_code ec, std::size_t)
+        {
+            if (ec) {
+                return close();
+            }
+            stream.expires_never();
+            auto self = shared_from_this();
+            sim.handle(req, stream.get_executor(), [self](std::shared_ptr<Response> response) {
+                if (!response) {
+                    return self->close();
+                }
+                self->served++;
+                const bool keep = self->sim.options.keepAlive && self->req.keep_alive() &&
+                                  (self->sim.options.maxRequestsPerConnection == 0 ||
+                                   self->served < self->sim.options.maxRequestsPerConnection);
+                response->keep_alive(keep);
+                response->prepare_payload();
+                self->res = std::move(response);
+                boost::beast::http::async_write(
+                    self->stream, *self->res, [self, keep](boost::beast::error_code ec, std::size_t) {
+                        if (ec || !keep) {
+                            return self->close();
+                        }
+                        self->doRead();
+                    });
+            });
+        }
+
+        void close()
+        {
+            boost::beast::error_code ec;
+            stream.socket().shutdown(boost::asio::ip::tcp::socket::shutdown_both, ec);
+            stream.socket().close(ec);
+        }
+
+    public:
+        Session(UpstreamSimulator& Sim, boost::asio::ip::tcp::socket&& socket)
+            : sim(Sim), stream(std::move(socket))
+        {
+        }
+
+        void run()
+        {
+            boost::asio::dispatch(
+                stream.get_executor(),
+                boost::beast::bind_front_handler(&Session::doRead, shared_from_this()));
+        }
+    };
+
+    const SimulatorOptions         options;
+    boost::asio::io_context        ioc;
+    boost::asio::ip::tcp::acceptor acceptor;
+    std::vector<std::thread>       threads;
+
+    std::mutex                        mutex;
+    std::mt19937_64                   rng;
+    uint32_t                          busy = 0;
+    std::deque<std::function<void()>> queue;
+    Stats                             stats;
+
+    void doAccept()
+    {
+        acceptor.async_accept(boost::asio::make_strand(ioc),
+                              [this](boost::beast::error_code ec, boost::asio::ip::tcp::socket socket) {
+                                  if (ec) {
+                                      return; // stopped
+                                  }
+                                  std::make_shared<Session>(*this, std::move(socket))->run();
+                                  doAccept();
+                              });
+    }
+
+    const MethodProfile& profileOf(const std::string& method) const
+    {
+        auto it = options.methods.find(method);
+        return it == options.methods.cend() ? options.defaultProfile : it->second;
+    }
+
+    // the response of one call (or of a body that isn't a call), drawn with the lock held
+    std::string simulateCall(boost::string_view         body,
+                             std::chrono::microseconds& latency,
+                             bool&                      failed,
+                             bool&                      dropped)
+    {
+        JsonRpcCall call;
+        const bool  valid   = JsonRpcScanner::Scan(body, nullptr, call);
+        const auto& profile = profileOf(valid ? call.method : std::string());
+        const auto  id =
+            valid && !call.id.empty() ? body.substr(call.id.offset, call.id.size).to_string() : "null";
+
+        std::uniform_real_distribution<double> uniform(0, 1);
+        latency += profile.latency.sample(rng);
+        if (uniform(rng) < profile.dropRate) {
+            dropped = true;
+        }
+        if (uniform(rng) < profile.errorRate) {
+            failed = true;
+            return R"({"result":null,"error":{"code":-32603,"message":"Simulated error"},"id":)" + id +
+                   "}";
+        }
+        return R"({"result":")" + std::string(profile.responseBytes, 'x') + R"(","error":null,"id":)" +
+               id + "}";
+    }
+
+    template <typename Executor>
+    void handle(const Request& req, const Executor& executor, Reply reply)
+    {
+        std::chrono::microseconds latency(0);
+        bool                      failed  = false;
+        bool                      dropped = false;
+        std::string               body;
+
+        std::function<void()> job;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            std::vector<JsonSpan>       elements;
+            if (JsonRpcScanner::SplitArray(req.body(), elements)) {
+                body = "[";
+                for (const JsonSpan& e : elements) {
+                    body += (body.size() > 1 ? "," : "") +
+                            simulateCall(boost::string_view(req.body()).substr(e.offset, e.size),
+                                         latency,
+                                         failed,
+                                         dropped);
+                }
+                body += "]";
+            } else {
+                body = simulateCall(req.body(), latency, failed, dropped);
+            }
+            stats.calls++;
+
+            auto response =
+                std::make_shared<Response>(failed ? boost::beast::http::status::internal_server_error
+                                                  : boost::beast::http::status::ok,
+                                           req.version());
+            response->set(boost::beast::http::field::content_type, "application/json");
+            response->body() = std::move(body);
+            if (dropped) {
+                response = nullptr;
+            }
+
+            // the call holds a worker for its latency, then hands it to the next queued call
+            job = [this, executor, latency, response, reply]() {
+                auto timer = std::make_shared<boost::asio::steady_timer>(executor, latency);
+                timer->async_wait([this, timer, response, reply](boost::beast::error_code) {
+                    reply(response);
+                    finishJob();
+                });
+            };
+            if (busy >= options.workers) {
+                if (queue.size() >= options.queueDepth) {
+                    stats.rejected++;
+                    job = nullptr;
+                } else {
+                    stats.errors += failed && !dropped ? 1 : 0;
+                    stats.drops += dropped ? 1 : 0;
+                    queue.push_back(std::move(job));
+                    stats.maxQueue = std::max<uint64_t>(stats.maxQueue, queue.size());
+                    return;
+                }
+            } else {
+                busy++;
+            }
+            if (job) {
+                stats.errors += failed && !dropped ? 1 : 0;
+                stats.drops += dropped ? 1 : 0;
+            }
+        }
+        if (job) {
+            return job();
+        }
+        auto response = std::make_shared<Response>(boost::beast::http::status::service_unavailable,
+                                                   req.version());
+        response->set(boost::beast::http::field::content_type, "text/plain");
+        response->body() = "Work queue depth exceeded";
+        boost::asio::dispatch(executor, [reply, response]() { reply(response); });
+    }
+
+    void finishJob()
+    {
+        std::function<void()> next;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (queue.empty()) {
+                busy--;
+                return;
+            }
+            next = std::move(queue.front());
+            queue.pop_front();
+        }
+        next();
+    }
+
+public:
+    UpstreamSimulator(const std::string& address, uint16_t port, SimulatorOptions Options)
+        : options(std::move(Options)),
+          acceptor(ioc, boost::asio::ip::tcp::endpoint(boost::asio::ip::make_address(address), port)),
+          rng(options.seed)
+    {
+    }
+
+    ~UpstreamSimulator() { stop(); }
+
+    UpstreamSimulator(const UpstreamSimulator&) = delete;
+    UpstreamSimulator& operator=(const UpstreamSimulator&) = delete;
+
+    void run(uint32_t threadCount = 1)
+    {
+        doAccept();
+        for (uint32_t i = 0; i < std::max<uint32_t>(threadCount, 1); i++) {
+            threads.emplace_back([this] { ioc.run(); });
+        }
+    }
+
+    void stop()
+    {
+        ioc.stop();
+        for (std::thread& t : threads) {
+            t.join();
+        }
+        threads.clear();
+    }
+
+    Stats getStats()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        return stats;
+    }
+};
+
+#endif // UPSTREAMSIMULATOR_H
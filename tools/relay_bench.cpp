@@ -0,0 +1,471 @@
+/**
+ * relay_bench: end-to-end benchmarks of the relay, with an in-process stub upstream and load generator
+ *
+ * Scenarios (--scenario):
+ * - execution_model: the same closed-loop load against a relay with separate server/client thread
+ *   pools, and against a relay with a single unified pool; reports latency, throughput, the number of
+ *   threads and the context switches per request of the whole process.
+ * - connection_churn: one request per connection, against a server with a type-erased handler
+ *   (RelayServer), a server with a concrete handler type (BasicRelayServer), both answering locally,
+ *   and against the full relay; measures the cost of setting up sessions.
+ * - filter: the cost per request of checking a call in one pass with params rules, compared with
+ *   parsing it into a json DOM.
+ * - tls: keep-alive latency of plain http and of TLS, and handshake throughput with one request per
+ *   TLS connection, with full handshakes and with resumed sessions; the certificate is generated
+ *   locally.
+ * - keep_alive: the relay opening a connection to the upstream per request, and reusing pooled
+ *   keep-alive connections (--upstream_connections); the load comes from a single thread that keeps
+ *   --concurrency requests in flight with an AsyncClient, and, for comparison, from one blocking
+ *   client thread per connection.
+ */
+
+#include "BlockingHttpClient.h"
+#include "Client/AsyncClient.h"
+#include "LoadReport.h"
+#include "Logging/DefaultLogger.h"
+#include "Relay/JsonRpcRelay.h"
+#include "Filters/JsonRpcScanner.h"
+#include "Server/EasyServer.h"
+#include "Server/TlsContext.h"
+#include "StubUpstream.h"
+#include "spdlog/sinks/stdout_color_sinks.h"
+#include <atomic>
+#include <boost/program_options.hpp>
+#include <cstdlib>
+#include <fstream>
+#include <jsoncpp/json/json.h>
+#include <sys/resource.h>
+#include <thread>
+#include <vector>
+
+struct BenchOptions
+{
+    uint32_t requests;
+    uint32_t concurrency;
+    uint32_t threads;
+    uint16_t basePort;
+};
+
+static const std::string BENCH_BODY =
+    R"({"jsonrpc": "2.0", "method": "getblockcount", "params": [], "id": 1})";
+
+static const std::string STUB_RESPONSE = R"({"result":800000,"error":null,"id":1})";
+
+uint64_t ContextSwitches()
+{
+    rusage usage{};
+    getrusage(RUSAGE_SELF, &usage);
+    return static_cast<uint64_t>(usage.ru_nvcsw + usage.ru_nivcsw);
+}
+
+uint32_t ProcessThreadCount()
+{
+    std::ifstream status("/proc/self/status");
+    std::string   line;
+    while (std::getline(status, line)) {
+        if (line.compare(0, 8, "Threads:") == 0) {
+            return static_cast<uint32_t>(std::stoul(line.substr(8)));
+        }
+    }
+    return 0;
+}
+
+/**
+ * Closed-loop load: every connection sends its next request as soon as it gets the previous response.
+ * With a TLS context, the clients connect over TLS (and offer their last session if resumeSessions).
+ */
+void RunClosedLoop(const std::string&         title,
+                   uint16_t                   port,
+                   const BenchOptions&        options,
+                   bool                       keepAlive      = true,
+                   boost::asio::ssl::context* tls            = nullptr,
+                   bool                       resumeSessions = false)
+{
+    LoadReport            report;
+    std::atomic<int64_t>  remaining{options.requests};
+    std::atomic<uint32_t> threadsDuring{0};
+    std::atomic<uint64_t> handshakes{0};
+    std::atomic<uint64_t> resumedHandshakes{0};
+    const uint64_t        switchesBefore = ContextSwitches();
+    const auto            start          = std::chrono::steady_clock::now();
+
+    std::vector<std::thread> workers;
+    for (uint32_t i = 0; i < options.concurrency; i++) {
+        workers.emplace_back([&] {
+            std::unique_ptr<BlockingHttpClient> connection(
+                tls ? new BlockingHttpClient("127.0.0.1", port, *tls, resumeSessions)
+                    : new BlockingHttpClient("127.0.0.1", port));
+            BlockingHttpClient&   client = *connection;
+            std::vector<uint64_t> latencies;
+            uint64_t              failures = 0;
+            auto req = BlockingHttpClient::MakeJsonRequest("127.0.0.1", BENCH_BODY, keepAlive);
+            while (remaining-- > 0) {
+                const auto sent = std::chrono::steady_clock::now();
+                try {
+                    auto res = client.send(req);
+                    if (res.result() != boost::beast::http::status::ok) {
+                        failures++;
+                        continue;
+                    }
+                    latencies.push_back(static_cast<uint64_t>(
+                        std::chrono::duration_cast<std::chrono::nanoseconds>(
+                            std::chrono::steady_clock::now() - sent)
+                            .count()));
+                } catch (std::exception&) {
+                    failures++;
+                }
+                if (latencies.size() == 100) {
+                    // all threads are up by now
+                    threadsDuring.store(ProcessThreadCount());
+                }
+            }
+            report.merge(latencies, failures);
+            handshakes += client.getHandshakeCount();
+            resumedHandshakes += client.getResumedHandshakeCount();
+        });
+    }
+    for (std::thread& t : workers) {
+        t.join();
+    }
+
+    const auto     wall     = std::chrono::steady_clock::now() - start;
+    const uint64_t switches = ContextSwitches() - switchesBefore;
+
+    report.print(title, wall);
+    std::cout << "process threads: " << threadsDuring.load() << " (" << options.concurrency
+              << " of them generate load)" << std::endl;
+    const double perRequest =
+        static_cast<double>(switches) / static_cast<double>(std::max<uint32_t>(1, options.requests));
+    std::cout << "context switches: " << switches << " (" << perRequest << " per request, whole process)"
+              << std::endl;
+    if (tls) {
+        const double seconds = std::chrono::duration<double>(wall).count();
+        std::cout << "TLS handshakes: " << handshakes.load() << " (" << resumedHandshakes.load()
+                  << " resumed), " << static_cast<double>(handshakes.load()) / seconds << " per second"
+                  << std::endl;
+    }
+    std::cout << std::endl;
+}
+
+/**
+ * Closed-loop load from a single thread: an AsyncClient keeps `concurrency` requests in flight over as
+ * many keep-alive connections
+ */
+void RunAsyncClosedLoop(const std::string& title, uint16_t port, const BenchOptions& options)
+{
+    net::io_context    ioc(1);
+    AsyncClientOptions clientOptions;
+    clientOptions.maxConnections = options.concurrency;
+    auto client = std::make_shared<AsyncClient>(ioc, "127.0.0.1", std::to_string(port), clientOptions);
+
+    // everything runs on this thread, in ioc.run()
+    LoadReport            report;
+    std::vector<uint64_t> latencies;
+    uint64_t              failures  = 0;
+    int64_t               remaining = options.requests;
+    const auto            req       = BlockingHttpClient::MakeJsonRequest("127.0.0.1", BENCH_BODY);
+
+    std::function<void()> sendNext = [&]() {
+        if (remaining-- <= 0) {
+            return;
+        }
+        const auto sent = std::chrono::steady_clock::now();
+        client->send(req, [&, sent](boost::beast::error_code ec, AsyncClient::Response&& res) {
+            if (ec || res.result() != boost::beast::http::status::ok) {
+                failures++;
+            } else {
+                latencies.push_back(static_cast<uint64_t>(
+                    std::chrono::duration_cast<std::chrono::nanoseconds>(
+                        std::chrono::steady_clock::now() - sent)
+                        .count()));
+            }
+            sendNext();
+        });
+    };
+
+    const uint64_t switchesBefore = ContextSwitches();
+    const auto     start          = std::chrono::steady_clock::now();
+    for (uint32_t i = 0; i < options.concurrency; i++) {
+        sendNext();
+    }
+    ioc.run();
+    const auto wall = std::chrono::steady_clock::now() - start;
+    client->stop();
+
+    report.merge(latencies, failures);
+    report.print(title, wall);
+    std::cout << "client connections opened: " << client->getConnectionsOpened() << std::endl;
+    const double perRequest = static_cast<double>(ContextSwitches() - switchesBefore) /
+                              static_cast<double>(std::max<uint32_t>(1, options.requests));
+    std::cout << "context switches: " << perRequest << " per request, whole process" << std::endl
+              << std::endl;
+}
+
+void BenchExecutionModel(const BenchOptions& options)
+{
+    const uint16_t stubPort = options.basePort;
+    auto stub = StartStubUpstream(stubPort, std::max<uint32_t>(1, options.threads), STUB_RESPONSE);
+
+    const std::pair<RelayExecutionModel, const char*> models[] = {
+        {RelayExecutionModel::SeparatePools, "separate server/client pools"},
+        {RelayExecutionModel::Unified, "unified pool"}};
+
+    uint16_t relayPort = stubPort + 1;
+    for (const auto& m : models) {
+        JsonRPCFilter filter;
+        filter.addAllowedMethod("getblockcount");
+        JsonRpcRelay relay(
+            std::move(filter), "127.0.0.1", relayPort, "127.0.0.1", stubPort, options.threads, m.first);
+        const std::string title = std::string("execution model: ") + m.second + ", " +
+                                  std::to_string(options.threads) + " threads per pool";
+        RunClosedLoop(title, relayPort, options);
+        relay.stop();
+        relayPort++;
+    }
+}
+
+ResponseType MakeLocalResponse(const RequestType& req)
+{
+    ResponseType res{boost::beast::http::status::ok, req.version()};
+    res.set(boost::beast::http::field::content_type, "application/json");
+    res.keep_alive(req.keep_alive());
+    res.body() = R"({"result":800000,"error":null,"id":1})";
+    res.prepare_payload();
+    return res;
+}
+
+// answers locally, as a concrete handler type
+struct LocalHandler
+{
+    void operator()(const RequestType& req, const SessionExecutor&, ResponseCallback done) const
+    {
+        done(MakeLocalResponse(req));
+    }
+};
+
+// runs a server on its own io_context and threads for the lifetime of the object
+template <typename Server>
+class ServerRunner
+{
+    net::io_context          ioc;
+    std::shared_ptr<Server>  server;
+    std::vector<std::thread> threads;
+
+    static net::ip::tcp::endpoint LocalEndpoint(uint16_t port)
+    {
+        return net::ip::tcp::endpoint{net::ip::make_address("127.0.0.1"), port};
+    }
+
+public:
+    template <typename... Args>
+    ServerRunner(uint16_t port, uint32_t threadCount, Args&&... args)
+        : ioc(static_cast<int>(threadCount)),
+          server(std::make_shared<Server>(ioc, LocalEndpoint(port), std::forward<Args>(args)...))
+    {
+    }
+
+    Server& get() { return *server; }
+
+    void run(uint32_t threadCount)
+    {
+        server->run();
+        for (uint32_t i = 0; i < threadCount; i++) {
+            threads.emplace_back([this] { ioc.run(); });
+        }
+    }
+
+    ~ServerRunner()
+    {
+        ioc.stop();
+        for (std::thread& t : threads) {
+            t.join();
+        }
+    }
+};
+
+void BenchConnectionChurn(const BenchOptions& options)
+{
+    const std::string suffix =
+        ", " + std::to_string(options.threads) + " threads, one request per connection";
+    uint16_t port = options.basePort;
+
+    {
+        ServerRunner<RelayServer> erased(port, options.threads);
+        erased.get().setRequestPassingFunctor(MakeLocalResponse);
+        erased.run(options.threads);
+        RunClosedLoop(
+            "connection churn: type-erased handler (RelayServer)" + suffix, port, options, false);
+    }
+    port++;
+
+    {
+        ServerRunner<BasicRelayServer<LocalHandler>> typed(
+            port, options.threads, std::make_shared<const LocalHandler>());
+        typed.run(options.threads);
+        RunClosedLoop("connection churn: concrete handler (BasicRelayServer<LocalHandler>)" + suffix,
+                      port,
+                      options,
+                      false);
+    }
+    port++;
+
+    const uint16_t stubPort = port++;
+    auto           stub     = StartStubUpstream(stubPort, options.threads, STUB_RESPONSE);
+    JsonRPCFilter  filter;
+    filter.addAllowedMethod("getblockcount");
+    JsonRpcRelay relay(std::move(filter), "127.0.0.1", port, "127.0.0.1", stubPort, options.threads);
+    RunClosedLoop("connection churn: relay to a stub upstream" + suffix, port, options, false);
+    relay.stop();
+}
+
+void BenchTls(const BenchOptions& options)
+{
+    const TlsCredentials credentials = MakeSelfSignedCredentials("127.0.0.1");
+    TlsOptions           tlsOptions;
+    tlsOptions.certificateChain = credentials.certificateChain;
+    tlsOptions.privateKey       = credentials.privateKey;
+    const std::shared_ptr<boost::asio::ssl::context> serverTls = MakeTlsServerContext(tlsOptions);
+
+    // the certificate is self-signed, so the clients don't verify it
+    boost::asio::ssl::context clientTls(boost::asio::ssl::context::tls_client);
+    clientTls.set_verify_mode(boost::asio::ssl::verify_none);
+
+    const std::string suffix = ", " + std::to_string(options.threads) + " threads";
+    uint16_t          port   = options.basePort;
+
+    {
+        ServerRunner<BasicRelayServer<LocalHandler>> plain(
+            port, options.threads, std::make_shared<const LocalHandler>());
+        plain.run(options.threads);
+        RunClosedLoop("tls: plain http, keep-alive" + suffix, port, options);
+    }
+    port++;
+
+    ServerRunner<BasicRelayServer<LocalHandler>> secure(
+        port, options.threads, std::make_shared<const LocalHandler>());
+    secure.get().setTlsContext(serverTls);
+    secure.run(options.threads);
+    RunClosedLoop("tls: keep-alive" + suffix, port, options, true, &clientTls);
+    RunClosedLoop(
+        "tls: full handshake per request" + suffix, port, options, false, &clientTls, false);
+    RunClosedLoop(
+        "tls: resumed session per request" + suffix, port, options, false, &clientTls, true);
+}
+
+void BenchKeepAlive(const BenchOptions& options)
+{
+    const uint16_t    stubPort = options.basePort;
+    auto              stub     = StartStubUpstream(stubPort, options.threads, STUB_RESPONSE);
+    const std::string suffix   = ", " + std::to_string(options.threads) + " threads, " +
+                               std::to_string(options.concurrency) + " requests in flight";
+
+    uint16_t relayPort = stubPort + 1;
+    for (const bool keepAlive : {false, true}) {
+        JsonRPCFilter filter;
+        filter.addAllowedMethod("getblockcount");
+        JsonRpcRelay relay(
+            std::move(filter), "127.0.0.1", relayPort, "127.0.0.1", stubPort, options.threads);
+        if (keepAlive) {
+            AsyncClientOptions upstreamOptions;
+            upstreamOptions.maxConnections = options.concurrency;
+            relay.enableUpstreamKeepAlive(upstreamOptions);
+        }
+        const std::string upstream =
+            keepAlive ? "keep-alive upstream connections" : "a new upstream connection per request";
+        RunAsyncClosedLoop("keep alive: " + upstream + ", load from one AsyncClient thread" + suffix,
+                           relayPort,
+                           options);
+        RunClosedLoop("keep alive: " + upstream + ", load from blocking client threads" + suffix,
+                      relayPort,
+                      options);
+        relay.stop();
+        relayPort++;
+    }
+}
+
+template <typename Func>
+void TimePerCall(const std::string& title, uint32_t iterations, Func&& func)
+{
+    uint64_t   passed = 0;
+    const auto start  = std::chrono::steady_clock::now();
+    for (uint32_t i = 0; i < iterations; i++) {
+        passed += func() ? 1 : 0;
+    }
+    const auto elapsed = std::chrono::steady_clock::now() - start;
+    const auto ns      = std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count();
+    std::cout << title << ": " << static_cast<double>(ns) / std::max<uint32_t>(1, iterations)
+              << " ns per call (" << passed << " of " << iterations << " passed)" << std::endl;
+}
+
+void BenchFilter(const BenchOptions& options)
+{
+    const ParamsRuleSet rules = ParamsRuleSet::Compile("getblock(str [0-9a-fA-F] len 64, int 0..1?)");
+    const std::string   prefix =
+        R"({"jsonrpc": "2.0", "method": "getblock", "params": [")" + std::string(64, 'f');
+    const std::string allowed = prefix + R"(", 1], "id": 1})";
+    const std::string heavy   = prefix + R"(", 2], "id": 1})";
+
+    for (const std::string* body : {&allowed, &heavy}) {
+        const std::string kind = body == &allowed ? "allowed call" : "rejected heavy call";
+        TimePerCall("json DOM parse, " + kind, options.requests, [body]() {
+            Json::Reader reader;
+            Json::Value  root;
+            return reader.parse(*body, root, false) && root["params"][1].asInt() <= 1;
+        });
+        TimePerCall("one-pass scan with params rules, " + kind, options.requests, [body, &rules]() {
+            JsonRpcCall call;
+            return JsonRpcScanner::Scan(*body, &rules, call);
+        });
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    namespace params = boost::program_options;
+
+    auto console_sink = std::make_shared<spdlog::sinks::stdout_color_sink_mt>();
+    LoggerSingleton::get().add_stream(console_sink, b_sev::err);
+
+    params::options_description desc("Program options");
+    // clang-format off
+    desc.add_options()("help", "produce help message")
+            ("scenario", params::value<std::string>()->default_value("execution_model"), "Benchmark to run: execution_model, connection_churn, filter, tls, keep_alive")
+            ("requests", params::value<uint32_t>()->default_value(20000), "Number of requests per measurement")
+            ("concurrency", params::value<uint32_t>()->default_value(16), "Number of concurrent client connections")
+            ("threads", params::value<uint32_t>()->default_value(std::thread::hardware_concurrency()), "Threads of the relay (per pool)")
+            ("base_port", params::value<uint16_t>()->default_value(18500), "First local port used by the benchmark");
+    // clang-format on
+
+    params::variables_map vm;
+    params::store(params::parse_command_line(argc, argv, desc), vm);
+    params::notify(vm);
+
+    if (vm.count("help")) {
+        std::cout << "Relay benchmarks" << std::endl << desc << std::endl;
+        return EXIT_SUCCESS;
+    }
+
+    BenchOptions options;
+    options.requests    = vm["requests"].as<uint32_t>();
+    options.concurrency = std::max<uint32_t>(1, vm["concurrency"].as<uint32_t>());
+    options.threads     = std::max<uint32_t>(1, vm["threads"].as<uint32_t>());
+    options.basePort    = vm["base_port"].as<uint16_t>();
+
+    const std::string scenario = vm["scenario"].as<std::string>();
+    if (scenario == "execution_model") {
+        BenchExecutionModel(options);
+    } else if (scenario == "connection_churn") {
+        BenchConnectionChurn(options);
+    } else if (scenario == "filter") {
+        BenchFilter(options);
+    } else if (scenario == "tls") {
+        BenchTls(options);
+    } else if (scenario == "keep_alive") {
+        BenchKeepAlive(options);
+    } else {
+        std::cerr << "Unknown scenario: " << scenario << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
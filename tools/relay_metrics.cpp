@@ -0,0 +1,98 @@
+/**
+ * relay_metrics: prints the counters of all the relays of this host that publish them (--shared_metrics
+ * of the relay), summed over the processes, without any network round trip. With --per_process, every
+ * relay is also printed on its own; with --watch_ms, the output is refreshed with the rates since the
+ * previous one.
+ */
+
+#include "Metrics/SharedMetrics.h"
+#include <boost/program_options.hpp>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <thread>
+
+void PrintSnapshot(const std::string& title, const MetricsSnapshot& s)
+{
+    std::cout << "== " << title << std::endl;
+    std::cout << "requests: " << s.requests << ", denied: " << s.denied
+              << ", served from cache: " << s.servedFromCache << ", failed: " << s.failed
+              << ", upstream errors: " << s.upstreamErrors << std::endl;
+    const double mean =
+        s.requests > 0 ? static_cast<double>(s.latencySumUs) / static_cast<double>(s.requests) : 0;
+    std::cout << "latency us: mean " << mean << ", p50 < " << s.getLatencyQuantileUs(0.5) << ", p90 < "
+              << s.getLatencyQuantileUs(0.9) << ", p99 < " << s.getLatencyQuantileUs(0.99)
+              << ", p99.9 < " << s.getLatencyQuantileUs(0.999) << std::endl;
+    if (s.methods.empty()) {
+        return;
+    }
+    std::cout << std::left << std::setw(40) << "method" << std::right << std::setw(14) << "requests"
+              << std::setw(14) << "denied" << std::setw(14) << "failed" << std::endl;
+    for (const auto& m : s.methods) {
+        if (m.second.requests == 0) {
+            continue;
+        }
+        std::cout << std::left << std::setw(40) << m.first << std::right << std::setw(14)
+                  << m.second.requests << std::setw(14) << m.second.denied << std::setw(14)
+                  << m.second.failed << std::endl;
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    namespace params = boost::program_options;
+
+    params::options_description desc("Program options");
+    // clang-format off
+    desc.add_options()("help", "produce help message")
+            ("prefix", params::value<std::string>()->default_value(SharedMetrics::DEFAULT_PREFIX), "Name prefix of the metrics segments (--shared_metrics_prefix of the relays)")
+            ("per_process", "Print the counters of every relay process too")
+            ("remove_stale", "Remove the segments of relays that exited without removing theirs")
+            ("watch_ms", params::value<uint64_t>()->default_value(0), "Print the counters again with this period, with the request rate; 0 prints once");
+    // clang-format on
+
+    params::variables_map vm;
+    params::store(params::parse_command_line(argc, argv, desc), vm);
+    params::notify(vm);
+
+    if (vm.count("help")) {
+        std::cout << "Aggregates the metrics of the local relays" << std::endl << desc << std::endl;
+        return EXIT_SUCCESS;
+    }
+
+    const std::string prefix      = vm["prefix"].as<std::string>();
+    const bool        perProcess  = vm.count("per_process") > 0;
+    const bool        removeStale = vm.count("remove_stale") > 0;
+    const uint64_t    watchMs     = vm["watch_ms"].as<uint64_t>();
+
+    uint64_t previousRequests = 0;
+    for (bool first = true;; first = false) {
+        const std::vector<MetricsSnapshot> snapshots = SharedMetrics::ReadAll(prefix, removeStale);
+
+        MetricsSnapshot total;
+        for (const MetricsSnapshot& s : snapshots) {
+            total.add(s);
+        }
+        PrintSnapshot("all relays (" + std::to_string(snapshots.size()) + " processes)", total);
+        if (!first && watchMs > 0 && total.requests >= previousRequests) {
+            std::cout << "rate: "
+                      << static_cast<double>(total.requests - previousRequests) * 1000.0 /
+                             static_cast<double>(watchMs)
+                      << " requests/s" << std::endl;
+        }
+        previousRequests = total.requests;
+
+        if (perProcess) {
+            for (const MetricsSnapshot& s : snapshots) {
+                PrintSnapshot("relay pid " + std::to_string(s.pids.front()), s);
+            }
+        }
+        if (watchMs == 0) {
+            break;
+        }
+        std::cout << std::endl;
+        std::this_thread::sleep_for(std::chrono::milliseconds(watchMs));
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,111 @@
+/**
+ * relay_replay: drives a relay with the traffic recorded by TrafficCapture (--capture_file of the relay)
+ *
+ * By default, an in-process JsonRpcRelay is started in front of a local stub upstream, so that only the
+ * relay itself is measured. With --relay_address/--relay_port an external relay is driven instead.
+ * Requests are replayed with their original spacing divided by --speed (0 means as fast as possible),
+ * over --concurrency keep-alive connections, and a throughput/latency report is printed at the end;
+ * latencies count from the time each request was scheduled to be sent (see ReplayCapture).
+ */
+
+#include "CaptureReplay.h"
+#include "Logging/DefaultLogger.h"
+#include "Relay/JsonRpcRelay.h"
+#include "spdlog/sinks/stdout_color_sinks.h"
+#include <boost/program_options.hpp>
+#include <cstdlib>
+#include <set>
+#include <thread>
+#include <vector>
+
+int main(int argc, char* argv[])
+{
+    namespace params = boost::program_options;
+
+    auto console_sink = std::make_shared<spdlog::sinks::stdout_color_sink_mt>();
+    LoggerSingleton::get().add_stream(console_sink, b_sev::err);
+
+    params::options_description desc("Program options");
+    // clang-format off
+    desc.add_options()("help", "produce help message")
+            ("capture_file", params::value<std::string>(), "Capture file written by the relay's --capture_file")
+            ("speed", params::value<double>()->default_value(1.), "Replay speed multiplier; 0 replays as fast as possible")
+            ("concurrency", params::value<uint32_t>()->default_value(8), "Number of concurrent connections to the relay")
+            ("relay_address", params::value<std::string>(), "Address of an external relay to drive (default: start one in-process)")
+            ("relay_port", params::value<uint16_t>()->default_value(18400), "Port of the relay")
+            ("stub_port", params::value<uint16_t>()->default_value(18401), "Port of the in-process stub upstream")
+            ("threads", params::value<uint32_t>()->default_value(std::thread::hardware_concurrency()), "Threads of the in-process relay")
+            ("emulate_upstream_latency", "Make the stub upstream wait the recorded upstream latency of each request");
+    // clang-format on
+
+    params::variables_map vm;
+    params::store(params::parse_command_line(argc, argv, desc), vm);
+    params::notify(vm);
+
+    if (vm.count("help") || !vm.count("capture_file")) {
+        std::cout << "Replay captured relay traffic" << std::endl << desc << std::endl;
+        return vm.count("help") ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    ReplayOptions options;
+    options.speed          = vm["speed"].as<double>();
+    options.concurrency    = std::max<uint32_t>(1, vm["concurrency"].as<uint32_t>());
+    options.emulateLatency = vm.count("emulate_upstream_latency") > 0;
+
+    const uint16_t relayPort = vm["relay_port"].as<uint16_t>();
+    const uint32_t threads   = std::max<uint32_t>(1, vm["threads"].as<uint32_t>());
+
+    std::vector<CaptureRecord> records;
+    try {
+        records = CaptureReader::ReadAll(vm["capture_file"].as<std::string>());
+    } catch (std::exception& ex) {
+        std::cerr << "Failed to read capture: " << ex.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+    if (records.empty()) {
+        std::cerr << "Capture file has no records" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    std::string                   relayAddress = "127.0.0.1";
+    std::unique_ptr<EasyServer>   stub;
+    std::unique_ptr<JsonRpcRelay> relay;
+    if (vm.count("relay_address")) {
+        relayAddress = vm["relay_address"].as<std::string>();
+    } else {
+        const uint16_t stubPort = vm["stub_port"].as<uint16_t>();
+        // sleeping handlers block their thread, so the stub needs enough threads for all connections
+        const uint32_t stubThreads =
+            options.emulateLatency ? std::max(threads, options.concurrency) : threads;
+        stub = StartStubUpstream(
+            stubPort, stubThreads, R"({"result":null,"error":null,"id":null})", options.emulateLatency);
+
+        std::set<std::string> methods;
+        for (const CaptureRecord& r : records) {
+            methods.insert(r.method);
+        }
+        JsonRPCFilter filter;
+        for (const std::string& m : methods) {
+            filter.addAllowedMethod(m);
+        }
+        relay.reset(new JsonRpcRelay(
+            std::move(filter), relayAddress, relayPort, "127.0.0.1", stubPort, threads));
+    }
+
+    std::cout << "Replaying " << records.size() << " requests at "
+              << (options.speed > 0 ? std::to_string(options.speed) + "x" : std::string("max"))
+              << " speed over " << options.concurrency << " connections" << std::endl;
+
+    LoadReport report;
+    const auto start = std::chrono::steady_clock::now();
+    ReplayCapture(std::move(records), relayAddress, relayPort, options, report);
+
+    report.print("replay of " + vm["capture_file"].as<std::string>(),
+                 std::chrono::steady_clock::now() - start);
+
+    if (relay) {
+        relay->stop();
+    }
+
+    return EXIT_SUCCESS;
+}
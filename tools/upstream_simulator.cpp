@@ -0,0 +1,110 @@
+/**
+ * upstream_simulator: a stub json-rpc node to run the relay (or relay_bench) against, with per-method
+ * latency distributions, response sizes, error and drop rates, and a bounded worker pool with a work
+ * queue, so that benchmarks are repeatable and overload behaviour can be tested without a real node.
+ * Every method gets --default_profile unless a --method option names it, e.g.,
+ *
+ *   upstream_simulator --port 8332 --workers 4 --queue_depth 16
+ *       --method getblock=lognormal:20:0.8,size=200000 --method getblockcount=fixed:0.2
+ *       --method sendrawtransaction=bimodal:1:50:0.1,error=0.05
+ */
+
+#include "UpstreamSimulator.h"
+#include <boost/asio/signal_set.hpp>
+#include <boost/program_options.hpp>
+#include <cstdlib>
+#include <iostream>
+
+int main(int argc, char* argv[])
+{
+    namespace params = boost::program_options;
+
+    params::options_description desc("Program options");
+    // clang-format off
+    desc.add_options()("help", "produce help message")
+            ("bind_address", params::value<std::string>()->default_value("127.0.0.1"), "Address to listen on")
+            ("port", params::value<uint16_t>()->default_value(8332), "Port to listen on")
+            ("method", params::value<std::vector<std::string>>()->composing(), "The profile of a method, as <method>=<latency>[,size=<bytes>][,error=<rate>][,drop=<rate>], where <latency> is fixed:<ms>, lognormal:<median_ms>:<sigma> or bimodal:<fast_ms>:<slow_ms>:<slow_fraction>; can be repeated")
+            ("default_profile", params::value<std::string>()->default_value("fixed:1"), "The profile of the methods without a --method option")
+            ("workers", params::value<uint32_t>()->default_value(4), "Calls processed at once")
+            ("queue_depth", params::value<std::size_t>()->default_value(16), "Calls waiting for a worker; beyond this, calls get 503")
+            ("no_keep_alive", "Close every connection after its response")
+            ("max_requests_per_connection", params::value<uint32_t>()->default_value(0), "Close a connection after this many responses; 0 is unlimited")
+            ("idle_timeout_ms", params::value<uint64_t>()->default_value(30000), "Close keep-alive connections idle for this long")
+            ("seed", params::value<uint64_t>()->default_value(1), "Seed of the random choices")
+            ("threads", params::value<uint32_t>()->default_value(1), "Network threads")
+            ("report_ms", params::value<uint64_t>()->default_value(5000), "Print the counters with this period; 0 never prints them");
+    // clang-format on
+
+    params::variables_map vm;
+    params::store(params::parse_command_line(argc, argv, desc), vm);
+    params::notify(vm);
+
+    if (vm.count("help")) {
+        std::cout << "Simulates a json-rpc upstream" << std::endl << desc << std::endl;
+        return EXIT_SUCCESS;
+    }
+
+    SimulatorOptions options;
+    try {
+        options.defaultProfile = MethodProfile::Parse(vm["default_profile"].as<std::string>());
+        if (vm.count("method")) {
+            for (const std::string& m : vm["method"].as<std::vector<std::string>>()) {
+                const std::size_t eq = m.find('=');
+                if (eq == std::string::npos || eq == 0) {
+                    throw std::runtime_error("Invalid --method (expected <method>=<profile>): " + m);
+                }
+                options.methods[m.substr(0, eq)] = MethodProfile::Parse(m.substr(eq + 1));
+            }
+        }
+    } catch (std::exception& ex) {
+        std::cerr << ex.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+    options.workers                  = std::max<uint32_t>(vm["workers"].as<uint32_t>(), 1);
+    options.queueDepth               = vm["queue_depth"].as<std::size_t>();
+    options.keepAlive                = vm.count("no_keep_alive") == 0;
+    options.maxRequestsPerConnection = vm["max_requests_per_connection"].as<uint32_t>();
+    options.idleTimeout              = std::chrono::milliseconds(vm["idle_timeout_ms"].as<uint64_t>());
+    options.seed                     = vm["seed"].as<uint64_t>();
+
+    const std::string address  = vm["bind_address"].as<std::string>();
+    const uint16_t    port     = vm["port"].as<uint16_t>();
+    const uint64_t    reportMs = vm["report_ms"].as<uint64_t>();
+
+    std::unique_ptr<UpstreamSimulator> simulator;
+    try {
+        simulator = std::make_unique<UpstreamSimulator>(address, port, options);
+    } catch (std::exception& ex) {
+        std::cerr << "Failed to listen on " << address << ":" << port << ": " << ex.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+    simulator->run(vm["threads"].as<uint32_t>());
+    std::cout << "Simulating an upstream on " << address << ":" << port << std::endl;
+
+    boost::asio::io_context   control;
+    boost::asio::signal_set   signals(control, SIGINT, SIGTERM);
+    boost::asio::steady_timer timer(control);
+
+    std::function<void()> scheduleReport = [&]() {
+        timer.expires_after(std::chrono::milliseconds(reportMs));
+        timer.async_wait([&](boost::system::error_code ec) {
+            if (ec) {
+                return;
+            }
+            const UpstreamSimulator::Stats s = simulator->getStats();
+            std::cout << "calls: " << s.calls << ", rejected: " << s.rejected << ", errors: " << s.errors
+                      << ", drops: " << s.drops << ", max queue: " << s.maxQueue << std::endl;
+            scheduleReport();
+        });
+    };
+    if (reportMs > 0) {
+        scheduleReport();
+    }
+    signals.async_wait([&](boost::system::error_code, int) {
+        timer.cancel();
+        simulator->stop();
+    });
+    control.run();
+    return EXIT_SUCCESS;
+}